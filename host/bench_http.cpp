@@ -0,0 +1,446 @@
+// HTTP load generator for the camera's frame endpoints.
+//
+// N clients hit one endpoint for a fixed time and the tool reports what they
+// got. A multipart/x-mixed-replace response (/stream, recording playback) is
+// read part by part for the whole run. Anything else (/frame) is requested
+// back to back, or at --rate per client, on a new connection each time like
+// the web UI does.
+//
+// Per step it reports:
+//   - delivered frames per second and payload bytes per second;
+//   - latency percentiles: request to last byte for single frames, first to
+//     last byte of each part for streams;
+//   - interval percentiles: time between consecutive frames at one client;
+//   - the 503 rate (requests or stream connects refused);
+//   - the duplicate rate: a frame with the same X-Frame-Seq as the client's
+//     previous one, or byte-identical to it when there is no such header.
+//
+// --clients takes a list, so one run shows how delivery degrades as viewers
+// are added. Each step is one JSON line on stdout; the exit status is 1 if a
+// step got no frame at all. It works the same against the board and against
+// the host simulation (host/sim).
+//
+//   bench_http [--host H] [--port N] [--path P] [--clients 1,2,4] [--seconds N]
+//              [--rate FPS] [--auth user:pass] [--setup PATH]... [--label TEXT]
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 80;
+  std::string path = "/frame";
+  std::vector<int> clients = {1};
+  double seconds = 10;
+  double rate = 0;  // requests per second per client, 0 = back to back
+  std::string auth;  // base64 of user:pass
+  std::vector<std::string> setup;
+  std::string label;
+  int timeoutMs = 5000;
+};
+
+Options opt;
+std::atomic<bool> running{true};
+
+int64_t nowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string base64(const std::string& in) {
+  static const char* table = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < in.size(); i += 3) {
+    uint32_t v = (uint8_t)in[i] << 16 | (uint8_t)in[i + 1] << 8 | (uint8_t)in[i + 2];
+    out += table[v >> 18];
+    out += table[(v >> 12) & 63];
+    out += table[(v >> 6) & 63];
+    out += table[v & 63];
+  }
+  if (i < in.size()) {
+    uint32_t v = (uint8_t)in[i] << 16 | (i + 1 < in.size() ? (uint8_t)in[i + 1] << 8 : 0);
+    out += table[v >> 18];
+    out += table[(v >> 12) & 63];
+    out += i + 1 < in.size() ? table[(v >> 6) & 63] : '=';
+    out += '=';
+  }
+  return out;
+}
+
+uint64_t fnv1a(const char* p, size_t n) {
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < n; i++) h = (h ^ (uint8_t)p[i]) * 1099511628211ull;
+  return h;
+}
+
+// Buffered reader over a blocking socket with a receive timeout.
+class Conn {
+ public:
+  ~Conn() { close(); }
+
+  bool open() {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(opt.host.c_str(), std::to_string(opt.port).c_str(), &hints, &res) != 0) return false;
+    fd_ = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    bool ok = fd_ >= 0 && connect(fd_, res->ai_addr, res->ai_addrlen) == 0;
+    freeaddrinfo(res);
+    if (!ok) {
+      close();
+      return false;
+    }
+    timeval tv = {opt.timeoutMs / 1000, (opt.timeoutMs % 1000) * 1000};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    buf_.clear();
+    pos_ = 0;
+    return true;
+  }
+
+  void close() {
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+
+  bool sendGet(const std::string& path) {
+    std::string req = "GET " + path + " HTTP/1.1\r\nHost: " + opt.host + "\r\nConnection: close\r\n";
+    if (!opt.auth.empty()) req += "Authorization: Basic " + opt.auth + "\r\n";
+    req += "\r\n";
+    return send(fd_, req.data(), req.size(), MSG_NOSIGNAL) == (ssize_t)req.size();
+  }
+
+  // One line without its CRLF.
+  bool readLine(std::string& line) {
+    for (;;) {
+      size_t eol = buf_.find("\r\n", pos_);
+      if (eol != std::string::npos) {
+        line.assign(buf_, pos_, eol - pos_);
+        pos_ = eol + 2;
+        return true;
+      }
+      if (!fill()) return false;
+    }
+  }
+
+  bool readBytes(size_t n, std::string& out) {
+    while (buf_.size() - pos_ < n) {
+      if (!fill()) return false;
+    }
+    out.assign(buf_, pos_, n);
+    pos_ += n;
+    return true;
+  }
+
+  // Everything up to the peer's close.
+  void readToEnd(std::string& out) {
+    while (fill()) {
+    }
+    out.assign(buf_, pos_, std::string::npos);
+    pos_ = buf_.size();
+  }
+
+ private:
+  bool fill() {
+    if (fd_ < 0) return false;
+    if (pos_ > 65536) {
+      buf_.erase(0, pos_);
+      pos_ = 0;
+    }
+    char tmp[16384];
+    ssize_t n = recv(fd_, tmp, sizeof(tmp), 0);
+    if (n <= 0) return false;
+    buf_.append(tmp, n);
+    return true;
+  }
+
+  int fd_ = -1;
+  std::string buf_;
+  size_t pos_ = 0;
+};
+
+struct Headers {
+  int status = 0;
+  long contentLength = -1;
+  std::string contentType;
+  long long frameSeq = -1;
+};
+
+bool startsWithNoCase(const std::string& s, const char* prefix) {
+  size_t n = strlen(prefix);
+  return s.size() >= n && strncasecmp(s.c_str(), prefix, n) == 0;
+}
+
+std::string valueOf(const std::string& line) {
+  size_t colon = line.find(':');
+  size_t v = line.find_first_not_of(' ', colon + 1);
+  return v == std::string::npos ? std::string() : line.substr(v);
+}
+
+// Header lines up to the blank one. statusLine: the first line is
+// "HTTP/1.1 NNN ..."; otherwise these are multipart part headers, where
+// boundary lines are skipped.
+bool readHeaders(Conn& c, bool statusLine, Headers& h) {
+  std::string line;
+  if (statusLine) {
+    if (!c.readLine(line) || line.compare(0, 5, "HTTP/") != 0) return false;
+    size_t sp = line.find(' ');
+    h.status = sp == std::string::npos ? 0 : atoi(line.c_str() + sp + 1);
+  }
+  bool any = statusLine;
+  for (;;) {
+    if (!c.readLine(line)) return false;
+    if (line.empty()) {
+      if (any) return true;
+      continue;  // CRLF between a part and the next boundary
+    }
+    if (line.compare(0, 2, "--") == 0) continue;
+    any = true;
+    if (startsWithNoCase(line, "Content-Length:")) h.contentLength = atol(valueOf(line).c_str());
+    else if (startsWithNoCase(line, "Content-Type:")) h.contentType = valueOf(line);
+    else if (startsWithNoCase(line, "X-Frame-Seq:")) h.frameSeq = atoll(valueOf(line).c_str());
+  }
+}
+
+struct ClientStats {
+  uint64_t requests = 0;  // requests sent (single frames) or stream connects
+  uint64_t frames = 0;
+  uint64_t bytes = 0;
+  uint64_t refused = 0;   // 503
+  uint64_t duplicates = 0;
+  uint64_t errors = 0;    // other statuses, resets, timeouts
+  std::vector<int64_t> latencyUs;
+  std::vector<int64_t> intervalUs;
+
+  int64_t lastFrameAt = 0;
+  long long lastSeq = -1;
+  uint64_t lastHash = 0;
+  bool haveLast = false;
+
+  void frame(const std::string& body, long long seq, int64_t startedAt, int64_t doneAt) {
+    frames++;
+    bytes += body.size();
+    latencyUs.push_back(doneAt - startedAt);
+    if (lastFrameAt) intervalUs.push_back(doneAt - lastFrameAt);
+    lastFrameAt = doneAt;
+    uint64_t hash = fnv1a(body.data(), body.size());
+    if (haveLast && (seq >= 0 ? seq == lastSeq : hash == lastHash)) duplicates++;
+    lastSeq = seq;
+    lastHash = hash;
+    haveLast = true;
+  }
+};
+
+// Read parts until the run ends or the stream breaks.
+void readStream(Conn& c, ClientStats& s) {
+  while (running.load(std::memory_order_relaxed)) {
+    Headers part;
+    if (!readHeaders(c, false, part) || part.contentLength < 0) {
+      if (running.load()) s.errors++;
+      return;
+    }
+    int64_t start = nowUs();
+    std::string body;
+    if (!c.readBytes(part.contentLength, body)) {
+      if (running.load()) s.errors++;
+      return;
+    }
+    s.frame(body, part.frameSeq, start, nowUs());
+  }
+}
+
+void client(ClientStats& s) {
+  int64_t period = opt.rate > 0 ? (int64_t)(1e6 / opt.rate) : 0;
+  int64_t next = nowUs();
+  while (running.load(std::memory_order_relaxed)) {
+    if (period) {
+      int64_t wait = next - nowUs();
+      if (wait > 0) std::this_thread::sleep_for(std::chrono::microseconds(wait));
+      next += period;
+    }
+    Conn c;
+    int64_t start = nowUs();
+    s.requests++;
+    if (!c.open() || !c.sendGet(opt.path)) {
+      s.errors++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    Headers h;
+    if (!readHeaders(c, true, h)) {
+      s.errors++;
+      continue;
+    }
+    if (h.status == 503) {
+      s.refused++;
+      continue;
+    }
+    if (h.status != 200) {
+      s.errors++;
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      continue;
+    }
+    if (startsWithNoCase(h.contentType, "multipart/")) {
+      readStream(c, s);
+      continue;
+    }
+    std::string body;
+    bool ok = h.contentLength >= 0 ? c.readBytes(h.contentLength, body) : (c.readToEnd(body), true);
+    if (!ok) {
+      s.errors++;
+      continue;
+    }
+    s.frame(body, h.frameSeq, start, nowUs());
+  }
+}
+
+// Fire-and-forget GET, e.g. /stream/start before the run.
+int simpleGet(const std::string& path) {
+  Conn c;
+  if (!c.open() || !c.sendGet(path)) return -1;
+  Headers h;
+  if (!readHeaders(c, true, h)) return -1;
+  return h.status;
+}
+
+int64_t percentile(std::vector<int64_t>& v, double p) {
+  if (v.empty()) return 0;
+  size_t idx = (size_t)(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + idx, v.end());
+  return v[idx];
+}
+
+std::string percentilesJson(std::vector<int64_t>& v) {
+  char out[160];
+  snprintf(out, sizeof(out), "{\"p50\":%.2f,\"p99\":%.2f,\"p999\":%.2f,\"max\":%.2f}",
+           percentile(v, 0.50) / 1000.0, percentile(v, 0.99) / 1000.0, percentile(v, 0.999) / 1000.0,
+           percentile(v, 1.0) / 1000.0);
+  return out;
+}
+
+std::string jsonEscape(const std::string& s) {
+  std::string out;
+  for (char ch : s) {
+    if (ch == '"' || ch == '\\') out += '\\';
+    out += ch;
+  }
+  return out;
+}
+
+// One step with this many clients; returns the frames delivered.
+uint64_t runStep(int clients) {
+  running = true;
+  std::vector<ClientStats> stats(clients);
+  std::vector<std::thread> threads;
+  int64_t start = nowUs();
+  for (int i = 0; i < clients; i++) threads.emplace_back(client, std::ref(stats[i]));
+  std::this_thread::sleep_for(std::chrono::duration<double>(opt.seconds));
+  running = false;
+  for (auto& t : threads) t.join();
+  double elapsed = (nowUs() - start) / 1e6;
+
+  ClientStats all;
+  for (auto& s : stats) {
+    all.requests += s.requests;
+    all.frames += s.frames;
+    all.bytes += s.bytes;
+    all.refused += s.refused;
+    all.duplicates += s.duplicates;
+    all.errors += s.errors;
+    all.latencyUs.insert(all.latencyUs.end(), s.latencyUs.begin(), s.latencyUs.end());
+    all.intervalUs.insert(all.intervalUs.end(), s.intervalUs.begin(), s.intervalUs.end());
+  }
+
+  printf("{");
+  if (!opt.label.empty()) printf("\"label\":\"%s\",", jsonEscape(opt.label).c_str());
+  printf("\"path\":\"%s\",\"clients\":%d,\"seconds\":%.2f,\"requests\":%llu,\"frames\":%llu,"
+         "\"fps\":%.2f,\"fps_per_client\":%.2f,\"bytes_per_s\":%.0f,"
+         "\"latency_ms\":%s,\"interval_ms\":%s,"
+         "\"refused_503\":%llu,\"rate_503\":%.4f,\"duplicates\":%llu,\"duplicate_rate\":%.4f,\"errors\":%llu}\n",
+         jsonEscape(opt.path).c_str(), clients, elapsed, (unsigned long long)all.requests,
+         (unsigned long long)all.frames, all.frames / elapsed, all.frames / elapsed / clients, all.bytes / elapsed,
+         percentilesJson(all.latencyUs).c_str(), percentilesJson(all.intervalUs).c_str(),
+         (unsigned long long)all.refused, all.requests ? (double)all.refused / all.requests : 0.0,
+         (unsigned long long)all.duplicates, all.frames ? (double)all.duplicates / all.frames : 0.0,
+         (unsigned long long)all.errors);
+  fflush(stdout);
+  return all.frames;
+}
+
+void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [--host H] [--port N] [--path P] [--clients 1,2,4] [--seconds N]\n"
+          "          [--rate FPS] [--auth user:pass] [--setup PATH]... [--label TEXT]\n",
+          argv0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--host" && hasValue) opt.host = argv[++i];
+    else if (arg == "--port" && hasValue) opt.port = atoi(argv[++i]);
+    else if (arg == "--path" && hasValue) opt.path = argv[++i];
+    else if (arg == "--seconds" && hasValue) opt.seconds = atof(argv[++i]);
+    else if (arg == "--rate" && hasValue) opt.rate = atof(argv[++i]);
+    else if (arg == "--auth" && hasValue) opt.auth = base64(argv[++i]);
+    else if (arg == "--setup" && hasValue) opt.setup.push_back(argv[++i]);
+    else if (arg == "--label" && hasValue) opt.label = argv[++i];
+    else if (arg == "--clients" && hasValue) {
+      opt.clients.clear();
+      for (const char* p = argv[++i]; *p;) {
+        opt.clients.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (!p) break;
+        p++;
+      }
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  for (int n : opt.clients) {
+    if (n <= 0) {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  for (const std::string& path : opt.setup) {
+    int status = simpleGet(path);
+    if (status != 200) {
+      fprintf(stderr, "setup %s failed (%d)\n", path.c_str(), status);
+      return 1;
+    }
+  }
+
+  bool delivered = true;
+  for (int n : opt.clients) {
+    if (runStep(n) == 0) delivered = false;
+  }
+  if (!delivered) fprintf(stderr, "FAIL: a step delivered no frames\n");
+  return delivered ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+// Check and benchmark for the DC-only JPEG decoder (src/jpeg_dc.h), against
+// libjpeg.
+//
+// Synthetic scenes (gradients, shapes and noise, so the AC data is not
+// trivial) are encoded with libjpeg in the layouts the decoder has to read:
+// 4:2:2 as the ESP32 camera sends, 4:2:0, 4:4:4 and grayscale, at several
+// qualities, with and without restart intervals, and once with the DHT
+// segments stripped (standard tables). --mjpg adds real frames, split from a
+// concatenated-JPEG file such as a recording from the board.
+//
+// For each frame the thumbnail must equal libjpeg's grayscale output with DCT
+// scaling to 1/8, byte for byte; a truncated copy must be refused. Then the
+// decoder, libjpeg at 1/8 and a full libjpeg decode to RGB (what the
+// decoder saves the device) are timed. One JSON line per case: microseconds
+// per frame for each and the DC decoder's speedup over both.
+//
+// Exits 1 on any mismatch.
+//
+//   bench_jpeg_dc [--iterations N] [--mjpg FILE]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "jpeg_dc.h"
+
+namespace {
+
+int failures = 0;
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t rng = 12345;
+uint32_t next() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// RGB scene: a diagonal gradient, a few rectangles and a disc, plus noise.
+std::vector<uint8_t> scene(int width, int height) {
+  std::vector<uint8_t> rgb(width * height * 3);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int r = (x * 255) / width, g = (y * 255) / height, b = ((x + y) * 127) / (width + height);
+      if ((x / 37 + y / 23) % 5 == 0) r = 255 - r, b = 200;
+      int dx = x - width / 2, dy = y - height / 3;
+      if (dx * dx + dy * dy < width * height / 40) g = 30;
+      int noise = (int)(next() % 21) - 10;
+      uint8_t* px = &rgb[(y * width + x) * 3];
+      px[0] = (uint8_t)std::min(255, std::max(0, r + noise));
+      px[1] = (uint8_t)std::min(255, std::max(0, g + noise));
+      px[2] = (uint8_t)std::min(255, std::max(0, b + noise));
+    }
+  }
+  return rgb;
+}
+
+struct Layout {
+  const char* name;
+  int components;  // 1: grayscale
+  int lumaH, lumaV;
+};
+
+std::vector<uint8_t> encode(const std::vector<uint8_t>& rgb, int width, int height, const Layout& layout,
+                            int quality, int restartRows) {
+  jpeg_compress_struct c;
+  jpeg_error_mgr err;
+  c.err = jpeg_std_error(&err);
+  jpeg_create_compress(&c);
+  unsigned char* out = nullptr;
+  unsigned long outLen = 0;
+  jpeg_mem_dest(&c, &out, &outLen);
+  c.image_width = width;
+  c.image_height = height;
+  c.input_components = 3;
+  c.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&c);
+  if (layout.components == 1) jpeg_set_colorspace(&c, JCS_GRAYSCALE);
+  c.comp_info[0].h_samp_factor = layout.lumaH;
+  c.comp_info[0].v_samp_factor = layout.lumaV;
+  jpeg_set_quality(&c, quality, TRUE);
+  c.restart_in_rows = restartRows;
+  jpeg_start_compress(&c, TRUE);
+  while (c.next_scanline < c.image_height) {
+    JSAMPROW row = (JSAMPROW)&rgb[c.next_scanline * width * 3];
+    jpeg_write_scanlines(&c, &row, 1);
+  }
+  jpeg_finish_compress(&c);
+  std::vector<uint8_t> jpeg(out, out + outLen);
+  jpeg_destroy_compress(&c);
+  free(out);
+  return jpeg;
+}
+
+// The same JPEG without its DHT segments.
+std::vector<uint8_t> stripTables(const std::vector<uint8_t>& jpeg) {
+  std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + 2);
+  size_t p = 2;
+  while (p + 4 <= jpeg.size() && jpeg[p] == 0xFF && jpeg[p + 1] != 0xDA) {
+    size_t len = 2 + ((jpeg[p + 2] << 8) | jpeg[p + 3]);
+    if (jpeg[p + 1] != 0xC4) out.insert(out.end(), jpeg.begin() + p, jpeg.begin() + p + len);
+    p += len;
+  }
+  out.insert(out.end(), jpeg.begin() + p, jpeg.end());
+  return out;
+}
+
+// libjpeg decode, grayscale at 1/8 or RGB at full size. False on error.
+struct ErrorExit : jpeg_error_mgr {
+  bool failed = false;
+};
+
+bool libjpegDecode(const std::vector<uint8_t>& jpeg, bool eighth, std::vector<uint8_t>& out, int& width,
+                   int& height) {
+  jpeg_decompress_struct d;
+  ErrorExit err;
+  d.err = jpeg_std_error(&err);
+  err.error_exit = [](j_common_ptr c) {
+    static_cast<ErrorExit*>(c->err)->failed = true;
+    throw 0;
+  };
+  err.emit_message = [](j_common_ptr, int) {};
+  jpeg_create_decompress(&d);
+  bool ok = true;
+  try {
+    jpeg_mem_src(&d, jpeg.data(), jpeg.size());
+    jpeg_read_header(&d, TRUE);
+    if (eighth) {
+      d.scale_num = 1;
+      d.scale_denom = 8;
+      d.out_color_space = JCS_GRAYSCALE;
+    } else {
+      d.out_color_space = JCS_RGB;
+    }
+    jpeg_start_decompress(&d);
+    width = d.output_width;
+    height = d.output_height;
+    size_t stride = (size_t)width * d.output_components;
+    out.resize(stride * height);
+    while (d.output_scanline < d.output_height) {
+      JSAMPROW row = &out[d.output_scanline * stride];
+      jpeg_read_scanlines(&d, &row, 1);
+    }
+    jpeg_finish_decompress(&d);
+  } catch (int) {
+    ok = false;
+  }
+  jpeg_destroy_decompress(&d);
+  return ok && !err.failed;
+}
+
+JpegDcDecoder decoder;
+
+bool dcDecode(const std::vector<uint8_t>& jpeg, std::vector<uint8_t>& plane, int& width, int& height) {
+  if (!decoder.parse(jpeg.data(), jpeg.size())) return false;
+  width = decoder.width();
+  height = decoder.height();
+  plane.resize((size_t)width * height);
+  return decoder.decode(plane.data(), width);
+}
+
+// Best of a few rounds: the fastest round is the least disturbed by the rest
+// of the machine.
+template <typename Fn>
+double timeUs(int iterations, Fn fn) {
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    int64_t start = nowNs();
+    for (int i = 0; i < iterations; i++) fn();
+    double us = double(nowNs() - start) / iterations / 1000;
+    if (round == 0 || us < best) best = us;
+  }
+  return best;
+}
+
+void run(const std::string& name, const std::vector<uint8_t>& jpeg, int iterations) {
+  std::vector<uint8_t> dc, ref, full;
+  int w = 0, h = 0, rw = 0, rh = 0, fw, fh;
+  if (!libjpegDecode(jpeg, true, ref, rw, rh)) {
+    fprintf(stderr, "%s: libjpeg can't decode it, skipped\n", name.c_str());
+    return;
+  }
+  if (!dcDecode(jpeg, dc, w, h)) {
+    fprintf(stderr, "%s: DC decoder refused it\n", name.c_str());
+    failures++;
+    return;
+  }
+  if (w != rw || h != rh || dc != ref) {
+    size_t diff = 0;
+    for (size_t i = 0; i < std::min(dc.size(), ref.size()); i++) diff += dc[i] != ref[i];
+    fprintf(stderr, "%s: thumbnail %dx%d differs from libjpeg's %dx%d (%zu pixels)\n", name.c_str(), w, h, rw, rh,
+            diff);
+    failures++;
+  }
+  std::vector<uint8_t> cut(jpeg.begin(), jpeg.begin() + jpeg.size() * 2 / 3);
+  if (dcDecode(cut, dc, w, h)) {
+    fprintf(stderr, "%s: truncated copy was not refused\n", name.c_str());
+    failures++;
+  }
+
+  double dcUs = timeUs(iterations, [&] { dcDecode(jpeg, dc, w, h); });
+  double scaledUs = timeUs(iterations, [&] { libjpegDecode(jpeg, true, ref, rw, rh); });
+  double fullUs = timeUs(iterations, [&] { libjpegDecode(jpeg, false, full, fw, fh); });
+  printf("{\"case\":\"%s\",\"bytes\":%zu,\"thumb\":\"%dx%d\",\"dc_us\":%.1f,\"libjpeg_eighth_us\":%.1f,"
+         "\"libjpeg_full_us\":%.1f,\"speedup_full\":%.1f,\"speedup_eighth\":%.2f}\n",
+         name.c_str(), jpeg.size(), rw, rh, dcUs, scaledUs, fullUs, fullUs / dcUs, scaledUs / dcUs);
+}
+
+// Frames of a concatenated-JPEG file, split on SOI / EOI.
+std::vector<std::vector<uint8_t>> loadMjpg(const char* path) {
+  std::vector<std::vector<uint8_t>> frames;
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", path);
+    failures++;
+    return frames;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+  for (size_t i = 0; i + 1 < data.size(); i++) {
+    if (data[i] != 0xFF || data[i + 1] != 0xD8) continue;
+    size_t j = i + 2;
+    while (j + 1 < data.size() && !(data[j] == 0xFF && data[j + 1] == 0xD9)) j++;
+    if (j + 1 >= data.size()) break;
+    frames.emplace_back(data.begin() + i, data.begin() + j + 2);
+    i = j + 1;
+  }
+  return frames;
+}
+
+void usage(const char* argv0) { fprintf(stderr, "usage: %s [--iterations N] [--mjpg FILE]\n", argv0); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 200;
+  const char* mjpg = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (arg == "--mjpg" && i + 1 < argc) {
+      mjpg = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (iterations <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  const Layout layouts[] = {{"422", 3, 2, 1}, {"420", 3, 2, 2}, {"444", 3, 1, 1}, {"gray", 1, 1, 1}};
+  const int sizes[][2] = {{320, 240}, {640, 480}, {100, 75}};
+  for (const auto& size : sizes) {
+    std::vector<uint8_t> rgb = scene(size[0], size[1]);
+    for (const Layout& layout : layouts) {
+      for (int quality : {12, 50, 90}) {
+        for (int restart : {0, 2}) {
+          char name[64];
+          snprintf(name, sizeof(name), "%dx%d_%s_q%d%s", size[0], size[1], layout.name, quality,
+                   restart ? "_dri" : "");
+          run(name, encode(rgb, size[0], size[1], layout, quality, restart), iterations);
+        }
+      }
+    }
+  }
+  std::vector<uint8_t> rgb = scene(640, 480);
+  run("640x480_422_q50_nodht", stripTables(encode(rgb, 640, 480, layouts[0], 50, 0)), iterations);
+
+  if (mjpg) {
+    std::vector<std::vector<uint8_t>> frames = loadMjpg(mjpg);
+    for (size_t i = 0; i < frames.size(); i++) run("mjpg_" + std::to_string(i), frames[i], iterations);
+  }
+  if (failures) fprintf(stderr, "%d mismatch(es)\n", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,406 @@
+// Golden-image check and benchmark for the JPEG MCU editor
+// (src/jpeg_edit.h), against libjpeg.
+//
+// Synthetic scenes are encoded with libjpeg in the layouts the editor has to
+// handle (4:2:2 as the ESP32 camera sends, 4:2:0, 4:4:4 and grayscale), at
+// several qualities, with and without restart intervals, and once without
+// DHT. Each is edited with two masks and a clock line. --mjpg adds real
+// frames, split from a concatenated-JPEG file such as a recording from the
+// board.
+//
+// The edited frame must decode with libjpeg without a warning, and match the
+// golden image built from the original's decode: every MCU outside the edits
+// identical, pixel for pixel; masked MCUs flat at the mask level with neutral
+// chroma; under the text, neutral chroma and the font's pixels on the right
+// side of mid-grey (a few may not be, at low quality). A truncated copy must
+// be refused. Then the edit is timed against a libjpeg decode and re-encode,
+// which is what painting on the pixels would cost. One JSON line per case.
+//
+// Exits 1 on any mismatch.
+//
+//   bench_jpeg_edit [--iterations N] [--mjpg FILE]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "jpeg_edit.h"
+
+namespace {
+
+const char* CLOCK = "2026-10-17 12:34:56";
+const uint8_t MASK_LEVEL = 40;
+const double MAX_TEXT_MISS = 0.03;  // share of text pixels allowed on the wrong side of mid-grey
+
+int failures = 0;
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t rng = 12345;
+uint32_t next() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// RGB scene: a diagonal gradient, a few rectangles and a disc, plus noise.
+std::vector<uint8_t> scene(int width, int height) {
+  std::vector<uint8_t> rgb(width * height * 3);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int r = (x * 255) / width, g = (y * 255) / height, b = ((x + y) * 127) / (width + height);
+      if ((x / 37 + y / 23) % 5 == 0) r = 255 - r, b = 200;
+      int dx = x - width / 2, dy = y - height / 3;
+      if (dx * dx + dy * dy < width * height / 40) g = 30;
+      int noise = (int)(next() % 21) - 10;
+      uint8_t* px = &rgb[(y * width + x) * 3];
+      px[0] = (uint8_t)std::min(255, std::max(0, r + noise));
+      px[1] = (uint8_t)std::min(255, std::max(0, g + noise));
+      px[2] = (uint8_t)std::min(255, std::max(0, b + noise));
+    }
+  }
+  return rgb;
+}
+
+struct Layout {
+  const char* name;
+  int components;  // 1: grayscale
+  int lumaH, lumaV;
+};
+
+std::vector<uint8_t> encode(const uint8_t* pixels, int width, int height, J_COLOR_SPACE in, int inComponents,
+                            const Layout& layout, int quality, int restartRows) {
+  jpeg_compress_struct c;
+  jpeg_error_mgr err;
+  c.err = jpeg_std_error(&err);
+  jpeg_create_compress(&c);
+  unsigned char* out = nullptr;
+  unsigned long outLen = 0;
+  jpeg_mem_dest(&c, &out, &outLen);
+  c.image_width = width;
+  c.image_height = height;
+  c.input_components = inComponents;
+  c.in_color_space = in;
+  jpeg_set_defaults(&c);
+  if (layout.components == 1) jpeg_set_colorspace(&c, JCS_GRAYSCALE);
+  c.comp_info[0].h_samp_factor = layout.lumaH;
+  c.comp_info[0].v_samp_factor = layout.lumaV;
+  jpeg_set_quality(&c, quality, TRUE);
+  c.restart_in_rows = restartRows;
+  jpeg_start_compress(&c, TRUE);
+  while (c.next_scanline < c.image_height) {
+    JSAMPROW row = (JSAMPROW)&pixels[c.next_scanline * width * inComponents];
+    jpeg_write_scanlines(&c, &row, 1);
+  }
+  jpeg_finish_compress(&c);
+  std::vector<uint8_t> jpeg(out, out + outLen);
+  jpeg_destroy_compress(&c);
+  free(out);
+  return jpeg;
+}
+
+// The same JPEG without its DHT segments.
+std::vector<uint8_t> stripTables(const std::vector<uint8_t>& jpeg) {
+  std::vector<uint8_t> out(jpeg.begin(), jpeg.begin() + 2);
+  size_t p = 2;
+  while (p + 4 <= jpeg.size() && jpeg[p] == 0xFF && jpeg[p + 1] != 0xDA) {
+    size_t len = 2 + ((jpeg[p + 2] << 8) | jpeg[p + 3]);
+    if (jpeg[p + 1] != 0xC4) out.insert(out.end(), jpeg.begin() + p, jpeg.begin() + p + len);
+    p += len;
+  }
+  out.insert(out.end(), jpeg.begin() + p, jpeg.end());
+  return out;
+}
+
+struct ErrorExit : jpeg_error_mgr {
+  bool failed = false;
+  int warnings = 0;
+};
+
+// libjpeg decode to YCbCr (or grayscale) without fancy upsampling, so each
+// MCU's pixels depend on that MCU alone. False on error.
+struct Image {
+  int width = 0, height = 0, components = 0, warnings = 0;
+  std::vector<uint8_t> pixels;
+  const uint8_t* at(int x, int y) const { return &pixels[((size_t)y * width + x) * components]; }
+};
+
+bool decode(const std::vector<uint8_t>& jpeg, Image& image, J_COLOR_SPACE space = JCS_UNKNOWN) {
+  jpeg_decompress_struct d;
+  ErrorExit err;
+  d.err = jpeg_std_error(&err);
+  err.error_exit = [](j_common_ptr c) {
+    static_cast<ErrorExit*>(c->err)->failed = true;
+    throw 0;
+  };
+  err.emit_message = [](j_common_ptr c, int level) {
+    if (level < 0) static_cast<ErrorExit*>(c->err)->warnings++;
+  };
+  jpeg_create_decompress(&d);
+  bool ok = true;
+  try {
+    jpeg_mem_src(&d, jpeg.data(), jpeg.size());
+    jpeg_read_header(&d, TRUE);
+    d.out_color_space = space != JCS_UNKNOWN ? space : d.num_components == 1 ? JCS_GRAYSCALE : JCS_YCbCr;
+    d.do_fancy_upsampling = FALSE;
+    jpeg_start_decompress(&d);
+    image.width = d.output_width;
+    image.height = d.output_height;
+    image.components = d.output_components;
+    size_t stride = (size_t)image.width * image.components;
+    image.pixels.resize(stride * image.height);
+    while (d.output_scanline < d.output_height) {
+      JSAMPROW row = &image.pixels[d.output_scanline * stride];
+      jpeg_read_scanlines(&d, &row, 1);
+    }
+    jpeg_finish_decompress(&d);
+  } catch (int) {
+    ok = false;
+  }
+  image.warnings = err.warnings;
+  jpeg_destroy_decompress(&d);
+  return ok && !err.failed;
+}
+
+struct Edits {
+  int masks[2][4];
+  int textX, textY;
+};
+
+// Two masks (one touching the right edge) and the clock at the bottom left.
+Edits editsFor(int width, int height) {
+  Edits e;
+  int m0[4] = {width * 6 / 10, height / 10, width * 3 / 10 + 8, height * 3 / 10};
+  int m1[4] = {5, height / 2, width / 6, height / 8};
+  memcpy(e.masks[0], m0, sizeof(m0));
+  memcpy(e.masks[1], m1, sizeof(m1));
+  e.textX = 0;
+  e.textY = (height - JPEG_EDIT_CELL) / JPEG_EDIT_CELL * JPEG_EDIT_CELL;
+  return e;
+}
+
+JpegMcuEditor editor;
+
+size_t runEdit(const std::vector<uint8_t>& jpeg, const Edits& e, std::vector<uint8_t>& out) {
+  if (!editor.parse(jpeg.data(), jpeg.size())) return 0;
+  for (const auto& m : e.masks) editor.mask(m[0], m[1], m[2], m[3]);
+  editor.text(CLOCK, e.textX, e.textY);
+  out.resize(jpeg.size() + 16384);
+  return editor.edit(out.data(), out.size());
+}
+
+bool fontInk(int glyph, int cx, int cy) {
+  int fx = (cx - 3) / 2, fy = (cy - 1) / 2;
+  return cx >= 3 && cy >= 1 && fx < 5 && fy < 7 && (JPEG_EDIT_FONT[glyph][fy] >> (4 - fx)) & 1;
+}
+
+// Compare the edited frame's decode with the golden image: the original's
+// decode with the edits applied. Returns the share of text pixels that
+// missed; -1 on a failure (reported).
+double check(const std::string& name, const std::vector<uint8_t>& jpeg, const std::vector<uint8_t>& edited,
+             const Edits& e) {
+  Image before, after;
+  if (!decode(jpeg, before)) return -2;  // libjpeg can't read the input either
+  if (!decode(edited, after) || after.warnings) {
+    fprintf(stderr, "%s: libjpeg %s the edited frame\n", name.c_str(),
+            after.warnings ? "warns about" : "can't decode");
+    failures++;
+    return -1;
+  }
+  if (after.width != before.width || after.height != before.height || after.components != before.components) {
+    fprintf(stderr, "%s: edited frame has a different geometry\n", name.c_str());
+    failures++;
+    return -1;
+  }
+  // The editor's geometry: parse the original again for it
+  editor.parse(jpeg.data(), jpeg.size());
+  int mw = editor.mcuWidth(), mh = editor.mcuHeight();
+  int textLen = std::min((int)strlen(CLOCK), (before.width - e.textX) / JPEG_EDIT_CELL);
+  if (e.textY + JPEG_EDIT_CELL > before.height) textLen = 0;
+
+  size_t keepDiff = 0, maskBad = 0, chromaBad = 0, textPixels = 0, textMiss = 0;
+  for (int y = 0; y < before.height; y++) {
+    for (int x = 0; x < before.width; x++) {
+      int mx = x / mw, my = y / mh;
+      bool masked = false;
+      for (const auto& m : e.masks) {
+        if (mx >= m[0] / mw && mx < (m[0] + m[2] + mw - 1) / mw && my >= m[1] / mh &&
+            my < (m[1] + m[3] + mh - 1) / mh) {
+          masked = true;
+        }
+      }
+      bool textMcu = !masked && textLen && mx >= e.textX / mw &&
+                     mx < (e.textX + textLen * JPEG_EDIT_CELL + mw - 1) / mw && my >= e.textY / mh &&
+                     my < (e.textY + JPEG_EDIT_CELL + mh - 1) / mh;
+      const uint8_t* a = after.at(x, y);
+      const uint8_t* b = before.at(x, y);
+      if (masked) {
+        if (abs(a[0] - MASK_LEVEL) > 8) maskBad++;
+        for (int c = 1; c < after.components; c++) chromaBad += a[c] != 128;
+      } else if (textMcu) {
+        for (int c = 1; c < after.components; c++) chromaBad += a[c] != 128;
+        int tx = x - e.textX, ty = y - e.textY;
+        if (tx >= 0 && ty >= 0 && tx < textLen * JPEG_EDIT_CELL && ty < JPEG_EDIT_CELL) {
+          const char* g = strchr(JPEG_EDIT_CHARS, CLOCK[tx / JPEG_EDIT_CELL]);
+          bool ink = fontInk((int)(g - JPEG_EDIT_CHARS), tx % JPEG_EDIT_CELL, ty);
+          textPixels++;
+          textMiss += ink != (a[0] >= 128);
+        } else if (a[0] != b[0]) {
+          keepDiff++;
+        }
+      } else {
+        for (int c = 0; c < after.components; c++) keepDiff += a[c] != b[c];
+      }
+    }
+  }
+  double miss = textPixels ? (double)textMiss / textPixels : 0;
+  if (keepDiff || maskBad || chromaBad || miss > MAX_TEXT_MISS) {
+    fprintf(stderr, "%s: %zu kept samples changed, %zu masked pixels off level, %zu chroma not neutral, "
+            "%.1f%% text pixels wrong\n", name.c_str(), keepDiff, maskBad, chromaBad, miss * 100);
+    failures++;
+    return -1;
+  }
+  return miss;
+}
+
+// Best of a few rounds.
+template <typename Fn>
+double timeUs(int iterations, Fn fn) {
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    int64_t start = nowNs();
+    for (int i = 0; i < iterations; i++) fn();
+    double us = double(nowNs() - start) / iterations / 1000;
+    if (round == 0 || us < best) best = us;
+  }
+  return best;
+}
+
+void run(const std::string& name, const std::vector<uint8_t>& jpeg, int quality, int iterations) {
+  Image probe;
+  if (!decode(jpeg, probe)) {
+    fprintf(stderr, "%s: libjpeg can't decode it, skipped\n", name.c_str());
+    return;
+  }
+  Edits e = editsFor(probe.width, probe.height);
+  std::vector<uint8_t> out;
+  size_t len = runEdit(jpeg, e, out);
+  if (!len) {
+    fprintf(stderr, "%s: editor refused it\n", name.c_str());
+    failures++;
+    return;
+  }
+  out.resize(len);
+  double miss = check(name, jpeg, out, e);
+  if (miss < 0) return;
+
+  std::vector<uint8_t> cut(jpeg.begin(), jpeg.begin() + jpeg.size() * 2 / 3);
+  std::vector<uint8_t> cutOut;
+  if (runEdit(cut, e, cutOut)) {
+    fprintf(stderr, "%s: truncated copy was not refused\n", name.c_str());
+    failures++;
+  }
+
+  editor.parse(jpeg.data(), jpeg.size());
+  runEdit(jpeg, e, out);
+  double recoded = editor.blocks() ? 100.0 * editor.recodedBlocks() / editor.blocks() : 0;
+  double editUs = timeUs(iterations, [&] { runEdit(jpeg, e, out); });
+  bool gray = probe.components == 1;
+  Image pixels;
+  double redoUs = timeUs(iterations, [&] {
+    decode(jpeg, pixels, gray ? JCS_GRAYSCALE : JCS_RGB);
+    Layout layout = {"", gray ? 1 : 3, 2, 1};
+    encode(pixels.pixels.data(), pixels.width, pixels.height, gray ? JCS_GRAYSCALE : JCS_RGB, gray ? 1 : 3, layout,
+           quality, 0);
+  });
+  printf("{\"case\":\"%s\",\"bytes\":%zu,\"edited_bytes\":%zu,\"recoded_pct\":%.1f,\"text_miss_pct\":%.2f,"
+         "\"edit_us\":%.1f,\"libjpeg_redo_us\":%.1f,\"speedup\":%.1f}\n",
+         name.c_str(), jpeg.size(), len, recoded, miss * 100, editUs, redoUs, redoUs / editUs);
+}
+
+// Frames of a concatenated-JPEG file, split on SOI / EOI.
+std::vector<std::vector<uint8_t>> loadMjpg(const char* path) {
+  std::vector<std::vector<uint8_t>> frames;
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "cannot open %s\n", path);
+    failures++;
+    return frames;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+  for (size_t i = 0; i + 1 < data.size(); i++) {
+    if (data[i] != 0xFF || data[i + 1] != 0xD8) continue;
+    size_t j = i + 2;
+    while (j + 1 < data.size() && !(data[j] == 0xFF && data[j + 1] == 0xD9)) j++;
+    if (j + 1 >= data.size()) break;
+    frames.emplace_back(data.begin() + i, data.begin() + j + 2);
+    i = j + 1;
+  }
+  return frames;
+}
+
+void usage(const char* argv0) { fprintf(stderr, "usage: %s [--iterations N] [--mjpg FILE]\n", argv0); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 100;
+  const char* mjpg = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (arg == "--mjpg" && i + 1 < argc) {
+      mjpg = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (iterations <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  editor.setMaskLevel(MASK_LEVEL);
+  const Layout layouts[] = {{"422", 3, 2, 1}, {"420", 3, 2, 2}, {"444", 3, 1, 1}, {"gray", 1, 1, 1}};
+  const int sizes[][2] = {{320, 240}, {640, 480}, {160, 120}};
+  for (const auto& size : sizes) {
+    std::vector<uint8_t> rgb = scene(size[0], size[1]);
+    for (const Layout& layout : layouts) {
+      for (int quality : {12, 50, 90}) {
+        for (int restart : {0, 2}) {
+          char name[64];
+          snprintf(name, sizeof(name), "%dx%d_%s_q%d%s", size[0], size[1], layout.name, quality,
+                   restart ? "_dri" : "");
+          run(name, encode(rgb.data(), size[0], size[1], JCS_RGB, 3, layout, quality, restart), quality,
+              iterations);
+        }
+      }
+    }
+  }
+  std::vector<uint8_t> rgb = scene(640, 480);
+  run("640x480_422_q50_nodht", stripTables(encode(rgb.data(), 640, 480, JCS_RGB, 3, layouts[0], 50, 0)), 50,
+      iterations);
+
+  if (mjpg) {
+    std::vector<std::vector<uint8_t>> frames = loadMjpg(mjpg);
+    for (size_t i = 0; i < frames.size(); i++) run("mjpg_" + std::to_string(i), frames[i], 80, iterations);
+  }
+  if (failures) fprintf(stderr, "%d mismatch(es)\n", failures);
+  return failures ? 1 : 0;
+}
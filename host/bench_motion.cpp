@@ -0,0 +1,169 @@
+// Microbenchmark and check for the motion detector's kernels
+// (src/motion_kernels.h).
+//
+// First every pair of byte values goes through the SWAR absolute difference
+// and background step, in every byte position of a word, against the byte
+// reference. Then random planes of the sizes the detector sees (QQVGA to VGA
+// at 1/8 scale) and one larger one go through both versions of each kernel;
+// the results must match and each is timed. One JSON line per kernel and
+// size: nanoseconds per plane for the SWAR and reference versions and the
+// speedup. The host's numbers are not the ESP32's; the ratio is what carries
+// over, roughly, since neither has SIMD to help the byte loop there.
+//
+// Exits 1 if any result differs from the reference.
+//
+//   bench_motion [--iterations N]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "motion_kernels.h"
+
+namespace {
+
+int failures = 0;
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint32_t rng = 12345;
+uint32_t next() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+// A plane that changes in a few places between frames, like a scene would,
+// plus sensor noise.
+void fillPair(std::vector<uint32_t>& a, std::vector<uint32_t>& b) {
+  uint8_t* pa = reinterpret_cast<uint8_t*>(a.data());
+  uint8_t* pb = reinterpret_cast<uint8_t*>(b.data());
+  for (size_t i = 0; i < a.size() * 4; i++) {
+    pa[i] = (uint8_t)next();
+    int d = (next() & 7) - 4;
+    if ((next() & 63) == 0) d = (int)(next() & 255) - 128;
+    int v = pa[i] + d;
+    pb[i] = (uint8_t)(v < 0 ? 0 : v > 255 ? 255 : v);
+  }
+}
+
+void checkExhaustive() {
+  std::vector<uint32_t> a(256), b(256), bg(256);
+  std::vector<uint8_t> bgRef(1024);
+  uint16_t sums[64], sumsRef[64];
+  for (int va = 0; va < 256; va++) {
+    uint8_t* pa = reinterpret_cast<uint8_t*>(a.data());
+    uint8_t* pb = reinterpret_cast<uint8_t*>(b.data());
+    for (int i = 0; i < 1024; i++) {
+      pa[i] = (uint8_t)va;
+      pb[i] = (uint8_t)(i / 4);  // every value in every byte position
+    }
+    // 64 words by 4 rows: one block per word, each summing |va - vb| x 16
+    motionBlockSad(a.data(), b.data(), 64, 4, sums);
+    motionBlockSadReference(pa, pb, 64, 4, sumsRef);
+    if (memcmp(sums, sumsRef, sizeof(sums)) != 0) {
+      fprintf(stderr, "motionBlockSad differs from the reference for a = %d\n", va);
+      failures++;
+    }
+    memcpy(bg.data(), b.data(), 1024);
+    memcpy(bgRef.data(), b.data(), 1024);
+    motionTrackBackground(a.data(), bg.data(), 256);
+    motionTrackBackgroundReference(pa, bgRef.data(), 256);
+    if (memcmp(bg.data(), bgRef.data(), 1024) != 0) {
+      fprintf(stderr, "motionTrackBackground differs from the reference for cur = %d\n", va);
+      failures++;
+    }
+  }
+}
+
+template <typename Fn>
+double timeNs(int iterations, Fn fn) {
+  int64_t start = nowNs();
+  for (int i = 0; i < iterations; i++) fn();
+  return double(nowNs() - start) / iterations;
+}
+
+void report(const char* kernel, int width, int height, double swar, double reference) {
+  printf("{\"kernel\":\"%s\",\"width\":%d,\"height\":%d,\"swar_ns\":%.0f,\"reference_ns\":%.0f,\"speedup\":%.2f}\n",
+         kernel, width, height, swar, reference, reference / swar);
+}
+
+void bench(int width, int height, int iterations) {
+  int words = (width + 3) / 4;
+  std::vector<uint32_t> a(words * height), b(words * height);
+  fillPair(a, b);
+  const uint8_t* pa = reinterpret_cast<const uint8_t*>(a.data());
+  const uint8_t* pb = reinterpret_cast<const uint8_t*>(b.data());
+  std::vector<uint16_t> sums(words * (height / MOTION_BLOCK)), sumsRef(sums.size());
+
+  motionBlockSad(a.data(), b.data(), words, height, sums.data());
+  motionBlockSadReference(pa, pb, words, height, sumsRef.data());
+  if (sums != sumsRef) {
+    fprintf(stderr, "motionBlockSad differs from the reference at %dx%d\n", width, height);
+    failures++;
+  }
+  volatile uint16_t sink = 0;
+  double swar = timeNs(iterations, [&] {
+    motionBlockSad(a.data(), b.data(), words, height, sums.data());
+    sink = sink + sums[0];
+  });
+  double reference = timeNs(iterations, [&] {
+    motionBlockSadReference(pa, pb, words, height, sumsRef.data());
+    sink = sink + sumsRef[0];
+  });
+  report("block_sad", width, height, swar, reference);
+
+  std::vector<uint32_t> bg(b), bgRef(b);
+  motionTrackBackground(a.data(), bg.data(), bg.size());
+  motionTrackBackgroundReference(pa, reinterpret_cast<uint8_t*>(bgRef.data()), bgRef.size());
+  if (bg != bgRef) {
+    fprintf(stderr, "motionTrackBackground differs from the reference at %dx%d\n", width, height);
+    failures++;
+  }
+  // The background keeps converging on a; both versions do the same work
+  swar = timeNs(iterations, [&] { motionTrackBackground(a.data(), bg.data(), bg.size()); });
+  reference = timeNs(iterations, [&] {
+    motionTrackBackgroundReference(pa, reinterpret_cast<uint8_t*>(bgRef.data()), bgRef.size());
+  });
+  if (bg != bgRef) {
+    fprintf(stderr, "motionTrackBackground diverged from the reference at %dx%d\n", width, height);
+    failures++;
+  }
+  report("track_background", width, height, swar, reference);
+}
+
+void usage(const char* argv0) { fprintf(stderr, "usage: %s [--iterations N]\n", argv0); }
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 20000;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--iterations" && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+  if (iterations <= 0) {
+    usage(argv[0]);
+    return 2;
+  }
+
+  checkExhaustive();
+  // QQVGA, QVGA, CIF and VGA at 1/8 scale, then a full QVGA plane
+  const int sizes[][2] = {{20, 15}, {40, 30}, {50, 37}, {80, 60}, {320, 240}};
+  for (const auto& size : sizes) bench(size[0], size[1], iterations);
+  if (failures) fprintf(stderr, "%d mismatch(es)\n", failures);
+  return failures ? 1 : 0;
+}
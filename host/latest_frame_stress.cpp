@@ -0,0 +1,218 @@
+// Threaded stress test for src/latest_frame.h + src/frame_pool.h.
+//
+// One producer publishes variable-size frames as fast as the pool lets it;
+// several readers grab the latest frame, check it byte for byte, hold it for
+// a while (like a slow HTTP client) and check it again. The recycle hook
+// poisons every buffer it gets back, so a reader that sees a frame after it
+// was recycled, or while the producer refills it, fails the check.
+//
+// Checks: no torn or recycled frame, per-reader sequence numbers never go
+// backwards, and get() never returns a frame older than seq() was just before
+// the call. Reports publish-to-read latency percentiles. Exits 1 on any
+// violation.
+//
+//   latest_frame_stress [--seconds N] [--readers N]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sleep inside LatestFrame::get()'s race window now and then so a single-core
+// runner still interleaves the producer between load, retain and re-check.
+static void raceHook();
+#define LATEST_FRAME_RACE_HOOK() raceHook()
+#include "latest_frame.h"
+
+namespace {
+
+const size_t kSlots = 6;
+const size_t kMaxFrame = 64 * 1024;
+const uint8_t kPoison = 0xA5;
+
+uint8_t buffers[kSlots][kMaxFrame];
+FramePool pool;
+LatestFrame latest(pool);
+
+std::atomic<bool> running{true};
+std::atomic<uint64_t> failures{0};
+
+int64_t nowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t frameLen(uint32_t seq) { return 512 + (seq * 7919u) % (kMaxFrame - 512); }
+
+uint8_t patternByte(uint32_t seq, size_t i) { return (uint8_t)((seq * 2654435761u >> 24) + i * 7); }
+
+void fill(uint8_t* buf, uint32_t seq, size_t len) {
+  memcpy(buf, &seq, sizeof(seq));
+  for (size_t i = sizeof(seq); i < len; i++) buf[i] = patternByte(seq, i);
+}
+
+// Empty string if the frame is intact, otherwise what is wrong with it.
+std::string verify(const FrameRef& frame) {
+  uint32_t seq = frame.seq();
+  if (frame.len() != frameLen(seq)) return "length mismatch";
+  uint32_t stamped;
+  memcpy(&stamped, frame.data(), sizeof(stamped));
+  if (stamped != seq) return "header seq mismatch";
+  for (size_t i = sizeof(seq); i < frame.len(); i++) {
+    if (frame.data()[i] != patternByte(seq, i)) return "payload mismatch";
+  }
+  return "";
+}
+
+void fail(const char* who, uint32_t seq, const std::string& what) {
+  if (failures.fetch_add(1) < 10) fprintf(stderr, "FAIL %s seq=%u: %s\n", who, seq, what.c_str());
+}
+
+void recycle(FrameSlot& slot) { memset(slot.owner, kPoison, kMaxFrame); }
+
+struct ReaderStats {
+  uint64_t reads = 0;
+  uint64_t distinct = 0;
+  uint64_t empty = 0;
+  std::vector<int64_t> latencyNs;
+};
+
+void reader(int id, ReaderStats& stats) {
+  uint32_t lastSeq = 0;
+  uint32_t rng = 0x9E3779B9u * (id + 1);
+  char who[16];
+  snprintf(who, sizeof(who), "reader%d", id);
+  while (running.load(std::memory_order_relaxed)) {
+    uint32_t before = latest.seq();
+    FrameRef frame = latest.get();
+    int64_t seenAt = nowNs();
+    if (!frame) {
+      stats.empty++;
+      std::this_thread::yield();
+      continue;
+    }
+    stats.reads++;
+    uint32_t seq = frame.seq();
+    if (seq < before) fail(who, seq, "older than seq() before get()");
+    if (seq < lastSeq) fail(who, seq, "sequence went backwards");
+    if (seq != lastSeq) {
+      stats.distinct++;
+      stats.latencyNs.push_back(seenAt - frame.timestamp());
+    }
+    lastSeq = seq;
+
+    std::string err = verify(frame);
+    if (!err.empty()) fail(who, seq, err);
+
+    // Hold the reference for 0-255 us like a slow client, then make sure the
+    // producer has not touched the frame meanwhile.
+    rng = rng * 1103515245u + 12345u;
+    uint32_t holdUs = (rng >> 16) & 0xFF;
+    if (holdUs & 1) {
+      std::this_thread::sleep_for(std::chrono::microseconds(holdUs));
+      err = verify(frame);
+      if (!err.empty()) fail(who, seq, "changed while held: " + err);
+    }
+  }
+}
+
+int64_t percentile(std::vector<int64_t>& v, double p) {
+  if (v.empty()) return 0;
+  size_t idx = (size_t)(p * (v.size() - 1));
+  std::nth_element(v.begin(), v.begin() + idx, v.end());
+  return v[idx];
+}
+
+}  // namespace
+
+static void raceHook() {
+  thread_local uint32_t n = 0;
+  if ((++n & 7) == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+}
+
+int main(int argc, char** argv) {
+  double seconds = 2.0;
+  int readers = 4;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--seconds" && i + 1 < argc) seconds = atof(argv[++i]);
+    else if (arg == "--readers" && i + 1 < argc) readers = atoi(argv[++i]);
+    else {
+      fprintf(stderr, "usage: %s [--seconds N] [--readers N]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  pool.begin(kSlots, recycle);
+
+  std::vector<ReaderStats> stats(readers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < readers; i++) threads.emplace_back(reader, i, std::ref(stats[i]));
+
+  uint64_t published = 0;
+  uint64_t dropped = 0;
+  std::thread producer([&]() {
+    while (running.load(std::memory_order_relaxed)) {
+      FrameSlot* slot = pool.acquire();
+      if (!slot) {
+        dropped++;
+        std::this_thread::yield();
+        continue;
+      }
+      uint8_t* buf = buffers[pool.indexOf(slot)];
+      uint32_t seq = latest.seq() + 1;  // what publish() will stamp
+      size_t len = frameLen(seq);
+      // Pause half way through now and then: a reader that wrongly picked up
+      // a slot being refilled then sees it half old, half new.
+      fill(buf, seq, len / 2);
+      if ((published & 15) == 0) std::this_thread::sleep_for(std::chrono::microseconds(100));
+      fill(buf, seq, len);
+      slot->owner = buf;
+      slot->data = buf;
+      slot->len = len;
+      slot->timestamp = nowNs();
+      latest.publish(slot);
+      if (slot->seq != seq) fail("producer", slot->seq, "unexpected sequence number");
+      published++;
+      if ((published & 63) == 0) std::this_thread::yield();
+    }
+  });
+
+  std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+  running = false;
+  producer.join();
+  for (auto& t : threads) t.join();
+  latest.clear();
+
+  if (pool.inUse() != 0) fail("main", 0, "slots still referenced after all readers exited");
+
+  std::vector<int64_t> all;
+  uint64_t reads = 0, distinct = 0, empty = 0;
+  for (auto& s : stats) {
+    reads += s.reads;
+    distinct += s.distinct;
+    empty += s.empty;
+    all.insert(all.end(), s.latencyNs.begin(), s.latencyNs.end());
+  }
+
+  printf("{\"seconds\":%.1f,\"readers\":%d,\"published\":%llu,\"pool_exhausted\":%llu,"
+         "\"reads\":%llu,\"distinct_reads\":%llu,\"empty_reads\":%llu,\"get_retries\":%u,"
+         "\"latency_ns\":{\"p50\":%lld,\"p99\":%lld,\"p999\":%lld,\"max\":%lld},\"failures\":%llu}\n",
+         seconds, readers, (unsigned long long)published, (unsigned long long)dropped,
+         (unsigned long long)reads, (unsigned long long)distinct, (unsigned long long)empty,
+         latest.retryCount(), (long long)percentile(all, 0.50), (long long)percentile(all, 0.99),
+         (long long)percentile(all, 0.999), (long long)percentile(all, 1.0),
+         (unsigned long long)failures.load());
+
+  if (published == 0 || reads == 0) {
+    fprintf(stderr, "FAIL: no frames exchanged\n");
+    return 1;
+  }
+  return failures.load() ? 1 : 0;
+}
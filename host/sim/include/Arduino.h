@@ -0,0 +1,96 @@
+#pragma once
+// Host stand-in for the Arduino-ESP32 core. The sketches are compiled
+// unmodified against this header set; see host/sim/README.md.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+#include <functional>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "WString.h"
+#include "IPAddress.h"
+#include "esp_heap_caps.h"
+
+#define PROGMEM
+#define PGM_P const char*
+#define F(s) (s)
+#define HIGH 1
+#define LOW 0
+#define OUTPUT 1
+#define INPUT 0
+
+using std::min;
+using std::max;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+bool psramFound();
+bool setCpuFrequencyMhz(uint32_t cpu_freq_mhz);
+uint32_t getCpuFrequencyMhz();
+uint32_t xPortGetCoreID();
+// SNTP isn't simulated: the host's clock is already set, only TZ applies.
+void configTzTime(const char* tz, const char* server1, const char* server2 = nullptr,
+                  const char* server3 = nullptr);
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+class HardwareSerial {
+ public:
+  void begin(unsigned long) {}
+  void flush() { fflush(stdout); }
+  size_t write(const char* s) { return print(s); }
+
+  size_t print(const char* s) {
+    if (!s) return 0;
+    fputs(s, stdout);
+    return strlen(s);
+  }
+  size_t print(const String& s) { return print(s.c_str()); }
+  size_t print(char c) { fputc(c, stdout); return 1; }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned int v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+  size_t print(const IPAddress& ip) { return print(ip.toString()); }
+
+  template <typename T>
+  size_t println(const T& v) { size_t n = print(v); n += print("\n"); return n; }
+  size_t println() { return print("\n"); }
+
+  size_t printf(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vprintf(fmt, args);
+    va_end(args);
+    return n < 0 ? 0 : (size_t)n;
+  }
+};
+extern HardwareSerial Serial;
+
+class EspClass {
+ public:
+  uint32_t getHeapSize();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getPsramSize();
+  uint32_t getFreePsram();
+  uint32_t getMaxAllocPsram();
+  uint32_t getCpuFreqMHz() { return getCpuFrequencyMhz(); }
+  [[noreturn]] void restart();
+};
+extern EspClass ESP;
@@ -0,0 +1,3 @@
+#pragma once
+// The sketches include ArduinoJson but build their JSON by hand; nothing from
+// the library is needed on the host.
@@ -0,0 +1,32 @@
+#pragma once
+// Host stand-in for AsyncTCP. Only the connection view an
+// AsyncWebServerRequest exposes is modelled: space() reports the free part of
+// an emulated lwIP send buffer (TCP_SND_BUF) so backpressure logic sees the
+// same numbers it would on the device. Each open connection has a tcp_pcb
+// on tcp_active_pcbs whose poll handler makes the server loop fill again,
+// like an lwIP poll.
+
+#include "Arduino.h"
+#include "lwip/tcp.h"
+
+class AsyncClient {
+ public:
+  explicit AsyncClient(int fd) : _fd(fd) {}
+
+  size_t space() const;
+  bool canSend() const { return space() > 0; }
+  bool connected() const { return _fd >= 0; }
+  IPAddress remoteIP() const { return _remoteIP; }
+  uint16_t remotePort() const { return _remotePort; }
+  void close(bool now = false);
+  tcp_pcb* pcb() { return connected() ? &_tcp : nullptr; }
+
+  // Simulation internals, used by the web server loop.
+  int _fd;
+  size_t _pending = 0;  // bytes accepted by space() but not yet in the kernel
+  bool _closeRequested = false;
+  IPAddress _remoteIP;
+  uint16_t _remotePort = 0;
+  tcp_pcb _tcp = {};
+  bool _pollRequested = false;  // the pcb's poll handler ran
+};
@@ -0,0 +1,201 @@
+#pragma once
+// Host stand-in for ESPAsyncWebServer. All handlers and response fillers run on
+// a single "async_tcp" thread, responses are pulled through their fillers as
+// the emulated send buffer drains, RESPONSE_TRY_AGAIN is retried on the next
+// ack or on the 500 ms lwIP poll, and every connection is closed after its
+// response, mirroring the library's behaviour on the device.
+
+#include <functional>
+#include <vector>
+#include "Arduino.h"
+#include "AsyncTCP.h"
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+class AsyncWebServer;
+class AsyncWebServerRequest;
+class AsyncWebServerResponse;
+
+typedef std::function<size_t(uint8_t*, size_t, size_t)> AwsResponseFiller;
+typedef std::function<void(AsyncWebServerRequest*)> ArRequestHandlerFunction;
+typedef std::function<void()> ArDisconnectHandler;
+
+class AsyncWebParameter {
+ public:
+  AsyncWebParameter(const String& name, const String& value, bool form = false)
+      : _name(name), _value(value), _isForm(form) {}
+  const String& name() const { return _name; }
+  const String& value() const { return _value; }
+  size_t size() const { return _value.length(); }
+  bool isPost() const { return _isForm; }
+  bool isFile() const { return false; }
+
+ private:
+  String _name;
+  String _value;
+  bool _isForm;
+};
+
+class AsyncWebHeader {
+ public:
+  AsyncWebHeader(const String& name, const String& value) : _name(name), _value(value) {}
+  const String& name() const { return _name; }
+  const String& value() const { return _value; }
+
+ private:
+  String _name;
+  String _value;
+};
+
+class AsyncWebServerResponse {
+ public:
+  virtual ~AsyncWebServerResponse() {}
+  void setCode(int code) { _code = code; }
+  void setContentLength(size_t len) { _contentLength = len; _sendContentLength = true; }
+  void setContentType(const String& type) { _contentType = type; }
+  void addHeader(const String& name, const String& value) { _headers.emplace_back(name, value); }
+  int code() const { return _code; }
+
+  // Simulation internals: produce up to maxLen bytes of the wire form
+  // (status line, headers, body). Returns RESPONSE_TRY_AGAIN when the body
+  // source has nothing yet, 0 once the response is complete.
+  size_t _fill(uint8_t* buf, size_t maxLen);
+  bool _finished() const { return _done; }
+  bool _started() const { return _headSent > 0; }
+
+ protected:
+  // Fill body bytes starting at body offset `index`. Returns 0 at the end.
+  virtual size_t _fillContent(uint8_t* buf, size_t maxLen, size_t index) = 0;
+
+  int _code = 200;
+  String _contentType;
+  size_t _contentLength = 0;
+  bool _sendContentLength = true;
+  bool _chunked = false;
+  std::vector<AsyncWebHeader> _headers;
+
+ private:
+  std::string _head;
+  size_t _headSent = 0;
+  size_t _bodyIndex = 0;
+  bool _done = false;
+  bool _lastChunkSent = false;
+};
+
+// Base for responses that produce their body sequentially, as in the library.
+class AsyncAbstractResponse : public AsyncWebServerResponse {
+ public:
+  virtual bool _sourceValid() const { return false; }
+  virtual size_t _fillBuffer(uint8_t*, size_t) { return 0; }
+
+ protected:
+  size_t _fillContent(uint8_t* buf, size_t maxLen, size_t index) override {
+    if (!_sourceValid() || index >= _contentLength) return 0;
+    return _fillBuffer(buf, std::min(maxLen, _contentLength - index));
+  }
+};
+
+class AsyncCallbackWebHandler {
+ public:
+  AsyncCallbackWebHandler& setFilter(std::function<bool(AsyncWebServerRequest*)>) { return *this; }
+
+  // Simulation internals
+  String _uri;
+  WebRequestMethodComposite _method = HTTP_ANY;
+  ArRequestHandlerFunction _onRequest;
+  bool canHandle(const String& url, WebRequestMethodComposite method) const;
+};
+
+class AsyncWebServerRequest {
+ public:
+  AsyncWebServerRequest(AsyncWebServer* server, AsyncClient* client);
+  ~AsyncWebServerRequest();
+
+  AsyncClient* client() { return _client; }
+  WebRequestMethodComposite method() const { return _method; }
+  const char* methodToString() const;
+  const String& url() const { return _url; }
+  const String& host() const { return _host; }
+  const String& contentType() const { return _contentType; }
+
+  void send(AsyncWebServerResponse* response);
+  void send(int code, const String& contentType = String(), const String& content = String());
+  void send_P(int code, const String& contentType, const uint8_t* content, size_t len);
+  void send_P(int code, const String& contentType, PGM_P content);
+  void redirect(const String& url);
+
+  AsyncWebServerResponse* beginResponse(int code, const String& contentType = String(),
+                                        const String& content = String());
+  AsyncWebServerResponse* beginResponse_P(int code, const String& contentType,
+                                          const uint8_t* content, size_t len);
+  AsyncWebServerResponse* beginResponse_P(int code, const String& contentType, PGM_P content);
+  AsyncWebServerResponse* beginResponse(const String& contentType, size_t len,
+                                        AwsResponseFiller callback);
+  AsyncWebServerResponse* beginChunkedResponse(const String& contentType,
+                                               AwsResponseFiller callback);
+
+  bool authenticate(const char* username, const char* password, const char* realm = nullptr,
+                    bool passwordIsHash = false);
+  void requestAuthentication(const char* realm = nullptr, bool isDigest = true);
+
+  size_t params() const { return _params.size(); }
+  bool hasParam(const String& name, bool post = false, bool file = false) const;
+  AsyncWebParameter* getParam(const String& name, bool post = false, bool file = false) const;
+  AsyncWebParameter* getParam(size_t num) const;
+  bool hasArg(const char* name) const { return hasParam(name); }
+  const String& arg(const String& name) const;
+
+  size_t headers() const { return _headersIn.size(); }
+  bool hasHeader(const String& name) const;
+  AsyncWebHeader* getHeader(const String& name) const;
+  String header(const char* name) const;
+
+  void onDisconnect(ArDisconnectHandler fn) { _onDisconnect = fn; }
+
+  // Simulation internals
+  AsyncWebServer* _server;
+  AsyncClient* _client;
+  AsyncWebServerResponse* _response = nullptr;
+  WebRequestMethodComposite _method = HTTP_GET;
+  String _url;
+  String _host;
+  String _contentType;
+  std::vector<AsyncWebParameter*> _params;
+  std::vector<AsyncWebHeader*> _headersIn;
+  ArDisconnectHandler _onDisconnect;
+};
+
+class AsyncWebServer {
+ public:
+  explicit AsyncWebServer(uint16_t port) : _port(port) {}
+  ~AsyncWebServer();
+
+  void begin();
+  void end();
+  AsyncCallbackWebHandler& on(const char* uri, ArRequestHandlerFunction onRequest) {
+    return on(uri, HTTP_ANY, onRequest);
+  }
+  AsyncCallbackWebHandler& on(const char* uri, WebRequestMethodComposite method,
+                              ArRequestHandlerFunction onRequest);
+  void onNotFound(ArRequestHandlerFunction fn) { _notFound = fn; }
+  void reset();
+
+  // Simulation internals
+  void _handleRequest(AsyncWebServerRequest* request);
+  uint16_t _port;
+  std::vector<AsyncCallbackWebHandler*> _handlers;
+  ArRequestHandlerFunction _notFound;
+  void* _impl = nullptr;
+};
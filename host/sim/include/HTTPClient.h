@@ -0,0 +1,20 @@
+#pragma once
+// Host stand-in for HTTPClient. The simulation has no upstream internet
+// access, so every request fails with a connection error.
+
+#include "Arduino.h"
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_REFUSED (-1)
+
+class HTTPClient {
+ public:
+  bool begin(const String& url) { url_ = url; return true; }
+  bool begin(const char* url) { url_ = url; return true; }
+  int GET() { return HTTPC_ERROR_CONNECTION_REFUSED; }
+  String getString() { return String(); }
+  void end() {}
+
+ private:
+  String url_;
+};
@@ -0,0 +1,25 @@
+#pragma once
+#include <stdint.h>
+#include "WString.h"
+
+class IPAddress {
+ public:
+  IPAddress() : bytes_{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes_{a, b, c, d} {}
+  explicit IPAddress(uint32_t addr) {
+    for (int i = 0; i < 4; i++) bytes_[i] = (uint8_t)(addr >> (8 * i));
+  }
+  uint8_t operator[](int i) const { return bytes_[i]; }
+  bool operator==(const IPAddress& o) const {
+    return bytes_[0] == o.bytes_[0] && bytes_[1] == o.bytes_[1] &&
+           bytes_[2] == o.bytes_[2] && bytes_[3] == o.bytes_[3];
+  }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes_[0], bytes_[1], bytes_[2], bytes_[3]);
+    return String(buf);
+  }
+
+ private:
+  uint8_t bytes_[4];
+};
@@ -0,0 +1,22 @@
+#pragma once
+#include "FS.h"
+
+typedef enum { CARD_NONE, CARD_MMC, CARD_SD, CARD_SDHC, CARD_UNKNOWN } sdcard_type_t;
+
+namespace fs {
+
+class SDMMCFS : public FS {
+ public:
+  bool begin(const char* mountpoint = "/sdcard", bool mode1bit = false,
+             bool format_if_mount_failed = false, int sdmmc_frequency = 20000,
+             uint8_t maxOpenFiles = 5);
+  void end();
+  sdcard_type_t cardType();
+  uint64_t cardSize();
+  uint64_t totalBytes();
+  uint64_t usedBytes();
+};
+
+}  // namespace fs
+
+extern fs::SDMMCFS SD_MMC;
@@ -0,0 +1,123 @@
+#pragma once
+// Host stand-in for the Arduino String class, backed by std::string. Only the
+// subset of the API the sketches use is provided.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+
+class String {
+ public:
+  String() {}
+  String(const char* s) : s_(s ? s : "") {}
+  String(const String& other) = default;
+  String(String&& other) = default;
+  String& operator=(const String& other) = default;
+  String& operator=(String&& other) = default;
+  String& operator=(const char* s) { s_ = s ? s : ""; return *this; }
+  explicit String(const std::string& s) : s_(s) {}
+  explicit String(char c) : s_(1, c) {}
+  explicit String(int v, unsigned char base = 10) { fromSigned(v, base); }
+  explicit String(unsigned int v, unsigned char base = 10) { fromUnsigned(v, base); }
+  explicit String(long v, unsigned char base = 10) { fromSigned(v, base); }
+  explicit String(unsigned long v, unsigned char base = 10) { fromUnsigned(v, base); }
+  explicit String(long long v, unsigned char base = 10) { fromSigned(v, base); }
+  explicit String(unsigned long long v, unsigned char base = 10) { fromUnsigned(v, base); }
+  explicit String(float v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+  explicit String(double v, unsigned int decimals = 2) { fromDouble(v, decimals); }
+
+  const char* c_str() const { return s_.c_str(); }
+  unsigned int length() const { return (unsigned int)s_.size(); }
+  bool isEmpty() const { return s_.empty(); }
+  bool reserve(unsigned int size) { s_.reserve(size); return true; }
+  char charAt(unsigned int i) const { return i < s_.size() ? s_[i] : 0; }
+  char operator[](unsigned int i) const { return charAt(i); }
+
+  String& operator+=(const String& rhs) { s_ += rhs.s_; return *this; }
+  String& operator+=(const char* rhs) { if (rhs) s_ += rhs; return *this; }
+  String& operator+=(char c) { s_ += c; return *this; }
+  String& operator+=(int v) { s_ += String(v).s_; return *this; }
+  String& operator+=(unsigned int v) { s_ += String(v).s_; return *this; }
+  String& operator+=(long v) { s_ += String(v).s_; return *this; }
+  String& operator+=(unsigned long v) { s_ += String(v).s_; return *this; }
+  bool concat(const String& rhs) { s_ += rhs.s_; return true; }
+  bool concat(const char* rhs) { if (rhs) s_ += rhs; return true; }
+  bool concat(const char* rhs, unsigned int len) { s_.append(rhs, len); return true; }
+  bool concat(char c) { s_ += c; return true; }
+
+  bool equals(const String& rhs) const { return s_ == rhs.s_; }
+  bool equals(const char* rhs) const { return s_ == (rhs ? rhs : ""); }
+  bool equalsIgnoreCase(const String& rhs) const { return strcasecmp(c_str(), rhs.c_str()) == 0; }
+  bool operator==(const String& rhs) const { return equals(rhs); }
+  bool operator==(const char* rhs) const { return equals(rhs); }
+  bool operator!=(const String& rhs) const { return !equals(rhs); }
+  bool operator!=(const char* rhs) const { return !equals(rhs); }
+  bool operator<(const String& rhs) const { return s_ < rhs.s_; }
+
+  bool startsWith(const String& prefix) const { return s_.compare(0, prefix.s_.size(), prefix.s_) == 0; }
+  bool startsWith(const String& prefix, unsigned int offset) const {
+    return offset <= s_.size() && s_.compare(offset, prefix.s_.size(), prefix.s_) == 0;
+  }
+  bool endsWith(const String& suffix) const {
+    return s_.size() >= suffix.s_.size() &&
+           s_.compare(s_.size() - suffix.s_.size(), suffix.s_.size(), suffix.s_) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const { return find(s_.find(c, from)); }
+  int indexOf(const String& str, unsigned int from = 0) const { return find(s_.find(str.s_, from)); }
+  int lastIndexOf(char c) const { return find(s_.rfind(c)); }
+  String substring(unsigned int left) const { return substring(left, length()); }
+  String substring(unsigned int left, unsigned int right) const {
+    if (left > right) { unsigned int t = left; left = right; right = t; }
+    if (left >= s_.size()) return String();
+    if (right > s_.size()) right = (unsigned int)s_.size();
+    return String(s_.substr(left, right - left));
+  }
+  long toInt() const { return strtol(s_.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(s_.c_str(), nullptr); }
+  double toDouble() const { return strtod(s_.c_str(), nullptr); }
+  void trim() {
+    size_t b = 0, e = s_.size();
+    while (b < e && isspace((unsigned char)s_[b])) b++;
+    while (e > b && isspace((unsigned char)s_[e - 1])) e--;
+    s_ = s_.substr(b, e - b);
+  }
+  void toLowerCase() { for (char& c : s_) c = (char)tolower((unsigned char)c); }
+  void toUpperCase() { for (char& c : s_) c = (char)toupper((unsigned char)c); }
+  void replace(const String& find, const String& repl) {
+    if (find.s_.empty()) return;
+    size_t pos = 0;
+    while ((pos = s_.find(find.s_, pos)) != std::string::npos) {
+      s_.replace(pos, find.s_.size(), repl.s_);
+      pos += repl.s_.size();
+    }
+  }
+
+  friend String operator+(const String& a, const String& b) { String r(a); r += b; return r; }
+  friend String operator+(const String& a, const char* b) { String r(a); r += b; return r; }
+  friend String operator+(const char* a, const String& b) { String r(a); r += b; return r; }
+  friend String operator+(const String& a, char b) { String r(a); r += b; return r; }
+
+ private:
+  static int find(size_t pos) { return pos == std::string::npos ? -1 : (int)pos; }
+  void fromSigned(long long v, unsigned char base) {
+    if (v < 0 && base == 10) { s_ = "-"; fromUnsignedAppend((unsigned long long)(-v), base); }
+    else fromUnsigned((unsigned long long)v, base);
+  }
+  void fromUnsigned(unsigned long long v, unsigned char base) { s_.clear(); fromUnsignedAppend(v, base); }
+  void fromUnsignedAppend(unsigned long long v, unsigned char base) {
+    char buf[72];
+    int i = 0;
+    if (base < 2) base = 10;
+    do { int d = (int)(v % base); buf[i++] = (char)(d < 10 ? '0' + d : 'a' + d - 10); v /= base; } while (v);
+    while (i) s_ += buf[--i];
+  }
+  void fromDouble(double v, unsigned int decimals) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+    s_ = buf;
+  }
+
+  std::string s_;
+};
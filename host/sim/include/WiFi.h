@@ -0,0 +1,41 @@
+#pragma once
+// Host stand-in for the Arduino-ESP32 WiFi class. The station is reported as
+// connected immediately; localIP() is the loopback address the simulated web
+// server listens on.
+
+#include "Arduino.h"
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+class WiFiClass {
+ public:
+  bool mode(wifi_mode_t) { return true; }
+  bool setSleep(bool) { return true; }
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet,
+              IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr);
+  wl_status_t status() { return connected_ ? WL_CONNECTED : WL_DISCONNECTED; }
+  bool isConnected() { return connected_; }
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+  IPAddress gatewayIP() { return gateway_; }
+  IPAddress subnetMask() { return subnet_; }
+  IPAddress dnsIP(uint8_t = 0) { return dns_; }
+  String macAddress() { return String("02:00:00:00:00:01"); }
+  int8_t RSSI() { return -55; }
+
+ private:
+  bool connected_ = false;
+  IPAddress gateway_{127, 0, 0, 1};
+  IPAddress subnet_{255, 0, 0, 0};
+  IPAddress dns_{127, 0, 0, 1};
+};
+extern WiFiClass WiFi;
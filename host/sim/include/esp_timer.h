@@ -0,0 +1,27 @@
+#pragma once
+#include <stdint.h>
+
+#include "esp_err.h"
+
+// Microseconds since process start (monotonic), as on the device.
+int64_t esp_timer_get_time();
+
+// One-shot timers. Callbacks run on a single "esp_timer" thread, like
+// ESP_TIMER_TASK dispatch.
+typedef void (*esp_timer_cb_t)(void* arg);
+typedef struct esp_timer* esp_timer_handle_t;
+typedef enum { ESP_TIMER_TASK } esp_timer_dispatch_t;
+
+typedef struct {
+  esp_timer_cb_t callback;
+  void* arg;
+  esp_timer_dispatch_t dispatch_method;
+  const char* name;
+  bool skip_unhandled_events;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out);
+// ESP_ERR_INVALID_STATE if the timer is already running, as on the device.
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
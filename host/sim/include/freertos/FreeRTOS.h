@@ -0,0 +1,41 @@
+#pragma once
+// Host stand-in for the ESP-IDF FreeRTOS port. Tasks are std::threads, ticks
+// are milliseconds (configTICK_RATE_HZ = 1000 as on Arduino-ESP32) and the
+// synchronisation objects are built on std::mutex / std::condition_variable.
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define pdTRUE  ((BaseType_t)1)
+#define pdFALSE ((BaseType_t)0)
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+#define errQUEUE_FULL ((BaseType_t)0)
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t)(((TickType_t)(xTimeInMs) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000U))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+#define tskIDLE_PRIORITY 0
+#define configUSE_TRACE_FACILITY 1
+#define configGENERATE_RUN_TIME_STATS 1  // counters are thread CPU time in us
+
+// Critical sections map onto a single process-wide recursive lock.
+typedef struct { int unused; } portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+void sim_enter_critical(portMUX_TYPE* mux);
+void sim_exit_critical(portMUX_TYPE* mux);
+#define portENTER_CRITICAL(mux) sim_enter_critical(mux)
+#define portEXIT_CRITICAL(mux) sim_exit_critical(mux)
+#define portENTER_CRITICAL_ISR(mux) sim_enter_critical(mux)
+#define portEXIT_CRITICAL_ISR(mux) sim_exit_critical(mux)
+#define portYIELD() sim_yield()
+#define taskYIELD() sim_yield()
+void sim_yield();
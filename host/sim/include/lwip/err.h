@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_MEM -1
@@ -0,0 +1,6 @@
+#pragma once
+#include "lwip/tcp.h"
+
+// Open connections, linked through next. Only touched on the tcpip thread,
+// which the web server loop plays.
+extern struct tcp_pcb* tcp_active_pcbs;
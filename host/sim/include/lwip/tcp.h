@@ -0,0 +1,14 @@
+#pragma once
+// Host stand-in for the lwIP pcb fields the sources touch: the callback
+// argument (the AsyncClient) and the poll handler.
+
+#include "lwip/err.h"
+
+struct tcp_pcb;
+typedef err_t (*tcp_poll_fn)(void* arg, struct tcp_pcb* tpcb);
+
+struct tcp_pcb {
+  struct tcp_pcb* next;
+  void* callback_arg;
+  tcp_poll_fn poll;
+};
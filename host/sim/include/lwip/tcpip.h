@@ -0,0 +1,8 @@
+#pragma once
+#include "lwip/err.h"
+
+typedef void (*tcpip_callback_fn)(void* ctx);
+
+// Queue fn to run on the tcpip thread: the web server loop, which plays
+// both tcpip and async_tcp. ERR_MEM when the queue is full.
+err_t tcpip_callback(tcpip_callback_fn fn, void* ctx);
@@ -0,0 +1,346 @@
+// esp32-camera stand-in. The "sensor" free-runs at SimConfig::sensorFps from
+// process start; esp_camera_fb_get() blocks until the next sensor frame after
+// the one last delivered and until a frame buffer is free, like the driver in
+// CAMERA_GRAB_LATEST mode. Payloads come from a concatenated-JPEG file.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Arduino.h"
+#include "esp_camera.h"
+#include "esp_timer.h"
+#include "sim_config.h"
+
+const resolution_info_t resolution[] = {
+    {96, 96},   {160, 120}, {176, 144}, {240, 176}, {240, 240},  {320, 240},  {400, 296},
+    {480, 320}, {640, 480}, {800, 600}, {1024, 768}, {1280, 720}, {1280, 1024}, {1600, 1200},
+};
+
+namespace {
+
+struct SimCamera {
+  std::mutex lock;
+  std::condition_variable freed;
+  std::vector<std::vector<uint8_t>> frames;  // replay source
+  std::vector<camera_fb_t> fbs;
+  std::vector<bool> fbInUse;
+  std::vector<std::vector<uint8_t>> fbStorage;
+  int64_t lastFrameNumber = -1;
+  bool initialised = false;
+  sensor_t sensor;
+};
+
+SimCamera& cam() {
+  static SimCamera camera;
+  return camera;
+}
+
+// Split a concatenated-JPEG stream on SOI/EOI markers.
+void loadMjpg(const std::string& path, std::vector<std::vector<uint8_t>>& out) {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (!f) {
+    fprintf(stderr, "[sim] cannot open %s\n", path.c_str());
+    return;
+  }
+  std::vector<uint8_t> data;
+  uint8_t chunk[65536];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) data.insert(data.end(), chunk, chunk + n);
+  fclose(f);
+
+  size_t i = 0;
+  while (i + 1 < data.size()) {
+    if (data[i] == 0xFF && data[i + 1] == 0xD8) {
+      size_t j = i + 2;
+      while (j + 1 < data.size() && !(data[j] == 0xFF && data[j + 1] == 0xD9)) j++;
+      if (j + 1 >= data.size()) break;
+      out.emplace_back(data.begin() + i, data.begin() + j + 2);
+      i = j + 2;
+    } else {
+      i++;
+    }
+  }
+}
+
+// MSB-first bit writer for entropy-coded data, with 0xFF stuffing.
+struct BitWriter {
+  std::vector<uint8_t>& out;
+  uint32_t acc = 0;
+  int bits = 0;
+
+  void put(uint32_t value, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+      acc = (acc << 1) | ((value >> i) & 1);
+      if (++bits == 8) {
+        out.push_back((uint8_t)acc);
+        if (acc == 0xFF) out.push_back(0x00);
+        acc = 0;
+        bits = 0;
+      }
+    }
+  }
+  void flush() {
+    while (bits) put(1, 1);  // pad with ones
+  }
+};
+
+void putSegment(std::vector<uint8_t>& f, uint8_t marker, const std::vector<uint8_t>& body) {
+  f.push_back(0xFF);
+  f.push_back(marker);
+  f.push_back((uint8_t)((body.size() + 2) >> 8));
+  f.push_back((uint8_t)(body.size() + 2));
+  f.insert(f.end(), body.begin(), body.end());
+}
+
+// A real, if blocky, grayscale baseline JPEG of width x height: a still
+// diagonal gradient made of flat 8x8 blocks (DC only, every AC run an EOB).
+// Browsers show it and the motion detector's DC decoder reads it; the scene
+// never changes, so activity stays 0.
+std::vector<uint8_t> syntheticImage(int width, int height) {
+  static const uint8_t dcBits[16] = {0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};  // Annex K.3 luma DC
+  uint16_t dcCode[12];
+  int dcLength[12];
+  for (int l = 1, code = 0, k = 0; l <= 16; l++, code <<= 1) {
+    for (int i = 0; i < dcBits[l - 1]; i++, k++, code++) {
+      dcCode[k] = (uint16_t)code;
+      dcLength[k] = l;
+    }
+  }
+
+  std::vector<uint8_t> f;
+  std::vector<uint8_t> dqt(65, 8);  // every step 8: a DC coefficient is the block's mean - 128
+  dqt[0] = 0;
+  putSegment(f, 0xDB, dqt);
+  putSegment(f, 0xC0, {8, (uint8_t)(height >> 8), (uint8_t)height, (uint8_t)(width >> 8), (uint8_t)width, 1, 1, 0x11, 0});
+  std::vector<uint8_t> dht(1 + 16 + 12 + 1 + 16 + 1, 0);  // DC table 0, then AC table 0
+  memcpy(&dht[1], dcBits, 16);
+  for (int i = 0; i < 12; i++) dht[17 + i] = (uint8_t)i;
+  dht[29] = 0x10;  // AC: EOB only, code "0"
+  dht[30] = 1;
+  putSegment(f, 0xC4, dht);
+  putSegment(f, 0xDA, {1, 1, 0x00, 0, 63, 0});
+
+  BitWriter bits{f};
+  int blocksX = (width + 7) / 8, blocksY = (height + 7) / 8;
+  int pred = 0;
+  for (int by = 0; by < blocksY; by++) {
+    for (int bx = 0; bx < blocksX; bx++) {
+      int dc = 40 + 160 * (bx + by) / (blocksX + blocksY) - 128;
+      int diff = dc - pred;
+      pred = dc;
+      int magnitude = diff < 0 ? -diff : diff;
+      int category = 0;
+      while (magnitude >> category) category++;
+      bits.put(dcCode[category], dcLength[category]);
+      if (category) bits.put(diff < 0 ? diff + (1 << category) - 1 : diff, category);
+      bits.put(0, 1);  // EOB
+    }
+  }
+  bits.flush();
+  return f;
+}
+
+// A synthetic frame of about bytes: SOI, COM filler with a frame counter so
+// consecutive frames differ, then the image and EOI.
+std::vector<uint8_t> syntheticFrame(uint32_t bytes, uint32_t number, const std::vector<uint8_t>& image) {
+  std::vector<uint8_t> f;
+  f.reserve(bytes + image.size() + 16);
+  f.push_back(0xFF);
+  f.push_back(0xD8);
+  uint32_t fixed = 6 + (uint32_t)image.size();
+  uint32_t remaining = bytes > fixed ? bytes - fixed : 0;
+  uint32_t seed = number * 2654435761u + 1;
+  while (remaining > 4) {
+    uint32_t seg = std::min<uint32_t>(remaining - 4, 65533);
+    f.push_back(0xFF);
+    f.push_back(0xFE);
+    f.push_back((uint8_t)((seg + 2) >> 8));
+    f.push_back((uint8_t)(seg + 2));
+    for (uint32_t k = 0; k < seg; k++) {
+      seed = seed * 1103515245u + 12345u;
+      f.push_back((uint8_t)(seed >> 24) & 0x7F);
+    }
+    remaining -= seg + 4;
+  }
+  f.insert(f.end(), image.begin(), image.end());
+  f.push_back(0xFF);
+  f.push_back(0xD9);
+  return f;
+}
+
+// Settings are changed from HTTP handlers while cameraTask reads them in
+// esp_camera_fb_get(), so they are guarded by the camera lock.
+int setFramesize(sensor_t* s, framesize_t v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.framesize = v;
+  return 0;
+}
+int setQuality(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.quality = (uint8_t)v;
+  return 0;
+}
+int setPixformat(sensor_t* s, pixformat_t v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->pixformat = v;
+  return 0;
+}
+int setSpecialEffect(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.special_effect = (uint8_t)v;
+  return 0;
+}
+int setSaturation(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.saturation = (int8_t)v;
+  return 0;
+}
+int setContrast(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.contrast = (int8_t)v;
+  return 0;
+}
+int setBrightness(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.brightness = (int8_t)v;
+  return 0;
+}
+int setGainceiling(sensor_t* s, gainceiling_t v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.gainceiling = (uint8_t)v;
+  return 0;
+}
+int setAecValue(sensor_t* s, int v) {
+  std::lock_guard<std::mutex> guard(cam().lock);
+  s->status.aec_value = (uint16_t)v;
+  return 0;
+}
+int setIgnored(sensor_t*, int) { return 0; }
+
+}  // namespace
+
+esp_err_t esp_camera_init(const camera_config_t* config) {
+  SimCamera& c = cam();
+  std::lock_guard<std::mutex> guard(c.lock);
+  const SimConfig& sim = simConfig();
+  if (!sim.mjpgPath.empty()) loadMjpg(sim.mjpgPath, c.frames);
+  if (c.frames.empty()) {
+    if (!sim.mjpgPath.empty()) fprintf(stderr, "[sim] no JPEG frames in %s, using synthetic frames\n", sim.mjpgPath.c_str());
+    framesize_t fs = config->frame_size < FRAMESIZE_INVALID ? config->frame_size : FRAMESIZE_QVGA;
+    std::vector<uint8_t> image = syntheticImage(resolution[fs].width, resolution[fs].height);
+    for (uint32_t i = 0; i < 16; i++) c.frames.push_back(syntheticFrame(sim.syntheticBytes, i, image));
+  }
+  size_t maxLen = 0;
+  for (auto& f : c.frames) maxLen = std::max(maxLen, f.size());
+
+  size_t count = config->fb_count ? config->fb_count : 1;
+  c.fbs.assign(count, camera_fb_t());
+  c.fbInUse.assign(count, false);
+  c.fbStorage.assign(count, std::vector<uint8_t>(maxLen));
+  for (size_t i = 0; i < count; i++) c.fbs[i].buf = c.fbStorage[i].data();
+
+  memset(&c.sensor, 0, sizeof(c.sensor));
+  c.sensor.pixformat = config->pixel_format;
+  c.sensor.status.framesize = config->frame_size;
+  c.sensor.status.quality = (uint8_t)config->jpeg_quality;
+  c.sensor.set_pixformat = setPixformat;
+  c.sensor.set_framesize = setFramesize;
+  c.sensor.set_quality = setQuality;
+  c.sensor.set_special_effect = setSpecialEffect;
+  c.sensor.set_saturation = setSaturation;
+  c.sensor.set_contrast = setContrast;
+  c.sensor.set_brightness = setBrightness;
+  c.sensor.set_gainceiling = setGainceiling;
+  c.sensor.set_aec_value = setAecValue;
+  c.sensor.set_sharpness = setIgnored;
+  c.sensor.set_denoise = setIgnored;
+  c.sensor.set_colorbar = setIgnored;
+  c.sensor.set_whitebal = setIgnored;
+  c.sensor.set_gain_ctrl = setIgnored;
+  c.sensor.set_exposure_ctrl = setIgnored;
+  c.sensor.set_hmirror = setIgnored;
+  c.sensor.set_vflip = setIgnored;
+  c.sensor.set_aec2 = setIgnored;
+  c.sensor.set_awb_gain = setIgnored;
+  c.sensor.set_agc_gain = setIgnored;
+  c.sensor.set_wb_mode = setIgnored;
+  c.sensor.set_ae_level = setIgnored;
+  c.sensor.set_dcw = setIgnored;
+  c.sensor.set_bpc = setIgnored;
+  c.sensor.set_wpc = setIgnored;
+  c.sensor.set_raw_gma = setIgnored;
+  c.sensor.set_lenc = setIgnored;
+  c.initialised = true;
+  fprintf(stderr, "[sim] camera: %zu frames, %zu frame buffers, %.1f fps sensor\n",
+          c.frames.size(), count, sim.sensorFps);
+  return ESP_OK;
+}
+
+esp_err_t esp_camera_deinit() {
+  cam().initialised = false;
+  return ESP_OK;
+}
+
+camera_fb_t* esp_camera_fb_get() {
+  SimCamera& c = cam();
+  if (!c.initialised) return nullptr;
+  const double fps = simConfig().sensorFps > 0 ? simConfig().sensorFps : 25.0;
+  const int64_t periodUs = (int64_t)(1e6 / fps);
+
+  std::unique_lock<std::mutex> lock(c.lock);
+  // The driver gives up after a few seconds without a free buffer.
+  size_t slot = 0;
+  auto hasFree = [&c, &slot] {
+    for (size_t i = 0; i < c.fbInUse.size(); i++) {
+      if (!c.fbInUse[i]) { slot = i; return true; }
+    }
+    return false;
+  };
+  if (!c.freed.wait_for(lock, std::chrono::seconds(4), hasFree)) {
+    fprintf(stderr, "[sim] cam_hal: Failed to get the frame on time!\n");
+    return nullptr;
+  }
+  c.fbInUse[slot] = true;
+
+  // Wait for the next sensor frame after the last one handed out.
+  int64_t now = esp_timer_get_time();
+  int64_t frameNumber = now / periodUs;
+  if (frameNumber <= c.lastFrameNumber) frameNumber = c.lastFrameNumber + 1;
+  c.lastFrameNumber = frameNumber;
+  framesize_t fs = c.sensor.status.framesize < FRAMESIZE_INVALID ? c.sensor.status.framesize : FRAMESIZE_QVGA;
+  lock.unlock();
+  int64_t readyAt = (frameNumber + 1) * periodUs;
+  if (readyAt > now) std::this_thread::sleep_for(std::chrono::microseconds(readyAt - now));
+
+  const std::vector<uint8_t>& src = c.frames[(size_t)(frameNumber % (int64_t)c.frames.size())];
+  camera_fb_t* fb = &c.fbs[slot];
+  memcpy(fb->buf, src.data(), src.size());
+  fb->len = src.size();
+  fb->width = resolution[fs].width;
+  fb->height = resolution[fs].height;
+  fb->format = PIXFORMAT_JPEG;
+  int64_t ts = esp_timer_get_time();
+  fb->timestamp.tv_sec = (time_t)(ts / 1000000);
+  fb->timestamp.tv_usec = (suseconds_t)(ts % 1000000);
+  return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t* fb) {
+  SimCamera& c = cam();
+  std::lock_guard<std::mutex> guard(c.lock);
+  for (size_t i = 0; i < c.fbs.size(); i++) {
+    if (&c.fbs[i] == fb) {
+      c.fbInUse[i] = false;
+      c.freed.notify_all();
+      return;
+    }
+  }
+}
+
+sensor_t* esp_camera_sensor_get() {
+  return cam().initialised ? &cam().sensor : nullptr;
+}
+
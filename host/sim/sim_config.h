@@ -0,0 +1,34 @@
+#pragma once
+// Runtime knobs for the host simulation, filled from the command line by
+// sim_main.cpp before the sketch's setup() runs.
+
+#include <stdint.h>
+#include <string>
+
+struct SimConfig {
+  // Camera: JPEGs replayed from a concatenated .mjpg file at sensorFps. With
+  // no file, synthetic JPEGs of about syntheticBytes are generated.
+  std::string mjpgPath;
+  double sensorFps = 25.0;
+  uint32_t syntheticBytes = 20000;
+
+  // SD card: a host directory; every write() costs writeLatencyUs plus
+  // writeUsPerKB per KiB, and every spikeEvery-th write stalls spikeMs to
+  // imitate FAT allocation / card garbage collection.
+  std::string sdRoot = "sim_sd";
+  uint64_t sdCardBytes = 8ULL * 1024ULL * 1024ULL * 1024ULL;
+  uint32_t sdWriteLatencyUs = 0;
+  uint32_t sdWriteUsPerKB = 0;
+  uint32_t sdSpikeMs = 0;
+  uint32_t sdSpikeEvery = 0;
+  uint32_t sdScanUsPerFile = 0;  // cost of each directory entry visited
+
+  // Network: the sketch's AsyncWebServer(80) listens on httpPort instead.
+  uint16_t httpPort = 8080;
+  uint32_t tcpSndBuf = 5744;  // CONFIG_LWIP_TCP_SND_BUF_DEFAULT
+
+  // Process: exit cleanly after runSeconds (0 = run until killed).
+  double runSeconds = 0;
+};
+
+SimConfig& simConfig();
@@ -0,0 +1,268 @@
+// Arduino core, ESP-IDF heap/timer and WiFi stand-ins for the host simulation.
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Arduino.h"
+#include "WiFi.h"
+#include "esp_timer.h"
+#include "sim_config.h"
+#include "sim_tasks.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+WiFiClass WiFi;
+
+SimConfig& simConfig() {
+  static SimConfig config;
+  return config;
+}
+
+static const std::chrono::steady_clock::time_point g_start = std::chrono::steady_clock::now();
+
+int64_t esp_timer_get_time() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - g_start).count();
+}
+
+// --- esp_timer one-shots ---
+// One thread fires every timer, in deadline order, like the esp_timer task.
+
+struct esp_timer {
+  esp_timer_cb_t callback;
+  void* arg;
+  int64_t at;  // 0: not running
+};
+
+namespace {
+struct TimerService {
+  std::mutex lock;
+  std::condition_variable changed;
+  std::vector<esp_timer*> timers;
+  bool started = false;
+};
+TimerService& timers() {
+  static TimerService service;
+  return service;
+}
+
+void timerLoop() {
+  simRegisterCurrentThread("esp_timer", 22, 0, 4096);
+  TimerService& t = timers();
+  std::unique_lock<std::mutex> guard(t.lock);
+  for (;;) {
+    esp_timer* next = nullptr;
+    for (esp_timer* timer : t.timers) {
+      if (timer->at && (!next || timer->at < next->at)) next = timer;
+    }
+    if (!next) {
+      t.changed.wait(guard);
+      continue;
+    }
+    int64_t now = esp_timer_get_time();
+    if (next->at > now) {
+      t.changed.wait_for(guard, std::chrono::microseconds(next->at - now));
+      continue;
+    }
+    next->at = 0;
+    esp_timer_cb_t callback = next->callback;
+    void* arg = next->arg;
+    guard.unlock();
+    callback(arg);
+    guard.lock();
+  }
+}
+}  // namespace
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out) {
+  if (!args || !args->callback || !out) return ESP_ERR_INVALID_ARG;
+  TimerService& t = timers();
+  std::lock_guard<std::mutex> guard(t.lock);
+  if (!t.started) {
+    std::thread(timerLoop).detach();
+    t.started = true;
+  }
+  *out = new esp_timer{args->callback, args->arg, 0};
+  t.timers.push_back(*out);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeoutUs) {
+  TimerService& t = timers();
+  std::lock_guard<std::mutex> guard(t.lock);
+  if (timer->at) return ESP_ERR_INVALID_STATE;
+  timer->at = esp_timer_get_time() + (int64_t)timeoutUs;
+  if (!timer->at) timer->at = 1;
+  t.changed.notify_one();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  TimerService& t = timers();
+  std::lock_guard<std::mutex> guard(t.lock);
+  if (!timer->at) return ESP_ERR_INVALID_STATE;
+  timer->at = 0;
+  t.changed.notify_one();
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  TimerService& t = timers();
+  std::lock_guard<std::mutex> guard(t.lock);
+  if (timer->at) return ESP_ERR_INVALID_STATE;
+  for (size_t i = 0; i < t.timers.size(); i++) {
+    if (t.timers[i] == timer) {
+      t.timers.erase(t.timers.begin() + i);
+      break;
+    }
+  }
+  delete timer;
+  return ESP_OK;
+}
+
+unsigned long millis() { return (unsigned long)(esp_timer_get_time() / 1000); }
+unsigned long micros() { return (unsigned long)esp_timer_get_time(); }
+void delay(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+void delayMicroseconds(uint32_t us) { std::this_thread::sleep_for(std::chrono::microseconds(us)); }
+
+static uint32_t g_cpuMhz = 160;
+bool setCpuFrequencyMhz(uint32_t mhz) { g_cpuMhz = mhz; return true; }
+uint32_t getCpuFrequencyMhz() { return g_cpuMhz; }
+bool psramFound() { return true; }
+void configTzTime(const char* tz, const char*, const char*, const char*) {
+  setenv("TZ", tz, 1);
+  tzset();
+}
+
+// --- Capability allocator ---
+// Sizes mirror an AI-Thinker board: ~320 KB internal heap, 4 MB PSRAM.
+static const size_t kInternalHeapBytes = 320 * 1024;
+static const size_t kPsramBytes = 4 * 1024 * 1024;
+
+namespace {
+struct HeapTracker {
+  std::mutex lock;
+  std::unordered_map<void*, std::pair<size_t, bool>> blocks;  // size, inPsram
+  size_t internalUsed = 0;
+  size_t psramUsed = 0;
+  size_t internalMinFree = kInternalHeapBytes;
+};
+HeapTracker& heap() {
+  static HeapTracker tracker;
+  return tracker;
+}
+}  // namespace
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+  HeapTracker& h = heap();
+  bool psram = (caps & MALLOC_CAP_SPIRAM) != 0;
+  std::lock_guard<std::mutex> guard(h.lock);
+  size_t used = psram ? h.psramUsed : h.internalUsed;
+  size_t total = psram ? kPsramBytes : kInternalHeapBytes;
+  if (size == 0 || used + size > total) return nullptr;
+  void* p = malloc(size);
+  if (!p) return nullptr;
+  h.blocks[p] = std::make_pair(size, psram);
+  if (psram) {
+    h.psramUsed += size;
+  } else {
+    h.internalUsed += size;
+    h.internalMinFree = std::min(h.internalMinFree, kInternalHeapBytes - h.internalUsed);
+  }
+  return p;
+}
+
+void* heap_caps_calloc(size_t n, size_t size, uint32_t caps) {
+  void* p = heap_caps_malloc(n * size, caps);
+  if (p) memset(p, 0, n * size);
+  return p;
+}
+
+void heap_caps_free(void* ptr) {
+  if (!ptr) return;
+  HeapTracker& h = heap();
+  {
+    std::lock_guard<std::mutex> guard(h.lock);
+    auto it = h.blocks.find(ptr);
+    if (it != h.blocks.end()) {
+      if (it->second.second) h.psramUsed -= it->second.first;
+      else h.internalUsed -= it->second.first;
+      h.blocks.erase(it);
+    }
+  }
+  free(ptr);
+}
+
+void* heap_caps_realloc(void* ptr, size_t size, uint32_t caps) {
+  if (!ptr) return heap_caps_malloc(size, caps);
+  size_t old = 0;
+  {
+    std::lock_guard<std::mutex> guard(heap().lock);
+    auto it = heap().blocks.find(ptr);
+    if (it != heap().blocks.end()) old = it->second.first;
+  }
+  void* p = heap_caps_malloc(size, caps);
+  if (!p) return nullptr;
+  memcpy(p, ptr, std::min(old, size));
+  heap_caps_free(ptr);
+  return p;
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+  return (caps & MALLOC_CAP_SPIRAM) ? kPsramBytes : kInternalHeapBytes;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+  std::lock_guard<std::mutex> guard(heap().lock);
+  if (caps & MALLOC_CAP_SPIRAM) return kPsramBytes - heap().psramUsed;
+  return kInternalHeapBytes - heap().internalUsed;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  // Host malloc does not fragment the emulated arenas; report a realistic
+  // fraction so "largest block" trends still read sensibly.
+  return heap_caps_get_free_size(caps) * 3 / 4;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+  std::lock_guard<std::mutex> guard(heap().lock);
+  if (caps & MALLOC_CAP_SPIRAM) return kPsramBytes - heap().psramUsed;
+  return heap().internalMinFree;
+}
+
+uint32_t EspClass::getHeapSize() { return (uint32_t)kInternalHeapBytes; }
+uint32_t EspClass::getFreeHeap() { return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_INTERNAL); }
+uint32_t EspClass::getMinFreeHeap() { return (uint32_t)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL); }
+uint32_t EspClass::getMaxAllocHeap() { return (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL); }
+uint32_t EspClass::getPsramSize() { return (uint32_t)kPsramBytes; }
+uint32_t EspClass::getFreePsram() { return (uint32_t)heap_caps_get_free_size(MALLOC_CAP_SPIRAM); }
+uint32_t EspClass::getMaxAllocPsram() { return (uint32_t)heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM); }
+
+void EspClass::restart() {
+  fprintf(stderr, "[sim] ESP.restart() requested, exiting\n");
+  fflush(stdout);
+  _Exit(3);
+}
+
+// --- Critical sections ---
+static std::recursive_mutex g_critical;
+void sim_enter_critical(portMUX_TYPE*) { g_critical.lock(); }
+void sim_exit_critical(portMUX_TYPE*) { g_critical.unlock(); }
+void sim_yield() { std::this_thread::yield(); }
+
+// --- WiFi ---
+bool WiFiClass::config(IPAddress, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress) {
+  gateway_ = gateway;
+  subnet_ = subnet;
+  dns_ = dns1;
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char*, const char*) {
+  connected_ = true;
+  return WL_CONNECTED;
+}
@@ -0,0 +1,339 @@
+// FreeRTOS stand-in: tasks are detached std::threads, semaphores and queues
+// are condition-variable based. Priorities and core affinity are recorded but
+// left to the host scheduler.
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "Arduino.h"
+#include "esp_timer.h"
+#include "sim_tasks.h"
+
+namespace {
+
+struct TaskExit {};
+
+std::chrono::steady_clock::time_point deadlineFor(TickType_t ticks) {
+  return std::chrono::steady_clock::now() + std::chrono::milliseconds(ticks);
+}
+
+// Wait on `cv` until `ready()` or `ticks` elapse (portMAX_DELAY = forever).
+template <typename Pred>
+bool waitFor(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, TickType_t ticks,
+             Pred ready) {
+  if (ticks == portMAX_DELAY) {
+    cv.wait(lock, ready);
+    return true;
+  }
+  return cv.wait_until(lock, deadlineFor(ticks), ready);
+}
+
+thread_local SimTask* t_current = nullptr;
+
+}  // namespace
+
+std::mutex& simTaskListLock() {
+  static std::mutex lock;
+  return lock;
+}
+
+std::vector<SimTask*>& simTaskList() {
+  static std::vector<SimTask*> tasks;
+  return tasks;
+}
+
+SimTask* simRegisterCurrentThread(const char* name, UBaseType_t priority, BaseType_t core,
+                                  uint32_t stackDepth) {
+  SimTask* task = new SimTask();
+  task->name = name;
+  task->priority = priority;
+  task->core = core;
+  task->stackDepth = stackDepth;
+  task->thread = pthread_self();
+  t_current = task;
+  std::lock_guard<std::mutex> guard(simTaskListLock());
+  simTaskList().push_back(task);
+  return task;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char* name, uint32_t stackDepth,
+                                   void* param, UBaseType_t priority, TaskHandle_t* created,
+                                   BaseType_t core) {
+  SimTask* task = new SimTask();
+  task->name = name ? name : "";
+  task->priority = priority;
+  task->core = core;
+  task->stackDepth = stackDepth;
+  {
+    std::lock_guard<std::mutex> guard(simTaskListLock());
+    simTaskList().push_back(task);
+  }
+  if (created) *created = task;
+  std::thread([task, code, param]() {
+    task->thread = pthread_self();
+    t_current = task;
+    try {
+      code(param);
+    } catch (const TaskExit&) {
+    }
+    task->deleted = true;
+  }).detach();
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char* name, uint32_t stackDepth, void* param,
+                       UBaseType_t priority, TaskHandle_t* created) {
+  return xTaskCreatePinnedToCore(code, name, stackDepth, param, priority, created, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task) {
+  if (task == nullptr || task == t_current) throw TaskExit();
+  // Deleting another task is not supported on the host; it keeps running.
+  fprintf(stderr, "[sim] vTaskDelete(%s) from another task ignored\n", task->name.c_str());
+}
+
+void vTaskDelay(TickType_t ticks) {
+  if (ticks == 0) {
+    std::this_thread::yield();
+    return;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+}
+
+TickType_t xTaskGetTickCount() { return (TickType_t)millis(); }
+
+void vTaskDelayUntil(TickType_t* previousWake, TickType_t increment) {
+  TickType_t target = *previousWake + increment;
+  TickType_t now = xTaskGetTickCount();
+  if ((int32_t)(target - now) > 0) vTaskDelay(target - now);
+  *previousWake = target;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() { return t_current; }
+
+const char* pcTaskGetName(TaskHandle_t task) {
+  if (!task) task = t_current;
+  return task ? task->name.c_str() : "main";
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) {
+  if (!task) task = t_current;
+  return task ? task->priority : 1;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+  if (!task) task = t_current;
+  // Host threads have megabyte stacks; report the configured depth as unused.
+  return task ? task->stackDepth : 0;
+}
+
+BaseType_t xTaskGetAffinity(TaskHandle_t task) {
+  if (!task) task = t_current;
+  return task ? task->core : tskNO_AFFINITY;
+}
+
+// --- Run-time stats ---
+// Each task's counter is its thread's CPU time, the total is wall time, both
+// in us as with CONFIG_FREERTOS_RUN_TIME_STATS_USING_ESP_TIMER.
+
+UBaseType_t uxTaskGetNumberOfTasks() {
+  std::lock_guard<std::mutex> guard(simTaskListLock());
+  UBaseType_t n = 0;
+  for (SimTask* task : simTaskList()) {
+    if (!task->deleted && task->thread) n++;
+  }
+  return n;
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t size, uint32_t* totalRunTime) {
+  std::lock_guard<std::mutex> guard(simTaskListLock());
+  UBaseType_t n = 0;
+  for (SimTask* task : simTaskList()) {
+    if (task->deleted || !task->thread) continue;
+    if (n == size) return 0;  // as on FreeRTOS: the array must hold every task
+    clockid_t clock;
+    struct timespec ts = {0, 0};
+    if (pthread_getcpuclockid(task->thread, &clock) == 0) clock_gettime(clock, &ts);
+    TaskStatus_t& s = status[n];
+    s.xHandle = task;
+    s.pcTaskName = task->name.c_str();
+    s.xTaskNumber = n + 1;
+    s.eCurrentState = task == t_current ? eRunning : eBlocked;
+    s.uxCurrentPriority = task->priority;
+    s.uxBasePriority = task->priority;
+    s.ulRunTimeCounter = (uint32_t)(ts.tv_sec * 1000000LL + ts.tv_nsec / 1000);
+    s.pxStackBase = nullptr;
+    s.usStackHighWaterMark = task->stackDepth;
+    n++;
+  }
+  if (totalRunTime) *totalRunTime = (uint32_t)esp_timer_get_time();
+  return n;
+}
+
+// --- Notifications ---
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  if (!task) return pdFAIL;
+  std::lock_guard<std::mutex> guard(task->notifyLock);
+  BaseType_t result = pdPASS;
+  switch (action) {
+    case eNoAction: break;
+    case eSetBits: task->notifyValue |= value; break;
+    case eIncrement: task->notifyValue++; break;
+    case eSetValueWithOverwrite: task->notifyValue = value; break;
+    case eSetValueWithoutOverwrite:
+      if (task->notifyPending) result = pdFAIL;
+      else task->notifyValue = value;
+      break;
+  }
+  task->notifyPending = true;
+  task->notifyCv.notify_all();
+  return result;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clearOnEntry, uint32_t clearOnExit, uint32_t* value,
+                           TickType_t ticks) {
+  SimTask* task = t_current;
+  if (!task) return pdFAIL;
+  std::unique_lock<std::mutex> lock(task->notifyLock);
+  if (!task->notifyPending) task->notifyValue &= ~clearOnEntry;
+  bool got = waitFor(task->notifyCv, lock, ticks, [task] { return task->notifyPending; });
+  if (value) *value = task->notifyValue;
+  if (!got) return pdFALSE;
+  task->notifyPending = false;
+  task->notifyValue &= ~clearOnExit;
+  return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clearCountOnExit, TickType_t ticks) {
+  SimTask* task = t_current;
+  if (!task) return 0;
+  std::unique_lock<std::mutex> lock(task->notifyLock);
+  waitFor(task->notifyCv, lock, ticks, [task] { return task->notifyValue != 0; });
+  uint32_t value = task->notifyValue;
+  if (value) {
+    task->notifyValue = clearCountOnExit ? 0 : value - 1;
+  }
+  task->notifyPending = task->notifyValue != 0;
+  return value;
+}
+
+// --- Semaphores ---
+
+struct SimSemaphore {
+  std::mutex lock;
+  std::condition_variable cv;
+  UBaseType_t count;
+  UBaseType_t max;
+};
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  SimSemaphore* s = new SimSemaphore();
+  s->count = 1;
+  s->max = 1;
+  return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary() {
+  SimSemaphore* s = new SimSemaphore();
+  s->count = 0;
+  s->max = 1;
+  return s;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t maxCount, UBaseType_t initialCount) {
+  SimSemaphore* s = new SimSemaphore();
+  s->count = initialCount;
+  s->max = maxCount;
+  return s;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t ticks) {
+  if (!s) return pdFALSE;
+  std::unique_lock<std::mutex> lock(s->lock);
+  if (!waitFor(s->cv, lock, ticks, [s] { return s->count > 0; })) return pdFALSE;
+  s->count--;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t s) {
+  if (!s) return pdFALSE;
+  std::lock_guard<std::mutex> guard(s->lock);
+  if (s->count >= s->max) return pdFALSE;
+  s->count++;
+  s->cv.notify_one();
+  return pdTRUE;
+}
+
+UBaseType_t uxSemaphoreGetCount(SemaphoreHandle_t s) {
+  std::lock_guard<std::mutex> guard(s->lock);
+  return s->count;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t s) { delete s; }
+
+// --- Queues ---
+
+struct SimQueue {
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::vector<uint8_t>> items;
+  UBaseType_t length;
+  UBaseType_t itemSize;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t itemSize) {
+  SimQueue* q = new SimQueue();
+  q->length = length;
+  q->itemSize = itemSize;
+  return q;
+}
+
+BaseType_t xQueueSend(QueueHandle_t q, const void* item, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!waitFor(q->cv, lock, ticks, [q] { return q->items.size() < q->length; })) return errQUEUE_FULL;
+  const uint8_t* bytes = static_cast<const uint8_t*>(item);
+  q->items.emplace_back(bytes, bytes + q->itemSize);
+  q->cv.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueSendToBack(QueueHandle_t q, const void* item, TickType_t ticks) {
+  return xQueueSend(q, item, ticks);
+}
+
+BaseType_t xQueueOverwrite(QueueHandle_t q, const void* item) {
+  std::lock_guard<std::mutex> guard(q->lock);
+  q->items.clear();
+  const uint8_t* bytes = static_cast<const uint8_t*>(item);
+  q->items.emplace_back(bytes, bytes + q->itemSize);
+  q->cv.notify_all();
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t q, void* buffer, TickType_t ticks) {
+  std::unique_lock<std::mutex> lock(q->lock);
+  if (!waitFor(q->cv, lock, ticks, [q] { return !q->items.empty(); })) return pdFALSE;
+  memcpy(buffer, q->items.front().data(), q->itemSize);
+  q->items.pop_front();
+  q->cv.notify_all();
+  return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  std::lock_guard<std::mutex> guard(q->lock);
+  return (UBaseType_t)q->items.size();
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t q) {
+  std::lock_guard<std::mutex> guard(q->lock);
+  return q->length - (UBaseType_t)q->items.size();
+}
+
+void vQueueDelete(QueueHandle_t q) { delete q; }
@@ -0,0 +1,77 @@
+// Entry point for the host simulation: parse the stand-in knobs, then run the
+// sketch's setup() and loop() on a thread registered as "loopTask", exactly
+// as the Arduino-ESP32 core does on core 1.
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "Arduino.h"
+#include "sim_config.h"
+#include "sim_tasks.h"
+
+void setup();
+void loop();
+
+static void usage(const char* argv0) {
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  --mjpg PATH             replay JPEG frames from a concatenated .mjpg file\n"
+          "  --fps N                 sensor frame rate (default 25)\n"
+          "  --synthetic-bytes N     synthetic frame size when no --mjpg (default 20000)\n"
+          "  --sd-dir DIR            directory backing SD_MMC (default ./sim_sd)\n"
+          "  --sd-size-mb N          reported card size (default 8192)\n"
+          "  --sd-write-latency-us N fixed cost of every File::write()\n"
+          "  --sd-write-us-per-kb N  per-KiB cost of every File::write()\n"
+          "  --sd-spike-ms N         stall injected every --sd-spike-every writes\n"
+          "  --sd-spike-every N\n"
+          "  --sd-scan-us-per-file N cost of each directory entry visited\n"
+          "  --port N                HTTP port on 127.0.0.1 (default 8080)\n"
+          "  --tcp-snd-buf N         emulated lwIP send buffer (default 5744)\n"
+          "  --run-seconds N         exit after N seconds (default: run forever)\n",
+          argv0);
+}
+
+int main(int argc, char** argv) {
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  SimConfig& cfg = simConfig();
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto next = [&](void) -> const char* {
+      if (i + 1 >= argc) {
+        usage(argv[0]);
+        exit(2);
+      }
+      return argv[++i];
+    };
+    if (arg == "--mjpg") cfg.mjpgPath = next();
+    else if (arg == "--fps") cfg.sensorFps = atof(next());
+    else if (arg == "--synthetic-bytes") cfg.syntheticBytes = (uint32_t)atol(next());
+    else if (arg == "--sd-dir") cfg.sdRoot = next();
+    else if (arg == "--sd-size-mb") cfg.sdCardBytes = (uint64_t)atoll(next()) * 1024ULL * 1024ULL;
+    else if (arg == "--sd-write-latency-us") cfg.sdWriteLatencyUs = (uint32_t)atol(next());
+    else if (arg == "--sd-write-us-per-kb") cfg.sdWriteUsPerKB = (uint32_t)atol(next());
+    else if (arg == "--sd-spike-ms") cfg.sdSpikeMs = (uint32_t)atol(next());
+    else if (arg == "--sd-spike-every") cfg.sdSpikeEvery = (uint32_t)atol(next());
+    else if (arg == "--sd-scan-us-per-file") cfg.sdScanUsPerFile = (uint32_t)atol(next());
+    else if (arg == "--port") cfg.httpPort = (uint16_t)atoi(next());
+    else if (arg == "--tcp-snd-buf") cfg.tcpSndBuf = (uint32_t)atol(next());
+    else if (arg == "--run-seconds") cfg.runSeconds = atof(next());
+    else {
+      usage(argv[0]);
+      return arg == "--help" || arg == "-h" ? 0 : 2;
+    }
+  }
+
+  if (cfg.runSeconds > 0) {
+    std::thread([seconds = cfg.runSeconds]() {
+      std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+      fflush(stdout);
+      _Exit(0);
+    }).detach();
+  }
+
+  simRegisterCurrentThread("loopTask", 1, 1, 8192);
+  setup();
+  for (;;) loop();
+}
@@ -0,0 +1,216 @@
+// SD_MMC stand-in: card paths map onto SimConfig::sdRoot, writes pay an
+// injectable latency and periodic stalls, usedBytes() walks the directory
+// the way FATFS walks the allocation table.
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "Arduino.h"
+#include "SD_MMC.h"
+#include "sim_config.h"
+
+fs::SDMMCFS SD_MMC;
+
+namespace fs {
+
+struct FileImpl {
+  FILE* fp = nullptr;
+  DIR* dir = nullptr;
+  std::string path;      // card path, e.g. "/rec_001.mjpg"
+  std::string hostPath;  // path under sdRoot
+  std::string baseName;
+};
+
+}  // namespace fs
+
+namespace {
+
+std::atomic<uint32_t> g_writeCount{0};
+bool g_mounted = false;
+
+std::string hostPathFor(const char* path) {
+  std::string p = simConfig().sdRoot;
+  if (!path || path[0] != '/') p += "/";
+  if (path) p += path;
+  return p;
+}
+
+std::string baseNameOf(const std::string& path) {
+  size_t slash = path.find_last_of('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+void sleepUs(uint64_t us) {
+  if (us) std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+uint64_t dirBytes(const std::string& hostDir) {
+  uint64_t total = 0;
+  DIR* d = opendir(hostDir.c_str());
+  if (!d) return 0;
+  while (struct dirent* e = readdir(d)) {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+    sleepUs(simConfig().sdScanUsPerFile);
+    std::string child = hostDir + "/" + e->d_name;
+    struct stat st;
+    if (stat(child.c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) total += dirBytes(child);
+    else total += ((uint64_t)st.st_size + 32767) & ~32767ULL;  // 32 KB clusters
+  }
+  closedir(d);
+  return total;
+}
+
+}  // namespace
+
+namespace fs {
+
+size_t File::write(const uint8_t* buf, size_t size) {
+  if (!_p || !_p->fp) return 0;
+  const SimConfig& sim = simConfig();
+  uint64_t us = sim.sdWriteLatencyUs + (uint64_t)sim.sdWriteUsPerKB * size / 1024;
+  uint32_t n = ++g_writeCount;
+  if (sim.sdSpikeEvery && n % sim.sdSpikeEvery == 0) us += (uint64_t)sim.sdSpikeMs * 1000;
+  sleepUs(us);
+  return fwrite(buf, 1, size, _p->fp);
+}
+
+int File::available() {
+  if (!_p || !_p->fp) return 0;
+  return (int)(size() - position());
+}
+
+int File::read() {
+  if (!_p || !_p->fp) return -1;
+  return fgetc(_p->fp);
+}
+
+int File::peek() {
+  if (!_p || !_p->fp) return -1;
+  int c = fgetc(_p->fp);
+  if (c != EOF) ungetc(c, _p->fp);
+  return c;
+}
+
+size_t File::read(uint8_t* buf, size_t size) {
+  if (!_p || !_p->fp) return 0;
+  return fread(buf, 1, size, _p->fp);
+}
+
+void File::flush() {
+  if (_p && _p->fp) fflush(_p->fp);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if (!_p || !_p->fp) return false;
+  int whence = mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END;
+  return fseek(_p->fp, (long)pos, whence) == 0;
+}
+
+size_t File::position() const {
+  if (!_p || !_p->fp) return 0;
+  return (size_t)ftell(_p->fp);
+}
+
+size_t File::size() const {
+  if (!_p) return 0;
+  if (_p->fp) fflush(_p->fp);
+  struct stat st;
+  if (stat(_p->hostPath.c_str(), &st) != 0) return 0;
+  return (size_t)st.st_size;
+}
+
+void File::close() {
+  if (!_p) return;
+  if (_p->fp) fclose(_p->fp);
+  if (_p->dir) closedir(_p->dir);
+  _p->fp = nullptr;
+  _p->dir = nullptr;
+  _p.reset();
+}
+
+File::operator bool() const { return _p && (_p->fp || _p->dir); }
+
+time_t File::getLastWrite() {
+  struct stat st;
+  if (!_p || stat(_p->hostPath.c_str(), &st) != 0) return 0;
+  return st.st_mtime;
+}
+
+const char* File::path() const { return _p ? _p->path.c_str() : nullptr; }
+const char* File::name() const { return _p ? _p->baseName.c_str() : nullptr; }
+
+bool File::isDirectory() { return _p && _p->dir; }
+
+File File::openNextFile(const char* mode) {
+  if (!_p || !_p->dir) return File();
+  while (struct dirent* e = readdir(_p->dir)) {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+    sleepUs(simConfig().sdScanUsPerFile);
+    std::string child = _p->path;
+    if (child.empty() || child.back() != '/') child += "/";
+    child += e->d_name;
+    return SD_MMC.open(child.c_str(), mode);
+  }
+  return File();
+}
+
+void File::rewindDirectory() {
+  if (_p && _p->dir) rewinddir(_p->dir);
+}
+
+File FS::open(const char* path, const char* mode, const bool) {
+  if (!g_mounted || !path) return File();
+  std::string host = hostPathFor(path);
+  struct stat st;
+  bool exists = stat(host.c_str(), &st) == 0;
+  FileImplPtr impl = std::make_shared<FileImpl>();
+  impl->path = path;
+  impl->hostPath = host;
+  impl->baseName = baseNameOf(impl->path);
+  if (exists && S_ISDIR(st.st_mode)) {
+    impl->dir = opendir(host.c_str());
+    if (!impl->dir) return File();
+    return File(impl);
+  }
+  if (!exists && strcmp(mode, FILE_READ) == 0) return File();
+  const char* hostMode = !strcmp(mode, FILE_WRITE) ? "w+b" : !strcmp(mode, FILE_APPEND) ? "a+b" : "rb";
+  impl->fp = fopen(host.c_str(), hostMode);
+  if (!impl->fp) return File();
+  return File(impl);
+}
+
+bool FS::exists(const char* path) {
+  struct stat st;
+  return g_mounted && stat(hostPathFor(path).c_str(), &st) == 0;
+}
+
+bool FS::remove(const char* path) { return g_mounted && ::unlink(hostPathFor(path).c_str()) == 0; }
+
+bool FS::rename(const char* from, const char* to) {
+  return g_mounted && ::rename(hostPathFor(from).c_str(), hostPathFor(to).c_str()) == 0;
+}
+
+bool FS::mkdir(const char* path) { return g_mounted && ::mkdir(hostPathFor(path).c_str(), 0755) == 0; }
+bool FS::rmdir(const char* path) { return g_mounted && ::rmdir(hostPathFor(path).c_str()) == 0; }
+
+bool SDMMCFS::begin(const char*, bool, bool, int, uint8_t) {
+  if (g_mounted) return true;
+  ::mkdir(simConfig().sdRoot.c_str(), 0755);
+  struct stat st;
+  g_mounted = stat(simConfig().sdRoot.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+  return g_mounted;
+}
+
+void SDMMCFS::end() { g_mounted = false; }
+sdcard_type_t SDMMCFS::cardType() { return g_mounted ? CARD_SDHC : CARD_NONE; }
+uint64_t SDMMCFS::cardSize() { return g_mounted ? simConfig().sdCardBytes : 0; }
+uint64_t SDMMCFS::totalBytes() { return cardSize(); }
+uint64_t SDMMCFS::usedBytes() { return g_mounted ? dirBytes(simConfig().sdRoot) : 0; }
+
+}  // namespace fs
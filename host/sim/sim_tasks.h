@@ -0,0 +1,33 @@
+#pragma once
+// Bookkeeping for simulated FreeRTOS tasks, shared between the scheduler
+// stand-in and anything that needs to enumerate tasks.
+
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "freertos/FreeRTOS.h"
+
+struct SimTask {
+  std::string name;
+  UBaseType_t priority = 0;
+  BaseType_t core = tskNO_AFFINITY;
+  uint32_t stackDepth = 0;
+  pthread_t thread = 0;
+  std::atomic<bool> deleted{false};
+
+  std::mutex notifyLock;
+  std::condition_variable notifyCv;
+  uint32_t notifyValue = 0;
+  bool notifyPending = false;
+};
+
+std::mutex& simTaskListLock();
+std::vector<SimTask*>& simTaskList();
+
+// Adopt the calling thread (main / web server) as a named task.
+SimTask* simRegisterCurrentThread(const char* name, UBaseType_t priority, BaseType_t core,
+                                  uint32_t stackDepth);
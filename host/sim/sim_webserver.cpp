@@ -0,0 +1,704 @@
+// ESPAsyncWebServer stand-in: one poll() loop thread plays the async_tcp task,
+// and the tcpip thread for tcpip_callback().
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ESPAsyncWebServer.h"
+#include "esp_timer.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/tcpip.h"
+#include "sim_config.h"
+#include "sim_tasks.h"
+
+namespace {
+
+const int64_t kPollIntervalUs = 500000;  // lwIP tcp_poll granularity used by AsyncTCP
+
+int64_t nowUs() { return esp_timer_get_time(); }
+
+const char* reasonPhrase(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 409: return "Conflict";
+    case 416: return "Range Not Satisfiable";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "";
+  }
+}
+
+String urlDecode(const std::string& in) {
+  std::string out;
+  for (size_t i = 0; i < in.size(); i++) {
+    if (in[i] == '+') {
+      out += ' ';
+    } else if (in[i] == '%' && i + 2 < in.size()) {
+      out += (char)strtol(in.substr(i + 1, 2).c_str(), nullptr, 16);
+      i += 2;
+    } else {
+      out += in[i];
+    }
+  }
+  return String(out);
+}
+
+std::string base64Encode(const std::string& in) {
+  static const char* tbl = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  while (i + 2 < in.size()) {
+    uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i + 1] << 8) | (uint8_t)in[i + 2];
+    out += tbl[v >> 18]; out += tbl[(v >> 12) & 63]; out += tbl[(v >> 6) & 63]; out += tbl[v & 63];
+    i += 3;
+  }
+  if (i + 1 == in.size()) {
+    uint32_t v = (uint8_t)in[i] << 16;
+    out += tbl[v >> 18]; out += tbl[(v >> 12) & 63]; out += "==";
+  } else if (i + 2 == in.size()) {
+    uint32_t v = ((uint8_t)in[i] << 16) | ((uint8_t)in[i + 1] << 8);
+    out += tbl[v >> 18]; out += tbl[(v >> 12) & 63]; out += tbl[(v >> 6) & 63]; out += '=';
+  }
+  return out;
+}
+
+// --- Concrete responses ---
+
+class BasicResponse : public AsyncWebServerResponse {
+ public:
+  BasicResponse(int code, const String& type, const String& content) : _content(content) {
+    _code = code;
+    _contentType = type;
+    _contentLength = content.length();
+  }
+
+ protected:
+  size_t _fillContent(uint8_t* buf, size_t maxLen, size_t index) override {
+    size_t n = std::min(maxLen, (size_t)_content.length() - index);
+    memcpy(buf, _content.c_str() + index, n);
+    return n;
+  }
+
+ private:
+  String _content;
+};
+
+class PointerResponse : public AsyncWebServerResponse {
+ public:
+  PointerResponse(int code, const String& type, const uint8_t* data, size_t len) : _data(data) {
+    _code = code;
+    _contentType = type;
+    _contentLength = len;
+  }
+
+ protected:
+  size_t _fillContent(uint8_t* buf, size_t maxLen, size_t index) override {
+    size_t n = std::min(maxLen, _contentLength - index);
+    memcpy(buf, _data + index, n);
+    return n;
+  }
+
+ private:
+  const uint8_t* _data;
+};
+
+class CallbackResponse : public AsyncWebServerResponse {
+ public:
+  CallbackResponse(const String& type, size_t len, AwsResponseFiller filler, bool chunked)
+      : _filler(filler) {
+    _code = 200;
+    _contentType = type;
+    _contentLength = len;
+    _chunked = chunked;
+    _sendContentLength = !chunked && len > 0;
+  }
+
+ protected:
+  size_t _fillContent(uint8_t* buf, size_t maxLen, size_t index) override {
+    if (_sendContentLength) {
+      if (index >= _contentLength) return 0;
+      maxLen = std::min(maxLen, _contentLength - index);
+    }
+    return _filler(buf, maxLen, index);
+  }
+
+ private:
+  AwsResponseFiller _filler;
+};
+
+// --- tcpip thread ---
+
+const size_t kTcpipQueueLen = 32;  // TCPIP_MBOX_SIZE
+
+struct TcpipQueue {
+  std::mutex lock;
+  std::vector<std::pair<tcpip_callback_fn, void*>> calls;
+};
+
+TcpipQueue& tcpipQueue() {
+  static TcpipQueue queue;
+  return queue;
+}
+
+void runTcpipCallbacks() {
+  std::vector<std::pair<tcpip_callback_fn, void*>> calls;
+  {
+    std::lock_guard<std::mutex> guard(tcpipQueue().lock);
+    calls.swap(tcpipQueue().calls);
+  }
+  for (auto& call : calls) call.first(call.second);
+}
+
+err_t pollClient(void* arg, tcp_pcb*) {
+  static_cast<AsyncClient*>(arg)->_pollRequested = true;
+  return ERR_OK;
+}
+
+void linkPcb(AsyncClient* client) {
+  client->_tcp.callback_arg = client;
+  client->_tcp.poll = pollClient;
+  client->_tcp.next = tcp_active_pcbs;
+  tcp_active_pcbs = &client->_tcp;
+}
+
+void unlinkPcb(AsyncClient* client) {
+  for (tcp_pcb** p = &tcp_active_pcbs; *p; p = &(*p)->next) {
+    if (*p == &client->_tcp) {
+      *p = client->_tcp.next;
+      break;
+    }
+  }
+}
+
+// --- Connection / server state ---
+
+struct Connection {
+  int fd;
+  AsyncClient* client;
+  AsyncWebServerRequest* request = nullptr;
+  std::string inbox;
+  std::string outbox;  // bytes produced by the response but not yet accepted by the kernel
+  bool dispatched = false;
+  bool waiting = false;  // filler returned RESPONSE_TRY_AGAIN
+  int64_t retryAt = 0;
+  int outqAtWait = 0;
+};
+
+struct ServerImpl {
+  AsyncWebServer* server;
+  int listenFd = -1;
+  std::vector<Connection*> conns;
+  std::atomic<bool> running{false};
+};
+
+int kernelOutq(int fd) {
+  int outq = 0;
+  if (ioctl(fd, SIOCOUTQ, &outq) != 0) return 0;
+  return outq;
+}
+
+void closeConnection(ServerImpl* impl, Connection* c) {
+  if (c->request) {
+    if (c->request->_onDisconnect) c->request->_onDisconnect();
+    delete c->request;
+  }
+  ::close(c->fd);
+  unlinkPcb(c->client);
+  c->client->_fd = -1;
+  delete c->client;
+  for (size_t i = 0; i < impl->conns.size(); i++) {
+    if (impl->conns[i] == c) {
+      impl->conns.erase(impl->conns.begin() + i);
+      break;
+    }
+  }
+  delete c;
+}
+
+bool parseRequest(AsyncWebServerRequest* req, const std::string& head) {
+  size_t lineEnd = head.find("\r\n");
+  std::string line = head.substr(0, lineEnd);
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.find(' ', sp1 + 1);
+  if (sp1 == std::string::npos || sp2 == std::string::npos) return false;
+  std::string method = line.substr(0, sp1);
+  std::string target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+
+  if (method == "GET") req->_method = HTTP_GET;
+  else if (method == "POST") req->_method = HTTP_POST;
+  else if (method == "DELETE") req->_method = HTTP_DELETE;
+  else if (method == "PUT") req->_method = HTTP_PUT;
+  else if (method == "PATCH") req->_method = HTTP_PATCH;
+  else if (method == "HEAD") req->_method = HTTP_HEAD;
+  else if (method == "OPTIONS") req->_method = HTTP_OPTIONS;
+  else return false;
+
+  size_t q = target.find('?');
+  req->_url = urlDecode(target.substr(0, q));
+  if (q != std::string::npos) {
+    std::string query = target.substr(q + 1);
+    size_t pos = 0;
+    while (pos <= query.size()) {
+      size_t amp = query.find('&', pos);
+      if (amp == std::string::npos) amp = query.size();
+      std::string kv = query.substr(pos, amp - pos);
+      if (!kv.empty()) {
+        size_t eq = kv.find('=');
+        String name = urlDecode(kv.substr(0, eq));
+        String value = eq == std::string::npos ? String() : urlDecode(kv.substr(eq + 1));
+        req->_params.push_back(new AsyncWebParameter(name, value));
+      }
+      pos = amp + 1;
+    }
+  }
+
+  size_t pos = lineEnd + 2;
+  while (pos < head.size()) {
+    size_t end = head.find("\r\n", pos);
+    if (end == std::string::npos || end == pos) break;
+    std::string h = head.substr(pos, end - pos);
+    size_t colon = h.find(':');
+    if (colon != std::string::npos) {
+      std::string value = h.substr(colon + 1);
+      while (!value.empty() && value[0] == ' ') value.erase(0, 1);
+      String name(h.substr(0, colon));
+      req->_headersIn.push_back(new AsyncWebHeader(name, String(value)));
+      if (name.equalsIgnoreCase("Host")) req->_host = String(value);
+      if (name.equalsIgnoreCase("Content-Type")) req->_contentType = String(value);
+    }
+    pos = end + 2;
+  }
+  return true;
+}
+
+// Pull one fill from the response into the connection's outbox, bounded by
+// the emulated send buffer. Mirrors AsyncAbstractResponse::_ack(): one fill
+// per event (accept, ACK or poll), sent before the next one.
+void pump(Connection* c) {
+  AsyncWebServerResponse* resp = c->request ? c->request->_response : nullptr;
+  if (!resp || resp->_finished()) return;
+  c->client->_pending = c->outbox.size();
+  c->client->_pollRequested = false;
+  size_t space = c->client->space();
+  if (space == 0) return;
+  std::vector<uint8_t> buf(space);
+  size_t n = resp->_fill(buf.data(), space);
+  if (n == RESPONSE_TRY_AGAIN) {
+    c->waiting = true;
+    c->retryAt = nowUs() + kPollIntervalUs;
+    c->outqAtWait = kernelOutq(c->fd) + (int)c->outbox.size();
+    return;
+  }
+  c->waiting = false;
+  c->outbox.append((const char*)buf.data(), n);
+}
+
+bool flushOutbox(Connection* c) {
+  while (!c->outbox.empty()) {
+    ssize_t n = ::send(c->fd, c->outbox.data(), c->outbox.size(), MSG_NOSIGNAL);
+    if (n < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) return true;
+      return false;
+    }
+    c->outbox.erase(0, (size_t)n);
+  }
+  c->client->_pending = 0;
+  return true;
+}
+
+void serverLoop(ServerImpl* impl) {
+  simRegisterCurrentThread("async_tcp", 3, tskNO_AFFINITY, 8192);
+  std::vector<pollfd> fds;
+  while (impl->running) {
+    fds.clear();
+    fds.push_back({impl->listenFd, POLLIN, 0});
+    bool anyWaiting = false;
+    for (Connection* c : impl->conns) {
+      short events = POLLIN;
+      bool sending = c->request && c->request->_response;
+      if (sending && !c->waiting) events |= POLLOUT;
+      if (!c->outbox.empty()) events |= POLLOUT;
+      if (c->waiting) anyWaiting = true;
+      fds.push_back({c->fd, events, 0});
+    }
+    int timeoutMs = anyWaiting ? 1 : 20;
+    int ready = poll(fds.data(), fds.size(), timeoutMs);
+    if (ready < 0 && errno != EINTR) break;
+    runTcpipCallbacks();
+
+    if (fds[0].revents & POLLIN) {
+      sockaddr_in addr;
+      socklen_t len = sizeof(addr);
+      int fd = accept(impl->listenFd, (sockaddr*)&addr, &len);
+      if (fd >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        Connection* c = new Connection();
+        c->fd = fd;
+        c->client = new AsyncClient(fd);
+        uint32_t ip = ntohl(addr.sin_addr.s_addr);
+        c->client->_remoteIP = IPAddress((uint8_t)(ip >> 24), (uint8_t)(ip >> 16), (uint8_t)(ip >> 8), (uint8_t)ip);
+        c->client->_remotePort = ntohs(addr.sin_port);
+        linkPcb(c->client);
+        impl->conns.push_back(c);
+      }
+    }
+
+    // Walk a snapshot: handlers may not add connections, but closing removes them.
+    std::vector<Connection*> snapshot(impl->conns);
+    for (size_t i = 0; i < snapshot.size(); i++) {
+      Connection* c = snapshot[i];
+      short revents = 0;
+      for (size_t k = 1; k < fds.size(); k++) {
+        if (fds[k].fd == c->fd) { revents = fds[k].revents; break; }
+      }
+      if (revents & (POLLERR | POLLNVAL)) {
+        closeConnection(impl, c);
+        continue;
+      }
+      if (revents & (POLLIN | POLLHUP)) {
+        char buf[4096];
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+          closeConnection(impl, c);
+          continue;
+        }
+        if (n > 0 && !c->dispatched) c->inbox.append(buf, (size_t)n);
+      }
+      if (!c->dispatched) {
+        size_t end = c->inbox.find("\r\n\r\n");
+        if (end == std::string::npos) {
+          if (c->inbox.size() > 16384) closeConnection(impl, c);
+          continue;
+        }
+        c->dispatched = true;
+        c->request = new AsyncWebServerRequest(impl->server, c->client);
+        if (!parseRequest(c->request, c->inbox.substr(0, end + 2))) {
+          c->request->send(400, "text/plain", "Bad Request");
+        } else {
+          impl->server->_handleRequest(c->request);
+          if (!c->request->_response) c->request->send(500, "text/plain", "No response");
+        }
+        pump(c);
+      } else if (c->waiting) {
+        int outq = kernelOutq(c->fd) + (int)c->outbox.size();
+        bool acked = outq < c->outqAtWait;
+        if (acked || c->client->_pollRequested || nowUs() >= c->retryAt) pump(c);
+      } else if (c->request && c->request->_response) {
+        pump(c);
+      }
+      if (!flushOutbox(c)) {
+        closeConnection(impl, c);
+        continue;
+      }
+      AsyncWebServerResponse* resp = c->request ? c->request->_response : nullptr;
+      if ((resp && resp->_finished() && c->outbox.empty()) || c->client->_closeRequested) {
+        shutdown(c->fd, SHUT_WR);
+        closeConnection(impl, c);
+      }
+    }
+  }
+}
+
+}  // namespace
+
+tcp_pcb* tcp_active_pcbs = nullptr;
+
+err_t tcpip_callback(tcpip_callback_fn fn, void* ctx) {
+  std::lock_guard<std::mutex> guard(tcpipQueue().lock);
+  if (tcpipQueue().calls.size() >= kTcpipQueueLen) return ERR_MEM;
+  tcpipQueue().calls.emplace_back(fn, ctx);
+  return ERR_OK;
+}
+
+// --- AsyncClient ---
+
+size_t AsyncClient::space() const {
+  if (_fd < 0) return 0;
+  int used = kernelOutq(_fd) + (int)_pending;
+  int cap = (int)simConfig().tcpSndBuf;
+  return used >= cap ? 0 : (size_t)(cap - used);
+}
+
+void AsyncClient::close(bool) { _closeRequested = true; }
+
+// --- AsyncWebServerResponse ---
+
+size_t AsyncWebServerResponse::_fill(uint8_t* buf, size_t maxLen) {
+  if (_done) return 0;
+  size_t written = 0;
+  if (_head.empty()) {
+    char line[128];
+    snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", _code, reasonPhrase(_code));
+    _head = line;
+    bool hasConnection = false;
+    for (auto& h : _headers) {
+      if (h.name().equalsIgnoreCase("Connection")) hasConnection = true;
+    }
+    if (!hasConnection) _head += "Connection: close\r\n";
+    _head += "Accept-Ranges: none\r\n";
+    if (_sendContentLength) _head += "Content-Length: " + std::to_string(_contentLength) + "\r\n";
+    if (_contentType.length()) _head += std::string("Content-Type: ") + _contentType.c_str() + "\r\n";
+    if (_chunked) _head += "Transfer-Encoding: chunked\r\n";
+    for (auto& h : _headers) _head += std::string(h.name().c_str()) + ": " + h.value().c_str() + "\r\n";
+    _head += "\r\n";
+  }
+  if (_headSent < _head.size()) {
+    size_t n = std::min(maxLen, _head.size() - _headSent);
+    memcpy(buf, _head.data() + _headSent, n);
+    _headSent += n;
+    written += n;
+    if (_headSent < _head.size()) return written;
+  }
+  if (_sendContentLength && _bodyIndex >= _contentLength) {
+    _done = true;
+    return written;
+  }
+  if (written == maxLen) return written;
+
+  if (_chunked) {
+    // Leave room for the "xxxx\r\n" prefix and "\r\n" suffix.
+    if (maxLen - written < 16) return written;
+    size_t room = maxLen - written - 8;
+    size_t n = _fillContent(buf + written + 6, room, _bodyIndex);
+    if (n == RESPONSE_TRY_AGAIN) return written ? written : RESPONSE_TRY_AGAIN;
+    char prefix[8];
+    snprintf(prefix, sizeof(prefix), "%04x\r\n", (unsigned)n);
+    memcpy(buf + written, prefix, 6);
+    memcpy(buf + written + 6 + n, "\r\n", 2);
+    written += n + 8;
+    _bodyIndex += n;
+    if (n == 0) _done = true;
+    return written;
+  }
+
+  size_t n = _fillContent(buf + written, maxLen - written, _bodyIndex);
+  if (n == RESPONSE_TRY_AGAIN) return written ? written : RESPONSE_TRY_AGAIN;
+  _bodyIndex += n;
+  written += n;
+  if (n == 0 || (_sendContentLength && _bodyIndex >= _contentLength)) _done = true;
+  return written;
+}
+
+// --- AsyncCallbackWebHandler ---
+
+bool AsyncCallbackWebHandler::canHandle(const String& url, WebRequestMethodComposite method) const {
+  if (!(_method & method)) return false;
+  if (_uri.length() && _uri.endsWith("*")) return url.startsWith(_uri.substring(0, _uri.length() - 1));
+  return _uri == url || url.startsWith(_uri + "/");
+}
+
+// --- AsyncWebServerRequest ---
+
+AsyncWebServerRequest::AsyncWebServerRequest(AsyncWebServer* server, AsyncClient* client)
+    : _server(server), _client(client) {}
+
+AsyncWebServerRequest::~AsyncWebServerRequest() {
+  for (auto* p : _params) delete p;
+  for (auto* h : _headersIn) delete h;
+  delete _response;
+}
+
+const char* AsyncWebServerRequest::methodToString() const {
+  switch (_method) {
+    case HTTP_GET: return "GET";
+    case HTTP_POST: return "POST";
+    case HTTP_DELETE: return "DELETE";
+    case HTTP_PUT: return "PUT";
+    case HTTP_PATCH: return "PATCH";
+    case HTTP_HEAD: return "HEAD";
+    case HTTP_OPTIONS: return "OPTIONS";
+    default: return "UNKNOWN";
+  }
+}
+
+void AsyncWebServerRequest::send(AsyncWebServerResponse* response) {
+  if (_response) {
+    delete response;
+    return;
+  }
+  _response = response;
+}
+
+void AsyncWebServerRequest::send(int code, const String& contentType, const String& content) {
+  send(beginResponse(code, contentType, content));
+}
+
+void AsyncWebServerRequest::send_P(int code, const String& contentType, const uint8_t* content, size_t len) {
+  send(beginResponse_P(code, contentType, content, len));
+}
+
+void AsyncWebServerRequest::send_P(int code, const String& contentType, PGM_P content) {
+  send(beginResponse_P(code, contentType, content));
+}
+
+void AsyncWebServerRequest::redirect(const String& url) {
+  AsyncWebServerResponse* r = beginResponse(302);
+  r->addHeader("Location", url);
+  send(r);
+}
+
+AsyncWebServerResponse* AsyncWebServerRequest::beginResponse(int code, const String& contentType,
+                                                             const String& content) {
+  return new BasicResponse(code, contentType, content);
+}
+
+AsyncWebServerResponse* AsyncWebServerRequest::beginResponse_P(int code, const String& contentType,
+                                                               const uint8_t* content, size_t len) {
+  return new PointerResponse(code, contentType, content, len);
+}
+
+AsyncWebServerResponse* AsyncWebServerRequest::beginResponse_P(int code, const String& contentType,
+                                                               PGM_P content) {
+  return new PointerResponse(code, contentType, (const uint8_t*)content, strlen(content));
+}
+
+AsyncWebServerResponse* AsyncWebServerRequest::beginResponse(const String& contentType, size_t len,
+                                                             AwsResponseFiller callback) {
+  return new CallbackResponse(contentType, len, callback, false);
+}
+
+AsyncWebServerResponse* AsyncWebServerRequest::beginChunkedResponse(const String& contentType,
+                                                                    AwsResponseFiller callback) {
+  return new CallbackResponse(contentType, 0, callback, true);
+}
+
+bool AsyncWebServerRequest::authenticate(const char* username, const char* password, const char*, bool) {
+  AsyncWebHeader* h = getHeader("Authorization");
+  if (!h) return false;
+  std::string expected = "Basic " + base64Encode(std::string(username) + ":" + password);
+  return h->value() == expected.c_str();
+}
+
+void AsyncWebServerRequest::requestAuthentication(const char* realm, bool) {
+  // The device defaults to Digest; the simulation only speaks Basic.
+  AsyncWebServerResponse* r = beginResponse(401);
+  r->addHeader("WWW-Authenticate", String("Basic realm=\"") + (realm ? realm : "Login Required") + "\"");
+  send(r);
+}
+
+bool AsyncWebServerRequest::hasParam(const String& name, bool, bool) const {
+  return getParam(name) != nullptr;
+}
+
+AsyncWebParameter* AsyncWebServerRequest::getParam(const String& name, bool, bool) const {
+  for (auto* p : _params) {
+    if (p->name() == name) return p;
+  }
+  return nullptr;
+}
+
+AsyncWebParameter* AsyncWebServerRequest::getParam(size_t num) const {
+  return num < _params.size() ? _params[num] : nullptr;
+}
+
+const String& AsyncWebServerRequest::arg(const String& name) const {
+  static const String empty;
+  AsyncWebParameter* p = getParam(name);
+  return p ? p->value() : empty;
+}
+
+bool AsyncWebServerRequest::hasHeader(const String& name) const { return getHeader(name) != nullptr; }
+
+AsyncWebHeader* AsyncWebServerRequest::getHeader(const String& name) const {
+  for (auto* h : _headersIn) {
+    if (h->name().equalsIgnoreCase(name)) return h;
+  }
+  return nullptr;
+}
+
+String AsyncWebServerRequest::header(const char* name) const {
+  AsyncWebHeader* h = getHeader(name);
+  return h ? h->value() : String();
+}
+
+// --- AsyncWebServer ---
+
+AsyncWebServer::~AsyncWebServer() { end(); }
+
+AsyncCallbackWebHandler& AsyncWebServer::on(const char* uri, WebRequestMethodComposite method,
+                                            ArRequestHandlerFunction onRequest) {
+  AsyncCallbackWebHandler* h = new AsyncCallbackWebHandler();
+  h->_uri = uri;
+  h->_method = method;
+  h->_onRequest = onRequest;
+  _handlers.push_back(h);
+  return *h;
+}
+
+void AsyncWebServer::reset() {
+  for (auto* h : _handlers) delete h;
+  _handlers.clear();
+  _notFound = nullptr;
+}
+
+void AsyncWebServer::_handleRequest(AsyncWebServerRequest* request) {
+  for (auto* h : _handlers) {
+    if (h->canHandle(request->url(), request->method())) {
+      h->_onRequest(request);
+      return;
+    }
+  }
+  if (_notFound) _notFound(request);
+  else request->send(404);
+}
+
+void AsyncWebServer::begin() {
+  if (_impl) return;
+  ServerImpl* impl = new ServerImpl();
+  impl->server = this;
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  uint16_t port = simConfig().httpPort ? simConfig().httpPort : _port;
+  addr.sin_port = htons(port);
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+    fprintf(stderr, "[sim] cannot listen on 127.0.0.1:%u: %s\n", port, strerror(errno));
+    ::close(fd);
+    delete impl;
+    return;
+  }
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  impl->listenFd = fd;
+  impl->running = true;
+  _impl = impl;
+  fprintf(stderr, "[sim] web server on http://127.0.0.1:%u\n", port);
+  std::thread(serverLoop, impl).detach();
+}
+
+void AsyncWebServer::end() {
+  ServerImpl* impl = static_cast<ServerImpl*>(_impl);
+  if (!impl) return;
+  impl->running = false;
+}
@@ -0,0 +1,7 @@
+// One of the sketches, compiled unmodified against the stand-in headers. The
+// Arduino IDE builds sketches as C++ with Arduino.h included first; this does
+// the same for the file named by SIM_SKETCH (set per target in
+// CMakeLists.txt).
+
+#include "Arduino.h"
+#include SIM_SKETCH
@@ -6,6 +6,26 @@
 #include "SD_MMC.h"
 #include "esp_timer.h"
 #include "esp_heap_caps.h"
+#include "src/frame_pool.h"
+#include "src/latest_frame.h"
+#include "src/mjpeg_stream.h"
+#include "src/sd_writer.h"
+#include "src/avi_recorder.h"
+#include "src/segment_catalog.h"
+#include "src/recordings.h"
+#include "src/storage_stats.h"
+#include "src/json_response.h"
+#include "src/metrics.h"
+#include "src/trace.h"
+#include "src/task_topology.h"
+#include "src/frame_pacer.h"
+#include "src/timelapse.h"
+#include "src/frame_slab.h"
+#include "src/quality_controller.h"
+#include "src/motion.h"
+#include "src/pre_event.h"
+#include "src/frame_decimator.h"
+#include "src/frame_overlay.h"
 
 // --- Network Credentials ---
 const char* ssid = "ZTE_2.4G_EhqFdr";
@@ -40,16 +60,34 @@ IPAddress secondaryDNS(8, 8, 4, 4);       // Secondary DNS (Google DNS)
 // --- Global Variables & State Management ---
 AsyncWebServer server(80);
 
-// Define the system's operational modes
-enum SystemMode { MODE_IDLE, MODE_STREAMING, MODE_RECORDING };
-SystemMode currentMode = MODE_IDLE;
+// Streaming and recording are independent; cameraTask feeds both from the
+// same captured frame
+bool streamActive = false;
+bool recordingActive = false;
 
 // --- Recording Control ---
 unsigned long recordingStartTime = 0;
 const unsigned long segmentDuration = 3600 * 1000UL; // 1 hour
-File videoFile;
 char currentFileName[30];
 const uint64_t STORAGE_THRESHOLD = 2 * 1024 * 1024 * 1024ULL; // 2GB
+SdWriter sdWriter;                     // Writer task + PSRAM ring, see src/sd_writer.h
+AviRecorder recorder(sdWriter);        // Indexed AVI segments, see src/avi_recorder.h
+SegmentCatalog catalog;                // Segments on the card, see src/segment_catalog.h
+uint32_t nextSegmentId = 0;            // Catalog id of the prepared next segment, 0 if none
+char nextFileName[30];
+unsigned long lastPrepareAttempt = 0;  // prepareNextSegment() is retried every second
+bool recordStartRequested = false;     // By /recording/start; loop() opens the segment
+bool recordStopRequested = false;      // By /recording/stop and /stop; loop() closes it
+bool timelapseStartRequested = false;  // By /timelapse/start; loop() creates the run directory
+uint32_t storageSynced = 0;            // StorageSample::count the catalog last took its free space from
+RecordingServer recordings;            // /recordings, see src/recordings.h
+StorageSampler storageStats;           // Card size and usage for /stats, see src/storage_stats.h
+const uint32_t STORAGE_SAMPLE_MS = 10000; // usedBytes() can walk the FAT, so it is sampled this often
+const size_t STATS_JSON_MAX = 3072;    // /stats body, rendered into the response itself
+const size_t RECORD_RING_BYTES = 1024 * 1024; // ~1.5 s of VGA recording to ride out SD stalls
+const uint8_t RECORD_YIELD_PERCENT = 50; // Viewers yield while the ring is fuller than this
+unsigned long recordedFrames = 0;      // Frames added to the recording
+unsigned long recordDropped = 0;       // Captured frames the recorder missed
 
 // --- Performance monitoring ---
 unsigned long frameCount = 0;
@@ -57,15 +95,119 @@ float currentFPS = 0;
 unsigned long lastFPSTime = 0;
 unsigned long lastFrameTime = 0;
 
+// --- Metrics ---
+// Per-stage counters and histograms behind /metrics, see src/metrics.h. The
+// SD writer and the stream broadcaster keep their own.
+MetricsRegistry metrics;
+MetricsCounter framesCaptured;         // esp_camera_fb_get() returned a frame
+MetricsCounter captureFailures;        // esp_camera_fb_get() returned nothing
+MetricsCounter framesNoSlot;           // Captured while every frame slot was still being read
+MetricsCounter frameRequests;          // /frame requests
+MetricsCounter frameUnavailable;       // /frame requests answered 503
+MetricsHistogram captureInterval(METRICS_BUCKETS(METRICS_INTERVAL_BUCKETS_US), 1e-6);
+MetricsHistogram jpegSize(METRICS_BUCKETS(METRICS_JPEG_BUCKETS_BYTES), 1);
+MetricsHistogram frameSend(METRICS_BUCKETS(METRICS_LATENCY_BUCKETS_US), 1e-6);
+int64_t lastCaptureAt = 0;             // cameraTask only; 0 after an idle stretch
+
 // --- Streaming optimization ---
-bool streamActive = false;
-volatile bool frameReady = false;
-camera_fb_t* currentFrame = nullptr;
-SemaphoreHandle_t frameMutex;
+TcpWaker tcpWaker;                     // Wakes /stream viewers and paced playbacks
+
+// --- Frame Pool ---
+// Camera framebuffers are handed out by reference instead of being copied:
+// /frame and /stream send straight out of the PSRAM buffer, the recorder copies
+// it into sdWriter's ring, and the buffer goes back to the driver when the last
+// of them lets go.
+const size_t FRAME_SLOTS = 4;          // camera fb_count: latest + in-flight readers + one being filled
+FramePool framePool;
+LatestFrame latestFrame(framePool);    // Lock-free handoff to readers; holds one reference
+// Copies of frames (a slow /stream viewer's spill) come from fixed PSRAM size
+// classes instead of malloc, see src/frame_slab.h. The largest class holds
+// the biggest JPEG the driver can hand out: a JPEG fb is width * height / 5.
+const size_t MAX_JPEG_BYTES = 640 * 480 / 5;  // VGA, the largest profile
+const FrameSlabClass FRAME_SLAB_CLASSES[] = {
+  {16 * 1024, MJPEG_MAX_CLIENTS}, {32 * 1024, MJPEG_MAX_CLIENTS}, {MAX_JPEG_BYTES, MJPEG_MAX_CLIENTS}};
+FrameSlab frameSlab;
+MjpegBroadcaster broadcaster(latestFrame); // /stream viewers, see src/mjpeg_stream.h
+
+// --- Task Topology ---
+// Core, priority and stack of every task the sketch starts. AsyncTCP's task
+// (network) is placed by the library's CONFIG_ASYNC_TCP_RUNNING_CORE, and
+// loop() (housekeeping) runs on ARDUINO_RUNNING_CORE. /tasks shows how busy
+// each one is, see src/task_topology.h.
+const TaskPlacement CAPTURE_TASK = {"CameraTask", "capture", 4096, 2, 0};
+const TaskPlacement WRITER_TASK = {"SdWriter", "writer", 4096, 2, 1};
+const TaskPlacement STORAGE_TASK = {"StorageStats", "housekeeping", 3072, 1, 0};
+const TaskPlacement MOTION_TASK = {"Motion", "analysis", 4096, 1, 0}; // below capture, see src/motion.h
+const size_t TASKS_JSON_MAX = 4096;      // /tasks body
+TaskStats taskStats;
+MetricsCounter cameraWakes;              // cameraTask returns from waiting for a frame or a consumer
+MetricsCounter loopWakes;                // loop() iterations
+
+// --- Frame Pacing ---
+// Target rate of each consumer of the captured frames, see src/frame_pacer.h.
+// 0 takes every frame the sensor delivers. /pacer changes them at run time.
+const float LIVE_FPS = 0;                // viewers get all the sensor delivers
+const float RECORD_FPS = 20;             // what RECORD_RING_BYTES is sized for
+const float TIMELAPSE_INTERVAL_S = 60;   // one still a minute
+const float MOTION_FPS = 0;              // every frame the detector is free for
+const size_t PACER_JSON_MAX = 512;       // /pacer body
+FramePacer pacer(LIVE_FPS, RECORD_FPS, 1 / TIMELAPSE_INTERVAL_S, MOTION_FPS);
+Timelapse timelapse;                     // Stills on the card, see src/timelapse.h
+
+// --- Adaptive Quality ---
+// JPEG quality and frame size follow what the link or the card sustains,
+// see src/quality_controller.h. Recording only adapts quality, so every
+// frame of a segment has the same size.
+QualityProfile recordQuality = {"record", FRAMESIZE_VGA, FRAMESIZE_VGA, FRAMESIZE_VGA, 10, 10, 30, 25, 12000};
+QualityProfile streamQuality = {"stream", FRAMESIZE_QVGA, FRAMESIZE_QQVGA, FRAMESIZE_VGA, 30, 12, 55, 25, 6000};
+QualityController quality;
+
+// --- Motion Detection ---
+// Once armed (/motion/start), motion starts a recording and the recording
+// stops MOTION_HOLD_S after the last of it, see src/motion.h. A recording
+// started by hand is left alone.
+const uint32_t MOTION_HOLD_S = 30;
+const uint8_t MOTION_THRESHOLD = 12;     // mean per-pixel difference of a changed block
+const uint16_t MOTION_MIN_BLOCKS = 3;    // changed blocks (32x32 pixels each) that make motion
+const size_t MOTION_JSON_MAX = 512;      // /motion body
+MotionDetector motion(MOTION_HOLD_S, MOTION_THRESHOLD, MOTION_MIN_BLOCKS);
+bool recordingByMotion = false;          // The current recording was started by motion
+// While armed, the last PRE_EVENT_S of recorded frames wait in PSRAM, so a
+// recording starts that long before the motion that triggered it, see
+// src/pre_event.h. The ring is sized from the frames and the free PSRAM.
+const float PRE_EVENT_S = 5;
+const int PRE_EVENT_DRAIN_BURST = 4;     // pre-event frames into the segment per captured frame
+PreEventBuffer preEvent(PRE_EVENT_S);
+
+// --- Static-scene Decimation ---
+// Frames of a scene that hasn't changed are recorded as repeats (empty
+// chunks) except one every DECIMATE_KEEPALIVE_S, see src/frame_decimator.h.
+// /decimation changes the settings at run time.
+const bool DECIMATE_STATIC = true;
+const float DECIMATE_LEVELS = 0.5;       // mean luma change a frame under which the scene is still
+const uint8_t DECIMATE_SIZE_PCT = 5;     // JPEG size change that still counts as the same picture
+const float DECIMATE_KEEPALIVE_S = 1;    // longest gap between full frames of a still scene
+const float DECIMATE_HOLD_S = 2;         // every frame for this long after a change
+const size_t DECIMATION_JSON_MAX = 384;  // /decimation body
+FrameDecimator decimator(DECIMATE_STATIC, DECIMATE_LEVELS, DECIMATE_SIZE_PCT, DECIMATE_KEEPALIVE_S, DECIMATE_HOLD_S);
+
+// --- Privacy Masks and Clock ---
+// Every frame leaves cameraTask with the masked areas blanked and the date
+// and time written in, edited into the JPEG without re-encoding it, see
+// src/frame_overlay.h. Masks are "x,y,w,h" rectangles in percent of the
+// frame, separated by ';'. /overlay changes them at run time.
+const char PRIVACY_MASKS[] = "";         // e.g. "0,0,30,25;70,50,30,50"
+const OverlayClock OVERLAY_CLOCK = OVERLAY_CLOCK_TOP;
+const uint8_t MASK_LEVEL = 40;           // luma of masked areas
+const char NTP_SERVER[] = "pool.ntp.org";
+const char TIME_ZONE[] = "UTC0";         // POSIX TZ, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+const size_t OVERLAY_JSON_MAX = 384;     // /overlay body
+FrameOverlay overlay(OVERLAY_CLOCK, MASK_LEVEL);
 
 // --- Task handles ---
 TaskHandle_t streamTaskHandle = nullptr;
 TaskHandle_t cameraTaskHandle = nullptr;
+TaskHandle_t loopTaskHandle = nullptr; // setup() and loop(); woken by the recorder
 
 // --- Web Interface ---
 const char index_html[] PROGMEM = R"rawliteral(
@@ -101,13 +243,14 @@ const char index_html[] PROGMEM = R"rawliteral(
       <div class="fps-indicator">Stream FPS: <span id="fps">0.0</span> | Target: 10+ FPS</div>
       <div class="perf-stats">
         Heap: <span id="heap">0</span> KB | SD: <span id="sd_space">0.00</span> GB | 
-        Load: <span id="frame-time">0</span>ms
+        Viewers: <span id="viewers">0</span>
       </div>
     </div>
 
     <div class="controls">
       <button id="stream-btn" onclick="startStream()">Start Stream</button>
       <button id="record-btn" onclick="startRecording()">Start Recording</button>
+      <button id="motion-btn" onclick="armMotion()">Record on Motion</button>
       <button id="stop-btn" class="stop-btn" onclick="stopAll()">Stop</button>
     </div>
 
@@ -125,11 +268,7 @@ const char index_html[] PROGMEM = R"rawliteral(
     const streamPlaceholder = document.getElementById('stream-placeholder');
     const modeStatus = document.getElementById('mode-status');
     
-    let frameCount = 0;
-    let lastFrameTime = Date.now();
-    let currentFPS = 0;
     let isStreaming = false;
-    let frameLoadTime = 0;
 
     function updateStatus() {
       fetch('/stats')
@@ -138,10 +277,10 @@ const char index_html[] PROGMEM = R"rawliteral(
           modeStatus.textContent = data.mode;
           document.getElementById('sd_space').textContent = data.sd_free_gb.toFixed(2);
           document.getElementById('heap').textContent = (data.heap / 1024).toFixed(0);
-          document.getElementById('fps').textContent = currentFPS.toFixed(1);
-          document.getElementById('frame-time').textContent = frameLoadTime;
+          document.getElementById('fps').textContent = data.fps.toFixed(1);
+          document.getElementById('viewers').textContent = data.stream_clients;
           
-          if (data.mode === 'RECORDING') {
+          if (data.mode.includes('RECORDING')) {
             modeStatus.style.color = '#f44336';
           } else if (data.mode === 'STREAMING') {
             modeStatus.style.color = '#4CAF50';
@@ -152,57 +291,38 @@ const char index_html[] PROGMEM = R"rawliteral(
     }
 
     function startStream() {
-      stopAll();
-      
       fetch('/stream/start')
         .then(response => {
           if (response.ok) {
             streamPlaceholder.style.display = 'none';
             streamImg.style.display = 'block';
             isStreaming = true;
-            frameCount = 0;
-            lastFrameTime = Date.now();
-            loadFrame();
+            connectStream();
           }
         });
     }
     
-    function loadFrame() {
-      if (!isStreaming || modeStatus.textContent !== 'STREAMING') return;
-      
-      const loadStart = Date.now();
-      const img = new Image();
-      
-      img.onload = function() {
-        streamImg.src = img.src;
-        frameCount++;
-        
-        const now = Date.now();
-        frameLoadTime = now - loadStart;
-        
-        // Calculate FPS every second
-        if (now - lastFrameTime >= 1000) {
-          currentFPS = frameCount / ((now - lastFrameTime) / 1000);
-          frameCount = 0;
-          lastFrameTime = now;
-        }
-        
-        // Immediate next frame request for maximum FPS
-        setTimeout(loadFrame, 20); // Target ~50fps client side, limited by server
-      };
-      
-      img.onerror = function() {
-        console.log('Frame error, retrying...');
-        setTimeout(loadFrame, 100);
-      };
-      
-      img.src = '/frame?t=' + Date.now();
+    // One long-lived multipart connection; the device pushes every new frame.
+    function connectStream() {
+      if (!isStreaming) return;
+      streamImg.src = '/stream?t=' + Date.now();
     }
     
+    streamImg.onerror = function() {
+      if (!isStreaming) return;
+      console.log('Stream interrupted, reconnecting...');
+      setTimeout(connectStream, 1000);
+    };
+    
+    // Recording runs alongside the stream, so neither start stops the other
     function startRecording() {
-      stopAll();
       fetch('/recording/start');
     }
+
+    // Recordings start on motion and stop once the scene is quiet again
+    function armMotion() {
+      fetch('/motion/start');
+    }
     
     function stopAll() {
       isStreaming = false;
@@ -219,46 +339,266 @@ const char index_html[] PROGMEM = R"rawliteral(
 </html>
 )rawliteral";
 
+// --- Frame Publishing ---
+void returnCameraFrame(FrameSlot& slot) {
+  if (slot.owner) esp_camera_fb_return((camera_fb_t*)slot.owner); // null: returned after the overlay
+}
+
+// Wake cameraTask, which sleeps while nothing is streaming, recording,
+// taking time-lapse stills or watching for motion
+void wakeCamera() {
+  if (cameraTaskHandle) xTaskNotifyGive(cameraTaskHandle);
+}
+
+// Burn the masks and the clock into slot's frame. The edited copy is in the
+// overlay's buffer for the slot, so the fb goes back to the driver right
+// away instead of when the last reader lets go. False: masks are set and
+// this frame couldn't be edited.
+bool overlayFrame(FrameSlot* slot, camera_fb_t* fb, uint32_t frameNo) {
+  TRACE_SCOPE("overlay", frameNo);
+  bool keep = overlay.apply(slot);
+  motion.ignoreRows(overlay.clockRow(), overlay.clockRows()); // the clock ticks; that's not activity
+  if (slot->data != fb->buf) {
+    esp_camera_fb_return(fb);
+    slot->owner = nullptr;
+  }
+  return keep;
+}
+
+// Hand slot to the readers. Never blocks: the previous frame's reference is
+// dropped and its fb goes back to the driver once no reader holds it.
+void publishFrame(FrameSlot* slot) {
+  if (slot) {
+    latestFrame.publish(slot);
+  } else {
+    latestFrame.clear();
+  }
+  broadcaster.framePublished(); // waiting viewers send it, or end with the stream
+}
+
+// Pre-event frames go into the new segment oldest first, a few per captured
+// frame and only while the SD writer keeps up, so neither capture nor the
+// frames queued behind them wait on the card
+void drainPreEvent() {
+  for (int i = 0; i < PRE_EVENT_DRAIN_BURST && !preEvent.empty(); i++) {
+    if (sdWriter.fillPercent() >= RECORD_YIELD_PERCENT) return;
+    const PreEventFrame& f = preEvent.oldest();
+    if (recorder.addFrame(f.data(), f.len, f.timestamp, f.width, f.height, f.activity)) {
+      recordedFrames++;
+      preEvent.drained();
+      decimator.written(f.len, f.timestamp);
+    } else {
+      recordDropped++;
+    }
+    preEvent.pop();
+  }
+}
+
+// Copy the frame into the SD writer's PSRAM ring as the next chunk of the AVI
+// segment, and index it with the scene activity the motion detector last
+// measured. The fb goes back to the driver as soon as the viewers
+// are done with it, whatever the card is doing.
+// Recording still has priority: while the ring backs up, viewers yield
+// (MjpegBroadcaster::setYield) and leave CPU and PSRAM bandwidth to the writer.
+// Before a recording starts, the frame waits in the pre-event ring instead;
+// after, so does every frame until that ring has drained into the segment.
+// A frame of a still scene goes in as a repeat of the last one written.
+void recordFrame(const FrameSlot* slot, bool record) {
+  uint16_t activity = motion.activity();
+  preEvent.hold(record);
+  if (record) drainPreEvent();
+  if (record && preEvent.empty()) {
+    if (decimator.still(slot->len, activity, slot->timestamp) && recorder.addRepeat(slot->timestamp, activity)) {
+      recordedFrames++;
+      decimator.repeated(slot->len);
+    } else if (recorder.addFrame(slot->data, slot->len, slot->timestamp, slot->width, slot->height, activity)) {
+      recordedFrames++;
+      decimator.written(slot->len, slot->timestamp);
+    } else {
+      recordDropped++;
+    }
+  } else if (!preEvent.keep(slot, activity) && record) {
+    recordDropped++; // Behind the pre-event frames, and their ring is full
+  }
+  broadcaster.setYield(sdWriter.fillPercent() >= RECORD_YIELD_PERCENT);
+}
+
+// Tell the quality controller what its consumer got over the last period:
+// the recorder while recording, otherwise the /stream viewers. While armed
+// the recording's profile is on (see applySensorProfile()) and waits for a
+// recording to judge it by.
+// cameraTask, once a second.
+void adaptQuality(float seconds) {
+  static uint32_t lastDelivered = 0;
+  static unsigned long lastRecorded = 0;
+  static unsigned long lastDropped = 0;
+  uint32_t delivered = broadcaster.totals().delivered.value();
+  unsigned long recorded = recordedFrames;
+  unsigned long dropped = recordDropped;
+  bool recordProfile = recordingActive || motion.armed();
+  const PacedChannel& channel = recordProfile ? pacer.record : pacer.live;
+  float sensorFps = pacer.sensorFps();
+  QualityLoad load = {seconds, channel.target() > 0 && channel.target() < sensorFps ? channel.target() : sensorFps};
+  if (recordingActive) {
+    load.gotFps = (recorded - lastRecorded) / seconds;
+    load.backlogPct = sdWriter.fillPercent();
+    load.lost = dropped != lastDropped;
+  } else if (int viewers = recordProfile ? 0 : broadcaster.activeCount()) {
+    load.gotFps = (delivered - lastDelivered) / seconds / viewers;
+    load.backlogPct = broadcaster.backlogPercent();
+  }
+  lastDelivered = delivered;
+  lastRecorded = recorded;
+  lastDropped = dropped;
+  if (seconds > 2) return; // The period spans an idle stretch
+  quality.update(load, esp_camera_sensor_get());
+}
+
 // --- Camera Task for Continuous Frame Capture ---
 void cameraTask(void* parameter) {
-  TickType_t xLastWakeTime = xTaskGetTickCount();
-  const TickType_t xFrequency = pdMS_TO_TICKS(50); // ~20 FPS capture rate target
-  
   while (true) {
-    if (currentMode == MODE_STREAMING && streamActive) {
-      camera_fb_t* fb = esp_camera_fb_get();
-      if (fb) {
-        if (xSemaphoreTake(frameMutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-          if (currentFrame) {
-            esp_camera_fb_return(currentFrame);
-          }
-          currentFrame = fb;
-          frameReady = true;
-          xSemaphoreGive(frameMutex);
+    bool live = streamActive;
+    bool record = recordingActive;
+    bool stills = timelapse.active();
+    bool watch = motion.armed();
+    // Disarmed, the pre-event ring gives its PSRAM back, unless a recording
+    // is still draining it
+    bool preRoll = watch && PRE_EVENT_S > 0;
+    if (!preRoll && !(record && preEvent.holding())) preEvent.release();
+    if (!live && !record && !stills && !watch) {
+      // Nothing to capture for: sleep until wakeCamera() instead of ticking
+      // through idle time
+      lastCaptureAt = 0; // Idle time is not a capture interval
+      currentFPS = 0;
+      pacer.idle();
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      cameraWakes.inc();
+      continue;
+    }
+    if (stills && !live && !record && !watch) {
+      // Only stills wanted: sleep until the next one is due rather than
+      // capturing at the sensor rate for one frame a minute. wakeCamera()
+      // cuts the sleep short when another consumer starts
+      int64_t left = pacer.timelapse.nextDue() - esp_timer_get_time();
+      TickType_t wait = pacer.timelapse.nextDue() && left > 0 ? pdMS_TO_TICKS(left / 1000) : 0;
+      if (wait > 1) {
+        lastCaptureAt = 0; // Nor is the sleep
+        pacer.pause();
+        ulTaskNotifyTake(pdTRUE, wait);
+        cameraWakes.inc();
+        continue;
+      }
+    }
+
+    // No tick of our own: esp_camera_fb_get() blocks until the sensor's next
+    // frame, so capture keeps the sensor's rate and phase, and the pacer picks
+    // each consumer's frames out of it
+    int64_t traceAt = TRACE_NOW();
+    camera_fb_t* fb = esp_camera_fb_get();
+    cameraWakes.inc();
+    uint32_t frameNo = latestFrame.seq() + 1; // the number publishFrame() gives it
+    TRACE_SPAN("capture", frameNo, traceAt);
+    if (!fb) {
+      captureFailures.inc();
+      vTaskDelay(pdMS_TO_TICKS(10)); // Don't spin on a sensor that keeps failing
+      continue;
+    }
+    int64_t now = esp_timer_get_time();
+    framesCaptured.inc();
+    frameCount++;
+    if (lastCaptureAt) captureInterval.observe(now - lastCaptureAt);
+    lastCaptureAt = now;
+    jpegSize.observe(fb->len);
+
+    pacer.captured(now);
+    bool toLive = pacer.live.take(now, live);
+    bool toRecord = pacer.record.take(now, record || preRoll); // pre-event frames at the record pace
+    bool toStill = pacer.timelapse.take(now, stills);
+    // The detector also scores activity for recordings and /stats, so it
+    // sees frames whenever they are recorded or streamed, armed or not
+    bool toMotion = pacer.motion.take(now, watch || record || live);
+    if (record || preRoll ? toRecord : toLive) quality.frame(fb->len); // the consumer the settings are for
+    if (!toLive && !toRecord && !toStill && !toMotion) {
+      esp_camera_fb_return(fb); // Between every consumer's frames
+    } else if (FrameSlot* slot = framePool.acquire()) {
+      slot->owner = fb;
+      slot->data = fb->buf;
+      slot->len = fb->len;
+      slot->width = fb->width;
+      slot->height = fb->height;
+      slot->timestamp = now;
+      if (!overlayFrame(slot, fb, frameNo)) {
+        framePool.release(slot); // Never hand out a frame the masks are missing from
+        if (toRecord && record) recordDropped++;
+      } else {
+        if (toRecord) {
+          TRACE_SCOPE("record", frameNo);
+          recordFrame(slot, record);
+        }
+        if (toStill) timelapse.offer(slot);
+        if (toMotion) motion.offer(slot);
+        if (toLive) {
+          TRACE_SCOPE("publish", frameNo);
+          publishFrame(slot);
         } else {
-          esp_camera_fb_return(fb);
+          framePool.release(slot);
         }
       }
+    } else {
+      esp_camera_fb_return(fb); // Every slot still being read; drop this frame
+      if (toRecord && record) recordDropped++;
+      framesNoSlot.inc();
+    }
+
+    // FPS accounting rides on the capture itself
+    unsigned long nowMs = millis();
+    if (nowMs - lastFPSTime >= 1000) {
+      currentFPS = frameCount;
+      adaptQuality((nowMs - lastFPSTime) / 1000.0f);
+      frameCount = 0;
+      lastFPSTime = nowMs;
     }
-    vTaskDelayUntil(&xLastWakeTime, xFrequency);
   }
 }
 
+// --- Stream State ---
+// /stream viewers keep going while this is true
+bool streamingActive() {
+  return streamActive;
+}
+
 // --- Function Prototypes ---
 void setupCamera();
 void setupWebServer();
+void setupMetrics();
 void startRecording();
 void stopRecording();
-void recordFrame();
+void prepareNextSegment();
+void finishRotation();
+void followRecordRequest();
+void followTimelapseRequest();
+void followMotion();
+void syncStorage();
+TickType_t housekeepingWait();
 void manageStorage();
-String getModeString();
+bool probeCard(uint64_t* totalBytes, uint64_t* usedBytes);
+void applySensorProfile();
+const char* getModeString();
 
 void setup() {
   Serial.begin(115200);
+  loopTaskHandle = xTaskGetCurrentTaskHandle();
+  recorder.notifyTo(loopTaskHandle); // finished rotations and full segments wake loop()
+  timelapse.notifyTo(loopTaskHandle); // so do time-lapse stills to write
+  motion.notifyTo(loopTaskHandle); // and motion, to start a recording
+  storageStats.notifyTo(loopTaskHandle); // and card usage samples, for the catalog
   Serial.println("\n\n=== ESP32-CAM High FPS Controller ===");
 
-  // Create mutex for frame access
-  frameMutex = xSemaphoreCreateMutex();
+  if (!tcpWaker.begin()) {
+    Serial.println("ERROR: Failed to create the viewer wake timer!");
+  }
+  frameSlab.begin(FRAME_SLAB_CLASSES, sizeof(FRAME_SLAB_CLASSES) / sizeof(FRAME_SLAB_CLASSES[0])); // allocated for the first viewer
+  broadcaster.begin(&tcpWaker, streamingActive, &frameSlab);
 
   // --- Initialize SD Card ---
   if (!SD_MMC.begin()) {
@@ -267,10 +607,30 @@ void setup() {
   }
   Serial.printf("SD Card Size: %.2f GB\n", (float)SD_MMC.cardSize() / (1024 * 1024 * 1024));
 
+  // Card writes get their own task on Core 1 so SD stalls never hold up capture
+  if (!sdWriter.begin(RECORD_RING_BYTES, WRITER_TASK) || !recorder.begin(SD_MMC)) {
+    Serial.println("SD writer init failed!");
+  }
+  if (!catalog.begin(SD_MMC, SD_MMC.cardSize(), SD_MMC.usedBytes())) {
+    Serial.println("Segment catalog init failed!");
+  }
+  Serial.printf("Segments on card: %u\n", (unsigned)catalog.count());
+  recordings.begin(SD_MMC, catalog, &tcpWaker);
+  if (!timelapse.begin(SD_MMC)) {
+    Serial.println("Time-lapse init failed!");
+  }
+  if (!storageStats.begin(probeCard, STORAGE_SAMPLE_MS, STORAGE_TASK)) {
+    Serial.println("Storage sampler init failed!");
+  }
+
   // Setup CPU frequency for maximum performance
   setCpuFrequencyMhz(240);
   Serial.println("CPU set to 240MHz for maximum performance");
 
+  quality.begin(); // before setupCamera() applies the first profile
+  if (!motion.begin(MOTION_TASK)) {
+    Serial.println("Motion detector init failed!");
+  }
   setupCamera();
 
   // --- Connect to WiFi with Static IP ---
@@ -307,6 +667,7 @@ void setup() {
     Serial.println(WiFi.subnetMask());
     Serial.print("DNS: ");
     Serial.println(WiFi.dnsIP());
+    configTzTime(TIME_ZONE, NTP_SERVER); // Wall clock for the overlay; uptime until it syncs
   } else {
     Serial.println("\nFailed to connect to WiFi!");
     Serial.println("Check your network settings and try again.");
@@ -314,43 +675,115 @@ void setup() {
     return;
   }
 
+  setupMetrics();
+  taskStats.track(CAPTURE_TASK, &cameraWakes);
+  taskStats.track(WRITER_TASK, &sdWriter.wakes());
+  taskStats.track(STORAGE_TASK, &storageStats.wakes());
+  taskStats.track(MOTION_TASK, &motion.analysed());
+  taskStats.track("async_tcp", "network");
+  taskStats.track("loopTask", "housekeeping", &loopWakes);
+  if (!tracer().begin()) {
+    Serial.println("Tracing unavailable (no PSRAM)");
+  }
   setupWebServer();
   server.begin();
   Serial.println("High-performance web server started.");
   Serial.printf("Access the camera at: http://%s\n", staticIP.toString().c_str());
 
-  // Create camera task on Core 0 (separate from main loop on Core 1)
-  xTaskCreatePinnedToCore(
-    cameraTask,
-    "CameraTask",
-    4096,
-    nullptr,
-    2, // High priority
-    &cameraTaskHandle,
-    0  // Pin to Core 0
-  );
+  // Create camera task, away from the main loop (see CAPTURE_TASK)
+  if (!startTask(CAPTURE_TASK, cameraTask, nullptr, &cameraTaskHandle)) {
+    Serial.println("ERROR: Camera task start failed!");
+  }
 }
 
 void loop() {
-  // Main recording logic (runs on Core 1)
-  if (currentMode == MODE_RECORDING) {
-    if (millis() - recordingStartTime >= segmentDuration) {
-      Serial.println("Segment duration reached. Starting new file.");
-      stopRecording();
-      startRecording();
-    }
-    recordFrame();
+  // Sleep until there is something to do: cameraTask finished a rotation,
+  // filled the segment or handed over a time-lapse still, a recording or
+  // time-lapse was asked for, motion started, or a deadline below is due
+  ulTaskNotifyTake(pdTRUE, housekeepingWait());
+  loopWakes.inc();
+  followTimelapseRequest();
+  timelapse.writePending();
+  followRecordRequest();
+  followMotion();
+  syncStorage();
+
+  // Segment rotation: cameraTask switches to the prepared segment at the next
+  // frame boundary; the catalog work and the next file happen here, after it
+  if (recordingActive) {
+    finishRotation();
+    if (millis() - recordingStartTime >= segmentDuration || recorder.segmentFull()) recorder.rotate();
+    if (!nextSegmentId && millis() - lastPrepareAttempt >= 1000) prepareNextSegment();
   }
-  
-  // Update FPS counter
+}
+
+// Stop or start the recording the HTTP handlers asked for; each request
+// clears the other, so only the latest is carried out
+void followRecordRequest() {
+  if (recordStopRequested) {
+    recordStopRequested = false;
+    stopRecording();
+    if (!streamActive) publishFrame(nullptr);
+    applySensorProfile();
+  }
+  if (recordStartRequested) {
+    recordStartRequested = false;
+    if (recordingActive) return;
+    startRecording();
+    if (recordingActive) applySensorProfile();
+  }
+}
+
+// Start the time-lapse run /timelapse/start asked for; making its directory
+// is card work, so it happens here rather than on async_tcp
+void followTimelapseRequest() {
+  if (!timelapseStartRequested) return;
+  timelapseStartRequested = false;
+  if (!timelapse.start()) {
+    Serial.println("Failed to start time-lapse!");
+    return;
+  }
+  wakeCamera();
+}
+
+// Motion-triggered recording: start when the detector sees motion, stop
+// once its hold time has passed without any. Recordings started by hand
+// are left to /recording/stop.
+void followMotion() {
+  if (motion.active()) {
+    if (recordingActive) return;
+    startRecording();
+    if (!recordingActive) return;
+    recordingByMotion = true;
+    applySensorProfile();
+    Serial.println("Motion: recording");
+  } else if (recordingByMotion) {
+    recordingByMotion = false;
+    if (!recordingActive) return; // Stopped by hand meanwhile
+    stopRecording();
+    if (!streamActive) publishFrame(nullptr);
+    applySensorProfile();
+    Serial.println("Motion: quiet, recording stopped");
+  }
+}
+
+// ms from now until at (both millis()), 0 once it has passed
+unsigned long msUntil(unsigned long at, unsigned long now) {
+  return (long)(at - now) > 0 ? at - now : 0;
+}
+
+// How long loop() may sleep: until the segment is due to rotate, a failed
+// prepareNextSegment() is due another try or a motion recording's hold runs
+// out; forever while not recording
+TickType_t housekeepingWait() {
   unsigned long now = millis();
-  if (now - lastFPSTime >= 1000) {
-    currentFPS = frameCount;
-    frameCount = 0;
-    lastFPSTime = now;
+  unsigned long wait = ULONG_MAX;
+  if (recordingActive) {
+    if (!recorder.rotationPending()) wait = min(wait, msUntil(recordingStartTime + segmentDuration, now));
+    if (!nextSegmentId) wait = min(wait, msUntil(lastPrepareAttempt + 1000, now));
+    if (recordingByMotion) wait = min(wait, msUntil(motion.quietAt(), now));
   }
-  
-  vTaskDelay(1); // Minimal delay to prevent watchdog
+  return wait == ULONG_MAX ? portMAX_DELAY : wait / portTICK_PERIOD_MS;
 }
 
 void setupCamera() {
@@ -378,15 +811,16 @@ void setupCamera() {
   config.grab_mode = CAMERA_GRAB_LATEST;
   
   if (psramFound()) {
-    config.frame_size = FRAMESIZE_CIF; // Default, will change dynamically
-    config.jpeg_quality = 20; // Default, will change dynamically
-    config.fb_count = 2; // Double buffering
+    config.frame_size = FRAMESIZE_VGA; // fbs are sized for the largest profile (recording)
+    config.jpeg_quality = 10;
+    config.fb_count = FRAME_SLOTS; // Readers hold fbs directly, see framePool
     config.fb_location = CAMERA_FB_IN_PSRAM;
     Serial.println("PSRAM found - using optimized settings");
   } else {
     config.frame_size = FRAMESIZE_QVGA; // 320x240
     config.jpeg_quality = 25;
-    config.fb_count = 1;
+    config.fb_count = 2; // latestFrame always pins one
+    config.fb_location = CAMERA_FB_IN_DRAM;
     Serial.println("No PSRAM - using minimal settings");
   }
   
@@ -395,6 +829,12 @@ void setupCamera() {
     Serial.printf("Camera init failed with error 0x%x\n", err);
     ESP.restart();
   }
+  framePool.begin(config.fb_count, returnCameraFrame);
+  overlay.begin(framePool, MAX_JPEG_BYTES);
+  if (!overlay.setMasks(PRIVACY_MASKS)) {
+    Serial.println("PRIVACY_MASKS doesn't parse; no masks");
+  }
+  streamQuality.largest = config.frame_size; // No larger than the fbs
   
   // Initial sensor settings
   sensor_t * s = esp_camera_sensor_get();
@@ -425,11 +865,122 @@ void setupCamera() {
     s->set_vflip(s, 0);
     s->set_dcw(s, 0); // Disable downsize for speed
     s->set_colorbar(s, 0);
+    applySensorProfile();
     
     Serial.println("Camera initialized with default settings");
   }
 }
 
+// /metrics families, in exposition order. Counters count from boot.
+void setupMetrics() {
+  metrics.counter("camera_frames_captured_total", "Frames returned by esp_camera_fb_get()", &framesCaptured);
+  metrics.counter("camera_capture_failures_total", "esp_camera_fb_get() calls that returned no frame", &captureFailures);
+  metrics.counter("camera_frames_no_slot_total", "Captured frames dropped because every frame slot was in use", &framesNoSlot);
+  metrics.histogram("camera_capture_interval_seconds", "Time between consecutive captured frames", &captureInterval);
+  metrics.histogram("camera_jpeg_size_bytes", "Size of each captured JPEG", &jpegSize);
+  metrics.gauge("pacer_sensor_fps", "Frames per second the sensor delivers",
+                []() -> double { return pacer.sensorFps(); });
+  metrics.gauge("pacer_live_target_fps", "Target rate of frames published to viewers, 0 for every frame",
+                []() -> double { return pacer.live.target(); });
+  metrics.gauge("pacer_live_fps", "Frames per second published to viewers",
+                []() -> double { return pacer.live.achieved(); });
+  metrics.gauge("pacer_record_target_fps", "Target rate of recorded frames, 0 for every frame",
+                []() -> double { return pacer.record.target(); });
+  metrics.gauge("pacer_record_fps", "Frames per second handed to the recorder",
+                []() -> double { return pacer.record.achieved(); });
+  metrics.gauge("pacer_timelapse_target_fps", "Target rate of time-lapse stills",
+                []() -> double { return pacer.timelapse.target(); });
+  metrics.counter("timelapse_stills_total", "Time-lapse stills written to the card",
+                  []() -> double { return timelapse.written(); });
+  metrics.gauge("quality_jpeg_quality", "set_quality() value the controller holds, -1 when it is off",
+                []() -> double { return quality.quality(); });
+  metrics.gauge("quality_frame_width", "Frame width the controller holds, 0 when it is off",
+                []() -> double { return quality.width(); });
+  metrics.gauge("quality_kbps", "Bitrate of the frames the controlled consumer took",
+                []() -> double { return quality.kbps(); });
+  metrics.counter("quality_steps_down_total", "Steps to a higher compression or smaller frame size", &quality.stepsDown());
+  metrics.counter("quality_steps_up_total", "Steps to a lower compression or larger frame size", &quality.stepsUp());
+  metrics.counter("motion_frames_analysed_total", "Frames the motion detector analysed", &motion.analysed());
+  metrics.counter("motion_frames_skipped_total", "Frames offered while the motion detector was busy", &motion.skipped());
+  metrics.counter("motion_events_total", "Times motion started", &motion.events());
+  metrics.gauge("motion_activity_levels", "Mean luma change between the last two analysed frames",
+                []() -> double { return motion.activity() / 16.0; });
+  metrics.gauge("motion_score_blocks", "Changed blocks in the last analysed frame",
+                []() -> double { return motion.score(); });
+  metrics.histogram("motion_analyse_seconds", "Decode and analysis of a frame by the motion detector", &motion.analyseTime());
+  metrics.gauge("pre_event_held_seconds", "Seconds of frames waiting in the pre-event ring",
+                []() -> double { return preEvent.heldSeconds(); });
+  metrics.gauge("pre_event_used_bytes", "Bytes of frames waiting in the pre-event ring",
+                []() -> double { return preEvent.usedBytes(); });
+  metrics.counter("overlay_frames_edited_total", "Frames the masks and clock were edited into", &overlay.editedFrames());
+  metrics.counter("overlay_frames_dropped_total", "Frames dropped because their masks couldn't be edited in",
+                  &overlay.droppedFrames());
+  metrics.histogram("overlay_edit_seconds", "Editing the masks and clock into a frame", &overlay.editTime());
+
+  metrics.counter("recorder_frames_total", "Frames queued for the SD card",
+                  []() -> double { return recordedFrames; });
+  metrics.counter("recorder_frames_repeated_total", "Frames of a still scene recorded as repeats",
+                  &decimator.repeatedFrames());
+  metrics.counter("recorder_repeat_saved_bytes_total", "JPEG bytes repeats kept off the SD card",
+                  []() -> double { return decimator.savedKB() * 1024.0; });
+  metrics.counter("recorder_frames_dropped_total", "Captured frames the recorder could not take",
+                  []() -> double { return recordDropped; });
+  metrics.counter("recorder_rotations_total", "Switches to a new recording segment",
+                  []() -> double { return recorder.rotations(); });
+  metrics.counter("sd_writes_total", "Block writes to the SD card",
+                  []() -> double { return sdWriter.writes(); });
+  metrics.counter("sd_written_bytes_total", "Bytes written to the SD card",
+                  []() -> double { return sdWriter.writtenKB() * 1024.0; });
+  metrics.counter("sd_ring_overflow_frames_total", "Frames dropped because the SD writer ring was full",
+                  []() -> double { return sdWriter.overflowFrames(); });
+  metrics.histogram("sd_write_seconds", "Latency of each SD block write", &sdWriter.writeLatency());
+  metrics.gauge("sd_ring_queued_bytes", "Recording data waiting for the SD card",
+                []() -> double { return sdWriter.queuedBytes(); });
+  metrics.gauge("sd_free_bytes", "Free space on the card at the last storage sample", []() -> double {
+    StorageSample card = storageStats.sample();
+    return card.valid ? card.freeBytes() : NAN;
+  });
+
+  metrics.counter("http_frame_requests_total", "/frame requests", &frameRequests);
+  metrics.counter("http_frame_unavailable_total", "/frame requests answered 503", &frameUnavailable);
+  metrics.histogram("http_frame_send_seconds", "From a /frame request to its last byte handed to TCP", &frameSend);
+  const MjpegTotals& stream = broadcaster.totals();
+  metrics.counter("stream_connections_total", "/stream viewers admitted", &stream.connections);
+  metrics.counter("stream_rejected_total", "/stream viewers turned away with every slot taken", &stream.rejected);
+  metrics.counter("stream_frames_delivered_total", "Frames handed to TCP across all /stream viewers", &stream.delivered);
+  metrics.counter("stream_frames_dropped_total", "Frames /stream viewers skipped while sending an older one", &stream.dropped);
+  metrics.counter("stream_spills_total", "Frames copied out of the camera buffer for a slow viewer", &stream.spills);
+  metrics.gauge("frame_slab_blocks_in_use", "Frame slab blocks holding spilled frames",
+                []() -> double { return frameSlab.blocksInUse(); });
+  metrics.counter("frame_slab_failures_total", "Frame slab requests no size class had a block for", &frameSlab.failures());
+  metrics.counter("frame_slab_oversize_total", "Frame slab requests larger than the largest class", &frameSlab.oversize());
+  metrics.histogram("stream_part_send_seconds", "From a /stream part's first byte to its JPEG handed to TCP", &stream.partSend);
+  metrics.gauge("stream_clients", "Connected /stream viewers",
+                []() -> double { return broadcaster.activeCount(); });
+
+  metrics.gauge("heap_free_bytes", "Free internal heap",
+                []() -> double { return ESP.getFreeHeap(); });
+  metrics.gauge("heap_largest_free_block_bytes", "Largest allocatable internal heap block",
+                []() -> double { return heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT); });
+  metrics.gauge("psram_free_bytes", "Free PSRAM",
+                []() -> double { return heap_caps_get_free_size(MALLOC_CAP_SPIRAM); });
+  metrics.gauge("wifi_rssi_dbm", "Signal strength of the access point",
+                []() -> double { return WiFi.RSSI(); });
+  metrics.gauge("uptime_seconds", "Time since boot",
+                []() -> double { return esp_timer_get_time() / 1e6; });
+}
+
+// Sets channel's target from the request's name parameter, if there is one.
+// False if it isn't a rate: negative, or 0 where every frame makes no sense.
+bool setPacerTarget(AsyncWebServerRequest *request, const char* name, PacedChannel& channel, bool everyFrame) {
+  if (!request->hasParam(name)) return true;
+  String value = request->getParam(name)->value();
+  float fps = value.toFloat();
+  if (fps < 0 || (fps == 0 && (!everyFrame || value[0] != '0'))) return false;
+  channel.setTarget(fps);
+  return true;
+}
+
 void setupWebServer() {
   // Serve main page
   server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
@@ -437,196 +988,520 @@ void setupWebServer() {
   });
   
   // Stats endpoint
+  // Rendered with snprintf into the response's own buffer, and the card
+  // figures are the storage sampler's: no String building and no FAT walk on
+  // the async_tcp task, however many dashboards poll
   server.on("/stats", HTTP_GET, [](AsyncWebServerRequest *request){
-    float sdFreeGB = (float)(SD_MMC.cardSize() - SD_MMC.usedBytes()) / (1024.0 * 1024.0 * 1024.0);
-    String json = "{";
-    json += "\"mode\":\"" + getModeString() + "\",";
-    json += "\"heap\":" + String(ESP.getFreeHeap()) + ",";
-    json += "\"fps\":" + String(currentFPS, 1) + ",";
-    json += "\"sd_free_gb\":" + String(sdFreeGB, 2);
-    json += "}";
-    request->send(200, "application/json", json);
+    StorageSample card = storageStats.sample();
+    JsonResponse<STATS_JSON_MAX> *response = new JsonResponse<STATS_JSON_MAX>();
+    JsonWriter &out = response->out();
+    out.printf("{\"mode\":\"%s\",\"heap\":%u,\"fps\":%.1f,\"sd_free_gb\":%.2f",
+               getModeString(), (unsigned)ESP.getFreeHeap(), currentFPS,
+               card.freeBytes() / (1024.0 * 1024.0 * 1024.0));
+    if (card.valid) {
+      out.printf(",\"storage\":{\"total_gb\":%.2f,\"used_gb\":%.2f,\"age_s\":%lu,\"probe_ms\":%u}",
+                 card.totalBytes / (1024.0 * 1024.0 * 1024.0), card.usedBytes / (1024.0 * 1024.0 * 1024.0),
+                 (millis() - card.takenAt) / 1000, (unsigned)card.probeMs);
+    } else {
+      out.printf(",\"storage\":null");
+    }
+    out.printf(",\"recorded_frames\":%lu,\"record_dropped\":%lu,\"rotation\":", recordedFrames, recordDropped);
+    recorder.rotationJson(out);
+    out.printf(",\"sd_writer\":");
+    sdWriter.statsJson(out);
+    out.printf(",\"frame_slab\":");
+    frameSlab.json(out);
+    out.printf(",\"pacer\":");
+    pacer.json(out);
+    out.printf(",\"quality\":");
+    quality.json(out);
+    out.printf(",\"motion\":");
+    motion.json(out);
+    out.printf(",\"pre_event\":");
+    preEvent.json(out);
+    out.printf(",\"decimation\":");
+    decimator.json(out);
+    out.printf(",\"overlay\":");
+    overlay.json(out);
+    out.printf(",\"timelapse\":");
+    timelapse.json(out);
+    out.printf(",\"stream_clients\":%d,\"clients\":", broadcaster.activeCount());
+    broadcaster.clientsJson(out);
+    out.printf("}");
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Stats too large");
+      return;
+    }
+    request->send(response);
+  });
+
+  // Prometheus text exposition, see setupMetrics()
+  server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(metrics.beginResponse(request));
+  });
+
+  // Stage trace for Perfetto: /trace/start, reproduce the problem, then /trace
+  server.on("/trace/start", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (!tracer().start()) {
+      request->send(503, "text/plain", "Tracing unavailable");
+      return;
+    }
+    request->send(200, "text/plain", "Tracing started.");
+  });
+
+  server.on("/trace/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    tracer().stop();
+    request->send(200, "text/plain", "Tracing stopped.");
+  });
+
+  server.on("/trace", HTTP_GET, [](AsyncWebServerRequest *request){
+    request->send(tracer().beginResponse(request));
+  });
+
+  // Per-task CPU share, stack headroom and wakeups, see src/task_topology.h
+  server.on("/tasks", HTTP_GET, [](AsyncWebServerRequest *request){
+    JsonResponse<TASKS_JSON_MAX> *response = new JsonResponse<TASKS_JSON_MAX>();
+    taskStats.json(response->out());
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Tasks too large");
+      return;
+    }
+    request->send(response);
   });
   
   // High-performance frame endpoint
   server.on("/frame", HTTP_GET, [](AsyncWebServerRequest *request){
-    if (currentMode != MODE_STREAMING || !frameReady) {
+    frameRequests.inc();
+    if (!streamActive) {
+      frameUnavailable.inc();
       request->send(503, "text/plain", "Not ready");
       return;
     }
     
-    if (xSemaphoreTake(frameMutex, pdMS_TO_TICKS(5)) == pdTRUE) {
-      if (currentFrame && frameReady) {
-        AsyncWebServerResponse *response = request->beginResponse_P(
-          200, 
-          "image/jpeg", 
-          currentFrame->buf, 
-          currentFrame->len
-        );
-        response->addHeader("Cache-Control", "no-cache");
-        response->addHeader("Connection", "close");
-        request->send(response);
-        frameCount++;
-        frameReady = false;
-      } else {
-        request->send(503, "text/plain", "No frame");
-      }
-      xSemaphoreGive(frameMutex);
-    } else {
-      request->send(503, "text/plain", "Busy");
+    // Always the newest frame: nothing is consumed, so concurrent clients
+    // don't take frames away from each other. The response keeps its own
+    // reference, so the fb can't be handed back to the driver (and
+    // overwritten) while it is still being sent
+    FrameRef frame = latestFrame.get();
+    if (!frame) {
+      frameUnavailable.inc();
+      request->send(503, "text/plain", "No frame");
+      return;
     }
+    AsyncWebServerResponse *response = beginFrameResponse(request, frame, &frameSend);
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("Connection", "close");
+    response->addHeader("X-Frame-Seq", String(frame.seq()));
+    request->send(response);
   });
   
   // Start streaming
   server.on("/stream/start", HTTP_GET, [](AsyncWebServerRequest *request){
-    if(currentMode != MODE_IDLE) {
-      request->send(409, "text/plain", "Device is busy.");
+    if (streamActive) {
+      request->send(200, "text/plain", "Already streaming.");
       return;
     }
     
-    sensor_t * s = esp_camera_sensor_get();
-    if (s != NULL) {
-      s->set_special_effect(s, 2); // Grayscale for black and white
-      s->set_framesize(s, FRAMESIZE_QVGA); // Smaller resolution for higher FPS
-      s->set_quality(s, 30); // Lower quality (higher compression) for smaller frames, higher FPS
-      s->set_saturation(s, -2); // Minimize color processing
-    }
-    
-    currentMode = MODE_STREAMING;
     streamActive = true;
-    frameCount = 0;
-    lastFPSTime = millis();
-    frameReady = false;
+    applySensorProfile();
+    if (!recordingActive) {
+      frameCount = 0;
+      lastFPSTime = millis();
+    }
+    wakeCamera();
     
-    Serial.println("High-performance black and white streaming mode activated");
+    Serial.println("High-performance streaming mode activated");
     request->send(200, "text/plain", "Streaming started.");
   });
 
+  // Stop streaming; recording, if any, carries on
+  server.on("/stream/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    streamActive = false;
+    if (!recordingActive) publishFrame(nullptr);
+    applySensorProfile();
+    
+    Serial.println("Streaming stopped");
+    request->send(200, "text/plain", "Streaming stopped.");
+  });
+
+  // Multipart MJPEG push stream: one connection per viewer. Registered after
+  // /stream/start and /stream/stop because "/stream" also matches every
+  // "/stream/..." URL.
+  server.on("/stream", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (!streamActive) {
+      request->send(503, "text/plain", "Not streaming");
+      return;
+    }
+    
+    AsyncWebServerResponse *response = broadcaster.beginStream(request);
+    if (!response) {
+      request->send(503, "text/plain", "Too many viewers");
+      return;
+    }
+    request->send(response);
+  });
+  
   // Start recording
   server.on("/recording/start", HTTP_GET, [](AsyncWebServerRequest *request){
-    if(currentMode != MODE_IDLE) {
-      request->send(409, "text/plain", "Device is busy.");
+    if (recordingActive && !recordStopRequested) {
+      recordingByMotion = false; // Keep it past the motion
+      request->send(200, "text/plain", "Already recording.");
       return;
     }
     
-    sensor_t * s = esp_camera_sensor_get();
-    if (s != NULL) {
-      s->set_special_effect(s, 0); // Color mode
-      s->set_framesize(s, FRAMESIZE_VGA); // Higher resolution for quality
-      s->set_quality(s, 10); // Higher quality (lower compression)
-      s->set_saturation(s, 0); // Normal saturation for color
+    // Opening the segment, the catalog journal and eviction are card work
+    // for loop(), not async_tcp
+    recordStopRequested = false;
+    recordStartRequested = true;
+    xTaskNotifyGive(loopTaskHandle);
+    request->send(202, "text/plain", "Recording starting.");
+  });
+
+  // Stop recording; the stream, if any, carries on
+  server.on("/recording/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    // Closing the segment and the catalog work are loop()'s, like opening
+    recordStartRequested = false;
+    recordStopRequested = true;
+    xTaskNotifyGive(loopTaskHandle);
+    request->send(202, "text/plain", "Recording stopping.");
+  });
+
+  // Listing, time-seek playback (?t=seconds&speed=N) and Range downloads of
+  // finished segments
+  server.on("/recordings", HTTP_GET, [](AsyncWebServerRequest *request){
+    recordings.handle(request);
+  });
+
+  // Per-consumer frame rates against what they achieve; ?live=, ?record= and
+  // ?timelapse= set targets in FPS (0 for every frame, not for stills)
+  server.on("/pacer", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (!setPacerTarget(request, "live", pacer.live, true) ||
+        !setPacerTarget(request, "record", pacer.record, true) ||
+        !setPacerTarget(request, "timelapse", pacer.timelapse, false) ||
+        !setPacerTarget(request, "motion", pacer.motion, true)) {
+      request->send(400, "text/plain", "Bad frame rate.");
+      return;
     }
-    
-    startRecording();
-    request->send(200, "text/plain", "Recording started.");
+    JsonResponse<PACER_JSON_MAX> *response = new JsonResponse<PACER_JSON_MAX>();
+    pacer.json(response->out());
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Pacer too large");
+      return;
+    }
+    request->send(response);
   });
 
-  // Stop all
-  server.on("/stop", HTTP_GET, [](AsyncWebServerRequest *request){
-    stopRecording();
-    streamActive = false;
-    currentMode = MODE_IDLE;
-    frameReady = false;
-    
-    if (xSemaphoreTake(frameMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-      if (currentFrame) {
-        esp_camera_fb_return(currentFrame);
-        currentFrame = nullptr;
+  // Stills at the pacer's timelapse rate into a new /timelapse/NNNN run;
+  // ?every=seconds sets the rate
+  server.on("/timelapse/start", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (request->hasParam("every")) {
+      float every = request->getParam("every")->value().toFloat();
+      if (every <= 0) {
+        request->send(400, "text/plain", "Bad interval.");
+        return;
       }
-      xSemaphoreGive(frameMutex);
+      pacer.timelapse.setTarget(1 / every);
     }
-    
-    // Reset sensor to default
-    sensor_t * s = esp_camera_sensor_get();
-    if (s != NULL) {
-      s->set_special_effect(s, 0);
-      s->set_framesize(s, FRAMESIZE_CIF);
-      s->set_quality(s, 20);
+    if (timelapse.active()) {
+      request->send(200, "text/plain", "Already taking stills.");
+      return;
+    }
+    timelapseStartRequested = true;
+    xTaskNotifyGive(loopTaskHandle);
+    request->send(202, "text/plain", "Time-lapse starting.");
+  });
+
+  server.on("/timelapse/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    timelapseStartRequested = false;
+    timelapse.stop();
+    request->send(200, "text/plain", "Time-lapse stopped.");
+  });
+
+  // Record on motion until /motion/stop
+  server.on("/motion/start", HTTP_GET, [](AsyncWebServerRequest *request){
+    motion.arm(true);
+    applySensorProfile(); // The recording's, for the pre-event frames
+    wakeCamera();
+    request->send(200, "text/plain", "Motion detection armed.");
+  });
+
+  // A recording motion started stops now; loop() does it
+  server.on("/motion/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    motion.arm(false);
+    applySensorProfile();
+    xTaskNotifyGive(loopTaskHandle);
+    request->send(200, "text/plain", "Motion detection disarmed.");
+  });
+
+  // Detector state; ?hold=seconds, ?threshold=level and ?blocks=count tune it.
+  // After /motion/start and /motion/stop, which it would match as well
+  server.on("/motion", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (request->hasParam("hold")) motion.setHold(request->getParam("hold")->value().toInt());
+    if (request->hasParam("threshold")) {
+      long level = request->getParam("threshold")->value().toInt();
+      if (level < 1 || level > 255) {
+        request->send(400, "text/plain", "Bad threshold.");
+        return;
+      }
+      motion.setThreshold(level);
+    }
+    if (request->hasParam("blocks")) {
+      long blocks = request->getParam("blocks")->value().toInt();
+      if (blocks < 1) {
+        request->send(400, "text/plain", "Bad block count.");
+        return;
+      }
+      motion.setMinBlocks(blocks);
+    }
+    JsonResponse<MOTION_JSON_MAX> *response = new JsonResponse<MOTION_JSON_MAX>();
+    motion.json(response->out());
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Motion too large");
+      return;
+    }
+    request->send(response);
+  });
+
+  // Static-scene decimation; ?enable=0|1, ?level=levels, ?size=percent and
+  // ?keepalive=seconds change it
+  server.on("/decimation", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (request->hasParam("enable")) decimator.enable(request->getParam("enable")->value().toInt() != 0);
+    if (request->hasParam("level")) {
+      float levels = request->getParam("level")->value().toFloat();
+      if (levels < 0 || levels > 255) {
+        request->send(400, "text/plain", "Bad level.");
+        return;
+      }
+      decimator.setLevel(levels);
+    }
+    if (request->hasParam("size")) {
+      long pct = request->getParam("size")->value().toInt();
+      if (pct < 0 || pct > 100) {
+        request->send(400, "text/plain", "Bad size percentage.");
+        return;
+      }
+      decimator.setSizePct(pct);
+    }
+    if (request->hasParam("keepalive")) {
+      float seconds = request->getParam("keepalive")->value().toFloat();
+      if (seconds <= 0 || seconds > 3600) {
+        request->send(400, "text/plain", "Bad keep-alive.");
+        return;
+      }
+      decimator.setKeepAlive(seconds);
+    }
+    JsonResponse<DECIMATION_JSON_MAX> *response = new JsonResponse<DECIMATION_JSON_MAX>();
+    decimator.json(response->out());
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Decimation too large");
+      return;
+    }
+    request->send(response);
+  });
+
+  // Privacy masks and clock; ?mask=x,y,w,h;... in percent (empty clears the
+  // masks), ?clock=top|bottom|off and ?level=luma change them
+  server.on("/overlay", HTTP_GET, [](AsyncWebServerRequest *request){
+    if (request->hasParam("mask") && !overlay.setMasks(request->getParam("mask")->value().c_str())) {
+      request->send(400, "text/plain", "Bad mask.");
+      return;
+    }
+    if (request->hasParam("clock")) {
+      String clock = request->getParam("clock")->value();
+      if (clock == "top") {
+        overlay.setClock(OVERLAY_CLOCK_TOP);
+      } else if (clock == "bottom") {
+        overlay.setClock(OVERLAY_CLOCK_BOTTOM);
+      } else if (clock == "off") {
+        overlay.setClock(OVERLAY_CLOCK_OFF);
+      } else {
+        request->send(400, "text/plain", "Bad clock.");
+        return;
+      }
     }
+    if (request->hasParam("level")) {
+      long level = request->getParam("level")->value().toInt();
+      if (level < 0 || level > 255) {
+        request->send(400, "text/plain", "Bad level.");
+        return;
+      }
+      overlay.setLevel(level);
+    }
+    JsonResponse<OVERLAY_JSON_MAX> *response = new JsonResponse<OVERLAY_JSON_MAX>();
+    overlay.json(response->out());
+    if (!response->finish()) {
+      delete response;
+      request->send(500, "text/plain", "Overlay too large");
+      return;
+    }
+    request->send(response);
+  });
+
+  // Stop all
+  server.on("/stop", HTTP_GET, [](AsyncWebServerRequest *request){
+    streamActive = false;
+    timelapseStartRequested = false;
+    timelapse.stop();
+    motion.arm(false);
+    publishFrame(nullptr); // fb goes back once in-flight responses finish
+    recordStartRequested = false;
+    recordStopRequested = true; // loop() closes the segment and applies the sensor profile
+    xTaskNotifyGive(loopTaskHandle);
     
     Serial.println("All operations stopped");
-    request->send(200, "text/plain", "Stopped.");
+    request->send(202, "text/plain", "Stopped.");
   });
 }
 
 void startRecording() {
-  manageStorage();
-
-  int videoFileNumber = 0;
-  do {
-    videoFileNumber++;
-    sprintf(currentFileName, "/rec_%03d.mjpg", videoFileNumber);
-  } while (SD_MMC.exists(currentFileName));
-
-  videoFile = SD_MMC.open(currentFileName, FILE_WRITE);
+  char fileName[30];
+  char indexName[30];
+  uint32_t id = catalog.create(fileName, indexName, sizeof(fileName));
+  if (!id) {
+    Serial.println("Segment catalog not available!");
+    return;
+  }
 
-  if (!videoFile) {
+  File file = SD_MMC.open(fileName, FILE_WRITE);
+  File index = SD_MMC.open(indexName, FILE_WRITE);
+  if (!file || !index || !recorder.open(file, index, id)) {
     Serial.println("Failed to open file for writing!");
-    currentMode = MODE_IDLE;
+    file.close();
+    index.close();
+    catalog.discard(id);
     return;
   }
+  catalog.start(id, (uint32_t)(preEvent.heldSeconds() + 0.5f)); // Its first frames are the pre-event ring's
 
-  currentMode = MODE_RECORDING;
+  strcpy(currentFileName, fileName);
+  recordingActive = true;
   recordingStartTime = millis();
+  wakeCamera();
   Serial.printf("Recording started: %s\n", currentFileName);
+  manageStorage();
+  prepareNextSegment();
 }
 
-void stopRecording() {
-  if (currentMode == MODE_RECORDING && videoFile) {
-    videoFile.close();
-    Serial.printf("Recording saved: %s\n", currentFileName);
+// Create the next segment's files while this one records, so the rotation
+// itself needs no card access (see AviRecorder::prepare)
+void prepareNextSegment() {
+  lastPrepareAttempt = millis();
+  if (!recordingActive || nextSegmentId) return;
+  char indexName[30];
+  uint32_t id = catalog.create(nextFileName, indexName, sizeof(nextFileName));
+  if (!id) return;
+
+  File file = SD_MMC.open(nextFileName, FILE_WRITE);
+  File index = SD_MMC.open(indexName, FILE_WRITE);
+  if (!file || !index || !recorder.prepare(file, index, id)) {
+    Serial.println("Failed to prepare the next segment!");
+    file.close();
+    index.close();
+    catalog.discard(id);
+    return;
   }
-  currentMode = MODE_IDLE;
+  nextSegmentId = id;
 }
 
-void recordFrame() {
-  if (!videoFile) return;
+// cameraTask switched to the prepared segment between two frames; record the
+// finished one and get the one after ready
+void finishRotation() {
+  AviSegmentSummary finished;
+  if (!recorder.takeRotated(finished)) return;
+  catalog.finish(finished.id, finished);
+  catalog.start(nextSegmentId);
+  Serial.printf("Recording saved: %s, continuing in %s\n", currentFileName, nextFileName);
+  strcpy(currentFileName, nextFileName);
+  nextSegmentId = 0;
+  recordingStartTime = millis();
+  manageStorage();
+  prepareNextSegment();
+}
 
-  camera_fb_t* fb = esp_camera_fb_get();
-  if (!fb) return;
+void stopRecording() {
+  if (!recordingActive) return;
+  recordingActive = false;
+  broadcaster.setYield(false);
+  AviSegmentSummary finished;
+  recorder.close(&finished); // Queued frames and the index are still written first
+  AviSegmentSummary rotated;
+  if (recorder.takeRotated(rotated)) {
+    // Rotated just before the stop; what close() finished was the standby
+    catalog.finish(rotated.id, rotated);
+    catalog.start(nextSegmentId);
+    strcpy(currentFileName, nextFileName);
+    nextSegmentId = 0;
+  }
+  if (finished.finished) catalog.finish(finished.id, finished);
+  uint32_t spare = recorder.dropStandby();
+  if (spare) catalog.discard(spare);
+  nextSegmentId = 0;
+  Serial.printf("Recording saved: %s\n", currentFileName);
+}
 
-  // Write raw JPEG frame to MJPEG file
-  videoFile.write(fb->buf, fb->len);
-  
-  esp_camera_fb_return(fb);
+// A new card usage sample: the catalog's free space follows the card, and
+// old segments go if it is below STORAGE_THRESHOLD
+void syncStorage() {
+  StorageSample card = storageStats.sample();
+  if (!card.valid || card.count == storageSynced) return;
+  storageSynced = card.count;
+  catalog.syncFreeBytes(card.freeBytes());
+  manageStorage();
 }
 
+// Make room until STORAGE_THRESHOLD is free again: finished time-lapse runs
+// go first, a batch of stills at a time, then the oldest segments. The
+// catalog knows every segment's size, so this takes no directory scan; what
+// the stills freed shows in the next card sample.
 void manageStorage() {
-  uint64_t freeSpace = SD_MMC.cardSize() - SD_MMC.usedBytes();
-  if (freeSpace < STORAGE_THRESHOLD) {
-    Serial.println("Managing storage...");
-    File root = SD_MMC.open("/");
-    File file = root.openNextFile();
-    char oldestFile[30] = "";
-    int oldestFileNum = INT_MAX;
-    
-    while(file){
-      String fileName = file.name();
-      if (fileName.startsWith("rec_") && fileName.endsWith(".mjpg")) {
-        int fileNum = fileName.substring(4, 7).toInt();
-        if (fileNum < oldestFileNum) {
-          oldestFileNum = fileNum;
-          strcpy(oldestFile, file.name());
-        }
-      }
-      file = root.openNextFile();
-    }
-    root.close();
-    
-    if (oldestFileNum != INT_MAX) {
-      char fullPath[40];
-      sprintf(fullPath, "/%s", oldestFile);
-      Serial.printf("Deleted: %s\n", fullPath);
-      SD_MMC.remove(fullPath);
-    }
+  if (catalog.freeBytes() >= STORAGE_THRESHOLD) return;
+  if (timelapse.removeOldest()) {
+    storageStats.refresh(); // syncStorage() comes back here with the new sample
+    return;
+  }
+  size_t deleted = catalog.evict(STORAGE_THRESHOLD);
+  if (deleted) {
+    Serial.printf("Managing storage: deleted %u segment(s)\n", (unsigned)deleted);
+    storageStats.refresh();
   }
 }
 
-String getModeString() {
-  switch(currentMode) {
-    case MODE_IDLE: return "IDLE";
-    case MODE_STREAMING: return "STREAMING";
-    case MODE_RECORDING: return "RECORDING";
-    default: return "UNKNOWN";
+// StorageProbe for storageStats; runs on the sampler task.
+bool probeCard(uint64_t* totalBytes, uint64_t* usedBytes) {
+  *totalBytes = SD_MMC.cardSize();
+  *usedBytes = SD_MMC.usedBytes();
+  return *totalBytes > 0;
+}
+
+// One sensor configuration serves every consumer, so pick it from what is
+// running. Recording wins: while it runs, viewers watch the recording's color
+// VGA frames. So does motion detection, whose pre-event frames open the
+// recording and must match the rest of it.
+void applySensorProfile() {
+  sensor_t * s = esp_camera_sensor_get();
+  if (s == NULL) return;
+  
+  // All in one call, under the controller's lock, so these writes never
+  // interleave with its own from cameraTask
+  if (recordingActive || motion.armed()) {
+    quality.setProfile(&recordQuality, s, {0, 0}); // Color, normal saturation; VGA, quality adapts to the card
+  } else if (streamActive) {
+    quality.setProfile(&streamQuality, s, {2, -2}); // Grayscale, minimal color processing; QVGA to start, adapts to the viewers
+  } else {
+    quality.setFixed(FRAMESIZE_CIF, 20, s, {0, -1});
   }
+}
+
+const char* getModeString() {
+  if (streamActive && recordingActive) return "STREAMING+RECORDING";
+  if (recordingActive) return "RECORDING";
+  if (streamActive) return "STREAMING";
+  if (timelapse.active()) return "TIMELAPSE";
+  if (motion.armed()) return "MOTION";
+  return "IDLE";
 }
\ No newline at end of file
@@ -0,0 +1,713 @@
+#pragma once
+// Indexed MJPEG AVI recording on top of SdWriter.
+//
+// Bare concatenated JPEGs carry no timestamps and no index: a player has to
+// scan the whole file to find frame N and can only guess the frame rate.
+// Each segment is now a standard RIFF AVI (one MJPG video stream, frames as
+// '00dc' chunks in the movi list, an idx1 index at the end) that desktop
+// players open directly, plus a sidecar rec_NNN.idx with one AviIndexEntry
+// (file offset, length, capture timestamp, scene activity) per frame, so
+// seeking by frame number or time is a single read, and finding where
+// something happened is a scan of the sidecar, not of the video.
+//
+// The index is built in RAM as frames are appended, in chunks of
+// AVI_INDEX_CHUNK entries. A full chunk is a checkpoint: it is queued to the
+// SdWriter task, which appends it to the sidecar, so a power cut loses at most
+// one chunk of index. Closing a segment queues a flushing call behind the
+// segment's last frame; the writer task then appends the rest of the index
+// and takes the file over, and the next segment's frames go on being written
+// while it copies the sidecar into idx1, one index chunk per background step
+// (SdWriter::background()), and finally rewrites the AVI header with the
+// final sizes, frame count and the frame rate measured from the timestamps.
+//
+// Rotation is gapless: the next segment's files are created and handed over
+// with prepare() while the current one is still recording, so the FAT
+// directory work is done before the rotation is due. rotate() only raises a
+// flag; the next addFrame() finishes the current segment and switches to the
+// standby one before appending its frame, all in memory. Every frame lands in
+// one segment or the other, and the old file is closed by the writer task
+// once its last frame and index are on the card.
+//
+// A frame the same as the last one can go in as a repeat (addRepeat()): an
+// empty '00dc' chunk, the way AVI marks a dropped frame, which players show
+// as the frame before. It keeps its place in the frame rate and its own
+// timestamp in the sidecar. A segment always starts with a real frame.
+//
+// addFrame() is called from cameraTask, open()/close() from the HTTP and loop
+// tasks; a mutex keeps them apart but never spans a card access. The loop
+// task need not poll: notifyTo() has addFrame() wake it when a rotation has
+// finished a segment or the open one has filled up.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "json_writer.h"
+#include "sd_writer.h"
+
+const size_t AVI_HEADER_SIZE = 512;                    // hdrl + JUNK, frame data starts sector aligned
+const uint32_t AVI_MOVI_OFFSET = AVI_HEADER_SIZE - 4;  // 'movi' fourcc, what idx1 offsets count from
+const uint64_t AVI_MAX_BYTES = 0xF0000000ULL;          // stay clear of FAT32's 4 GB file limit
+const size_t AVI_INDEX_CHUNK = 256;                    // index entries per checkpoint
+const size_t AVI_INDEX_CHUNKS = 4;
+const size_t AVI_SEGMENTS = 4;                         // open, standby, and ones still being finished
+const uint32_t AVI_DEFAULT_FRAME_US = 50000;           // header value until a second frame is seen
+const size_t AVI_IDX1_ENTRY_SIZE = 16;
+const size_t AVI_INDEX_V1_ENTRY_SIZE = 16;             // sidecars written before activity scores
+
+// Sidecar .idx layout: an AviIndexHeader followed by one entry per frame, in
+// file order. Little endian, like the AVI. Version 1 entries stop after
+// timestampUs; aviReadIndex() reads both.
+struct AviIndexHeader {
+  char magic[4];        // "MJIX"
+  uint16_t version;     // 2
+  uint16_t entrySize;   // sizeof(AviIndexEntry)
+  uint32_t moviOffset;  // AVI_MOVI_OFFSET
+  uint32_t reserved;
+};
+
+struct AviIndexEntry {
+  uint32_t offset;      // first JPEG byte in the .avi
+  uint32_t length;      // JPEG bytes; 0 for a repeat of the frame before (addRepeat)
+  int64_t timestampUs;  // capture time, esp_timer clock
+  uint16_t activity;    // scene change, 1/16 luma levels (see motion.h); 0 in version 1
+  uint16_t reserved[3];
+};
+
+struct AviSegmentInfo {
+  uint32_t frames;
+  uint32_t moviBytes;   // '00dc' chunks, headers and padding included
+  uint32_t usPerFrame;
+  uint32_t maxFrameLen;
+  uint16_t width;
+  uint16_t height;
+};
+
+// What a finished segment ended up as, for the caller's bookkeeping.
+struct AviSegmentSummary {
+  bool finished;        // false: there was no open segment
+  uint32_t id;          // as given to open() / prepare()
+  uint64_t bytes;       // .avi plus sidecar .idx
+  uint32_t frames;
+  uint32_t durationMs;  // first to last frame
+};
+
+inline uint8_t* aviPutFourcc(uint8_t* p, const char* cc) {
+  memcpy(p, cc, 4);
+  return p + 4;
+}
+
+inline uint8_t* aviPut32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+inline uint8_t* aviPut16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+// The AVI_HEADER_SIZE bytes in front of the first frame chunk. Written with
+// zero counts when a segment opens and rewritten when it is finished.
+inline void aviBuildHeader(uint8_t* h, const AviSegmentInfo& s) {
+  uint32_t fps = s.usPerFrame ? (1000000 + s.usPerFrame / 2) / s.usPerFrame : 0;
+  uint32_t idx1Bytes = 8 + s.frames * AVI_IDX1_ENTRY_SIZE;
+  memset(h, 0, AVI_HEADER_SIZE);
+  uint8_t* p = h;
+  p = aviPutFourcc(p, "RIFF");
+  p = aviPut32(p, AVI_HEADER_SIZE - 8 + s.moviBytes + idx1Bytes);
+  p = aviPutFourcc(p, "AVI ");
+
+  p = aviPutFourcc(p, "LIST");
+  p = aviPut32(p, 192);
+  p = aviPutFourcc(p, "hdrl");
+  p = aviPutFourcc(p, "avih");
+  p = aviPut32(p, 56);
+  p = aviPut32(p, s.usPerFrame);
+  p = aviPut32(p, s.maxFrameLen * fps);  // dwMaxBytesPerSec
+  p = aviPut32(p, 0);                    // dwPaddingGranularity
+  p = aviPut32(p, 0x10);                 // AVIF_HASINDEX
+  p = aviPut32(p, s.frames);
+  p = aviPut32(p, 0);                    // dwInitialFrames
+  p = aviPut32(p, 1);                    // dwStreams
+  p = aviPut32(p, s.maxFrameLen);        // dwSuggestedBufferSize
+  p = aviPut32(p, s.width);
+  p = aviPut32(p, s.height);
+  p += 16;                               // dwReserved[4]
+
+  p = aviPutFourcc(p, "LIST");
+  p = aviPut32(p, 116);
+  p = aviPutFourcc(p, "strl");
+  p = aviPutFourcc(p, "strh");
+  p = aviPut32(p, 56);
+  p = aviPutFourcc(p, "vids");
+  p = aviPutFourcc(p, "MJPG");
+  p = aviPut32(p, 0);                    // dwFlags
+  p = aviPut32(p, 0);                    // wPriority, wLanguage
+  p = aviPut32(p, 0);                    // dwInitialFrames
+  p = aviPut32(p, s.usPerFrame);         // dwScale / dwRate = seconds per frame
+  p = aviPut32(p, 1000000);
+  p = aviPut32(p, 0);                    // dwStart
+  p = aviPut32(p, s.frames);             // dwLength
+  p = aviPut32(p, s.maxFrameLen);
+  p = aviPut32(p, 0xFFFFFFFF);           // dwQuality: default
+  p = aviPut32(p, 0);                    // dwSampleSize
+  p = aviPut16(p, 0);                    // rcFrame
+  p = aviPut16(p, 0);
+  p = aviPut16(p, s.width);
+  p = aviPut16(p, s.height);
+
+  p = aviPutFourcc(p, "strf");
+  p = aviPut32(p, 40);
+  p = aviPut32(p, 40);                   // BITMAPINFOHEADER.biSize
+  p = aviPut32(p, s.width);
+  p = aviPut32(p, s.height);
+  p = aviPut16(p, 1);                    // biPlanes
+  p = aviPut16(p, 24);                   // biBitCount
+  p = aviPutFourcc(p, "MJPG");
+  p = aviPut32(p, (uint32_t)s.width * s.height * 3);
+  p += 16;                               // resolution, palette
+
+  uint32_t junk = AVI_HEADER_SIZE - (p - h) - 8 - 12;
+  p = aviPutFourcc(p, "JUNK");
+  p = aviPut32(p, junk);
+  p += junk;
+
+  p = aviPutFourcc(p, "LIST");
+  p = aviPut32(p, 4 + s.moviBytes);
+  aviPutFourcc(p, "movi");
+}
+
+// Entry size of a sidecar opened for reading, from its header; 0 if it is
+// not one.
+inline size_t aviIndexEntrySize(File& idx) {
+  AviIndexHeader ih;
+  if (!idx || !idx.seek(0) || idx.read((uint8_t*)&ih, sizeof(ih)) != sizeof(ih) || memcmp(ih.magic, "MJIX", 4) != 0 ||
+      ih.entrySize < AVI_INDEX_V1_ENTRY_SIZE || ih.entrySize > sizeof(AviIndexEntry)) {
+    return 0;
+  }
+  return ih.entrySize;
+}
+
+inline uint32_t aviIndexFrames(File& idx, size_t entrySize) {
+  if (!entrySize || idx.size() < sizeof(AviIndexHeader)) return 0;
+  return (idx.size() - sizeof(AviIndexHeader)) / entrySize;
+}
+
+// Read up to count entries from entry first of a sidecar with entrySize
+// entries; fields an older version lacks come back 0. Returns how many were
+// read.
+inline size_t aviReadIndex(File& idx, size_t entrySize, uint32_t first, AviIndexEntry* out, size_t count) {
+  if (!entrySize || !idx.seek(sizeof(AviIndexHeader) + (size_t)first * entrySize)) return 0;
+  size_t n = idx.read((uint8_t*)out, count * entrySize) / entrySize;
+  if (entrySize < sizeof(AviIndexEntry)) {
+    // Spread out from the back, so no entry is overwritten before it moves
+    for (size_t i = n; i-- > 0;) {
+      uint8_t* dst = (uint8_t*)&out[i];
+      memmove(dst, (uint8_t*)out + i * entrySize, entrySize);
+      memset(dst + entrySize, 0, sizeof(AviIndexEntry) - entrySize);
+    }
+  }
+  return n;
+}
+
+class AviRecorder {
+ public:
+  explicit AviRecorder(SdWriter& writer) : writer_(writer) {}
+
+  // fs is where the sidecars live; it is reopened for reading when a segment
+  // is finished.
+  bool begin(FS& fs) {
+    fs_ = &fs;
+    for (size_t i = 0; i < AVI_INDEX_CHUNKS; i++) {
+      chunks_[i].entries = (AviIndexEntry*)alloc(AVI_INDEX_CHUNK * sizeof(AviIndexEntry));
+      if (!chunks_[i].entries) return false;
+    }
+    copyBuf_ = (uint8_t*)alloc(AVI_INDEX_CHUNK * sizeof(AviIndexEntry));
+    lock_ = xSemaphoreCreateMutex();
+    return copyBuf_ && lock_;
+  }
+
+  // Start a new segment with id in avi, indexed into idx (both freshly opened
+  // for writing). The open segment, if any, is finished behind its last frame
+  // and described in *finished. False if the writer is too far behind to take
+  // another segment.
+  bool open(File avi, File idx, uint32_t id, AviSegmentSummary* finished = nullptr) {
+    if (finished) finished->finished = false;
+    if (!lock_ || !writeIndexHeader(idx)) return false;
+
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    Segment* seg = freeSegment();
+    bool ok = seg != nullptr && writerHasRoom();
+    if (ok) {
+      finishCurrent(finished);
+      rotate_ = false;
+      seg->id = id;
+      seg->idx = idx;
+      ok = startSegment(seg, avi);
+    }
+    xSemaphoreGive(lock_);
+    return ok;
+  }
+
+  // Get the next segment ready while the open one is still recording: avi and
+  // idx are freshly opened for writing, so the card has already done the
+  // directory work when rotate() switches to it. One standby at a time; false
+  // if there is one already.
+  bool prepare(File avi, File idx, uint32_t id) {
+    if (!lock_ || !writeIndexHeader(idx)) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    Segment* seg = standby_ ? nullptr : freeSegment();
+    if (seg) {
+      seg->id = id;
+      seg->avi = avi;
+      seg->idx = idx;
+      seg->busy.store(true, std::memory_order_relaxed);
+      standby_ = seg;
+    }
+    xSemaphoreGive(lock_);
+    return seg != nullptr;
+  }
+
+  // Task to xTaskNotifyGive() when there is a rotated segment to take or the
+  // open segment is full. Set before recording starts.
+  void notifyTo(TaskHandle_t task) { notify_ = task; }
+
+  // A rotate() that has not switched segments yet.
+  bool rotationPending() {
+    if (!lock_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool pending = rotate_;
+    xSemaphoreGive(lock_);
+    return pending;
+  }
+
+  // Switch to the standby segment at the next frame boundary. Until there is
+  // a standby, the open segment just carries on.
+  void rotate() {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    if (current_ && !rotate_ && !rotated_.finished) {  // one not yet taken: already rotated
+      rotate_ = true;
+      if (!standby_) lateRotations_++;
+    }
+    xSemaphoreGive(lock_);
+  }
+
+  // After a rotation: the segment it finished, once. The standby it switched
+  // to is now the open segment.
+  bool takeRotated(AviSegmentSummary& finished) {
+    if (!lock_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool any = rotated_.finished;
+    if (any) {
+      finished = rotated_;
+      rotated_.finished = false;
+    }
+    xSemaphoreGive(lock_);
+    return any;
+  }
+
+  // Finish the open segment; frames are ignored until the next open().
+  void close(AviSegmentSummary* finished = nullptr) {
+    if (finished) finished->finished = false;
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    rotate_ = false;
+    if (current_) {
+      finishCurrent(finished);
+      writer_.close();
+    }
+    xSemaphoreGive(lock_);
+  }
+
+  // Give up the standby segment, closing its files. Returns its id so the
+  // caller can delete them, 0 if there was none.
+  uint32_t dropStandby() {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    Segment* seg = standby_;
+    standby_ = nullptr;
+    uint32_t id = 0;
+    File avi, idx;
+    if (seg) {
+      id = seg->id;
+      avi = seg->avi;
+      idx = seg->idx;
+      seg->avi = File();
+      seg->idx = File();
+      seg->busy.store(false, std::memory_order_release);
+    }
+    xSemaphoreGive(lock_);
+    avi.close();
+    idx.close();
+    return id;
+  }
+
+  // Append one JPEG to the open segment, with its activity score for the
+  // index. False if there is none, or the frame was dropped (ring or index
+  // chunks full); it is then not indexed either.
+  bool addFrame(const uint8_t* jpeg, size_t len, int64_t timestampUs,
+                uint16_t width, uint16_t height, uint16_t activity = 0) {
+    if (!lock_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool ok = false;
+    if (current_ && rotate_ && standby_ && writerHasRoom()) switchToStandby();
+    Segment* seg = current_;
+    if (len == 0 && (!seg || seg->info.frames == 0)) {
+      xSemaphoreGive(lock_);  // a repeat of nothing: the caller sends the frame itself
+      return false;
+    }
+    if (seg && seg->chunk && seg->chunk->count == AVI_INDEX_CHUNK) queueChunk(seg);
+    if (seg && !seg->chunk) seg->chunk = freeChunk();
+    if (seg && seg->chunk && seg->chunk->count < AVI_INDEX_CHUNK) {
+      uint8_t head[8];
+      static const uint8_t pad = 0;
+      aviPut32(aviPutFourcc(head, "00dc"), len);
+      SdWriter::Piece pieces[3] = {{head, sizeof(head)}, {jpeg, len}, {&pad, len & 1}};
+      ok = writer_.append(pieces, len ? 3 : 1);
+    }
+    if (ok) {
+      AviSegmentInfo& info = seg->info;
+      IndexChunk* chunk = seg->chunk;
+      AviIndexEntry& e = chunk->entries[chunk->count++];
+      e.offset = AVI_HEADER_SIZE + info.moviBytes + 8;
+      e.length = len;
+      e.timestampUs = timestampUs;
+      e.activity = activity;
+      memset(e.reserved, 0, sizeof(e.reserved));
+
+      if (info.frames++ == 0) {
+        seg->firstUs = timestampUs;
+        info.width = width;
+        info.height = height;
+      }
+      seg->lastUs = timestampUs;
+      info.moviBytes += 8 + len + (len & 1);
+      if (len > info.maxFrameLen) info.maxFrameLen = len;
+
+      if (chunk->count == AVI_INDEX_CHUNK) queueChunk(seg);
+      if (!rotate_ && full(seg) && notify_) xTaskNotifyGive(notify_);
+    }
+    if (ok && gapPending_) {
+      uint32_t gap = (uint32_t)(timestampUs - gapFromUs_);
+      lastGapUs_ = gap;
+      if (gap > maxGapUs_) maxGapUs_ = gap;
+      gapPending_ = false;
+    } else if (!ok && seg && (rotate_ || gapPending_ || finishing_.load(std::memory_order_relaxed))) {
+      rotationDropped_++;
+    }
+    xSemaphoreGive(lock_);
+    return ok;
+  }
+
+  // Index a frame that is the same as the one before: an empty chunk, which
+  // players show as a repeat of the previous frame, so the segment keeps its
+  // frame rate and timing without the JPEG (see frame_decimator.h). False if
+  // it could not be added, or the segment has no frame to repeat yet (the
+  // first after a rotation); send the frame itself then.
+  bool addRepeat(int64_t timestampUs, uint16_t activity = 0) {
+    return addFrame(nullptr, 0, timestampUs, 0, 0, activity);
+  }
+
+  // Frames in the open segment, 0 if none is open.
+  uint32_t segmentFrames() {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint32_t frames = current_ ? current_->info.frames : 0;
+    xSemaphoreGive(lock_);
+    return frames;
+  }
+
+  // The open segment is close to the FAT32 file size limit; rotate.
+  bool segmentFull() {
+    if (!lock_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool isFull = current_ && full(current_);
+    xSemaphoreGive(lock_);
+    return isFull;
+  }
+
+  // Segment switches since boot.
+  uint32_t rotations() {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint32_t n = rotations_;
+    xSemaphoreGive(lock_);
+    return n;
+  }
+
+  // JSON object for /stats. dropped counts frames the recorder refused while
+  // a rotation was due, or until the segment it finished was complete on the
+  // card, and gap_ms is the capture-time
+  // distance between the last frame of a segment and the first of the next:
+  // one frame interval when nothing was lost. late counts rotations that had
+  // to wait for a standby segment.
+  void rotationJson(JsonWriter& out) {
+    if (!lock_) {
+      out.printf("{}");
+      return;
+    }
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint32_t rotations = rotations_, dropped = rotationDropped_, late = lateRotations_;
+    uint32_t lastGap = lastGapUs_, maxGap = maxGapUs_;
+    xSemaphoreGive(lock_);
+    out.printf("{\"count\":%u,\"dropped\":%u,\"gap_ms\":%.1f,\"max_gap_ms\":%.1f,\"late\":%u}",
+               (unsigned)rotations, (unsigned)dropped, lastGap / 1000.0, maxGap / 1000.0,
+               (unsigned)late);
+  }
+
+ private:
+  struct Segment;
+
+  struct IndexChunk {
+    AviIndexEntry* entries = nullptr;
+    size_t count = 0;
+    Segment* seg = nullptr;
+    std::atomic<bool> busy{false};  // filling, or queued to the writer
+  };
+
+  struct Segment {
+    AviRecorder* owner = nullptr;
+    uint32_t id = 0;
+    File avi;                       // standby, until handed to the writer; finished, while idx1 is added
+    File idx;                       // read back while idx1 is added
+    IndexChunk* chunk = nullptr;    // being filled
+    AviSegmentInfo info = {};
+    int64_t firstUs = 0;
+    int64_t lastUs = 0;
+    uint32_t idx1Left = 0;          // entries still to go into idx1
+    uint32_t idx1Pos = 0;           // where idx1 starts in avi
+    bool rotatedOut = false;        // finished by a rotation, see finishing_
+    std::atomic<bool> busy{false};  // open, or not yet finished by the writer
+  };
+
+  static void* alloc(size_t bytes) {
+    void* p = heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    return p ? p : heap_caps_malloc(bytes, MALLOC_CAP_8BIT);
+  }
+
+  static bool writeIndexHeader(File& idx) {
+    AviIndexHeader ih = {{'M', 'J', 'I', 'X'}, 2, sizeof(AviIndexEntry), AVI_MOVI_OFFSET, 0};
+    return idx.write((const uint8_t*)&ih, sizeof(ih)) == sizeof(ih);
+  }
+
+  Segment* freeSegment() {
+    for (size_t i = 0; i < AVI_SEGMENTS; i++) {
+      if (!segments_[i].busy.load(std::memory_order_acquire)) return &segments_[i];
+    }
+    return nullptr;
+  }
+
+  // Room in the writer to finish the open segment (last index chunk, finishing
+  // call), switch files and append a header. Lock held: frames are only
+  // appended under it, so what fits now still fits when the switch is queued,
+  // and a file is never handed to the writer and then failed back.
+  bool writerHasRoom() {
+    return writer_.capacity() - writer_.queuedBytes() >= AVI_HEADER_SIZE && writer_.pendingFree() >= 3;
+  }
+
+  static bool full(const Segment* seg) {
+    return AVI_HEADER_SIZE + (uint64_t)seg->info.moviBytes + (uint64_t)seg->info.frames * AVI_IDX1_ENTRY_SIZE >
+           AVI_MAX_BYTES;
+  }
+
+  // Make seg (id and idx set) the open segment, writing to avi. Lock held.
+  bool startSegment(Segment* seg, File avi) {
+    seg->owner = this;
+    seg->chunk = nullptr;
+    seg->rotatedOut = false;
+    seg->firstUs = seg->lastUs = 0;
+    memset(&seg->info, 0, sizeof(seg->info));
+    seg->info.usPerFrame = AVI_DEFAULT_FRAME_US;
+    aviBuildHeader(header_, seg->info);
+    if (!writer_.switchTo(avi) || !writer_.append(header_, AVI_HEADER_SIZE)) {
+      writer_.close();
+      seg->idx = File();
+      seg->busy.store(false, std::memory_order_release);
+      return false;
+    }
+    seg->busy.store(true, std::memory_order_relaxed);
+    current_ = seg;
+    return true;
+  }
+
+  // cameraTask, between two frames: finish the open segment and carry on in
+  // the standby one. Nothing here touches the card. Lock held.
+  void switchToStandby() {
+    Segment* seg = standby_;
+    standby_ = nullptr;
+    rotate_ = false;
+    gapPending_ = current_->info.frames > 0;
+    gapFromUs_ = current_->lastUs;
+    current_->rotatedOut = true;
+    finishing_.fetch_add(1, std::memory_order_relaxed);
+    finishCurrent(&rotated_);
+    File avi = seg->avi;
+    seg->avi = File();
+    if (startSegment(seg, avi)) rotations_++;
+    if (notify_) xTaskNotifyGive(notify_);
+  }
+
+  IndexChunk* freeChunk() {
+    for (size_t i = 0; i < AVI_INDEX_CHUNKS; i++) {
+      if (!chunks_[i].busy.load(std::memory_order_acquire)) {
+        chunks_[i].busy.store(true, std::memory_order_relaxed);
+        chunks_[i].count = 0;
+        return &chunks_[i];
+      }
+    }
+    return nullptr;
+  }
+
+  // Hand the segment's full chunk to the writer task. Lock held. If the
+  // writer's queue is full the chunk stays put and the next addFrame() retries.
+  void queueChunk(Segment* seg) {
+    seg->chunk->seg = seg;
+    if (writer_.call(writeChunk, seg->chunk, false)) seg->chunk = nullptr;
+  }
+
+  // Queue everything needed to finish current_ and forget it. Lock held.
+  void finishCurrent(AviSegmentSummary* finished) {
+    Segment* seg = current_;
+    if (!seg) return;
+    current_ = nullptr;
+    if (finished) {
+      const AviSegmentInfo& info = seg->info;
+      finished->finished = true;
+      finished->id = seg->id;
+      finished->frames = info.frames;
+      finished->bytes = AVI_HEADER_SIZE + (uint64_t)info.moviBytes + 8 +
+                        (uint64_t)info.frames * (AVI_IDX1_ENTRY_SIZE + sizeof(AviIndexEntry)) + sizeof(AviIndexHeader);
+      finished->durationMs = (uint32_t)((seg->lastUs - seg->firstUs) / 1000);
+    }
+    if (seg->chunk) {
+      seg->chunk->seg = seg;
+      if (writer_.call(writeChunk, seg->chunk, false)) seg->chunk = nullptr;
+    }
+    if (!writer_.call(finishSegment, seg, true)) {
+      // Should not happen with AVI_SEGMENTS and AVI_INDEX_CHUNKS bounded; leave
+      // the AVI without idx1 rather than lose the file
+      if (seg->chunk) seg->chunk->busy.store(false, std::memory_order_release);
+      seg->idx.close();
+      segmentFinished(seg);
+    }
+  }
+
+  // The segment is complete on the card (or given up); it can be reused.
+  static void segmentFinished(Segment* seg) {
+    if (seg->rotatedOut) seg->owner->finishing_.fetch_sub(1, std::memory_order_relaxed);
+    seg->busy.store(false, std::memory_order_release);
+  }
+
+  // Writer task: checkpoint a chunk of index entries to the sidecar.
+  static void writeChunk(File& file, void* arg) {
+    IndexChunk* chunk = (IndexChunk*)arg;
+    chunk->seg->idx.write((const uint8_t*)chunk->entries, chunk->count * sizeof(AviIndexEntry));
+    chunk->busy.store(false, std::memory_order_release);
+  }
+
+  // Writer task, after the segment's last frame is in file: take the file
+  // over, so the writer goes on with the next segment's, and add idx1 built
+  // from the sidecar in background steps.
+  static void finishSegment(File& file, void* arg) {
+    Segment* seg = (Segment*)arg;
+    AviRecorder* self = seg->owner;
+    AviSegmentInfo& info = seg->info;
+    if (info.frames > 1) info.usPerFrame = (uint32_t)((seg->lastUs - seg->firstUs) / (info.frames - 1));
+
+    String path = seg->idx.path();
+    seg->idx.close();
+    seg->avi = file;
+    file = File();
+    if (!seg->avi) {
+      segmentFinished(seg);
+      return;
+    }
+    uint8_t head[8];
+    seg->idx1Pos = seg->avi.position();
+    aviPut32(aviPutFourcc(head, "idx1"), info.frames * AVI_IDX1_ENTRY_SIZE);
+    seg->avi.write(head, sizeof(head));
+    seg->idx = self->fs_->open(path, FILE_READ);
+    seg->idx.seek(sizeof(AviIndexHeader));
+    seg->idx1Left = info.frames;
+    if (!self->writer_.background(finishStep, seg)) {
+      while (finishStep(seg)) {
+      }
+    }
+  }
+
+  // Writer task, background: one index chunk's worth of idx1; after the last,
+  // the header. False once the segment is finished.
+  static bool finishStep(void* arg) {
+    Segment* seg = (Segment*)arg;
+    AviRecorder* self = seg->owner;
+    AviSegmentInfo& info = seg->info;
+    if (seg->idx1Left) {
+      size_t want = std::min((size_t)seg->idx1Left, AVI_INDEX_CHUNK) * sizeof(AviIndexEntry);
+      size_t n = seg->idx.read(self->copyBuf_, want) / sizeof(AviIndexEntry);
+      if (n) {
+        // In place: {'00dc', AVIIF_KEYFRAME, chunk offset from 'movi', size},
+        // each no longer than the sidecar entry it is made from, which is
+        // read before anything is written over it
+        AviIndexEntry* src = (AviIndexEntry*)self->copyBuf_;
+        for (size_t i = 0; i < n; i++) {
+          AviIndexEntry e = src[i];
+          uint8_t* p = self->copyBuf_ + i * AVI_IDX1_ENTRY_SIZE;
+          p = aviPutFourcc(p, "00dc");
+          p = aviPut32(p, 0x10);
+          p = aviPut32(p, e.offset - 8 - AVI_MOVI_OFFSET);
+          aviPut32(p, e.length);
+        }
+        seg->avi.write(self->copyBuf_, n * AVI_IDX1_ENTRY_SIZE);
+        seg->idx1Left -= n;
+        if (seg->idx1Left) return true;
+      }
+    }
+    seg->idx.close();
+
+    // Entries the sidecar lost (card error) are left out of idx1 and the
+    // frame counts; the chunks are still in movi
+    if (seg->idx1Left) {
+      uint8_t head[8];
+      info.frames -= seg->idx1Left;
+      aviPut32(aviPutFourcc(head, "idx1"), info.frames * AVI_IDX1_ENTRY_SIZE);
+      seg->avi.seek(seg->idx1Pos);
+      seg->avi.write(head, sizeof(head));
+    }
+    aviBuildHeader(self->copyBuf_, info);
+    seg->avi.seek(0);
+    seg->avi.write(self->copyBuf_, AVI_HEADER_SIZE);
+    seg->avi.close();
+    segmentFinished(seg);
+    return false;
+  }
+
+  SdWriter& writer_;
+  FS* fs_ = nullptr;
+  SemaphoreHandle_t lock_ = nullptr;
+  Segment segments_[AVI_SEGMENTS];
+  Segment* current_ = nullptr;
+  Segment* standby_ = nullptr;     // prepared, waiting for a rotation
+  bool rotate_ = false;            // rotation due at the next frame
+  TaskHandle_t notify_ = nullptr;
+  AviSegmentSummary rotated_ = {};
+  bool gapPending_ = false;        // first frame after a rotation not yet added
+  int64_t gapFromUs_ = 0;
+  uint32_t rotations_ = 0;
+  uint32_t rotationDropped_ = 0;
+  std::atomic<uint32_t> finishing_{0};  // rotated-out segments the writer hasn't finished
+  uint32_t lateRotations_ = 0;
+  uint32_t lastGapUs_ = 0;
+  uint32_t maxGapUs_ = 0;
+  IndexChunk chunks_[AVI_INDEX_CHUNKS];
+  uint8_t* copyBuf_ = nullptr;   // writer task only
+  uint8_t header_[AVI_HEADER_SIZE];
+};
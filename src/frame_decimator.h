@@ -0,0 +1,115 @@
+#pragma once
+// Static-scene decimation of recorded frames.
+//
+// A continuous recording of a scene where nothing happens for hours still
+// wrote every frame the record pace took. The decimator sits in front of the
+// recorder and tells cameraTask which frames are still: frames whose
+// activity score (the motion detector's mean luma change, see motion.h) is
+// under a level and whose JPEG size is within a few percent of the last frame
+// written. The JPEG size reacts on the frame itself, which covers the frame
+// or two the detector's score lags behind.
+//
+// A still frame is written anyway once a keep-alive interval has passed since
+// the last one, and every frame is written for a hold time after the scene
+// last changed, so slow movement that stays under the level from one frame to
+// the next is still recorded at full rate around the change. The other still
+// frames go to the recorder as repeats (AviRecorder::addRepeat): an empty
+// chunk with its own timestamp, which players show as the frame before, so
+// the AVI keeps its frame rate and the sidecar its timing for a few bytes a
+// frame.
+//
+// The decision runs on cameraTask; the settings come from the HTTP handlers
+// and the stats go to any task, both as atomics.
+
+#include <Arduino.h>
+#include <atomic>
+#include "json_writer.h"
+#include "metrics.h"
+
+class FrameDecimator {
+ public:
+  // levels: activity under this is still (luma levels). sizePct: JPEG size
+  // change from the last frame written that still counts as still.
+  // keepAliveS: longest time between written frames. holdS: full rate for
+  // this long after a change.
+  FrameDecimator(bool enabled, float levels, uint8_t sizePct, float keepAliveS, float holdS)
+      : enabled_(enabled), holdUs_((int64_t)(holdS * 1000000)) {
+    setLevel(levels);
+    setSizePct(sizePct);
+    setKeepAlive(keepAliveS);
+  }
+
+  void enable(bool on) { enabled_.store(on, std::memory_order_relaxed); }
+  bool enabled() const { return enabled_.load(std::memory_order_relaxed); }
+  void setLevel(float levels) { level_.store((uint16_t)(levels * 16 + 0.5f), std::memory_order_relaxed); }
+  void setSizePct(uint8_t pct) { sizePct_.store(pct, std::memory_order_relaxed); }
+  void setKeepAlive(float seconds) {
+    keepAliveUs_.store((uint32_t)(seconds * 1000000), std::memory_order_relaxed);
+  }
+
+  // cameraTask: whether this frame may go to the recorder as a repeat.
+  // activity is in 1/16 levels, as MotionDetector::activity() gives it.
+  bool still(size_t len, uint16_t activity, int64_t timestamp) {
+    if (!enabled() || !lastWrittenUs_) {
+      changedUs_ = timestamp;
+      return false;
+    }
+    size_t delta = len > lastLen_ ? len - lastLen_ : lastLen_ - len;
+    if (activity >= level_.load(std::memory_order_relaxed) ||
+        delta * 100 > lastLen_ * sizePct_.load(std::memory_order_relaxed)) {
+      changedUs_ = timestamp;
+    }
+    staticNow_.store(timestamp - changedUs_ >= holdUs_, std::memory_order_relaxed);
+    return timestamp - changedUs_ >= holdUs_ &&
+           timestamp - lastWrittenUs_ < (int64_t)keepAliveUs_.load(std::memory_order_relaxed);
+  }
+
+  // cameraTask: the frame went to the recorder in full.
+  void written(size_t len, int64_t timestamp) {
+    lastLen_ = len;
+    lastWrittenUs_ = timestamp;
+    written_.inc();
+  }
+
+  // cameraTask: the frame went as a repeat instead.
+  void repeated(size_t len) {
+    repeated_.inc();
+    savedRest_ += len;
+    savedKB_.fetch_add(savedRest_ / 1024, std::memory_order_relaxed);
+    savedRest_ %= 1024;
+  }
+
+  const MetricsCounter& writtenFrames() const { return written_; }
+  const MetricsCounter& repeatedFrames() const { return repeated_; }
+  // JPEG bytes the repeats kept off the card.
+  uint32_t savedKB() const { return savedKB_.load(std::memory_order_relaxed); }
+
+  // The "decimation" object of /stats and /decimation.
+  void json(JsonWriter& out) const {
+    uint32_t written = written_.value(), repeated = repeated_.value();
+    out.printf("{\"enabled\":%s,\"static\":%s,\"level\":%.2f,\"size_pct\":%u,\"keepalive_s\":%.1f,\"hold_s\":%.1f,"
+               "\"written\":%u,\"repeated\":%u,\"repeated_pct\":%u,\"saved_mb\":%.1f}",
+               enabled() ? "true" : "false", enabled() && staticNow_.load(std::memory_order_relaxed) ? "true" : "false",
+               level_.load(std::memory_order_relaxed) / 16.0, (unsigned)sizePct_.load(std::memory_order_relaxed),
+               keepAliveUs_.load(std::memory_order_relaxed) / 1e6, holdUs_ / 1e6, (unsigned)written,
+               (unsigned)repeated, written + repeated ? (unsigned)((uint64_t)repeated * 100 / (written + repeated)) : 0,
+               savedKB() / 1024.0);
+  }
+
+ private:
+  std::atomic<bool> enabled_;
+  std::atomic<uint16_t> level_{0};
+  std::atomic<uint8_t> sizePct_{0};
+  std::atomic<uint32_t> keepAliveUs_{0};
+  const int64_t holdUs_;
+  // cameraTask only
+  size_t lastLen_ = 0;
+  int64_t lastWrittenUs_ = 0;  // 0: nothing written yet
+  int64_t changedUs_ = 0;      // capture time of the last frame that was not still
+  size_t savedRest_ = 0;       // bytes not yet counted in savedKB_
+  // Stats, any task
+  std::atomic<bool> staticNow_{false};
+  MetricsCounter written_;
+  MetricsCounter repeated_;
+  std::atomic<uint32_t> savedKB_{0};
+};
@@ -0,0 +1,217 @@
+#pragma once
+// Privacy masks and the date and time, burnt into every frame the camera
+// hands out.
+//
+// cameraTask runs each captured frame through apply() before any consumer
+// sees it, so viewers, recordings, pre-event frames, stills and the motion
+// detector all get the edited frame. The edit is done in the compressed
+// domain by JpegMcuEditor (jpeg_edit.h): masked MCUs become flat blocks at
+// the mask level, the clock is spliced in as pre-coded glyph blocks, and
+// the rest of the scan is copied. It writes into a PSRAM buffer of the frame
+// slot's own, one per pool slot, allocated the first time the slot carries
+// an edited frame; the slot then points at that buffer, and cameraTask can
+// give the camera fb back to the driver straight away.
+//
+// Masks are rectangles in percent of the frame, so they stay on the same
+// part of the scene when the quality controller changes the frame size.
+// They are rounded out to whole MCUs (16x8 pixels for 4:2:2). The clock is
+// local time once SNTP has set it (configTzTime() in the sketches), uptime
+// before; on frames narrower than the date it is the time alone. With masks
+// set a frame the editor can't handle is dropped rather than sent
+// unmasked; with only the clock it goes out as it is.
+//
+// Settings come from the HTTP handlers, under a spinlock; the edit runs on
+// cameraTask only, and the stats go to any task.
+
+#include <Arduino.h>
+#include <atomic>
+#include <time.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "frame_pool.h"
+#include "jpeg_edit.h"
+#include "json_writer.h"
+#include "metrics.h"
+
+enum OverlayClock { OVERLAY_CLOCK_OFF, OVERLAY_CLOCK_TOP, OVERLAY_CLOCK_BOTTOM };
+
+const size_t FRAME_OVERLAY_SLACK = 8 * 1024;  // output room over the largest frame, for the glyphs
+const time_t FRAME_OVERLAY_TIME_VALID = 1600000000;  // time() past this came from SNTP
+
+struct OverlayMask {
+  uint8_t x, y, w, h;  // percent of the frame
+};
+
+class FrameOverlay {
+ public:
+  FrameOverlay(OverlayClock clock, uint8_t level) : clock_(clock), level_(level) {}
+
+  // frameBytes: the largest JPEG the camera hands out.
+  void begin(const FramePool& pool, size_t frameBytes) {
+    pool_ = &pool;
+    capacity_ = frameBytes + FRAME_OVERLAY_SLACK;
+  }
+
+  // "x,y,w,h;x,y,w,h..." in percent, at most JPEG_EDIT_MAX_MASKS. An empty
+  // spec clears the masks. False, with the masks unchanged, if it doesn't
+  // parse or a rectangle leaves the frame.
+  bool setMasks(const char* spec) {
+    OverlayMask masks[JPEG_EDIT_MAX_MASKS] = {};
+    int count = 0;
+    const char* p = spec;
+    while (*p) {
+      if (count == JPEG_EDIT_MAX_MASKS) return false;
+      long v[4];
+      for (int i = 0; i < 4; i++) {
+        char* end;
+        v[i] = strtol(p, &end, 10);
+        if (end == p || v[i] < 0 || v[i] > 100) return false;
+        p = end;
+        if (i < 3 && *p++ != ',') return false;
+      }
+      if (!v[2] || !v[3] || v[0] + v[2] > 100 || v[1] + v[3] > 100) return false;
+      if (*p == ';') p++;
+      else if (*p) return false;
+      masks[count++] = {(uint8_t)v[0], (uint8_t)v[1], (uint8_t)v[2], (uint8_t)v[3]};
+    }
+    portENTER_CRITICAL(&mux_);
+    memcpy(masks_, masks, sizeof(masks));
+    maskCount_ = count;
+    portEXIT_CRITICAL(&mux_);
+    return true;
+  }
+  void setClock(OverlayClock clock) { clock_.store(clock, std::memory_order_relaxed); }
+  OverlayClock clock() const { return clock_.load(std::memory_order_relaxed); }
+  // Luma of the masks, 0..255.
+  void setLevel(uint8_t level) { level_.store(level, std::memory_order_relaxed); }
+
+  bool active() const {
+    return clock() != OVERLAY_CLOCK_OFF || maskCount_.load(std::memory_order_relaxed);
+  }
+
+  // cameraTask: edit the frame in slot. On success slot's data is in the
+  // overlay's buffer, no longer in the producer's. False: drop the frame.
+  bool apply(FrameSlot* slot) {
+    if (!active()) return true;
+    int64_t start = esp_timer_get_time();
+    OverlayMask masks[JPEG_EDIT_MAX_MASKS];
+    portENTER_CRITICAL(&mux_);
+    int count = maskCount_;
+    memcpy(masks, masks_, sizeof(masks));
+    portEXIT_CRITICAL(&mux_);
+    OverlayClock clock = this->clock();
+
+    uint8_t* out = buffer(pool_->indexOf(slot));
+    size_t len = 0;
+    if (out && editor_.parse(slot->data, slot->len)) {
+      int width = editor_.width(), height = editor_.height();
+      editor_.setMaskLevel(level_.load(std::memory_order_relaxed));
+      for (int i = 0; i < count; i++) {
+        editor_.mask(masks[i].x * width / 100, masks[i].y * height / 100, masks[i].w * width / 100,
+                     masks[i].h * height / 100);
+      }
+      clockY_ = -1;
+      if (clock != OVERLAY_CLOCK_OFF) {
+        char text[24];
+        clockText(text, sizeof(text), width);
+        clockY_ = clock == OVERLAY_CLOCK_TOP ? 0 : (height / JPEG_EDIT_CELL - 1) * JPEG_EDIT_CELL;
+        editor_.text(text, 0, clockY_);
+      }
+      len = editor_.edit(out, capacity_);
+    }
+    if (!len) {
+      if (count) {
+        dropped_.inc();
+        return false;
+      }
+      passed_.inc();
+      return true;  // only the clock missing
+    }
+    slot->data = out;
+    slot->len = len;
+    edited_.inc();
+    recodedPct_.store(editor_.blocks() ? editor_.recodedBlocks() * 100 / editor_.blocks() : 0,
+                      std::memory_order_relaxed);
+    editTime_.observe(esp_timer_get_time() - start);
+    return true;
+  }
+
+  // The clock's band in the 1/8 scale plane the motion detector reads, for
+  // it to ignore: first row and rows. 0 rows without a clock.
+  int clockRow() const { return clockY_ < 0 ? 0 : clockY_ / 8; }
+  int clockRows() const { return clockY_ < 0 ? 0 : JPEG_EDIT_CELL / 8; }
+
+  const MetricsCounter& editedFrames() const { return edited_; }
+  const MetricsCounter& droppedFrames() const { return dropped_; }
+  const MetricsHistogram& editTime() const { return editTime_; }
+
+  // The "overlay" object of /stats and /overlay.
+  void json(JsonWriter& out) const {
+    OverlayMask masks[JPEG_EDIT_MAX_MASKS];
+    portENTER_CRITICAL(&mux_);
+    int count = maskCount_;
+    memcpy(masks, masks_, sizeof(masks));
+    portEXIT_CRITICAL(&mux_);
+    static const char* const CLOCKS[] = {"off", "top", "bottom"};
+    out.printf("{\"masks\":\"");
+    for (int i = 0; i < count; i++) {
+      out.printf("%s%u,%u,%u,%u", i ? ";" : "", masks[i].x, masks[i].y, masks[i].w, masks[i].h);
+    }
+    out.printf("\",\"clock\":\"%s\",\"level\":%u,\"time_set\":%s,\"edited\":%u,\"passed\":%u,\"dropped\":%u,"
+               "\"recoded_pct\":%u,\"buffers\":%u,\"alloc_failures\":%u}",
+               CLOCKS[clock()], (unsigned)level_.load(std::memory_order_relaxed),
+               time(nullptr) > FRAME_OVERLAY_TIME_VALID ? "true" : "false", (unsigned)edited_.value(),
+               (unsigned)passed_.value(), (unsigned)dropped_.value(),
+               (unsigned)recodedPct_.load(std::memory_order_relaxed),
+               (unsigned)buffers_.load(std::memory_order_relaxed), (unsigned)allocFailures_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  // Slot i's output buffer, allocated on first use. Freed never: the slots
+  // keep cycling while the overlay is on.
+  uint8_t* buffer(size_t i) {
+    if (i >= FramePool::MAX_SLOTS) return nullptr;
+    if (!out_[i]) {
+      out_[i] = (uint8_t*)heap_caps_malloc(capacity_, MALLOC_CAP_SPIRAM);
+      if (!out_[i]) {
+        allocFailures_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      buffers_.fetch_add(1, std::memory_order_relaxed);
+    }
+    return out_[i];
+  }
+
+  static void clockText(char* text, size_t size, int width) {
+    bool date = width >= 19 * JPEG_EDIT_CELL;
+    time_t now = time(nullptr);
+    if (now > FRAME_OVERLAY_TIME_VALID) {
+      struct tm local;
+      localtime_r(&now, &local);
+      strftime(text, size, date ? "%Y-%m-%d %H:%M:%S" : "%H:%M:%S", &local);
+    } else {
+      uint32_t s = esp_timer_get_time() / 1000000;
+      snprintf(text, size, "%02u:%02u:%02u", (unsigned)(s / 3600), (unsigned)(s / 60 % 60), (unsigned)(s % 60));
+    }
+  }
+
+  std::atomic<OverlayClock> clock_;
+  std::atomic<uint8_t> level_;
+  std::atomic<int> maskCount_{0};
+  OverlayMask masks_[JPEG_EDIT_MAX_MASKS] = {};
+  mutable portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+  const FramePool* pool_ = nullptr;
+  size_t capacity_ = 0;
+  // cameraTask only
+  JpegMcuEditor editor_;
+  uint8_t* out_[FramePool::MAX_SLOTS] = {};
+  int clockY_ = -1;  // pixel row of the last clock, -1 for none
+  // Stats, any task
+  MetricsCounter edited_;
+  MetricsCounter passed_;   // the editor failed on a frame with only the clock
+  MetricsCounter dropped_;  // the editor failed on a masked frame
+  MetricsHistogram editTime_{METRICS_BUCKETS(METRICS_LATENCY_BUCKETS_US), 1e-6};
+  std::atomic<uint8_t> recodedPct_{0};
+  std::atomic<uint8_t> buffers_{0};
+  std::atomic<uint32_t> allocFailures_{0};
+};
@@ -0,0 +1,155 @@
+#pragma once
+// Per-consumer frame pacing.
+//
+// cameraTask blocks in esp_camera_fb_get() and so runs at whatever rate the
+// sensor delivers, rather than on a fixed tick that capped every consumer at
+// 20 FPS and slipped out of phase with the sensor on slow frames. Each
+// consumer (live view, recording, time-lapse, motion detection) has a
+// PacedChannel with its own target rate that decides, frame by frame, whether
+// it takes the frame just captured. A frame no consumer wants goes straight
+// back to the driver.
+//
+// A channel keeps a grid of due times one target interval apart and takes the
+// first frame within half an interval of the next one. The long-run rate is
+// the target exactly, even when the sensor rate isn't a multiple of it, and a
+// target at or above the sensor rate gets every frame despite jitter. After a
+// stall longer than an interval the grid restarts from the frame that ended
+// it instead of bursting to catch up.
+//
+// The achieved rate is measured over windows of at least a second and two
+// target intervals, and is reported next to the target. Each camera can then
+// trade temporal resolution against SD wear and bandwidth per consumer.
+
+#include <Arduino.h>
+#include <atomic>
+#include "json_writer.h"
+#include "metrics.h"
+
+class PacedChannel {
+ public:
+  // fps 0 takes every frame.
+  PacedChannel(const char* name, float fps) : name_(name) { setTarget(fps); }
+
+  // Any task. Takes effect from the next frame.
+  void setTarget(float fps) {
+    target_.store(fps > 0 ? fps : 0, std::memory_order_relaxed);
+    interval_.store(fps > 0 ? (uint32_t)(1e6f / fps) : 0, std::memory_order_relaxed);
+  }
+  float target() const { return target_.load(std::memory_order_relaxed); }
+  uint32_t intervalUs() const { return interval_.load(std::memory_order_relaxed); }
+
+  // cameraTask only: whether the frame captured at timestamp (us) goes to
+  // this consumer. active is whether the consumer is running; while it isn't,
+  // the channel takes nothing and starts afresh when it resumes.
+  bool take(int64_t timestamp, bool active) {
+    if (!active) {
+      stop();
+      return false;
+    }
+    uint32_t interval = interval_.load(std::memory_order_relaxed);
+    bool due = !nextDue_ || timestamp >= nextDue_ - interval / 2;
+    if (due) {
+      // Stay on the grid so the average is exact; restart it after a stall
+      bool onGrid = nextDue_ && interval && timestamp - nextDue_ < (int64_t)interval;
+      nextDue_ = onGrid ? nextDue_ + interval : timestamp + interval;
+      taken_.inc();
+      windowTaken_++;
+    } else {
+      skipped_.inc();
+    }
+    if (!windowStart_) {
+      windowStart_ = timestamp;  // windows count the frames after their start
+      windowTaken_ = 0;
+    } else {
+      int64_t elapsed = timestamp - windowStart_;
+      if (elapsed >= 1000000 && elapsed >= 2 * (int64_t)interval) {
+        achieved_.store(windowTaken_ * 1e6f / elapsed, std::memory_order_relaxed);
+        windowStart_ = timestamp;
+        windowTaken_ = 0;
+      }
+    }
+    return due;
+  }
+
+  // cameraTask only: esp_timer time the next frame is due at, 0 if the
+  // first frame the channel sees is.
+  int64_t nextDue() const { return nextDue_; }
+
+  // cameraTask only: the consumer stopped or the camera went idle.
+  void stop() {
+    nextDue_ = 0;
+    windowStart_ = 0;
+    windowTaken_ = 0;
+    achieved_.store(0, std::memory_order_relaxed);
+  }
+
+  const char* name() const { return name_; }
+  float achieved() const { return achieved_.load(std::memory_order_relaxed); }
+  // Frames this consumer took, and frames captured while it ran that it passed up.
+  const MetricsCounter& taken() const { return taken_; }
+  const MetricsCounter& skipped() const { return skipped_; }
+
+  void json(JsonWriter& out) const {
+    out.printf("{\"target_fps\":%.4g,\"achieved_fps\":%.4g,\"taken\":%u,\"skipped\":%u}", target(), achieved(),
+               (unsigned)taken_.value(), (unsigned)skipped_.value());
+  }
+
+ private:
+  const char* name_;
+  std::atomic<float> target_{0};
+  std::atomic<uint32_t> interval_{0};  // us, 0 for every frame
+  std::atomic<float> achieved_{0};
+  MetricsCounter taken_;
+  MetricsCounter skipped_;
+  // cameraTask only
+  int64_t nextDue_ = 0;  // 0 until the first frame
+  int64_t windowStart_ = 0;
+  uint32_t windowTaken_ = 0;
+};
+
+// The consumers cameraTask feeds, plus the sensor's own delivery rate.
+class FramePacer {
+ public:
+  FramePacer(float liveFps, float recordFps, float timelapseFps, float motionFps)
+      : live("live", liveFps), record("record", recordFps), timelapse("timelapse", timelapseFps),
+        motion("motion", motionFps), sensor_("sensor", 0) {}
+
+  // cameraTask only: count a captured frame before the channels look at it.
+  void captured(int64_t timestamp) { sensor_.take(timestamp, true); }
+
+  // cameraTask only: nothing wants frames, the task is about to sleep.
+  void idle() {
+    sensor_.stop();
+    live.stop();
+    record.stop();
+    timelapse.stop();
+    motion.stop();
+  }
+
+  // cameraTask only: capture pauses until a channel's next frame; the
+  // sensor rate is measured afresh after it.
+  void pause() { sensor_.stop(); }
+
+  float sensorFps() const { return sensor_.achieved(); }
+
+  // The "pacer" object of /stats and /pacer.
+  void json(JsonWriter& out) const {
+    out.printf("{\"sensor_fps\":%.4g,\"live\":", sensorFps());
+    live.json(out);
+    out.printf(",\"record\":");
+    record.json(out);
+    out.printf(",\"timelapse\":");
+    timelapse.json(out);
+    out.printf(",\"motion\":");
+    motion.json(out);
+    out.printf("}");
+  }
+
+  PacedChannel live;
+  PacedChannel record;
+  PacedChannel timelapse;
+  PacedChannel motion;
+
+ private:
+  PacedChannel sensor_;  // target 0: takes every frame, so achieved is the capture rate
+};
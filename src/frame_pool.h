@@ -0,0 +1,187 @@
+#pragma once
+// Zero-copy, reference-counted pool of encoded frames.
+//
+// Each slot wraps a buffer the producer already owns (on the camera that is a
+// camera_fb_t living in PSRAM), so publishing a frame copies nothing. Every
+// consumer - an HTTP response, a stream viewer, the recorder - holds a
+// FrameRef; when the last reference is dropped the pool's recycle hook hands
+// the buffer back (esp_camera_fb_return on the device). Reference counts are
+// atomic, so references may be taken and dropped from any task.
+//
+// Slot states, all in `refs`: > 0 live, 0 free, SLOT_RECYCLING while the last
+// releaser runs the recycle hook. A slot only becomes free again once the hook
+// has finished, so acquire() can never hand out a slot that is still being
+// torn down.
+//
+// Portable C++11 with no Arduino dependencies so it can be exercised on the
+// host as well.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+class FramePool;
+
+struct FrameSlot {
+  std::atomic<int32_t> refs;
+  FramePool* pool;
+  void* owner;            // producer's handle for the buffer (camera_fb_t*)
+  const uint8_t* data;
+  size_t len;
+  uint32_t seq;           // publish sequence number, assigned by the producer
+  int64_t timestamp;      // capture time in microseconds
+  uint16_t width;
+  uint16_t height;
+};
+
+class FramePool {
+ public:
+  typedef void (*RecycleFn)(FrameSlot& slot);
+
+  static const size_t MAX_SLOTS = 8;
+  static const int32_t SLOT_RECYCLING = -1;
+
+  // slots must not exceed MAX_SLOTS; it should equal the number of buffers the
+  // producer can have outstanding (camera fb_count) so a free slot always
+  // exists for a freshly captured buffer.
+  void begin(size_t slots, RecycleFn recycle) {
+    slotCount_ = slots < MAX_SLOTS ? slots : MAX_SLOTS;
+    recycle_ = recycle;
+    for (size_t i = 0; i < MAX_SLOTS; i++) {
+      slots_[i].refs.store(0);
+      slots_[i].pool = this;
+      slots_[i].owner = nullptr;
+      slots_[i].data = nullptr;
+      slots_[i].len = 0;
+      slots_[i].seq = 0;
+      slots_[i].timestamp = 0;
+      slots_[i].width = 0;
+      slots_[i].height = 0;
+    }
+  }
+
+  // Claim a free slot for a new frame; the caller owns the single reference.
+  // Returns nullptr when every slot is still referenced.
+  FrameSlot* acquire() {
+    for (size_t i = 0; i < slotCount_; i++) {
+      int32_t expected = 0;
+      if (slots_[i].refs.compare_exchange_strong(expected, 1, std::memory_order_acquire)) {
+        return &slots_[i];
+      }
+    }
+    exhausted_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  // Add a reference to a slot the caller already holds one on.
+  void retain(FrameSlot* slot) { slot->refs.fetch_add(1, std::memory_order_relaxed); }
+
+  // Add a reference to a slot the caller does not hold, unless it has already
+  // been released for good. Used by readers racing the producer.
+  bool tryRetain(FrameSlot* slot) {
+    int32_t r = slot->refs.load(std::memory_order_relaxed);
+    while (r > 0) {
+      if (slot->refs.compare_exchange_weak(r, r + 1, std::memory_order_acquire,
+                                           std::memory_order_relaxed)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void release(FrameSlot* slot) {
+    int32_t r = slot->refs.load(std::memory_order_relaxed);
+    for (;;) {
+      if (r == 1) {
+        if (slot->refs.compare_exchange_weak(r, SLOT_RECYCLING, std::memory_order_acq_rel,
+                                             std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (slot->refs.compare_exchange_weak(r, r - 1, std::memory_order_release,
+                                                  std::memory_order_relaxed)) {
+        return;
+      }
+    }
+    if (recycle_) recycle_(*slot);
+    slot->owner = nullptr;
+    slot->data = nullptr;
+    slot->len = 0;
+    slot->refs.store(0, std::memory_order_release);
+  }
+
+  size_t slotCount() const { return slotCount_; }
+  size_t indexOf(const FrameSlot* slot) const { return (size_t)(slot - slots_); }
+
+  // Slots currently referenced by someone (producer, latest-frame holder or
+  // a consumer) or being recycled.
+  size_t inUse() const {
+    size_t n = 0;
+    for (size_t i = 0; i < slotCount_; i++) {
+      if (slots_[i].refs.load(std::memory_order_relaxed) != 0) n++;
+    }
+    return n;
+  }
+
+  // Times acquire() found no free slot (a frame had to be dropped).
+  uint32_t exhaustedCount() const { return exhausted_.load(std::memory_order_relaxed); }
+
+ private:
+  FrameSlot slots_[MAX_SLOTS];
+  size_t slotCount_ = 0;
+  RecycleFn recycle_ = nullptr;
+  std::atomic<uint32_t> exhausted_{0};
+};
+
+// RAII handle to one reference on a FrameSlot. Copying takes another
+// reference, so a FrameRef can be captured by value in an AwsResponseFiller
+// lambda and the frame stays valid until the response is destroyed.
+class FrameRef {
+ public:
+  FrameRef() : slot_(nullptr) {}
+  // Adopts a reference the caller already holds.
+  explicit FrameRef(FrameSlot* slot) : slot_(slot) {}
+  FrameRef(const FrameRef& other) : slot_(other.slot_) {
+    if (slot_) slot_->pool->retain(slot_);
+  }
+  FrameRef(FrameRef&& other) : slot_(other.slot_) { other.slot_ = nullptr; }
+  FrameRef& operator=(const FrameRef& other) {
+    if (this != &other) {
+      if (other.slot_) other.slot_->pool->retain(other.slot_);
+      reset();
+      slot_ = other.slot_;
+    }
+    return *this;
+  }
+  FrameRef& operator=(FrameRef&& other) {
+    if (this != &other) {
+      reset();
+      slot_ = other.slot_;
+      other.slot_ = nullptr;
+    }
+    return *this;
+  }
+  ~FrameRef() { reset(); }
+
+  void reset() {
+    if (slot_) slot_->pool->release(slot_);
+    slot_ = nullptr;
+  }
+
+  // Give up ownership without releasing (e.g. to park the reference in a
+  // latest-frame holder).
+  FrameSlot* detach() {
+    FrameSlot* s = slot_;
+    slot_ = nullptr;
+    return s;
+  }
+
+  explicit operator bool() const { return slot_ != nullptr; }
+  FrameSlot* slot() const { return slot_; }
+  const uint8_t* data() const { return slot_->data; }
+  size_t len() const { return slot_->len; }
+  uint32_t seq() const { return slot_->seq; }
+  int64_t timestamp() const { return slot_->timestamp; }
+
+ private:
+  FrameSlot* slot_;
+};
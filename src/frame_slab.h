@@ -0,0 +1,179 @@
+#pragma once
+// Fixed size-class allocator for copies of encoded frames, in PSRAM.
+//
+// Frames normally live in the camera fb they were captured into (see
+// frame_pool.h), but some must be copied out: a slow /stream viewer spills
+// the rest of its JPEG so the fb can go back to the driver. Those copies
+// used to be heap_caps_malloc()ed at whatever size the frame had, so weeks
+// of varying JPEG sizes broke PSRAM into holes that a large busy-scene frame
+// no longer fit into.
+//
+// FrameSlab takes one PSRAM block and cuts it into a few size classes (say 16 KB, 32 KB and the largest JPEG the driver can produce),
+// each a fixed number of blocks. A request gets a block from the smallest
+// class that has room for it, falling back to larger classes, and a freed
+// block goes back to its own class. Nothing is split or merged, so there is
+// no external fragmentation however long the camera runs, and the waste
+// inside a block is bounded by the class spacing. Every class reports how
+// many blocks are in use, the peak, and the requests it could not serve.
+//
+// The block is only held while someone may spill: acquire() takes it for the
+// first user (the first /stream viewer), release() gives it back after the
+// last, so an idle camera doesn't keep the largest-JPEG-times-viewers
+// reservation. acquire() and release() run on one task (async_tcp).
+//
+// alloc() and free() are a few instructions under a spinlock, callable from
+// any task that holds an acquire().
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "json_writer.h"
+#include "metrics.h"
+
+const size_t FRAME_SLAB_MAX_CLASSES = 6;
+const size_t FRAME_SLAB_MAX_BLOCKS = 32;  // per class, one bit each in the free mask
+
+struct FrameSlabClass {
+  size_t bytes;   // block size; a multiple of 4
+  size_t blocks;  // at most FRAME_SLAB_MAX_BLOCKS
+};
+
+class FrameSlab {
+ public:
+  // classes must be in ascending size. Nothing is allocated until acquire().
+  void begin(const FrameSlabClass* classes, size_t count) {
+    count = count < FRAME_SLAB_MAX_CLASSES ? count : FRAME_SLAB_MAX_CLASSES;
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+      Class& c = classes_[i];
+      c.bytes = (classes[i].bytes + 3) & ~(size_t)3;
+      c.blocks = classes[i].blocks < FRAME_SLAB_MAX_BLOCKS ? classes[i].blocks : FRAME_SLAB_MAX_BLOCKS;
+      c.offset = total;
+      c.free = c.blocks == FRAME_SLAB_MAX_BLOCKS ? 0xFFFFFFFFu : (1u << c.blocks) - 1;
+      total += c.bytes * c.blocks;
+    }
+    totalBytes_ = total;
+    count_ = count;
+  }
+
+  // A user is starting; the first one allocates the arena. False without
+  // PSRAM for it: alloc() then fails, and release() must not be called.
+  bool acquire() {
+    if (users_ == 0) {
+      uint8_t* arena = (uint8_t*)heap_caps_malloc(totalBytes_, MALLOC_CAP_SPIRAM);  // copies of frames never need internal RAM
+      if (!arena) return false;
+      portENTER_CRITICAL(&mux_);
+      arena_ = arena;
+      portEXIT_CRITICAL(&mux_);
+    }
+    users_++;
+    return true;
+  }
+
+  // A user has freed all its blocks and is done; the last one frees the arena.
+  void release() {
+    if (users_ == 0 || --users_ > 0) return;
+    portENTER_CRITICAL(&mux_);
+    uint8_t* arena = arena_;
+    arena_ = nullptr;
+    portEXIT_CRITICAL(&mux_);
+    heap_caps_free(arena);
+  }
+
+  // A block of at least len bytes, or nullptr. *cap is set to its size.
+  uint8_t* alloc(size_t len, size_t* cap) {
+    if (!arena_) return nullptr;
+    if (len > classes_[count_ - 1].bytes) {
+      oversize_.inc();
+      return nullptr;
+    }
+    size_t first = 0;
+    while (classes_[first].bytes < len) first++;
+    portENTER_CRITICAL(&mux_);
+    for (size_t i = first; i < count_; i++) {
+      Class& c = classes_[i];
+      if (!c.free) continue;
+      uint32_t block = __builtin_ctz(c.free);
+      c.free &= ~(1u << block);
+      size_t used = c.blocks - __builtin_popcount(c.free);
+      if (used > c.peak) c.peak = used;
+      if (i != first) classes_[first].fallbacks++;
+      portEXIT_CRITICAL(&mux_);
+      *cap = c.bytes;
+      return arena_ + c.offset + block * c.bytes;
+    }
+    classes_[first].failures++;
+    portEXIT_CRITICAL(&mux_);
+    failures_.inc();
+    return nullptr;
+  }
+
+  // p must come from alloc(); nullptr is ignored.
+  void free(uint8_t* p) {
+    if (!p) return;
+    size_t at = p - arena_;
+    size_t i = 0;
+    while (at >= classes_[i].offset + classes_[i].bytes * classes_[i].blocks) i++;
+    Class& c = classes_[i];
+    portENTER_CRITICAL(&mux_);
+    c.free |= 1u << ((at - c.offset) / c.bytes);
+    portEXIT_CRITICAL(&mux_);
+  }
+
+  bool ready() const { return arena_ != nullptr; }
+  size_t largest() const { return count_ ? classes_[count_ - 1].bytes : 0; }
+
+  size_t blocksInUse() const {
+    size_t n = 0;
+    portENTER_CRITICAL(&mux_);
+    for (size_t i = 0; i < count_; i++) n += classes_[i].blocks - __builtin_popcount(classes_[i].free);
+    portEXIT_CRITICAL(&mux_);
+    return n;
+  }
+  // Requests no class had a block for, and requests larger than any class.
+  const MetricsCounter& failures() const { return failures_; }
+  const MetricsCounter& oversize() const { return oversize_; }
+
+  // The "frame_slab" object of /stats. arena_kb is 0 while no one holds it.
+  void json(JsonWriter& out) const {
+    if (!count_) {
+      out.printf("null");
+      return;
+    }
+    Class snapshot[FRAME_SLAB_MAX_CLASSES];
+    portENTER_CRITICAL(&mux_);
+    memcpy(snapshot, classes_, sizeof(snapshot));
+    size_t arenaBytes = arena_ ? totalBytes_ : 0;
+    portEXIT_CRITICAL(&mux_);
+    out.printf("{\"arena_kb\":%u,\"failures\":%u,\"oversize\":%u,\"classes\":[", (unsigned)(arenaBytes / 1024),
+               (unsigned)failures_.value(), (unsigned)oversize_.value());
+    for (size_t i = 0; i < count_; i++) {
+      const Class& c = snapshot[i];
+      out.printf("%s{\"bytes\":%u,\"blocks\":%u,\"in_use\":%u,\"peak\":%u,\"fallbacks\":%u,\"failures\":%u}",
+                 i ? "," : "", (unsigned)c.bytes, (unsigned)c.blocks,
+                 (unsigned)(c.blocks - __builtin_popcount(c.free)), (unsigned)c.peak, (unsigned)c.fallbacks,
+                 (unsigned)c.failures);
+    }
+    out.printf("]}");
+  }
+
+ private:
+  struct Class {
+    size_t bytes;
+    size_t blocks;
+    size_t offset;       // of block 0 in the arena
+    uint32_t free;       // bit per block, set when free
+    size_t peak;         // most blocks in use at once
+    uint32_t fallbacks;  // requests served by a larger class because this one was full
+    uint32_t failures;   // requests sized for this class that nothing could serve
+  };
+
+  uint8_t* arena_ = nullptr;
+  size_t totalBytes_ = 0;
+  size_t users_ = 0;
+  Class classes_[FRAME_SLAB_MAX_CLASSES] = {};
+  size_t count_ = 0;
+  mutable portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+  MetricsCounter failures_;
+  MetricsCounter oversize_;
+};
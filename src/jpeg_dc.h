@@ -0,0 +1,476 @@
+#pragma once
+// DC-only JPEG decoding: the luma of a frame at 1/8 scale, straight from the
+// compressed data.
+//
+// The DC coefficient of an 8x8 block is the block's mean, so the luma DCs
+// alone are the picture at 1/8 scale, one byte per block. Getting them still
+// means walking the whole entropy-coded segment, since a block's AC codes
+// have to be read to find where the next block starts, but nothing else of a
+// full decode is needed: one multiply per luma block and no IDCT, chroma,
+// upsampling or colour conversion. The AC codes are skipped with a lookup
+// that covers a code and its extra bits together, so most coefficients cost
+// one table read and one shift.
+//
+// This covers what the ESP32 camera sensors produce and what desktop
+// encoders usually do: sequential Huffman (SOF0/SOF1), 8-bit samples, one to
+// four components with any sampling factors, restart intervals, and
+// interleaved or one-component scans. A frame without DHT (motion-JPEG
+// style) uses the standard tables of JPEG Annex K.3. Progressive,
+// arithmetic-coded, lossless and 12-bit JPEGs are refused, as are Huffman
+// table ids above 1.
+//
+// The result is exactly what libjpeg gives with DCT scaling to 1/8;
+// host/bench_jpeg_dc.cpp checks that and times both against a full decode.
+// No device dependencies and no allocation: a decoder holds its tables
+// (about 6 KB) and is used from one task.
+//
+//   JpegDcDecoder dc;
+//   if (dc.parse(jpeg, len) && dc.width() <= W && dc.height() <= H)
+//     dc.decode(plane, stride);
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+const int JPEG_DC_FAST_BITS = 9;         // code bits resolved by one table read
+const int JPEG_DC_MAX_COMPONENTS = 4;
+const int JPEG_DC_TABLES = 2;            // Huffman tables of each class
+
+// Annex K.3 tables, as DHT would carry them: 16 code counts, then symbols.
+const uint8_t JPEG_DC_STD_DC_LUMA[] = {
+    0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t JPEG_DC_STD_DC_CHROMA[] = {
+    0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+const uint8_t JPEG_DC_STD_AC_LUMA[] = {
+    0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+const uint8_t JPEG_DC_STD_AC_CHROMA[] = {
+    0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa};
+
+class JpegDcDecoder {
+ public:
+  // Read the headers up to the scan that holds the luma (first) component.
+  // False for anything this decoder doesn't handle or that is cut short.
+  bool parse(const uint8_t* jpeg, size_t len) {
+    end_ = jpeg + len;
+    scan_ = nullptr;
+    components_ = 0;
+    restartInterval_ = 0;
+    bool dhtSeen = false;
+    for (int i = 0; i < JPEG_DC_TABLES; i++) dc_[i].present = ac_[i].present = false;
+    if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) return false;
+    const uint8_t* p = jpeg + 2;
+
+    for (;;) {
+      while (p < end_ && *p != 0xFF) p++;  // tolerate junk between segments
+      while (p < end_ && *p == 0xFF) p++;  // and fill bytes
+      if (p + 3 > end_) return false;
+      uint8_t marker = *p++;
+      if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) continue;  // no length
+      if (marker == 0xD9) return false;                                                      // EOI before the scan
+      size_t segLen = (p[0] << 8) | p[1];
+      if (segLen < 2 || p + segLen > end_) return false;
+      const uint8_t* seg = p + 2;
+      size_t n = segLen - 2;
+      p += segLen;
+
+      switch (marker) {
+        case 0xC0:
+        case 0xC1:
+          if (!parseFrame(seg, n)) return false;
+          break;
+        case 0xC4:
+          if (!parseTables(seg, n)) return false;
+          dhtSeen = true;
+          break;
+        case 0xDB:
+          if (!parseQuant(seg, n)) return false;
+          break;
+        case 0xDD:
+          if (n < 2) return false;
+          restartInterval_ = (seg[0] << 8) | seg[1];
+          break;
+        case 0xDA:
+          if (!components_) return false;
+          if (!dhtSeen) {
+            buildTable(dc_[0], JPEG_DC_STD_DC_LUMA, sizeof(JPEG_DC_STD_DC_LUMA), false);
+            buildTable(dc_[1], JPEG_DC_STD_DC_CHROMA, sizeof(JPEG_DC_STD_DC_CHROMA), false);
+            buildTable(ac_[0], JPEG_DC_STD_AC_LUMA, sizeof(JPEG_DC_STD_AC_LUMA), true);
+            buildTable(ac_[1], JPEG_DC_STD_AC_CHROMA, sizeof(JPEG_DC_STD_AC_CHROMA), true);
+            dhtSeen = true;
+          }
+          if (parseScan(seg, n)) {
+            scan_ = p;
+            return true;
+          }
+          if (scanCount_ == 0) return false;  // a scan we can't read
+          p = skipEntropy(p);                 // a chroma-only scan: look further
+          break;
+        default:
+          if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false;  // progressive, lossless, arithmetic
+          }
+          break;  // APPn, COM and the like
+      }
+    }
+  }
+
+  // Thumbnail size in pixels, after a successful parse().
+  int width() const { return thumbWidth_; }
+  int height() const { return thumbHeight_; }
+
+  // Decode the luma DCs of the parsed frame into plane, rows stride bytes
+  // apart. Bytes past width() in each row are left alone. False if the data
+  // runs out or is corrupt; the plane is then partly written.
+  bool decode(uint8_t* plane, int stride) {
+    if (!scan_) return false;
+    const uint8_t* scan = scan_;
+    scan_ = nullptr;  // one decode per parse
+    startBits(scan);
+    int preds[JPEG_DC_MAX_COMPONENTS] = {0};
+    const Component& luma = comp_[0];
+    int quant = quant_[luma.quant];
+    uint32_t mcus = (uint32_t)mcusX_ * mcusY_;
+    uint32_t untilRestart = restartInterval_;
+
+    for (uint32_t m = 0; m < mcus; m++) {
+      if (restartInterval_ && untilRestart-- == 0) {
+        if (!restart()) return false;
+        memset(preds, 0, sizeof(preds));
+        untilRestart = restartInterval_ - 1;
+      }
+      int mx = m % mcusX_, my = m / mcusX_;
+      for (int i = 0; i < scanCount_; i++) {
+        const Component& c = comp_[scanComp_[i]];
+        int h = single_ ? 1 : c.h, v = single_ ? 1 : c.v;
+        for (int by = 0; by < v; by++) {
+          for (int bx = 0; bx < h; bx++) {
+            int diff;
+            if (!dcDiff(dc_[c.dcTable], diff) || !skipAc(ac_[c.acTable])) return false;
+            preds[i] += diff;
+            if (scanComp_[i] != 0) continue;
+            int x = mx * h + bx, y = my * v + by;
+            if (x < thumbWidth_ && y < thumbHeight_) {
+              int value = 128 + ((preds[i] * quant + 4) >> 3);  // as libjpeg's 1x1 IDCT
+              plane[y * stride + x] = value < 0 ? 0 : value > 255 ? 255 : value;
+            }
+          }
+        }
+      }
+    }
+    return bits_ >= padded_ * 8;  // the last block didn't read past the data
+  }
+
+ private:
+  struct Table {
+    uint16_t fast[1 << JPEG_DC_FAST_BITS];  // see buildTable()
+    int32_t maxCode[17];                    // per code length: one past the largest code, -1 for none
+    int32_t offset[17];                     // symbols index minus the first code of that length
+    uint8_t symbols[256];
+    bool present;
+  };
+
+  struct Component {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t quant;
+    uint8_t dcTable, acTable;
+  };
+
+  // Fast entries: DC tables hold (length << 8) | symbol for codes of up to
+  // JPEG_DC_FAST_BITS. AC tables hold (bits << 8) | coefficients for a code
+  // and its extra bits together (64 coefficients for EOB, 16 for ZRL), or
+  // 0x8000 | (length << 8) | symbol when only the code fits. 0: longer code.
+  static void buildTable(Table& t, const uint8_t* dht, size_t n, bool ac) {
+    memset(t.fast, 0, sizeof(t.fast));
+    int count = 0;
+    for (int l = 0; l < 16; l++) count += dht[l];
+    memcpy(t.symbols, dht + 16, count <= 256 && 16 + (size_t)count <= n ? count : 0);
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+      int lengthCount = dht[l - 1];
+      t.offset[l] = k - code;
+      for (int i = 0; i < lengthCount; i++, k++, code++) {
+        if (l > JPEG_DC_FAST_BITS || code >= (1 << l)) continue;  // long, or a table that overflows
+        uint8_t sym = t.symbols[k];
+        int fill = 1 << (JPEG_DC_FAST_BITS - l);
+        uint16_t entry = (uint16_t)((l << 8) | sym);
+        int extra = sym & 15, run = sym >> 4;
+        if (ac) {
+          if (sym == 0x00) entry = (uint16_t)((l << 8) | 64);
+          else if (sym == 0xF0) entry = (uint16_t)((l << 8) | 16);
+          else entry = 0x8000 | (uint16_t)((l << 8) | sym);
+        }
+        for (int f = 0; f < fill; f++) {
+          int index = (code << (JPEG_DC_FAST_BITS - l)) | f;
+          uint16_t e = entry;
+          // The extra bits are in the index too: skip them in the same step
+          if (ac && (entry & 0x8000) && l + extra <= JPEG_DC_FAST_BITS) {
+            e = (uint16_t)(((l + extra) << 8) | (run + 1));
+          }
+          t.fast[index] = e;
+        }
+      }
+      t.maxCode[l] = lengthCount ? code : -1;
+      code <<= 1;
+    }
+    t.present = true;
+  }
+
+  bool parseTables(const uint8_t* s, size_t n) {
+    while (n >= 17) {
+      int cls = s[0] >> 4, id = s[0] & 15;
+      size_t count = 0;
+      for (int l = 1; l <= 16; l++) count += s[l];
+      if (cls > 1 || id >= JPEG_DC_TABLES || count > 256 || 17 + count > n) return false;
+      buildTable(cls ? ac_[id] : dc_[id], s + 1, 16 + count, cls == 1);
+      s += 17 + count;
+      n -= 17 + count;
+    }
+    return n == 0;
+  }
+
+  bool parseQuant(const uint8_t* s, size_t n) {
+    while (n >= 65) {
+      int precision = s[0] >> 4, id = s[0] & 15;
+      size_t size = precision ? 129 : 65;
+      if (id > 3 || size > n) return false;
+      quant_[id] = precision ? (s[1] << 8) | s[2] : s[1];  // the DC entry comes first
+      s += size;
+      n -= size;
+    }
+    return n == 0;
+  }
+
+  bool parseFrame(const uint8_t* s, size_t n) {
+    if (n < 6 || s[0] != 8) return false;
+    height_ = (s[1] << 8) | s[2];
+    width_ = (s[3] << 8) | s[4];
+    components_ = s[5];
+    if (!width_ || !height_ || !components_ || components_ > JPEG_DC_MAX_COMPONENTS || n < 6 + 3u * components_) {
+      components_ = 0;
+      return false;
+    }
+    hMax_ = vMax_ = 1;
+    for (int i = 0; i < components_; i++) {
+      Component& c = comp_[i];
+      c.id = s[6 + 3 * i];
+      c.h = s[7 + 3 * i] >> 4;
+      c.v = s[7 + 3 * i] & 15;
+      c.quant = s[8 + 3 * i] & 3;
+      if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4) {
+        components_ = 0;
+        return false;
+      }
+      if (c.h > hMax_) hMax_ = c.h;
+      if (c.v > vMax_) vMax_ = c.v;
+    }
+    // The luma plane's own size, in blocks
+    const Component& luma = comp_[0];
+    thumbWidth_ = ((width_ * luma.h + hMax_ - 1) / hMax_ + 7) / 8;
+    thumbHeight_ = ((height_ * luma.v + vMax_ - 1) / vMax_ + 7) / 8;
+    return true;
+  }
+
+  // True if this scan has the luma component and can be decoded.
+  bool parseScan(const uint8_t* s, size_t n) {
+    scanCount_ = 0;
+    if (n < 1) return false;
+    int count = s[0];
+    if (count < 1 || count > components_ || n < 4 + 2u * count) return false;
+    bool hasLuma = false;
+    for (int i = 0; i < count; i++) {
+      int which = -1;
+      for (int j = 0; j < components_; j++) {
+        if (comp_[j].id == s[1 + 2 * i]) which = j;
+      }
+      if (which < 0) return false;
+      Component& c = comp_[which];
+      c.dcTable = s[2 + 2 * i] >> 4;
+      c.acTable = s[2 + 2 * i] & 15;
+      if (c.dcTable >= JPEG_DC_TABLES || c.acTable >= JPEG_DC_TABLES || !dc_[c.dcTable].present ||
+          !ac_[c.acTable].present) {
+        return false;
+      }
+      scanComp_[i] = which;
+      if (which == 0) hasLuma = true;
+    }
+    const uint8_t* tail = s + 1 + 2 * count;
+    if (tail[0] != 0 || tail[1] != 63 || tail[2] != 0) return false;  // not sequential
+    scanCount_ = count;
+    if (!hasLuma) return false;
+
+    single_ = count == 1;
+    if (single_) {
+      // One component: its blocks in raster order, one per MCU
+      const Component& c = comp_[scanComp_[0]];
+      mcusX_ = ((width_ * c.h + hMax_ - 1) / hMax_ + 7) / 8;
+      mcusY_ = ((height_ * c.v + vMax_ - 1) / vMax_ + 7) / 8;
+    } else {
+      mcusX_ = (width_ + 8 * hMax_ - 1) / (8 * hMax_);
+      mcusY_ = (height_ + 8 * vMax_ - 1) / (8 * vMax_);
+    }
+    return true;
+  }
+
+  // Past the entropy-coded data starting at p, to its terminating marker.
+  const uint8_t* skipEntropy(const uint8_t* p) const {
+    while (p + 1 < end_) {
+      if (p[0] == 0xFF && p[1] != 0x00 && !(p[1] >= 0xD0 && p[1] <= 0xD7)) return p;
+      p++;
+    }
+    return end_;
+  }
+
+  // Bit reader: bits_ valid bits at the top of acc_. Stuffed zero bytes are
+  // dropped; at a marker it stops and feeds zeros.
+  void startBits(const uint8_t* p) {
+    p_ = p;
+    acc_ = 0;
+    bits_ = 0;
+    marker_ = false;
+    padded_ = 0;
+  }
+
+  void refill() {
+    while (bits_ <= 24) {
+      uint32_t b = 0;
+      if (!marker_ && p_ < end_ && (p_[0] != 0xFF || (p_ + 1 < end_ && p_[1] == 0x00))) {
+        b = *p_;
+        p_ += b == 0xFF ? 2 : 1;
+      } else {
+        marker_ = true;
+        padded_++;
+      }
+      acc_ |= b << (24 - bits_);
+      bits_ += 8;
+    }
+  }
+
+  uint32_t peek(int n) const { return acc_ >> (32 - n); }
+  void consume(int n) {
+    acc_ <<= n;
+    bits_ -= n;
+  }
+
+  // Signed value of s extra bits (the JPEG "extend").
+  int receive(int s) {
+    if (bits_ < s) refill();
+    int v = (int)peek(s);
+    consume(s);
+    return v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+  }
+
+  // A code longer than JPEG_DC_FAST_BITS (or any code, on a table miss).
+  int slowSymbol(const Table& t) {
+    for (int l = JPEG_DC_FAST_BITS + 1; l <= 16; l++) {
+      int32_t code = (int32_t)peek(l);
+      if (code < t.maxCode[l]) {
+        consume(l);
+        return t.symbols[(t.offset[l] + code) & 255];
+      }
+    }
+    return -1;  // no such code: corrupt data
+  }
+
+  bool dcDiff(const Table& t, int& diff) {
+    if (bits_ < 16) refill();
+    uint16_t e = t.fast[peek(JPEG_DC_FAST_BITS)];
+    int s;
+    if (e) {
+      consume(e >> 8);
+      s = e & 0xFF;
+    } else {
+      s = slowSymbol(t);
+      if (s < 0) return false;
+    }
+    s &= 15;
+    diff = s ? receive(s) : 0;
+    return true;
+  }
+
+  bool skipAc(const Table& t) {
+    for (int k = 1; k < 64;) {
+      if (bits_ < 16) refill();
+      uint16_t e = t.fast[peek(JPEG_DC_FAST_BITS)];
+      if (e && !(e & 0x8000)) {
+        consume(e >> 8);  // code and extra bits, or EOB / ZRL
+        k += e & 0xFF;
+        continue;
+      }
+      int rs;
+      if (e) {
+        consume((e >> 8) & 0x7F);
+        rs = e & 0xFF;
+      } else {
+        rs = slowSymbol(t);
+        if (rs < 0) return false;
+      }
+      int s = rs & 15, r = rs >> 4;
+      if (s == 0) {
+        if (r != 15) return true;  // EOB
+        k += 16;
+        continue;
+      }
+      if (bits_ < s) refill();
+      consume(s);
+      k += r + 1;
+    }
+    return true;
+  }
+
+  // Expect RSTn: drop the bits left over and carry on after the marker.
+  bool restart() {
+    const uint8_t* p = p_;
+    while (p + 1 < end_ && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7)) p++;
+    if (p + 1 >= end_) return false;
+    startBits(p + 2);
+    return true;
+  }
+
+  const uint8_t* end_ = nullptr;
+  const uint8_t* scan_ = nullptr;  // entropy data of the luma scan, once parsed
+  Table dc_[JPEG_DC_TABLES];
+  Table ac_[JPEG_DC_TABLES];
+  uint16_t quant_[4] = {1, 1, 1, 1};
+  Component comp_[JPEG_DC_MAX_COMPONENTS];
+  int components_ = 0;
+  int width_ = 0, height_ = 0;
+  int hMax_ = 1, vMax_ = 1;
+  int thumbWidth_ = 0, thumbHeight_ = 0;
+  int scanComp_[JPEG_DC_MAX_COMPONENTS];
+  int scanCount_ = 0;
+  bool single_ = false;
+  int mcusX_ = 0, mcusY_ = 0;
+  uint32_t restartInterval_ = 0;
+
+  const uint8_t* p_ = nullptr;
+  uint32_t acc_ = 0;
+  int bits_ = 0;
+  bool marker_ = false;
+  int padded_ = 0;                 // zero bytes fed past the data
+};
@@ -0,0 +1,856 @@
+#pragma once
+// Privacy masks and a text overlay edited into a JPEG without re-encoding it.
+//
+// Decoding a frame to pixels, painting on it and encoding it again costs a
+// full IDCT, colour conversion and DCT per frame, far more than cameraTask
+// has. The editor instead works on the entropy-coded scan, MCU by MCU:
+//  - an MCU under a mask is replaced by flat blocks (one DC, then EOB) at the
+//    mask's luma level and neutral chroma;
+//  - luma blocks under the text get glyph blocks, coded once per set of
+//    tables: a 16x16 pixel cell per character (2x2 blocks), transformed and
+//    quantized with the frame's own table and Huffman coded with its own AC
+//    table, so splicing one in is a copy of its bits plus a DC difference.
+//    Chroma there is neutral;
+//  - every other block is copied bit for bit. DC coefficients are coded as
+//    the difference from the block before, so after a replaced block the
+//    first block of each component has its DC difference re-coded and its AC
+//    bits copied; from there on the stream is in step again.
+// Finding where a block ends still means reading its Huffman codes, as in
+// jpeg_dc.h (the same lookup that takes a code and its extra bits in one
+// step), but the bits read are forwarded as they are, nothing is decoded
+// further. With restart intervals, an interval without edits is copied as
+// bytes, markers and all, without reading it.
+//
+// Masks cover whole MCUs (16x8 pixels for the camera's 4:2:2), so they are
+// rounded out to them. Text is placed on a 16 pixel grid, which is whole
+// MCUs for all the usual samplings; an MCU partly under text keeps its other
+// luma blocks. The glyphs are "0123456789-: "; anything else is a space.
+//
+// Same scope as JpegDcDecoder: baseline and extended Huffman (SOF0/SOF1),
+// 8-bit, with all components in one interleaved scan, or grayscale. The luma
+// component must have the largest sampling factors. Frames without DHT use
+// the standard tables. Everything outside the scan is copied unchanged.
+// host/bench_jpeg_edit.cpp checks the output against libjpeg and times it
+// against a decode and re-encode. No device dependencies and no allocation;
+// an editor is used from one task.
+//
+//   JpegMcuEditor editor;
+//   if (editor.parse(jpeg, len)) {
+//     editor.mask(x, y, w, h);
+//     editor.text("12:34:56", 0, 0);
+//     size_t outLen = editor.edit(out, capacity);  // 0: failed
+//   }
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "jpeg_dc.h"  // the standard Huffman tables
+
+const int JPEG_EDIT_FAST_BITS = 9;
+const int JPEG_EDIT_MAX_COMPONENTS = 4;
+const int JPEG_EDIT_TABLES = 2;            // Huffman tables of each class
+const int JPEG_EDIT_MAX_MASKS = 8;
+const int JPEG_EDIT_MAX_TEXT = 24;         // characters
+const int JPEG_EDIT_CELL = 16;             // glyph cell, pixels
+const int JPEG_EDIT_GLYPHS = 13;
+const size_t JPEG_EDIT_GLYPH_BYTES = 6144; // coded glyph blocks, for all tables in use
+const uint8_t JPEG_EDIT_TEXT_BG = 16;      // glyph cell levels
+const uint8_t JPEG_EDIT_TEXT_FG = 240;
+
+const char JPEG_EDIT_CHARS[] = "0123456789-: ";
+// 5x7, one byte per row, bit 4 leftmost
+const uint8_t JPEG_EDIT_FONT[JPEG_EDIT_GLYPHS][7] = {
+    {0x0E, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0E}, {0x04, 0x0C, 0x04, 0x04, 0x04, 0x04, 0x0E},
+    {0x0E, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1F}, {0x1F, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0E},
+    {0x02, 0x06, 0x0A, 0x12, 0x1F, 0x02, 0x02}, {0x1F, 0x10, 0x1E, 0x01, 0x01, 0x11, 0x0E},
+    {0x06, 0x08, 0x10, 0x1E, 0x11, 0x11, 0x0E}, {0x1F, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},
+    {0x0E, 0x11, 0x11, 0x0E, 0x11, 0x11, 0x0E}, {0x0E, 0x11, 0x11, 0x0F, 0x01, 0x02, 0x0C},
+    {0x00, 0x00, 0x00, 0x1F, 0x00, 0x00, 0x00}, {0x00, 0x0C, 0x0C, 0x00, 0x0C, 0x0C, 0x00},
+    {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}};
+
+// Natural (row-major) index of each zigzag position.
+const uint8_t JPEG_EDIT_ZIGZAG[64] = {
+    0,  1,  8,  16, 9,  2,  3,  10, 17, 24, 32, 25, 18, 11, 4,  5,  12, 19, 26, 33, 40, 48,
+    41, 34, 27, 20, 13, 6,  7,  14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23,
+    30, 37, 44, 51, 58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+class JpegMcuEditor {
+ public:
+  // Luma of masked areas, 0..255.
+  void setMaskLevel(uint8_t level) { maskLevel_ = level; }
+
+  // Read the headers up to the scan, and forget the last frame's masks and
+  // text. False for anything the editor doesn't handle or that is cut short.
+  bool parse(const uint8_t* jpeg, size_t len) {
+    jpeg_ = jpeg;
+    end_ = jpeg + len;
+    scan_ = nullptr;
+    masks_ = 0;
+    textLen_ = 0;
+    components_ = 0;
+    mcuW_ = mcuH_ = 0;
+    restartInterval_ = 0;
+    bool dhtSeen = false;
+    for (int i = 0; i < JPEG_EDIT_TABLES; i++) dc_[i].present = ac_[i].present = false;
+    if (len < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) return false;
+    const uint8_t* p = jpeg + 2;
+
+    for (;;) {
+      while (p < end_ && *p != 0xFF) p++;
+      while (p < end_ && *p == 0xFF) p++;
+      if (p + 3 > end_) return false;
+      uint8_t marker = *p++;
+      if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) continue;
+      if (marker == 0xD9) return false;
+      size_t segLen = (p[0] << 8) | p[1];
+      if (segLen < 2 || p + segLen > end_) return false;
+      const uint8_t* seg = p + 2;
+      size_t n = segLen - 2;
+      p += segLen;
+
+      switch (marker) {
+        case 0xC0:
+        case 0xC1:
+          if (!parseFrame(seg, n)) return false;
+          break;
+        case 0xC4:
+          if (!parseTables(seg, n)) return false;
+          dhtSeen = true;
+          break;
+        case 0xDB:
+          if (!parseQuant(seg, n)) return false;
+          break;
+        case 0xDD:
+          if (n < 2) return false;
+          restartInterval_ = (seg[0] << 8) | seg[1];
+          break;
+        case 0xDA:
+          if (!components_) return false;
+          if (!dhtSeen) {
+            buildTable(dc_[0], JPEG_DC_STD_DC_LUMA, sizeof(JPEG_DC_STD_DC_LUMA), false);
+            buildTable(dc_[1], JPEG_DC_STD_DC_CHROMA, sizeof(JPEG_DC_STD_DC_CHROMA), false);
+            buildTable(ac_[0], JPEG_DC_STD_AC_LUMA, sizeof(JPEG_DC_STD_AC_LUMA), true);
+            buildTable(ac_[1], JPEG_DC_STD_AC_CHROMA, sizeof(JPEG_DC_STD_AC_CHROMA), true);
+          }
+          if (!parseScan(seg, n)) return false;
+          scan_ = p;
+          return true;
+        default:
+          if (marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false;  // progressive, lossless, arithmetic
+          }
+          break;
+      }
+    }
+  }
+
+  int width() const { return width_; }
+  int height() const { return height_; }
+  int mcuWidth() const { return mcuW_; }
+  int mcuHeight() const { return mcuH_; }
+
+  // Blank this rectangle (pixels) in the next edit(), rounded out to whole
+  // MCUs. False when JPEG_EDIT_MAX_MASKS are set already.
+  bool mask(int x, int y, int w, int h) {
+    if (masks_ == JPEG_EDIT_MAX_MASKS) return false;
+    if (w <= 0 || h <= 0 || !mcuW_) return true;  // nothing to cover
+    Rect& r = mask_[masks_++];
+    r.x0 = x > 0 ? x / mcuW_ : 0;
+    r.y0 = y > 0 ? y / mcuH_ : 0;
+    r.x1 = (x + w + mcuW_ - 1) / mcuW_;
+    r.y1 = (y + h + mcuH_ - 1) / mcuH_;
+    return true;
+  }
+
+  // Write s in the next edit(), its cell grid starting at x, y rounded down
+  // to JPEG_EDIT_CELL. Cells past the frame's edge are left out.
+  void text(const char* s, int x, int y) {
+    textLen_ = 0;
+    if (!mcuW_) return;
+    textX_ = x > 0 ? x / JPEG_EDIT_CELL * JPEG_EDIT_CELL : 0;
+    textY_ = y > 0 ? y / JPEG_EDIT_CELL * JPEG_EDIT_CELL : 0;
+    for (; s[textLen_] && textLen_ < JPEG_EDIT_MAX_TEXT; textLen_++) {
+      const char* g = strchr(JPEG_EDIT_CHARS, s[textLen_]);
+      text_[textLen_] = (uint8_t)(g ? g - JPEG_EDIT_CHARS : JPEG_EDIT_GLYPHS - 1);
+    }
+    int fit = (width_ - textX_) / JPEG_EDIT_CELL;
+    if (textY_ + JPEG_EDIT_CELL > height_) fit = 0;
+    if (textLen_ > fit) textLen_ = fit > 0 ? fit : 0;
+    textRect_.x0 = textX_ / mcuW_;
+    textRect_.y0 = textY_ / mcuH_;
+    textRect_.x1 = (textX_ + textLen_ * JPEG_EDIT_CELL + mcuW_ - 1) / mcuW_;
+    textRect_.y1 = (textY_ + JPEG_EDIT_CELL + mcuH_ - 1) / mcuH_;
+  }
+
+  // Write the parsed frame with its masks and text to out. Returns the
+  // length, or 0 if the frame is corrupt or out is too small. One edit per
+  // parse.
+  size_t edit(uint8_t* out, size_t capacity) {
+    if (!scan_) return 0;
+    const uint8_t* scan = scan_;
+    scan_ = nullptr;
+    size_t head = scan - jpeg_;
+    if (capacity < head + 2) return 0;
+    memcpy(out, jpeg_, head);
+    uint32_t mcus = (uint32_t)mcusX_ * mcusY_;
+    blocks_ = recoded_ = 0;
+    for (int i = 0; i < scanCount_; i++) blocks_ += mcus * comp_[scanComp_[i]].h * comp_[scanComp_[i]].v;
+    bool any = masks_ > 0 || textLen_ > 0;
+    if (!any) {  // nothing to do: the frame as it is
+      if (capacity < (size_t)(end_ - jpeg_)) return 0;
+      memcpy(out + head, scan, end_ - scan);
+      return end_ - jpeg_;
+    }
+    if (textLen_ && !buildGlyphs()) return 0;
+    for (int i = 0; i < scanCount_; i++) {
+      const Component& c = comp_[scanComp_[i]];
+      flatDc_[i] = scanComp_[i] == 0 ? dcFor(maskLevel_, quant_[c.quant][0]) : 0;
+    }
+
+    out_.begin(out + head, out + capacity);
+    startBits(scan);
+    uint32_t interval = restartInterval_ ? restartInterval_ : mcus;
+    for (uint32_t first = 0, n = 0; first < mcus; first += interval, n++) {
+      uint32_t last = first + interval < mcus ? first + interval : mcus;
+      if (n) {
+        out_.pad();
+        out_.marker(0xD0 + ((n - 1) & 7));
+        if (!restart()) return 0;
+      }
+      if (restartInterval_ && !edited(first, last)) {
+        const uint8_t* e = nextMarker(p_);  // a whole interval as it is
+        out_.raw(p_, e - p_);
+        p_ = e;
+        continue;
+      }
+      memset(predIn_, 0, sizeof(predIn_));
+      memset(predOut_, 0, sizeof(predOut_));
+      for (uint32_t m = first; m < last; m++) {
+        if (!editMcu(m % mcusX_, m / mcusX_) || out_.overflow) return 0;
+      }
+      if (bits_ < padded_ * 8) return 0;  // read past the data: corrupt
+    }
+    copy_ = false;
+    out_.pad();
+    const uint8_t* tail = nextMarker(p_);
+    if (tail == end_) return 0;  // cut short: no EOI
+    out_.raw(tail, end_ - tail);
+    if (out_.overflow) return 0;
+    return out_.p - out;
+  }
+
+  // Blocks in the frame last edited, and those not copied bit for bit
+  // (replaced, or with their DC re-coded).
+  uint32_t blocks() const { return blocks_; }
+  uint32_t recodedBlocks() const { return recoded_; }
+
+ private:
+  struct Table {
+    uint16_t fast[1 << JPEG_EDIT_FAST_BITS];  // as JpegDcDecoder's
+    int32_t maxCode[17];
+    int32_t offset[17];
+    uint8_t symbols[256];
+    uint16_t code[256];                       // encoder: code and length of each symbol, length 0 for none
+    uint8_t size[256];
+    uint32_t hash;                            // of the DHT, to know when the glyphs need coding again
+    bool present;
+  };
+
+  struct Component {
+    uint8_t id;
+    uint8_t h, v;
+    uint8_t quant;
+    uint8_t dcTable, acTable;
+  };
+
+  struct Rect {
+    int x0, y0, x1, y1;  // MCUs, end exclusive
+    bool has(int x, int y) const { return x >= x0 && x < x1 && y >= y0 && y < y1; }
+  };
+
+  // Output bits, with 0xFF bytes stuffed. Overflow stops writing; the edit
+  // then fails.
+  struct BitWriter {
+    uint8_t* p;
+    uint8_t* end;
+    uint64_t acc;
+    int bits;
+    bool overflow;
+
+    void begin(uint8_t* out, uint8_t* limit) {
+      p = out;
+      end = limit;
+      acc = 0;
+      bits = 0;
+      overflow = false;
+    }
+
+    void put(uint32_t value, int n) {
+      acc = (acc << n) | value;
+      bits += n;
+      if (bits >= 32) flushWord();
+    }
+
+    void flushWord() {
+      bits -= 32;
+      uint32_t w = (uint32_t)(acc >> bits);
+      if (end - p < 8) {
+        overflow = true;
+        return;
+      }
+      uint32_t x = ~w;
+      if (((x - 0x01010101u) & ~x & 0x80808080u) == 0) {  // no 0xFF byte: store the word
+        p[0] = w >> 24;
+        p[1] = w >> 16;
+        p[2] = w >> 8;
+        p[3] = w;
+        p += 4;
+        return;
+      }
+      for (int s = 24; s >= 0; s -= 8) {
+        uint8_t b = w >> s;
+        *p++ = b;
+        if (b == 0xFF) *p++ = 0;
+      }
+    }
+
+    // Fill the last byte with 1 bits, as the encoder does before a marker.
+    void pad() {
+      int n = (8 - (bits & 7)) & 7;
+      if (n) put((1u << n) - 1, n);
+      while (bits >= 8) {
+        bits -= 8;
+        uint8_t b = acc >> bits;
+        if (end - p < 2) {
+          overflow = true;
+          return;
+        }
+        *p++ = b;
+        if (b == 0xFF) *p++ = 0;
+      }
+    }
+
+    void marker(uint8_t m) {
+      uint8_t bytes[2] = {0xFF, m};
+      raw(bytes, 2);
+    }
+
+    // Bytes at a byte boundary, as they are.
+    void raw(const uint8_t* src, size_t n) {
+      if ((size_t)(end - p) < n) {
+        overflow = true;
+        return;
+      }
+      memcpy(p, src, n);
+      p += n;
+    }
+  };
+
+  // --- Headers ---
+
+  static void buildTable(Table& t, const uint8_t* dht, size_t n, bool ac) {
+    memset(t.fast, 0, sizeof(t.fast));
+    memset(t.size, 0, sizeof(t.size));
+    int count = 0;
+    for (int l = 0; l < 16; l++) count += dht[l];
+    if (count > 256 || 16 + (size_t)count > n) count = 0;
+    memcpy(t.symbols, dht + 16, count);
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < 16 + count; i++) hash = (hash ^ dht[i]) * 16777619u;
+    t.hash = hash;
+    int32_t code = 0;
+    int k = 0;
+    for (int l = 1; l <= 16; l++) {
+      int lengthCount = dht[l - 1];
+      t.offset[l] = k - code;
+      for (int i = 0; i < lengthCount && k < count; i++, k++, code++) {
+        uint8_t sym = t.symbols[k];
+        if (code < (1 << l)) {
+          t.code[sym] = (uint16_t)code;
+          t.size[sym] = (uint8_t)l;
+        }
+        if (l > JPEG_EDIT_FAST_BITS || code >= (1 << l)) continue;
+        int fill = 1 << (JPEG_EDIT_FAST_BITS - l);
+        uint16_t entry = (uint16_t)((l << 8) | sym);
+        int extra = sym & 15, run = sym >> 4;
+        if (ac) {
+          if (sym == 0x00) entry = (uint16_t)((l << 8) | 64);
+          else if (sym == 0xF0) entry = (uint16_t)((l << 8) | 16);
+          else entry = 0x8000 | (uint16_t)((l << 8) | sym);
+        }
+        for (int f = 0; f < fill; f++) {
+          int index = (code << (JPEG_EDIT_FAST_BITS - l)) | f;
+          uint16_t e = entry;
+          if (ac && (entry & 0x8000) && l + extra <= JPEG_EDIT_FAST_BITS) {
+            e = (uint16_t)(((l + extra) << 8) | (run + 1));
+          }
+          t.fast[index] = e;
+        }
+      }
+      t.maxCode[l] = lengthCount ? code : -1;
+      code <<= 1;
+    }
+    t.present = true;
+  }
+
+  bool parseTables(const uint8_t* s, size_t n) {
+    while (n >= 17) {
+      int cls = s[0] >> 4, id = s[0] & 15;
+      size_t count = 0;
+      for (int l = 1; l <= 16; l++) count += s[l];
+      if (cls > 1 || id >= JPEG_EDIT_TABLES || count > 256 || 17 + count > n) return false;
+      buildTable(cls ? ac_[id] : dc_[id], s + 1, 16 + count, cls == 1);
+      s += 17 + count;
+      n -= 17 + count;
+    }
+    return n == 0;
+  }
+
+  bool parseQuant(const uint8_t* s, size_t n) {
+    while (n >= 65) {
+      int precision = s[0] >> 4, id = s[0] & 15;
+      size_t size = precision ? 129 : 65;
+      if (id > 3 || size > n) return false;
+      for (int k = 0; k < 64; k++) quant_[id][k] = precision ? (s[1 + 2 * k] << 8) | s[2 + 2 * k] : s[1 + k];
+      s += size;
+      n -= size;
+    }
+    return n == 0;
+  }
+
+  bool parseFrame(const uint8_t* s, size_t n) {
+    if (n < 6 || s[0] != 8) return false;
+    height_ = (s[1] << 8) | s[2];
+    width_ = (s[3] << 8) | s[4];
+    components_ = s[5];
+    if (!width_ || !height_ || !components_ || components_ > JPEG_EDIT_MAX_COMPONENTS ||
+        n < 6 + 3u * components_) {
+      components_ = 0;
+      return false;
+    }
+    hMax_ = vMax_ = 1;
+    for (int i = 0; i < components_; i++) {
+      Component& c = comp_[i];
+      c.id = s[6 + 3 * i];
+      c.h = s[7 + 3 * i] >> 4;
+      c.v = s[7 + 3 * i] & 15;
+      c.quant = s[8 + 3 * i] & 3;
+      if (c.h < 1 || c.h > 4 || c.v < 1 || c.v > 4) {
+        components_ = 0;
+        return false;
+      }
+      if (c.h > hMax_) hMax_ = c.h;
+      if (c.v > vMax_) vMax_ = c.v;
+    }
+    if (comp_[0].h != hMax_ || comp_[0].v != vMax_) {
+      components_ = 0;  // luma not at full resolution
+      return false;
+    }
+    return true;
+  }
+
+  // One scan with every component, sequential.
+  bool parseScan(const uint8_t* s, size_t n) {
+    if (n < 1) return false;
+    int count = s[0];
+    if (count != components_ || n < 4 + 2u * count) return false;
+    for (int i = 0; i < count; i++) {
+      int which = -1;
+      for (int j = 0; j < components_; j++) {
+        if (comp_[j].id == s[1 + 2 * i]) which = j;
+      }
+      if (which < 0) return false;
+      Component& c = comp_[which];
+      c.dcTable = s[2 + 2 * i] >> 4;
+      c.acTable = s[2 + 2 * i] & 15;
+      if (c.dcTable >= JPEG_EDIT_TABLES || c.acTable >= JPEG_EDIT_TABLES || !dc_[c.dcTable].present ||
+          !ac_[c.acTable].present) {
+        return false;
+      }
+      scanComp_[i] = which;
+    }
+    const uint8_t* tail = s + 1 + 2 * count;
+    if (tail[0] != 0 || tail[1] != 63 || tail[2] != 0) return false;
+    scanCount_ = count;
+    if (count == 1) {
+      // Grayscale: one block per MCU
+      comp_[0].h = comp_[0].v = hMax_ = vMax_ = 1;
+    }
+    mcuW_ = 8 * hMax_;
+    mcuH_ = 8 * vMax_;
+    mcusX_ = (width_ + mcuW_ - 1) / mcuW_;
+    mcusY_ = (height_ + mcuH_ - 1) / mcuH_;
+    return true;
+  }
+
+  // The next marker other than a stuffed zero or, with restart intervals
+  // walked, RSTn: the end of the entropy-coded data (or of an interval).
+  const uint8_t* nextMarker(const uint8_t* p) const {
+    while (p + 1 < end_) {
+      p = (const uint8_t*)memchr(p, 0xFF, end_ - 1 - p);
+      if (!p) return end_;
+      if (p[1] != 0x00) return p;
+      p += 2;
+    }
+    return end_;
+  }
+
+  // --- Editing ---
+
+  bool edited(uint32_t first, uint32_t last) const {
+    for (uint32_t m = first; m < last; m++) {
+      if (kind(m % mcusX_, m / mcusX_)) return true;
+    }
+    return false;
+  }
+
+  enum { KEEP, MASK, TEXT };
+  int kind(int mx, int my) const {
+    for (int i = 0; i < masks_; i++) {
+      if (mask_[i].has(mx, my)) return MASK;
+    }
+    return textLen_ && textRect_.has(mx, my) ? TEXT : KEEP;
+  }
+
+  bool editMcu(int mx, int my) {
+    int k = kind(mx, my);
+    for (int i = 0; i < scanCount_; i++) {
+      const Component& c = comp_[scanComp_[i]];
+      const Table& dc = dc_[c.dcTable];
+      const Table& ac = ac_[c.acTable];
+      for (int by = 0; by < c.v; by++) {
+        for (int bx = 0; bx < c.h; bx++) {
+          bool ok;
+          if (k == KEEP) {
+            ok = copyBlock(i, dc, ac);
+          } else if (k == MASK) {
+            ok = replaceBlock(i, dc, ac, flatDc_[i], -1);
+          } else if (scanComp_[i] != 0) {
+            ok = replaceBlock(i, dc, ac, 0, -1);  // neutral chroma under text
+          } else {
+            int px = (mx * c.h + bx) * 8 - textX_, py = (my * c.v + by) * 8 - textY_;
+            if (px < 0 || py < 0 || px >= textLen_ * JPEG_EDIT_CELL || py >= JPEG_EDIT_CELL) {
+              ok = copyBlock(i, dc, ac);
+            } else {
+              int glyph = text_[px / JPEG_EDIT_CELL] * 4 + (py / 8) * 2 + (px / 8) % 2;
+              ok = replaceBlock(i, dc, ac, glyphDc_[glyph], glyph);
+            }
+          }
+          if (!ok) return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  bool copyBlock(int i, const Table& dc, const Table& ac) {
+    int diff;
+    if (predOut_[i] == predIn_[i]) {
+      copy_ = true;  // in step: the whole block as it is
+      if (!dcDiff(dc, diff)) {
+        copy_ = false;
+        return false;
+      }
+      bool ok = skipAc(ac);
+      copy_ = false;
+      predIn_[i] += diff;
+      predOut_[i] = predIn_[i];
+      return ok;
+    }
+    if (!dcDiff(dc, diff)) return false;
+    predIn_[i] += diff;
+    recoded_++;
+    if (!putDc(dc, predIn_[i] - predOut_[i])) return false;
+    predOut_[i] = predIn_[i];
+    copy_ = true;
+    bool ok = skipAc(ac);
+    copy_ = false;
+    return ok;
+  }
+
+  bool replaceBlock(int i, const Table& dc, const Table& ac, int dcValue, int glyph) {
+    int diff;
+    if (!dcDiff(dc, diff) || !skipAc(ac)) return false;
+    predIn_[i] += diff;
+    recoded_++;
+    if (!putDc(dc, dcValue - predOut_[i])) return false;
+    predOut_[i] = dcValue;
+    if (glyph >= 0) {
+      putGlyph(glyph);
+      return true;
+    }
+    if (!ac.size[0x00]) return false;
+    out_.put(ac.code[0x00], ac.size[0x00]);  // EOB: a flat block
+    return true;
+  }
+
+  static int category(int v) {
+    int a = v < 0 ? -v : v, s = 0;
+    while (a) {
+      s++;
+      a >>= 1;
+    }
+    return s;
+  }
+
+  bool putDc(const Table& t, int diff) {
+    int s = category(diff);
+    if (s > 11 || !t.size[s]) return false;
+    out_.put(t.code[s], t.size[s]);
+    if (s) out_.put((uint32_t)(diff < 0 ? diff - 1 : diff) & ((1u << s) - 1), s);
+    return true;
+  }
+
+  // Quantized DC of a flat block at level.
+  static int dcFor(int level, int q) {
+    int v = 8 * (level - 128);
+    return (v >= 0 ? v + q / 2 : v - q / 2) / q;
+  }
+
+  // --- Glyphs ---
+
+  // Code the glyph blocks for the luma quantization and AC tables of this
+  // frame, unless they were coded for the same ones last time.
+  bool buildGlyphs() {
+    const Component& luma = comp_[0];
+    const Table& ac = ac_[luma.acTable];
+    uint32_t key = ac.hash;
+    for (int k = 0; k < 64; k++) key = (key ^ quant_[luma.quant][k]) * 16777619u;
+    if (key == glyphKey_ && glyphsOk_) return true;
+    glyphKey_ = key;
+    glyphsOk_ = false;
+
+    float basis[8][8];  // C(u)/2 cos((2x+1)u pi/16)
+    for (int u = 0; u < 8; u++) {
+      for (int x = 0; x < 8; x++) {
+        basis[u][x] = (u ? 0.5f : 0.35355339f) * cosf((2 * x + 1) * u * 3.14159265f / 16);
+      }
+    }
+    size_t bits = 0;
+    for (int g = 0; g < JPEG_EDIT_GLYPHS; g++) {
+      for (int sub = 0; sub < 4; sub++) {
+        float pixels[8][8], rows[8][8];
+        for (int y = 0; y < 8; y++) {
+          for (int x = 0; x < 8; x++) {
+            int cx = (sub % 2) * 8 + x, cy = (sub / 2) * 8 + y;
+            int fx = (cx - 3) / 2, fy = (cy - 1) / 2;  // the 5x7 font doubled, centred in the cell
+            bool ink = cx >= 3 && cy >= 1 && fx < 5 && fy < 7 && (JPEG_EDIT_FONT[g][fy] >> (4 - fx)) & 1;
+            pixels[y][x] = (ink ? JPEG_EDIT_TEXT_FG : JPEG_EDIT_TEXT_BG) - 128.0f;
+          }
+        }
+        for (int v = 0; v < 8; v++) {
+          for (int x = 0; x < 8; x++) {
+            float sum = 0;
+            for (int y = 0; y < 8; y++) sum += basis[v][y] * pixels[y][x];
+            rows[v][x] = sum;
+          }
+        }
+        int coef[64];  // zigzag order, quantized
+        for (int k = 0; k < 64; k++) {
+          int v = JPEG_EDIT_ZIGZAG[k] / 8, u = JPEG_EDIT_ZIGZAG[k] % 8;
+          float sum = 0;
+          for (int x = 0; x < 8; x++) sum += basis[u][x] * rows[v][x];
+          float q = quant_[luma.quant][k];
+          coef[k] = (int)(sum >= 0 ? sum / q + 0.5f : sum / q - 0.5f);
+        }
+        int index = g * 4 + sub;
+        glyphDc_[index] = coef[0];
+        glyphStart_[index] = (uint16_t)(bits / 8);
+        if (!codeAc(ac, coef, bits)) return false;
+        glyphBits_[index] = (uint16_t)(bits - glyphStart_[index] * 8);
+        bits = (bits + 7) & ~(size_t)7;  // each starts on a byte
+      }
+    }
+    glyphsOk_ = true;
+    return true;
+  }
+
+  bool codeAc(const Table& t, const int* coef, size_t& bits) {
+    int run = 0;
+    for (int k = 1; k < 64; k++) {
+      int v = coef[k];
+      if (!v) {
+        run++;
+        continue;
+      }
+      for (; run > 15; run -= 16) {
+        if (!glyphPut(t, 0xF0, 0, 0, bits)) return false;
+      }
+      int s = category(v);
+      if (s > 10 || !glyphPut(t, (uint8_t)((run << 4) | s), (uint32_t)(v < 0 ? v - 1 : v) & ((1u << s) - 1), s, bits)) {
+        return false;
+      }
+      run = 0;
+    }
+    return !run || glyphPut(t, 0x00, 0, 0, bits);
+  }
+
+  bool glyphPut(const Table& t, uint8_t sym, uint32_t extra, int extraBits, size_t& bits) {
+    if (!t.size[sym]) return false;
+    uint32_t value = ((uint32_t)t.code[sym] << extraBits) | extra;
+    int n = t.size[sym] + extraBits;
+    if (bits + n > JPEG_EDIT_GLYPH_BYTES * 8) return false;
+    for (int b = n - 1; b >= 0; b--, bits++) {
+      uint8_t& byte = glyphPool_[bits / 8];
+      if (bits % 8 == 0) byte = 0;
+      byte |= ((value >> b) & 1) << (7 - bits % 8);
+    }
+    return true;
+  }
+
+  void putGlyph(int index) {
+    const uint8_t* p = glyphPool_ + glyphStart_[index];
+    int n = glyphBits_[index];
+    for (; n >= 8; n -= 8) out_.put(*p++, 8);
+    if (n) out_.put(*p >> (8 - n), n);
+  }
+
+  // --- Input bits, as JpegDcDecoder reads them; forwarded to out_ while copy_ ---
+
+  void startBits(const uint8_t* p) {
+    p_ = p;
+    acc_ = 0;
+    bits_ = 0;
+    marker_ = false;
+    padded_ = 0;
+  }
+
+  void refill() {
+    while (bits_ <= 24) {
+      uint32_t b = 0;
+      if (!marker_ && p_ < end_ && (p_[0] != 0xFF || (p_ + 1 < end_ && p_[1] == 0x00))) {
+        b = *p_;
+        p_ += b == 0xFF ? 2 : 1;
+      } else {
+        marker_ = true;
+        padded_++;
+      }
+      acc_ |= b << (24 - bits_);
+      bits_ += 8;
+    }
+  }
+
+  uint32_t peek(int n) const { return acc_ >> (32 - n); }
+  void consume(int n) {
+    if (copy_) out_.put(peek(n), n);
+    acc_ <<= n;
+    bits_ -= n;
+  }
+
+  int slowSymbol(const Table& t) {
+    for (int l = JPEG_EDIT_FAST_BITS + 1; l <= 16; l++) {
+      int32_t code = (int32_t)peek(l);
+      if (code < t.maxCode[l]) {
+        consume(l);
+        return t.symbols[(t.offset[l] + code) & 255];
+      }
+    }
+    return -1;
+  }
+
+  bool dcDiff(const Table& t, int& diff) {
+    if (bits_ < 16) refill();
+    uint16_t e = t.fast[peek(JPEG_EDIT_FAST_BITS)];
+    int s;
+    if (e) {
+      consume(e >> 8);
+      s = e & 0xFF;
+    } else {
+      s = slowSymbol(t);
+      if (s < 0) return false;
+    }
+    s &= 15;
+    diff = 0;
+    if (s) {
+      if (bits_ < s) refill();
+      int v = (int)peek(s);
+      consume(s);
+      diff = v < (1 << (s - 1)) ? v - (1 << s) + 1 : v;
+    }
+    return true;
+  }
+
+  bool skipAc(const Table& t) {
+    for (int k = 1; k < 64;) {
+      if (bits_ < 16) refill();
+      uint16_t e = t.fast[peek(JPEG_EDIT_FAST_BITS)];
+      if (e && !(e & 0x8000)) {
+        consume(e >> 8);
+        k += e & 0xFF;
+        continue;
+      }
+      int rs;
+      if (e) {
+        consume((e >> 8) & 0x7F);
+        rs = e & 0xFF;
+      } else {
+        rs = slowSymbol(t);
+        if (rs < 0) return false;
+      }
+      int s = rs & 15, r = rs >> 4;
+      if (s == 0) {
+        if (r != 15) return true;
+        k += 16;
+        continue;
+      }
+      if (bits_ < s) refill();
+      consume(s);
+      k += r + 1;
+    }
+    return true;
+  }
+
+  bool restart() {
+    const uint8_t* p = p_;
+    while (p + 1 < end_ && !(p[0] == 0xFF && p[1] >= 0xD0 && p[1] <= 0xD7)) p++;
+    if (p + 1 >= end_) return false;
+    startBits(p + 2);
+    return true;
+  }
+
+  const uint8_t* jpeg_ = nullptr;
+  const uint8_t* end_ = nullptr;
+  const uint8_t* scan_ = nullptr;
+  Table dc_[JPEG_EDIT_TABLES];
+  Table ac_[JPEG_EDIT_TABLES];
+  uint16_t quant_[4][64] = {};  // zigzag order, as in DQT
+  Component comp_[JPEG_EDIT_MAX_COMPONENTS];
+  int components_ = 0;
+  int width_ = 0, height_ = 0;
+  int hMax_ = 1, vMax_ = 1;
+  int scanComp_[JPEG_EDIT_MAX_COMPONENTS];
+  int scanCount_ = 0;
+  int mcuW_ = 0, mcuH_ = 0;
+  int mcusX_ = 0, mcusY_ = 0;
+  uint32_t restartInterval_ = 0;
+
+  uint8_t maskLevel_ = 0;
+  Rect mask_[JPEG_EDIT_MAX_MASKS];
+  int masks_ = 0;
+  uint8_t text_[JPEG_EDIT_MAX_TEXT];  // glyph indexes
+  int textLen_ = 0;
+  int textX_ = 0, textY_ = 0;
+  Rect textRect_ = {0, 0, 0, 0};
+  int flatDc_[JPEG_EDIT_MAX_COMPONENTS] = {0};
+
+  uint8_t glyphPool_[JPEG_EDIT_GLYPH_BYTES];
+  uint16_t glyphStart_[JPEG_EDIT_GLYPHS * 4];  // byte in glyphPool_
+  uint16_t glyphBits_[JPEG_EDIT_GLYPHS * 4];
+  int16_t glyphDc_[JPEG_EDIT_GLYPHS * 4];
+  uint32_t glyphKey_ = 0;
+  bool glyphsOk_ = false;
+
+  int predIn_[JPEG_EDIT_MAX_COMPONENTS];   // DC predictors of the input and of the output
+  int predOut_[JPEG_EDIT_MAX_COMPONENTS];
+  uint32_t blocks_ = 0;
+  uint32_t recoded_ = 0;
+
+  BitWriter out_;
+  bool copy_ = false;
+  const uint8_t* p_ = nullptr;
+  uint32_t acc_ = 0;
+  int bits_ = 0;
+  bool marker_ = false;
+  int padded_ = 0;
+};
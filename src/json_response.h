@@ -0,0 +1,42 @@
+#pragma once
+// An AsyncWebServer response whose JSON body lives inside the response
+// object itself. The handler renders into it with JsonWriter and sends it;
+// the library frees it with the request. The only heap allocation is the
+// response object, which every response needs anyway: no String, no
+// reallocation while the body grows, and no shared buffer whose lifetime
+// has to outlast a slow client.
+
+#include <ESPAsyncWebServer.h>
+#include "json_writer.h"
+
+template <size_t N>
+class JsonResponse : public AsyncAbstractResponse {
+ public:
+  JsonResponse() : out_(body_, N) {
+    _code = 200;
+    _contentType = "application/json";
+  }
+
+  JsonWriter& out() { return out_; }
+
+  // False if the body didn't fit; the response must then not be sent.
+  bool finish() {
+    _contentLength = out_.length();
+    return !out_.overflowed();
+  }
+
+  bool _sourceValid() const override { return true; }
+
+  size_t _fillBuffer(uint8_t* buf, size_t maxLen) override {
+    size_t n = out_.length() - sent_;
+    if (n > maxLen) n = maxLen;
+    memcpy(buf, body_ + sent_, n);
+    sent_ += n;
+    return n;
+  }
+
+ private:
+  char body_[N];
+  JsonWriter out_;
+  size_t sent_ = 0;
+};
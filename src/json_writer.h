@@ -0,0 +1,83 @@
+#pragma once
+// snprintf-based JSON rendering into a caller-owned, fixed-size buffer.
+//
+// /stats used to be built with String concatenation: a dozen reallocations
+// per request on the async_tcp task, from every dashboard, every second.
+// JsonWriter appends formatted text to a char array instead and never
+// touches the heap. Output that doesn't fit is cut off and flagged, so the
+// caller can refuse to send a truncated document.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+class JsonWriter {
+ public:
+  JsonWriter(char* buf, size_t size) : buf_(buf), size_(size) {
+    if (size_) buf_[0] = '\0';
+  }
+
+  void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (len_ >= size_) {
+      overflow_ = true;
+      return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf_ + len_, size_ - len_, fmt, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= size_ - len_) {
+      overflow_ = true;
+      len_ = size_ - 1;
+      buf_[len_] = '\0';
+      return;
+    }
+    len_ += n;
+  }
+
+  // Appends a quoted string, escaping what JSON requires.
+  void string(const char* s) {
+    put('"');
+    for (; *s; s++) {
+      unsigned char c = *s;
+      if (c == '"' || c == '\\') {
+        put('\\');
+        put(c);
+      } else if (c < 0x20) {
+        printf("\\u%04x", c);
+      } else {
+        put(c);
+      }
+    }
+    put('"');
+  }
+
+  // Drops everything after len, e.g. a partly written section that
+  // overflowed, and clears the overflow flag.
+  void truncate(size_t len) {
+    if (len < len_) {
+      len_ = len;
+      buf_[len_] = '\0';
+    }
+    overflow_ = false;
+  }
+
+  const char* c_str() const { return buf_; }
+  size_t length() const { return len_; }
+  bool overflowed() const { return overflow_; }
+
+ private:
+  void put(char c) {
+    if (len_ + 1 >= size_) {
+      overflow_ = true;
+      return;
+    }
+    buf_[len_++] = c;
+    buf_[len_] = '\0';
+  }
+
+  char* buf_;
+  size_t size_;
+  size_t len_ = 0;
+  bool overflow_ = false;
+};
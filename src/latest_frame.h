@@ -0,0 +1,73 @@
+#pragma once
+// Lock-free "latest frame" mailbox between cameraTask and its readers.
+//
+// The producer publishes a FrameSlot it acquired from the pool; readers get a
+// FrameRef to the newest published slot. Neither side takes a lock: publish()
+// is an atomic exchange plus a release of the superseded slot, and get() is a
+// reference-count increment validated against the mailbox, retried only when
+// the producer published in between. The producer never waits on a reader,
+// and a reader never sees a slot before the producer has finished filling it.
+//
+// seq() is the number of the newest published frame (monotonic, starts at 1),
+// cheap enough to poll before bothering with get().
+//
+// Portable C++11, built and stress-tested on the host (host/latest_frame_stress.cpp).
+
+#include "frame_pool.h"
+
+// Test seam: the stress test defines this to yield inside the reader's race
+// window so the interleavings show up even on a single core.
+#ifndef LATEST_FRAME_RACE_HOOK
+#define LATEST_FRAME_RACE_HOOK()
+#endif
+
+class LatestFrame {
+ public:
+  explicit LatestFrame(FramePool& pool) : pool_(pool) {}
+
+  // Single producer. Takes over the caller's reference on slot and stamps it
+  // with the next sequence number.
+  void publish(FrameSlot* slot) {
+    uint32_t seq = seq_.load(std::memory_order_relaxed) + 1;
+    slot->seq = seq;
+    FrameSlot* previous = latest_.exchange(slot, std::memory_order_acq_rel);
+    seq_.store(seq, std::memory_order_release);
+    if (previous) pool_.release(previous);
+  }
+
+  // Drop the mailbox's reference; get() returns an empty ref until the next
+  // publish(). Safe to call from any task.
+  void clear() {
+    FrameSlot* previous = latest_.exchange(nullptr, std::memory_order_acq_rel);
+    if (previous) pool_.release(previous);
+  }
+
+  // Reference to the newest complete frame, or an empty ref if none.
+  FrameRef get() const {
+    for (;;) {
+      FrameSlot* slot = latest_.load(std::memory_order_acquire);
+      if (!slot) return FrameRef();
+      LATEST_FRAME_RACE_HOOK();
+      if (pool_.tryRetain(slot)) {
+        // Our reference pins this incarnation of the slot, so if the mailbox
+        // still points at it, it is the published frame and not a recycled
+        // slot the producer is refilling.
+        LATEST_FRAME_RACE_HOOK();
+        if (latest_.load(std::memory_order_acquire) == slot) return FrameRef(slot);
+        pool_.release(slot);
+      }
+      retries_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  uint32_t seq() const { return seq_.load(std::memory_order_acquire); }
+
+  // Times get() lost a race with publish() and had to look again.
+  uint32_t retryCount() const { return retries_.load(std::memory_order_relaxed); }
+
+ private:
+  FramePool& pool_;
+  std::atomic<FrameSlot*> latest_{nullptr};
+  std::atomic<uint32_t> seq_{0};
+  mutable std::atomic<uint32_t> retries_{0};
+};
@@ -0,0 +1,202 @@
+#pragma once
+// Pipeline counters and histograms, exported at /metrics in the Prometheus
+// text format.
+//
+// Each stage counts what it does in a MetricsCounter (a relaxed atomic, so any
+// task can bump it) and records sizes and timings in a MetricsHistogram with
+// fixed buckets. MetricsRegistry holds a static table of metric families
+// (name, help, type, and where the value comes from) and renders them into a
+// chunked response, as many whole lines as each fill has room for. A scrape
+// therefore needs no buffer beyond the TCP window and allocates nothing but
+// the response. A histogram is copied when its first line is written, so its
+// buckets, sum and count agree even when it spans several fills.
+//
+// Counters are 32-bit and wrap; Prometheus' rate() treats a wrap like a
+// restart. Histogram buckets are upper bounds in the unit observed (us,
+// bytes) and are scaled to the exported unit (seconds, bytes) when rendered.
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "json_writer.h"
+
+#define METRICS_PREFIX "esp32cam_"
+#define METRICS_CONTENT_TYPE "text/plain; version=0.0.4; charset=utf-8"
+
+const size_t METRICS_MAX_BUCKETS = 12;
+const size_t METRICS_MAX_FAMILIES = 64;
+
+// Standard bucket sets. Latencies in us: 1 ms .. 1 s.
+const uint32_t METRICS_LATENCY_BUCKETS_US[] = {1000, 2000, 5000, 10000, 20000, 50000,
+                                               100000, 200000, 500000, 1000000};
+// Capture interval in us: the sensor rate, 40 FPS down to 1 FPS.
+const uint32_t METRICS_INTERVAL_BUCKETS_US[] = {25000, 40000, 50000, 60000, 75000,
+                                                100000, 150000, 250000, 500000, 1000000};
+// JPEG sizes in bytes, QQVGA thumbnails to high-quality UXGA.
+const uint32_t METRICS_JPEG_BUCKETS_BYTES[] = {4096, 8192, 16384, 24576, 32768, 49152,
+                                               65536, 98304, 131072, 262144};
+
+#define METRICS_BUCKETS(array) array, sizeof(array) / sizeof(array[0])
+
+class MetricsCounter {
+ public:
+  void inc(uint32_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint32_t value() const { return value_.load(std::memory_order_relaxed); }
+
+ private:
+  std::atomic<uint32_t> value_{0};
+};
+
+class MetricsHistogram {
+ public:
+  // bounds must stay valid; at most METRICS_MAX_BUCKETS, ascending. scale
+  // converts observed units to exported ones (1e-6 for us to seconds).
+  MetricsHistogram(const uint32_t* bounds, size_t count, double scale)
+      : bounds_(bounds), count_(count < METRICS_MAX_BUCKETS ? count : METRICS_MAX_BUCKETS),
+        scale_(scale) {}
+
+  void observe(uint32_t value) {
+    size_t i = 0;
+    while (i < count_ && value > bounds_[i]) i++;
+    portENTER_CRITICAL(&mux_);
+    buckets_[i]++;
+    sum_ += value;
+    portEXIT_CRITICAL(&mux_);
+  }
+
+  // Cumulative bucket counts (the last one is +Inf, i.e. the count) and sum.
+  struct Snapshot {
+    uint32_t cumulative[METRICS_MAX_BUCKETS + 1];
+    uint64_t sum;
+  };
+
+  void snapshot(Snapshot& s) const {
+    portENTER_CRITICAL(&mux_);
+    memcpy(s.cumulative, buckets_, sizeof(buckets_));
+    s.sum = sum_;
+    portEXIT_CRITICAL(&mux_);
+    for (size_t i = 1; i <= count_; i++) s.cumulative[i] += s.cumulative[i - 1];
+  }
+
+  // Series lines: one per bucket, +Inf, _sum and _count.
+  size_t lines() const { return count_ + 3; }
+
+  void renderLine(const char* name, size_t line, const Snapshot& s, JsonWriter& out) const {
+    if (line < count_) {
+      out.printf(METRICS_PREFIX "%s_bucket{le=\"%.10g\"} %u\n", name, bounds_[line] * scale_,
+                 (unsigned)s.cumulative[line]);
+    } else if (line == count_) {
+      out.printf(METRICS_PREFIX "%s_bucket{le=\"+Inf\"} %u\n", name, (unsigned)s.cumulative[count_]);
+    } else if (line == count_ + 1) {
+      out.printf(METRICS_PREFIX "%s_sum %.10g\n", name, s.sum * scale_);
+    } else {
+      out.printf(METRICS_PREFIX "%s_count %u\n", name, (unsigned)s.cumulative[count_]);
+    }
+  }
+
+ private:
+  const uint32_t* bounds_;
+  size_t count_;
+  double scale_;
+  mutable portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t buckets_[METRICS_MAX_BUCKETS + 1] = {};  // last one is +Inf
+  uint64_t sum_ = 0;
+};
+
+class MetricsRegistry {
+ public:
+  typedef double (*ValueFn)();
+
+  // Families are rendered in the order they are added. name is without
+  // METRICS_PREFIX; counters should end in _total. False when the table is
+  // full.
+  bool counter(const char* name, const char* help, const MetricsCounter* counter) {
+    Family f = {name, help, "counter", counter, nullptr, nullptr};
+    return add(f);
+  }
+  bool counter(const char* name, const char* help, ValueFn fn) {
+    Family f = {name, help, "counter", nullptr, fn, nullptr};
+    return add(f);
+  }
+  bool gauge(const char* name, const char* help, ValueFn fn) {
+    Family f = {name, help, "gauge", nullptr, fn, nullptr};
+    return add(f);
+  }
+  bool histogram(const char* name, const char* help, const MetricsHistogram* histogram) {
+    Family f = {name, help, "histogram", nullptr, nullptr, histogram};
+    return add(f);
+  }
+
+  // Chunked text response. Each fill renders as many whole lines as fit; if
+  // not even one does, it waits for the send buffer to drain.
+  AsyncWebServerResponse* beginResponse(AsyncWebServerRequest* request) {
+    Cursor cursor = {};
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+      METRICS_CONTENT_TYPE,
+      [this, cursor](uint8_t* buffer, size_t maxLen, size_t) mutable -> size_t {
+        if (cursor.family == count_) return 0;
+        JsonWriter out((char*)buffer, maxLen);
+        while (cursor.family < count_) {
+          const Family& f = families_[cursor.family];
+          if (cursor.line == 0 && f.histogram) f.histogram->snapshot(cursor.snapshot);
+          size_t mark = out.length();
+          renderLine(f, cursor, out);
+          if (out.overflowed()) {
+            out.truncate(mark);
+            break;
+          }
+          if (++cursor.line == 2 + (f.histogram ? f.histogram->lines() : 1)) {
+            cursor.family++;
+            cursor.line = 0;
+          }
+        }
+        return out.length() ? out.length() : RESPONSE_TRY_AGAIN;
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    return response;
+  }
+
+ private:
+  struct Family {
+    const char* name;
+    const char* help;
+    const char* type;
+    const MetricsCounter* counter;
+    ValueFn fn;
+    const MetricsHistogram* histogram;
+  };
+
+  // Where a response has got to: line 0 is # HELP, 1 is # TYPE, then the
+  // samples.
+  struct Cursor {
+    size_t family;
+    size_t line;
+    MetricsHistogram::Snapshot snapshot;
+  };
+
+  bool add(const Family& f) {
+    if (count_ == METRICS_MAX_FAMILIES) return false;
+    families_[count_++] = f;
+    return true;
+  }
+
+  void renderLine(const Family& f, const Cursor& c, JsonWriter& out) const {
+    if (c.line == 0) {
+      out.printf("# HELP " METRICS_PREFIX "%s %s\n", f.name, f.help);
+    } else if (c.line == 1) {
+      out.printf("# TYPE " METRICS_PREFIX "%s %s\n", f.name, f.type);
+    } else if (f.histogram) {
+      f.histogram->renderLine(f.name, c.line - 2, c.snapshot, out);
+    } else if (f.counter) {
+      out.printf(METRICS_PREFIX "%s %u\n", f.name, (unsigned)f.counter->value());
+    } else {
+      double v = f.fn();
+      if (isnan(v)) out.printf(METRICS_PREFIX "%s NaN\n", f.name);
+      else out.printf(METRICS_PREFIX "%s %.10g\n", f.name, v);
+    }
+  }
+
+  Family families_[METRICS_MAX_FAMILIES];
+  size_t count_ = 0;
+};
@@ -0,0 +1,378 @@
+#pragma once
+// Multipart MJPEG push stream (multipart/x-mixed-replace) for AsyncWebServer.
+//
+// One long-lived response per viewer: each part is emitted as soon as
+// cameraTask publishes a new frame, so a viewer costs a single TCP connection
+// instead of a handshake per frame. Every viewer reads the same published
+// frame through a FrameRef; nothing is consumed, so viewers can't steal
+// frames from each other.
+//
+// MjpegBroadcaster keeps a fixed table of viewers with their last delivered
+// sequence number, delivered/dropped counters and AsyncTCP send-buffer
+// occupancy. The drop policy keeps slow viewers from hurting anyone else:
+//  - A viewer never queues frames. When it is ready for the next part it
+//    jumps to the newest frame, and the frames it skipped count as dropped.
+//  - A viewer that falls MJPEG_SPILL_LAG frames behind while still sending a
+//    JPEG copies the rest of it into a block from the frame slab (see
+//    frame_slab.h, held while any viewer is connected) and releases the
+//    camera fb. A slow link therefore can't
+//    pin framebuffers and starve capture. The block goes back to the slab
+//    once the JPEG is sent.
+//  - At most MJPEG_MAX_CLIENTS viewers are admitted; the rest get a 503.
+//  - While the recorder is behind, setYield(true) puts viewers last: they
+//    finish the part they are on but start no new one, and let go of the
+//    camera fb as soon as a newer frame exists.
+//
+// A viewer waiting for the next frame parks its TcpWaker slot (tcp_wake.h)
+// and returns RESPONSE_TRY_AGAIN; framePublished() wakes it, so the filler
+// never blocks async_tcp.
+//
+// All fillers and /stats run on the async_tcp task, so the client table needs
+// no locking; activeCount() and backlogPercent(), which cameraTask reads,
+// are kept in atomics. totals() accumulates over every viewer, past and
+// present, for /metrics.
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "frame_pool.h"
+#include "frame_slab.h"
+#include "json_writer.h"
+#include "latest_frame.h"
+#include "metrics.h"
+#include "tcp_wake.h"
+#include "trace.h"
+
+#define MJPEG_BOUNDARY "camframe"
+
+const char MJPEG_CONTENT_TYPE[] = "multipart/x-mixed-replace;boundary=" MJPEG_BOUNDARY;
+const char MJPEG_PART_TRAILER[] = "\r\n--" MJPEG_BOUNDARY "\r\n";
+const size_t MJPEG_PART_TRAILER_LEN = sizeof(MJPEG_PART_TRAILER) - 1;
+
+const size_t MJPEG_MAX_CLIENTS = 4;
+const uint32_t MJPEG_SPILL_LAG = 2;
+
+struct MjpegClient {
+  bool active;
+  uint32_t id;
+  char ip[16];
+  unsigned long connectedAt;  // millis()
+  uint32_t lastSeq;           // sequence number of the last frame started
+  uint32_t delivered;         // frames fully handed to TCP
+  uint32_t dropped;           // frames published that this viewer skipped
+  uint32_t spills;            // frames copied out to release the camera fb
+  uint32_t sendFree;          // AsyncClient::space() at the last fill
+  uint32_t sendCapacity;      // largest space() seen, i.e. the empty send buffer
+};
+
+// Monotonic totals over every viewer.
+struct MjpegTotals {
+  MetricsCounter connections;   // viewers admitted
+  MetricsCounter rejected;      // turned away, MJPEG_MAX_CLIENTS were connected
+  MetricsCounter delivered;
+  MetricsCounter dropped;
+  MetricsCounter spills;
+  // From a part's first byte to its JPEG's last byte handed to TCP
+  MetricsHistogram partSend{METRICS_BUCKETS(METRICS_LATENCY_BUCKETS_US), 1e-6};
+};
+
+struct MjpegStream {
+  MjpegClient* client = nullptr;
+  MjpegTotals* totals = nullptr;
+  AsyncClient* tcp = nullptr;
+  FrameSlab* slab = nullptr;  // where spills come from, acquired; none without
+  TcpWaker* waker = nullptr;
+  int wakeSlot = -1;
+  std::atomic<uint32_t>* wakeSlots = nullptr;  // the broadcaster's mask of viewer slots
+  std::atomic<int>* activeCount = nullptr;
+
+  FrameRef frame;             // frame being sent, released once its bytes are out
+  const uint8_t* jpeg = nullptr;  // frame.data(), or spill after a spill
+  size_t jpegFrom = 0;        // JPEG offset jpeg[0] corresponds to
+  size_t frameLen = 0;
+  uint32_t frameSeq = 0;      // sequence number of the last frame grabbed (0 = none yet)
+
+  uint8_t* spill = nullptr;   // private copy for slow viewers, a slab block
+  size_t spillCap = 0;
+
+  char head[112];
+  size_t headLen = 0;
+  size_t partPos = 0;         // bytes of the current part already emitted
+  size_t partLen = 0;
+  int64_t partStartedAt = 0;  // esp_timer_get_time()
+  bool ending = false;
+
+  ~MjpegStream() {
+    releaseSpill();
+    if (slab) slab->release();
+    if (waker) {
+      wakeSlots->fetch_and(~TcpWaker::bit(wakeSlot));
+      waker->detach(wakeSlot);
+    }
+    if (client) {
+      client->active = false;
+      activeCount->fetch_sub(1, std::memory_order_relaxed);
+    }
+  }
+
+  void setFrame(const FrameRef& ref) {
+    if (frameSeq && ref.seq() > frameSeq + 1) {
+      client->dropped += ref.seq() - frameSeq - 1;
+      totals->dropped.inc(ref.seq() - frameSeq - 1);
+    }
+    frame = ref;
+    jpeg = ref.data();
+    jpegFrom = 0;
+    frameLen = ref.len();
+    frameSeq = ref.seq();
+    client->lastSeq = frameSeq;
+  }
+
+  // Copy the unsent tail of the JPEG out of the camera fb and let it go.
+  // Keeps the fb if the slab has no block; the viewer then just holds it
+  // longer.
+  void spillFrame() {
+    size_t sent = partPos > headLen ? partPos - headLen : 0;
+    size_t rest = frameLen - sent;
+    if (!slab) return;
+    uint8_t* buf = slab->alloc(rest, &spillCap);
+    if (!buf) return;
+    memcpy(buf, jpeg + (sent - jpegFrom), rest);
+    spill = buf;
+    jpeg = spill;
+    jpegFrom = sent;
+    frame.reset();
+    client->spills++;
+    totals->spills.inc();
+  }
+
+  void releaseSpill() {
+    if (slab) slab->free(spill);
+    spill = nullptr;
+    spillCap = 0;
+  }
+};
+
+class MjpegBroadcaster {
+ public:
+  typedef bool (*ActiveFn)();
+
+  explicit MjpegBroadcaster(LatestFrame& latest) : latest_(latest) {}
+
+  // waker wakes viewers waiting for a frame; without one they wait for the
+  // lwIP poll. active() says whether the camera is streaming (false ends
+  // every open stream). Slow viewers spill into slab blocks; without one
+  // they keep holding the camera fb.
+  void begin(TcpWaker* waker, ActiveFn active, FrameSlab* slab = nullptr) {
+    waker_ = waker;
+    active_ = active;
+    slab_ = slab;
+  }
+
+  // Response for a new viewer, or nullptr when MJPEG_MAX_CLIENTS are connected.
+  AsyncWebServerResponse* beginStream(AsyncWebServerRequest* request) {
+    MjpegClient* client = nullptr;
+    for (size_t i = 0; i < MJPEG_MAX_CLIENTS; i++) {
+      if (!clients_[i].active) {
+        client = &clients_[i];
+        break;
+      }
+    }
+    if (!client) {
+      totals_.rejected.inc();
+      return nullptr;
+    }
+    totals_.connections.inc();
+
+    memset(client, 0, sizeof(*client));
+    client->active = true;
+    activeCount_.fetch_add(1, std::memory_order_relaxed);
+    client->id = ++nextId_;
+    client->connectedAt = millis();
+    strncpy(client->ip, request->client()->remoteIP().toString().c_str(), sizeof(client->ip) - 1);
+
+    std::shared_ptr<MjpegStream> stream = std::make_shared<MjpegStream>();
+    stream->client = client;
+    stream->totals = &totals_;
+    stream->tcp = request->client();
+    if (slab_ && slab_->acquire()) stream->slab = slab_;
+    stream->activeCount = &activeCount_;
+    if (waker_) {
+      stream->waker = waker_;
+      stream->wakeSlot = waker_->attach(request->client());
+      stream->wakeSlots = &wakeSlots_;
+      wakeSlots_.fetch_or(TcpWaker::bit(stream->wakeSlot));
+    }
+    AsyncWebServerResponse* response = request->beginResponse(
+      MJPEG_CONTENT_TYPE, 0,
+      [this, stream](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return fill(*stream, buffer, maxLen);
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    return response;
+  }
+
+  // Called by cameraTask whenever it hands the recorder a frame. Skipped
+  // frames still count as dropped for each viewer.
+  void setYield(bool yield) { yield_.store(yield, std::memory_order_relaxed); }
+
+  // cameraTask, after publishing a frame or clearing it when streaming
+  // stops: wake the viewers waiting for it.
+  void framePublished() {
+    if (waker_) waker_->wake(wakeSlots_.load());
+  }
+
+  const MjpegTotals& totals() const { return totals_; }
+
+  int activeCount() const { return activeCount_.load(std::memory_order_relaxed); }
+
+  // How full the fullest viewer's TCP send buffer was at its last fill, in %.
+  uint8_t backlogPercent() const { return backlogPct_.load(std::memory_order_relaxed); }
+
+  // JSON array of connected viewers for /stats.
+  void clientsJson(JsonWriter& out) const {
+    uint32_t latestSeq = latest_.seq();
+    const char* sep = "";
+    out.printf("[");
+    for (size_t i = 0; i < MJPEG_MAX_CLIENTS; i++) {
+      const MjpegClient& c = clients_[i];
+      if (!c.active) continue;
+      out.printf("%s{\"id\":%u,\"ip\":\"%s\",\"seconds\":%lu", sep, (unsigned)c.id, c.ip,
+                 (unsigned long)((millis() - c.connectedAt) / 1000));
+      out.printf(",\"delivered\":%u,\"dropped\":%u,\"spills\":%u,\"lag\":%u,\"send_queued\":%u}",
+                 (unsigned)c.delivered, (unsigned)c.dropped, (unsigned)c.spills,
+                 (unsigned)(c.lastSeq ? latestSeq - c.lastSeq : 0),
+                 (unsigned)(c.sendCapacity - c.sendFree));
+      sep = ",";
+    }
+    out.printf("]");
+  }
+
+ private:
+  // Point the stream at the newest frame. False if there is nothing new yet.
+  bool nextFrame(MjpegStream& s) {
+    if (latest_.seq() == s.frameSeq) return false;
+    FrameRef frame = latest_.get();
+    if (!frame || frame.seq() == s.frameSeq) return false;
+    s.setFrame(frame);
+    return true;
+  }
+
+  // The fullest send buffer over the connected viewers, for backlogPercent().
+  void updateBacklog() {
+    uint32_t worst = 0;
+    for (size_t i = 0; i < MJPEG_MAX_CLIENTS; i++) {
+      const MjpegClient& c = clients_[i];
+      if (!c.active || !c.sendCapacity) continue;
+      uint32_t pct = (c.sendCapacity - c.sendFree) * 100 / c.sendCapacity;
+      if (pct > worst) worst = pct;
+    }
+    backlogPct_.store(worst, std::memory_order_relaxed);
+  }
+
+  // AwsResponseFiller body: emits the boundary-delimited parts. The closing
+  // boundary is sent right after each JPEG so browsers render the frame
+  // immediately instead of waiting for the next part to start.
+  size_t fill(MjpegStream& s, uint8_t* buf, size_t maxLen) {
+    MjpegClient& client = *s.client;
+    uint32_t sendFree = s.tcp->space();
+    client.sendFree = sendFree;
+    if (sendFree > client.sendCapacity) client.sendCapacity = sendFree;
+    updateBacklog();
+
+    // Fell behind mid-JPEG: stop pinning the camera fb
+    bool yielding = yield_.load(std::memory_order_relaxed);
+    if (s.frame && latest_.seq() - s.frameSeq >= (yielding ? 1 : MJPEG_SPILL_LAG)) s.spillFrame();
+
+    size_t written = 0;
+    while (written < maxLen) {
+      if (s.partPos == s.partLen) {
+        if (written) break;  // hand over what we have before waiting
+        if (s.ending) return 0;
+        if (!active_ || !active_()) {
+          s.ending = true;
+          return 0;
+        }
+        if (yielding || !nextFrame(s)) {
+          // Park, then look once more: a frame published in between has
+          // already found the slot parked
+          if (waker_) waker_->park(s.wakeSlot);
+          if (yielding || !nextFrame(s)) return RESPONSE_TRY_AGAIN;
+        }
+
+        s.headLen = snprintf(s.head, sizeof(s.head),
+                             "%sContent-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n",
+                             s.partLen == 0 ? "--" MJPEG_BOUNDARY "\r\n" : "",
+                             (unsigned)s.frameLen);
+        s.partPos = 0;
+        s.partLen = s.headLen + s.frameLen + MJPEG_PART_TRAILER_LEN;
+        s.partStartedAt = esp_timer_get_time();
+      }
+
+      size_t pos = s.partPos;
+      const uint8_t* src;
+      size_t avail;
+      if (pos < s.headLen) {
+        src = (const uint8_t*)s.head + pos;
+        avail = s.headLen - pos;
+      } else if (pos < s.headLen + s.frameLen) {
+        src = s.jpeg + (pos - s.headLen - s.jpegFrom);
+        avail = s.headLen + s.frameLen - pos;
+      } else {
+        src = (const uint8_t*)MJPEG_PART_TRAILER + (pos - s.headLen - s.frameLen);
+        avail = s.partLen - pos;
+      }
+      size_t n = min(avail, maxLen - written);
+      memcpy(buf + written, src, n);
+      written += n;
+      s.partPos += n;
+      // The JPEG is in the TCP buffer now; don't pin the slot while we wait
+      // for the next frame.
+      if (s.jpeg && s.partPos >= s.headLen + s.frameLen) {
+        s.frame.reset();
+        s.jpeg = nullptr;
+        s.releaseSpill();
+        client.delivered++;
+        s.totals->delivered.inc();
+        s.totals->partSend.observe(esp_timer_get_time() - s.partStartedAt);
+        TRACE_SPAN("stream_send", s.frameSeq, s.partStartedAt);
+      }
+    }
+    return written;
+  }
+
+  LatestFrame& latest_;
+  TcpWaker* waker_ = nullptr;
+  FrameSlab* slab_ = nullptr;
+  ActiveFn active_ = nullptr;
+  std::atomic<bool> yield_{false};
+  std::atomic<uint32_t> wakeSlots_{0};  // TcpWaker slots of the viewers
+  std::atomic<int> activeCount_{0};
+  std::atomic<uint8_t> backlogPct_{0};
+  MjpegClient clients_[MJPEG_MAX_CLIENTS] = {};
+  uint32_t nextId_ = 0;
+  MjpegTotals totals_;
+};
+
+// Single-frame image/jpeg response that sends straight out of the frame slot.
+// beginResponse_P() only stores the pointer, so the frame has to stay alive
+// until the response is done - the filler's captured FrameRef guarantees it.
+// sendTime, if given, gets the time from here to the last byte handed to TCP.
+inline AsyncWebServerResponse* beginFrameResponse(AsyncWebServerRequest* request,
+                                                  const FrameRef& frame,
+                                                  MetricsHistogram* sendTime = nullptr) {
+  int64_t start = esp_timer_get_time();
+  return request->beginResponse(
+    "image/jpeg", frame.len(),
+    [frame, sendTime, start](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+      size_t n = min(maxLen, frame.len() - index);
+      memcpy(buffer, frame.data() + index, n);
+      if (n && index + n == frame.len()) {
+        if (sendTime) sendTime->observe(esp_timer_get_time() - start);
+        TRACE_SPAN("frame_send", frame.seq(), start);
+      }
+      return n;
+    });
+}
@@ -0,0 +1,275 @@
+#pragma once
+// Motion detection on the captured frames, for event-triggered recording.
+//
+// While armed, the detector is one more consumer of cameraTask's frames (its
+// rate is set in the FramePacer, see frame_pacer.h). cameraTask only hands it
+// a reference, and only while the detector is idle: a frame that arrives
+// during analysis is skipped and counted, so detection never holds more than
+// one fb and never slows capture. The motion task (MOTION_TASK in each sketch,
+// on core 0 below capture) does the work:
+//  - reads the luma DC coefficients out of the JPEG (jpeg_dc.h), which are
+//    the picture at 1/8 scale: a grayscale plane of at most 80x60 for VGA;
+//  - sums the absolute difference from a background model over 4x4 blocks
+//    with the SWAR kernels of motion_kernels.h;
+//  - counts the blocks whose mean difference is over the threshold. Enough
+//    of them on MOTION_CONFIRM_FRAMES frames in a row is motion.
+// The background moves one level toward the current frame every
+// MOTION_LEARN_EVERY frames, which follows lighting that drifts through the
+// day but not someone walking through. A block that stays changed for
+// MOTION_ABSORB_FRAMES (a parked car, or the ghost of something that was in
+// the picture when the background was learned) is copied into the background
+// and stops counting. A change over most of the picture at once (lights
+// switched on, the sensor's exposure jumping) re-learns the whole background
+// instead of counting as motion, and so does a change of frame size.
+//
+// active() stays true for the hold time after the last motion. The task that
+// starts and stops recordings (loop()) is woken when motion starts and
+// checks back at quietAt() for the end.
+//
+// The detector also scores scene change, armed or not, for the sketches to
+// run it whenever frames are recorded or streamed: activity() is the mean
+// luma difference between the last two frames it analysed, in 1/16 levels.
+// The recorder stores it with each frame (avi_recorder.h), which is what
+// /recordings/...?events reads to find the busy stretches of a segment.
+// Frames skipped while the detector was busy get the score of the newest
+// analysed frame.
+//
+// Frames carry the overlay's clock (frame_overlay.h), which changes every
+// second; ignoreRows() names its band of the plane, and those rows are
+// blanked before anything is compared, so the clock is neither motion nor
+// activity. Privacy masks are flat in every frame and never change anyway.
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_pool.h"
+#include "jpeg_dc.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "motion_kernels.h"
+#include "task_topology.h"
+
+const int MOTION_MAX_WIDTH = 80;        // plane pixels: VGA at 1/8
+const int MOTION_MAX_HEIGHT = 60;
+const int MOTION_MAX_WORDS = MOTION_MAX_WIDTH / 4;
+const uint8_t MOTION_CONFIRM_FRAMES = 2;  // frames in a row with motion before it counts
+const uint8_t MOTION_LEARN_EVERY = 4;     // frames per background step
+const uint8_t MOTION_LIGHTING_PCT = 60;   // % of blocks changed at once: lighting, not motion
+const uint8_t MOTION_ABSORB_FRAMES = 50;  // frames a block stays changed before it is background
+
+class MotionDetector {
+ public:
+  // holdS: seconds recording continues after the last motion. threshold:
+  // mean difference per pixel (0..255) for a block to count as changed.
+  // minBlocks: changed blocks that make motion.
+  MotionDetector(uint32_t holdS, uint8_t threshold, uint16_t minBlocks)
+      : holdMs_(holdS * 1000), threshold_(threshold), minBlocks_(minBlocks) {}
+
+  bool begin(const TaskPlacement& placement) { return startTask(placement, taskEntry, this, &task_); }
+
+  // The task that starts recordings; woken when motion starts.
+  void notifyTo(TaskHandle_t task) { notify_ = task; }
+
+  void arm(bool on) {
+    armed_.store(on, std::memory_order_relaxed);
+    if (!on) lastMotion_.store(0, std::memory_order_relaxed);
+  }
+  bool armed() const { return armed_.load(std::memory_order_relaxed); }
+
+  void setHold(uint32_t seconds) { holdMs_.store(seconds * 1000, std::memory_order_relaxed); }
+  void setThreshold(uint8_t level) { threshold_.store(level, std::memory_order_relaxed); }
+  void setMinBlocks(uint16_t blocks) { minBlocks_.store(blocks, std::memory_order_relaxed); }
+  // Plane rows (1/8 scale) to leave out of the comparison; count 0 for none.
+  void ignoreRows(int first, int count) {
+    ignoreFirst_.store(first, std::memory_order_relaxed);
+    ignoreCount_.store(count, std::memory_order_relaxed);
+  }
+
+  // cameraTask: analyse this frame if the detector is free. Takes a
+  // reference of its own on slot.
+  void offer(FrameSlot* slot) {
+    bool idle = false;
+    if (!task_ || !busy_.compare_exchange_strong(idle, true, std::memory_order_acq_rel)) {
+      skipped_.inc();
+      return;
+    }
+    slot->pool->retain(slot);
+    pending_.store(slot, std::memory_order_release);
+    xTaskNotifyGive(task_);
+  }
+
+  // Motion within the hold time, while armed.
+  bool active() const {
+    return armed() && lastMotion_.load(std::memory_order_relaxed) && (long)(quietAt() - millis()) > 0;
+  }
+  // millis() at which the current motion's hold runs out.
+  uint32_t quietAt() const {
+    return lastMotion_.load(std::memory_order_relaxed) + holdMs_.load(std::memory_order_relaxed);
+  }
+
+  const MetricsCounter& analysed() const { return analysed_; }
+  const MetricsCounter& skipped() const { return skipped_; }
+  const MetricsCounter& events() const { return events_; }
+  const MetricsHistogram& analyseTime() const { return analyseTime_; }
+  uint16_t score() const { return score_; }
+  // Scene change of the newest analysed frame, 1/16 luma levels.
+  uint16_t activity() const { return activity_.load(std::memory_order_relaxed); }
+
+  // The "motion" object of /stats and /motion.
+  void json(JsonWriter& out) const {
+    out.printf("{\"armed\":%s,\"active\":%s,\"activity\":%.2f,\"score\":%u,\"blocks\":%u,\"width\":%d,\"height\":%d,"
+               "\"hold_s\":%u,\"threshold\":%u,\"min_blocks\":%u,\"events\":%u,\"analysed\":%u,"
+               "\"skipped\":%u,\"decode_failures\":%u,\"lighting_resets\":%u}",
+               armed() ? "true" : "false", active() ? "true" : "false", activity() / 16.0, (unsigned)score_,
+               (unsigned)blocks_,
+               width_, height_, (unsigned)(holdMs_.load(std::memory_order_relaxed) / 1000),
+               (unsigned)threshold_.load(std::memory_order_relaxed),
+               (unsigned)minBlocks_.load(std::memory_order_relaxed), (unsigned)events_.value(),
+               (unsigned)analysed_.value(), (unsigned)skipped_.value(), (unsigned)decodeFailures_,
+               (unsigned)lightingResets_);
+  }
+
+ private:
+  static void taskEntry(void* arg) { static_cast<MotionDetector*>(arg)->run(); }
+
+  void run() {
+    for (;;) {
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      FrameRef frame(pending_.exchange(nullptr, std::memory_order_acq_rel));
+      if (frame) {
+        int64_t start = esp_timer_get_time();
+        analyse(frame);
+        analyseTime_.observe(esp_timer_get_time() - start);
+        analysed_.inc();
+      }
+      frame.reset();
+      busy_.store(false, std::memory_order_release);
+    }
+  }
+
+  void analyse(const FrameRef& frame) {
+    if (!dc_.parse(frame.data(), frame.len()) || dc_.width() > MOTION_MAX_WIDTH ||
+        dc_.height() > MOTION_MAX_HEIGHT) {
+      decodeFailures_++;
+      return;
+    }
+    int width = dc_.width(), height = dc_.height();
+    if (width != width_ || height != height_) {
+      width_ = width;
+      height_ = height;
+      words_ = (width + 3) / 4;
+      blocks_ = words_ * (height / MOTION_BLOCK);
+      primed_ = false;
+      memset(cur_, 0, sizeof(cur_));  // the padding at the end of each row stays 0
+    }
+    if (!dc_.decode(reinterpret_cast<uint8_t*>(cur_), words_ * 4)) {
+      decodeFailures_++;  // cur_ is scratch: bg_ and prev_ are still good
+      return;
+    }
+    size_t words = words_ * height;
+    int first = ignoreFirst_.load(std::memory_order_relaxed);
+    int count = ignoreCount_.load(std::memory_order_relaxed);
+    if (first < height && count > 0) {
+      memset(&cur_[first * words_], 0, (count < height - first ? count : height - first) * words_ * 4);
+    }
+
+    // Scene change from the previous frame, then the background model
+    if (primed_ && blocks_) {
+      motionBlockSad(cur_, prev_, words_, height, sums_);
+      uint32_t total = 0;
+      for (uint16_t i = 0; i < blocks_; i++) total += sums_[i];
+      activity_.store(total / blocks_, std::memory_order_relaxed);  // 16 pixels a block
+    } else {
+      activity_.store(0, std::memory_order_relaxed);
+    }
+    memcpy(prev_, cur_, words * 4);
+    if (!primed_) {
+      memcpy(bg_, cur_, words * 4);
+      primed_ = true;
+      memset(still_, 0, sizeof(still_));
+      streak_ = 0;
+      score_ = 0;
+      return;
+    }
+
+    motionBlockSad(cur_, bg_, words_, height, sums_);
+    uint32_t limit = threshold_.load(std::memory_order_relaxed) * MOTION_BLOCK * MOTION_BLOCK;
+    uint16_t changed = 0;
+    for (uint16_t i = 0; i < blocks_; i++) {
+      if (sums_[i] <= limit) {
+        still_[i] = 0;
+      } else if (++still_[i] >= MOTION_ABSORB_FRAMES) {
+        absorb(i);
+      } else {
+        changed++;
+      }
+    }
+    if (changed * 100 >= blocks_ * MOTION_LIGHTING_PCT) {
+      memcpy(bg_, cur_, words * 4);  // the whole scene changed: lighting
+      lightingResets_++;
+      memset(still_, 0, sizeof(still_));
+      streak_ = 0;
+      score_ = 0;
+      return;
+    }
+    score_ = changed;
+    if (++learn_ >= MOTION_LEARN_EVERY) {
+      motionTrackBackground(cur_, bg_, words);
+      learn_ = 0;
+    }
+
+    if (changed < minBlocks_.load(std::memory_order_relaxed)) streak_ = 0;
+    else if (streak_ < MOTION_CONFIRM_FRAMES) streak_++;
+    if (streak_ >= MOTION_CONFIRM_FRAMES && armed()) {
+      bool started = !active();
+      lastMotion_.store(millis() | 1, std::memory_order_relaxed);  // 0 means none
+      if (started) {
+        events_.inc();
+        if (notify_) xTaskNotifyGive(notify_);
+      }
+    }
+  }
+
+  // Copy block i of the current plane into the background.
+  void absorb(uint16_t i) {
+    int first = (i / words_) * MOTION_BLOCK * words_ + i % words_;
+    for (int y = 0; y < MOTION_BLOCK; y++) bg_[first + y * words_] = cur_[first + y * words_];
+    still_[i] = 0;
+  }
+
+  TaskHandle_t task_ = nullptr;
+  TaskHandle_t notify_ = nullptr;
+  std::atomic<bool> armed_{false};
+  std::atomic<bool> busy_{false};          // a frame is pending or being analysed
+  std::atomic<FrameSlot*> pending_{nullptr};
+  std::atomic<uint32_t> lastMotion_{0};    // millis(), 0 for none since arming
+  std::atomic<uint32_t> holdMs_;
+  std::atomic<uint8_t> threshold_;
+  std::atomic<uint16_t> minBlocks_;
+  std::atomic<int> ignoreFirst_{0};
+  std::atomic<int> ignoreCount_{0};
+  MetricsCounter analysed_;
+  MetricsCounter skipped_;                 // offered while the detector was busy
+  MetricsCounter events_;                  // motion started
+  MetricsHistogram analyseTime_{METRICS_BUCKETS(METRICS_LATENCY_BUCKETS_US), 1e-6};
+  uint32_t decodeFailures_ = 0;
+  uint32_t lightingResets_ = 0;
+  std::atomic<uint16_t> activity_{0};
+  // Motion task only
+  JpegDcDecoder dc_;
+  uint32_t cur_[MOTION_MAX_WORDS * MOTION_MAX_HEIGHT];
+  uint32_t prev_[MOTION_MAX_WORDS * MOTION_MAX_HEIGHT];  // the frame before, for activity
+  uint32_t bg_[MOTION_MAX_WORDS * MOTION_MAX_HEIGHT];
+  uint16_t sums_[MOTION_MAX_WORDS * (MOTION_MAX_HEIGHT / MOTION_BLOCK)];
+  uint8_t still_[MOTION_MAX_WORDS * (MOTION_MAX_HEIGHT / MOTION_BLOCK)];  // frames each block has been changed
+  int width_ = 0;
+  int height_ = 0;
+  int words_ = 0;                          // per plane row
+  uint16_t blocks_ = 0;
+  uint16_t score_ = 0;                     // changed blocks in the last frame
+  bool primed_ = false;                    // bg_ and prev_ hold frames of this size
+  uint8_t streak_ = 0;
+  uint8_t learn_ = 0;
+};
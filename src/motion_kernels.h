@@ -0,0 +1,103 @@
+#pragma once
+// Pixel kernels of the motion detector (motion.h), on 8-bit grayscale planes.
+//
+// The ESP32's Xtensa cores have no SIMD, so the kernels work on four pixels
+// per 32-bit word (SWAR). A word is split into its even and odd bytes, each
+// pair held in two 16-bit lanes (0x00XX00XX), where a difference can be taken
+// with a 0x0100 bias per lane: it never borrows into the next lane, and bit 8
+// says which side was larger. The lanes also give the sums room to grow, so a
+// block's absolute differences accumulate without unpacking.
+//
+// The background step compares whole bytes the same way, with a 128 bias
+// on the low seven bits.
+//
+// Planes are arrays of words, rows `words` words apart; a pixel is byte
+// (x & 3) of word x / 4, in memory order, which is what a uint8_t view of the
+// same array sees. Blocks are MOTION_BLOCK pixels square, i.e. one word wide.
+//
+// Each kernel has a byte-at-a-time reference that defines its result;
+// host/bench_motion.cpp checks that both agree and times them. This header
+// has no device dependencies, so the benchmark builds it as is.
+
+#include <stddef.h>
+#include <stdint.h>
+
+const int MOTION_BLOCK = 4;  // block side in plane pixels: one word by four rows
+
+const uint32_t MOTION_LANES = 0x00FF00FFu;  // the two 16-bit lanes' low bytes
+const uint32_t MOTION_BIAS = 0x01000100u;   // 256 in each lane
+const uint32_t MOTION_ONES = 0x00010001u;
+
+// |a - b| per lane, for lanes holding one byte each.
+inline uint32_t motionAbsDiffLanes(uint32_t a, uint32_t b) {
+  uint32_t t = (a | MOTION_BIAS) - b;                // 256 + a - b per lane
+  uint32_t below = ((t >> 8) & MOTION_ONES) ^ MOTION_ONES;  // 1 where a < b
+  uint32_t flip = below * 0xFFu;                     // 0xFF there: negate t
+  return ((t & MOTION_LANES) ^ flip) + below;
+}
+
+// Sum of |a - b| over each block of two planes, `words` words by `rows` rows.
+// sums gets words * (rows / MOTION_BLOCK) entries, row-major; rows past the
+// last whole block are ignored. A block sums 16 pixels, so it fits in 16 bits.
+inline void motionBlockSad(const uint32_t* a, const uint32_t* b, int words, int rows, uint16_t* sums) {
+  for (int by = 0; by + MOTION_BLOCK <= rows; by += MOTION_BLOCK) {
+    const uint32_t* pa = a + by * words;
+    const uint32_t* pb = b + by * words;
+    for (int bx = 0; bx < words; bx++) {
+      uint32_t acc = 0;  // two lanes of partial sums, at most 8 * 255 each
+      for (int y = 0; y < MOTION_BLOCK; y++) {
+        uint32_t wa = pa[y * words + bx];
+        uint32_t wb = pb[y * words + bx];
+        acc += motionAbsDiffLanes(wa & MOTION_LANES, wb & MOTION_LANES);
+        acc += motionAbsDiffLanes((wa >> 8) & MOTION_LANES, (wb >> 8) & MOTION_LANES);
+      }
+      *sums++ = (uint16_t)((acc & 0xFFFF) + (acc >> 16));
+    }
+  }
+}
+
+inline void motionBlockSadReference(const uint8_t* a, const uint8_t* b, int words, int rows, uint16_t* sums) {
+  int stride = words * 4;
+  for (int by = 0; by + MOTION_BLOCK <= rows; by += MOTION_BLOCK) {
+    for (int bx = 0; bx < words; bx++) {
+      int sum = 0;
+      for (int y = by; y < by + MOTION_BLOCK; y++) {
+        for (int x = bx * 4; x < bx * 4 + 4; x++) {
+          int d = a[y * stride + x] - b[y * stride + x];
+          sum += d < 0 ? -d : d;
+        }
+      }
+      *sums++ = (uint16_t)sum;
+    }
+  }
+}
+
+// Per byte: 1 where a >= b, else 0. Bit 7 compares the low seven bits of
+// each byte with a 128 bias; the top bits decide where they differ.
+inline uint32_t motionAtLeast(uint32_t a, uint32_t b) {
+  const uint32_t top = 0x80808080u;
+  uint32_t low = (a | top) - (b & ~top);
+  return (((a & ~b) | (~(a ^ b) & low)) & top) >> 7;
+}
+
+// One step of an approximate-median background: each background pixel moves
+// one level toward the current frame's. Run every few frames, it follows
+// lighting that drifts over minutes but not someone walking through.
+inline void motionTrackBackground(const uint32_t* cur, uint32_t* bg, size_t words) {
+  for (size_t i = 0; i < words; i++) {
+    uint32_t c = cur[i];
+    uint32_t g = bg[i];
+    uint32_t up = motionAtLeast(c, g);
+    uint32_t down = motionAtLeast(g, c);
+    // Every byte's result is in 0..255 (up without down means bg < cur),
+    // so one add and one subtract on the word give each byte its own
+    bg[i] = g + up - down;
+  }
+}
+
+inline void motionTrackBackgroundReference(const uint8_t* cur, uint8_t* bg, size_t words) {
+  for (size_t i = 0; i < words * 4; i++) {
+    if (cur[i] > bg[i]) bg[i]++;
+    else if (cur[i] < bg[i]) bg[i]--;
+  }
+}
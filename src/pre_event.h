@@ -0,0 +1,296 @@
+#pragma once
+// Pre-event ring: the last few seconds of recorded frames, kept in PSRAM
+// while motion detection is armed, so a recording it triggers starts before
+// the motion did.
+//
+// A triggered recording is opened only after the detector has confirmed the
+// motion and loop() has created the segment's files, by which time whatever
+// caused it may be gone. While armed, cameraTask copies each frame the
+// recorder would take (at the record pace, see frame_pacer.h) into this ring
+// with its timestamp and activity score, and drops frames older than the
+// pre-roll. When a recording starts, the ring holds its frames (hold()) and
+// cameraTask drains them into the segment ahead of the live ones, a few per
+// captured frame and only while the SD writer's ring has room: frames
+// captured meanwhile queue behind them here, so the segment stays in capture
+// order and capture never waits for the drain. Once the ring is empty,
+// frames go straight to the recorder again.
+//
+// The ring sizes itself. It measures the byte rate of the frames it is given
+// and takes PSRAM for the pre-roll at that rate plus PRE_EVENT_HEADROOM_PCT,
+// which is what queues up behind the pre-roll while it drains, bounded by the
+// free PSRAM. A rate that moves more than PRE_EVENT_RESIZE_PCT away from the
+// one it was sized for (another frame size or quality) resizes it outside a
+// drain, starting empty. Frames are never split across the end of the arena,
+// so each drains with a single addFrame() call.
+//
+// Everything but the stats runs on cameraTask; the stats are atomics any task
+// can read.
+
+#include <Arduino.h>
+#include <algorithm>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "frame_pool.h"
+#include "json_writer.h"
+
+const uint8_t PRE_EVENT_HEADROOM_PCT = 50;          // on top of the pre-roll, for frames queued during the drain
+const uint8_t PRE_EVENT_RESIZE_PCT = 50;            // byte rate change that resizes the ring
+const uint8_t PRE_EVENT_PSRAM_SHARE_PCT = 50;       // of the free PSRAM, at most
+const size_t PRE_EVENT_PSRAM_RESERVE = 512 * 1024;  // left in the largest free block for everyone else
+const int64_t PRE_EVENT_MEASURE_US = 1000000;       // the byte rate is measured over this long
+const int64_t PRE_EVENT_MAX_GAP_US = 1000000;       // longer gaps between frames are idle time, not rate
+
+// One frame in the ring; its JPEG follows.
+struct PreEventFrame {
+  uint32_t len;        // PRE_EVENT_SKIP: the rest of the arena is unused
+  uint16_t width;
+  uint16_t height;
+  int64_t timestamp;   // capture time in µs
+  uint16_t activity;   // the motion detector's score when it was captured
+  uint16_t reserved[3];
+
+  const uint8_t* data() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+};
+
+const uint32_t PRE_EVENT_SKIP = 0xFFFFFFFFu;
+
+class PreEventBuffer {
+ public:
+  explicit PreEventBuffer(float seconds) : seconds_(seconds) {}
+
+  // cameraTask: keep a copy of this frame. Outside a hold, frames past the
+  // pre-roll and whatever is in the way of this one are dropped first; in a
+  // hold nothing is, and false means the frame did not fit.
+  bool keep(const FrameSlot* slot, uint16_t activity) {
+    measure(slot->len, slot->timestamp);
+    if (!holding_ && !fit()) return false;
+    if (!arena_) return false;
+    size_t need = recordBytes(slot->len);
+    size_t waste;
+    for (;;) {
+      if (count_ == 0) head_ = tail_ = used_ = 0;  // start over at the front: nothing to skip
+      waste = size_ - head_ < need ? size_ - head_ : 0;  // a frame never wraps
+      if (size_ - used_ >= waste + need) break;
+      if (holding_ || count_ == 0) {
+        if (holding_) dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+      pop();
+    }
+    if (waste) {
+      if (waste >= sizeof(PreEventFrame)) reinterpret_cast<PreEventFrame*>(arena_ + head_)->len = PRE_EVENT_SKIP;
+      head_ = 0;
+      used_ += waste;
+    }
+    PreEventFrame* f = reinterpret_cast<PreEventFrame*>(arena_ + head_);
+    f->len = slot->len;
+    f->width = slot->width;
+    f->height = slot->height;
+    f->timestamp = slot->timestamp;
+    f->activity = activity;
+    memset(f->reserved, 0, sizeof(f->reserved));
+    memcpy(f + 1, slot->data, slot->len);
+    head_ = (head_ + need) % size_;
+    used_ += need;
+    if (count_++ == 0) oldestUs_ = slot->timestamp;
+    newestUs_ = slot->timestamp;
+    if (!holding_) {
+      int64_t window = (int64_t)(seconds_ * 1000000);
+      while (count_ > 1 && newestUs_ - oldestUs_ > window) pop();
+    }
+    publish();
+    return true;
+  }
+
+  bool empty() const { return count_ == 0; }
+
+  // The oldest frame; only while not empty().
+  const PreEventFrame& oldest() {
+    skipToFrame();
+    return *reinterpret_cast<const PreEventFrame*>(arena_ + tail_);
+  }
+
+  // Drop the oldest frame; one that went to the recorder when drained.
+  void pop() {
+    skipToFrame();
+    size_t bytes = recordBytes(reinterpret_cast<const PreEventFrame*>(arena_ + tail_)->len);
+    tail_ = (tail_ + bytes) % size_;
+    used_ -= bytes;
+    if (--count_ == 0) {
+      holding_ = false;
+    } else {
+      oldestUs_ = oldest().timestamp;
+    }
+    publish();
+  }
+
+  // on: a recording has started, keep every frame until they have drained.
+  // off: it stopped before they had; back to a pre-roll.
+  void hold(bool on) {
+    if (!on) {
+      holding_ = false;
+      publish();
+      return;
+    }
+    if (holding_ || count_ == 0) return;
+    holding_ = true;
+    lastPreRollMs_.store((uint32_t)((newestUs_ - oldestUs_) / 1000), std::memory_order_relaxed);
+    holds_.fetch_add(1, std::memory_order_relaxed);
+  }
+  bool holding() const { return holding_; }
+
+  // Give the PSRAM back, dropping every frame, and measure afresh next time
+  // (disarmed).
+  void release() {
+    if (!arena_ && !lastUs_) return;
+    freeArena();
+    sizedFor_ = 0;
+    rate_ = 0;
+    lastUs_ = 0;
+  }
+
+  // Frames drained into a recording, for the caller to count.
+  void drained() { drained_.fetch_add(1, std::memory_order_relaxed); }
+
+  float seconds() const { return seconds_; }
+  // Seconds between the oldest and newest frame held; any task.
+  float heldSeconds() const { return spanMs_.load(std::memory_order_relaxed) / 1000.0f; }
+  size_t usedBytes() const { return usedStat_.load(std::memory_order_relaxed); }
+
+  // The "pre_event" object of /stats.
+  void json(JsonWriter& out) const {
+    size_t capacity = capacity_.load(std::memory_order_relaxed);
+    out.printf("{\"seconds\":%.1f,\"capacity_kb\":%u,\"held_s\":%.2f,\"frames\":%u,\"used_pct\":%u,"
+               "\"draining\":%s,\"last_preroll_s\":%.2f,\"events\":%u,\"drained\":%u,\"dropped\":%u,"
+               "\"resizes\":%u,\"alloc_failures\":%u}",
+               seconds_, (unsigned)(capacity / 1024), heldSeconds(), (unsigned)frames_.load(std::memory_order_relaxed),
+               (unsigned)(capacity ? usedBytes() * 100 / capacity : 0),
+               draining_.load(std::memory_order_relaxed) ? "true" : "false",
+               lastPreRollMs_.load(std::memory_order_relaxed) / 1000.0, (unsigned)holds_.load(std::memory_order_relaxed),
+               (unsigned)drained_.load(std::memory_order_relaxed), (unsigned)dropped_.load(std::memory_order_relaxed),
+               (unsigned)resizes_.load(std::memory_order_relaxed),
+               (unsigned)allocFailures_.load(std::memory_order_relaxed));
+  }
+
+ private:
+  static size_t recordBytes(size_t len) { return sizeof(PreEventFrame) + ((len + 7) & ~(size_t)7); }
+
+  // Bytes a second the frames take in the ring, averaged over periods of
+  // PRE_EVENT_MEASURE_US; a gap longer than PRE_EVENT_MAX_GAP_US starts a
+  // period afresh.
+  void measure(size_t len, int64_t timestamp) {
+    if (!lastUs_ || timestamp - lastUs_ > PRE_EVENT_MAX_GAP_US) {
+      periodUs_ = timestamp;  // bytes count from the frame after this one
+      periodBytes_ = 0;
+      periodFrames_ = 0;
+    } else {
+      periodBytes_ += recordBytes(len);
+      periodFrames_++;
+    }
+    lastUs_ = timestamp;
+    int64_t span = timestamp - periodUs_;
+    if (span >= PRE_EVENT_MEASURE_US) {
+      float rate = periodBytes_ * 1000000.0f / span;
+      rate_ = rate_ > 0 ? (rate_ + rate) / 2 : rate;
+      frameBytes_ = periodBytes_ / periodFrames_;
+      periodUs_ = timestamp;
+      periodBytes_ = 0;
+      periodFrames_ = 0;
+    }
+  }
+
+  // Size the arena for the measured byte rate: allocate it once there is a
+  // rate, and start over when the rate has moved too far. A failed
+  // allocation is retried only at another rate. False while there is no
+  // arena.
+  bool fit() {
+    if (rate_ <= 0) return arena_ != nullptr;
+    float perSecond = rate_;
+    if (sizedFor_ > 0) {
+      float drift = perSecond > sizedFor_ ? perSecond / sizedFor_ : sizedFor_ / perSecond;
+      if (drift * 100 <= 100 + PRE_EVENT_RESIZE_PCT) return arena_ != nullptr;
+      if (arena_) resizes_.fetch_add(1, std::memory_order_relaxed);
+    }
+    freeArena();
+    size_t want = (size_t)(perSecond * seconds_ * (100 + PRE_EVENT_HEADROOM_PCT) / 100) +
+                  frameBytes_ * 2;
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM);
+    size_t share = heap_caps_get_free_size(MALLOC_CAP_SPIRAM) * PRE_EVENT_PSRAM_SHARE_PCT / 100;
+    size_t room = largest > PRE_EVENT_PSRAM_RESERVE ? largest - PRE_EVENT_PSRAM_RESERVE : 0;
+    size_t bytes = std::min(std::min(want, room), share) & ~(size_t)7;
+    sizedFor_ = perSecond;
+    // Less than a few frames is no pre-roll; don't take the PSRAM for it
+    if (bytes >= frameBytes_ * 4) {
+      arena_ = (uint8_t*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);
+    }
+    if (!arena_) {
+      allocFailures_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    size_ = bytes;
+    clear();
+    return true;
+  }
+
+  void freeArena() {
+    heap_caps_free(arena_);
+    arena_ = nullptr;
+    size_ = 0;
+    clear();
+  }
+
+  // Past a skip marker, or a tail too short for a header, to the front.
+  void skipToFrame() {
+    if (size_ - tail_ < sizeof(PreEventFrame) ||
+        reinterpret_cast<const PreEventFrame*>(arena_ + tail_)->len == PRE_EVENT_SKIP) {
+      used_ -= size_ - tail_;
+      tail_ = 0;
+    }
+  }
+
+  void clear() {
+    head_ = tail_ = used_ = 0;
+    count_ = 0;
+    holding_ = false;
+    capacity_.store(size_, std::memory_order_relaxed);
+    publish();
+  }
+
+  void publish() {
+    frames_.store(count_, std::memory_order_relaxed);
+    usedStat_.store(used_, std::memory_order_relaxed);
+    spanMs_.store(count_ ? (uint32_t)((newestUs_ - oldestUs_) / 1000) : 0, std::memory_order_relaxed);
+    draining_.store(holding_, std::memory_order_relaxed);
+  }
+
+  const float seconds_;
+  // cameraTask only
+  uint8_t* arena_ = nullptr;
+  size_t size_ = 0;
+  size_t head_ = 0;           // offset the next frame goes to
+  size_t tail_ = 0;           // offset of the oldest frame, or of the skip before it
+  size_t used_ = 0;           // bytes between them, skips included
+  uint32_t count_ = 0;
+  int64_t oldestUs_ = 0;
+  int64_t newestUs_ = 0;
+  bool holding_ = false;
+  int64_t lastUs_ = 0;        // newest frame measured, 0 for none
+  int64_t periodUs_ = 0;      // start of the measuring period
+  size_t periodBytes_ = 0;
+  uint32_t periodFrames_ = 0;
+  float rate_ = 0;            // bytes a second, 0 until the first period is over
+  size_t frameBytes_ = 0;     // a frame's average share of it
+  float sizedFor_ = 0;        // bytes per second the arena was sized for
+  // Stats, any task
+  std::atomic<size_t> capacity_{0};
+  std::atomic<size_t> usedStat_{0};
+  std::atomic<uint32_t> frames_{0};
+  std::atomic<uint32_t> spanMs_{0};
+  std::atomic<bool> draining_{false};
+  std::atomic<uint32_t> lastPreRollMs_{0};
+  std::atomic<uint32_t> holds_{0};
+  std::atomic<uint32_t> drained_{0};
+  std::atomic<uint32_t> dropped_{0};      // frames that did not fit during a hold
+  std::atomic<uint32_t> resizes_{0};
+  std::atomic<uint32_t> allocFailures_{0};
+};
@@ -0,0 +1,227 @@
+#pragma once
+// Closed-loop JPEG quality and frame size.
+//
+// Each mode used to pin one hand-tuned setting (QVGA at quality 30 to stream,
+// VGA at 10 to record) whatever the camera's link or card could take, so a
+// weak link dropped frames and a strong one left quality unused. The
+// controller starts from the mode's setting and moves it once a second from
+// what the consumer got over the last period:
+//  - the frame rate it got against the rate it should get,
+//  - the bitrate of the frames it took against a budget,
+//  - the fullest queue in front of it (a viewer's TCP send buffer or the SD
+//    writer's ring), and whether a full queue lost it frames.
+// Falling short of the rate, going over the budget, a backlog or a loss is
+// pressure: the JPEG quality value goes up (smaller frames), and once it is
+// at the profile's worst the frame size drops a step and quality starts
+// again from the middle. Plenty of headroom on every count goes the other
+// way, quality first, then size. Pressure must last QUALITY_DOWN_PERIODS and
+// headroom QUALITY_UP_PERIODS, and the thresholds leave a band where nothing
+// moves, so the setting doesn't oscillate around the edge of what the link
+// sustains. After a frame size change the sensor gets QUALITY_SETTLE_PERIODS
+// to settle before the next decision.
+//
+// setProfile() comes from the HTTP handlers and loop(), update() from
+// cameraTask, so the controller's state and every sensor write of a mode
+// change (the mode's look included) are under a mutex: OV2640 settings are
+// bank-select plus register sequences, and two interleaved ones can program
+// the wrong bank.
+
+#include <Arduino.h>
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "json_writer.h"
+#include "metrics.h"
+
+const uint8_t QUALITY_DOWN_PERIODS = 2;    // periods of pressure before stepping down
+const uint8_t QUALITY_UP_PERIODS = 5;      // periods of headroom before stepping up
+const uint8_t QUALITY_SETTLE_PERIODS = 2;  // no decisions this long after a frame size change
+const int QUALITY_STEP_DOWN = 5;           // set_quality steps; larger values are smaller frames
+const int QUALITY_STEP_UP = 2;
+const uint8_t QUALITY_BACKLOG_HIGH = 60;   // % of a queue; above this is pressure
+const uint8_t QUALITY_BACKLOG_LOW = 20;    // below this is headroom
+const float QUALITY_FPS_SHORT = 0.9f;      // of the wanted rate; below this is pressure
+const float QUALITY_FPS_MET = 0.97f;       // at or above this is headroom, whatever the jitter
+const float QUALITY_BUDGET_ROOM = 0.6f;    // of the budget; below this is headroom
+
+// Frame sizes the controller steps through, smallest first.
+const framesize_t QUALITY_SIZES[] = {FRAMESIZE_QQVGA, FRAMESIZE_HQVGA, FRAMESIZE_QVGA,
+                                     FRAMESIZE_CIF, FRAMESIZE_HVGA, FRAMESIZE_VGA};
+const size_t QUALITY_SIZE_COUNT = sizeof(QUALITY_SIZES) / sizeof(QUALITY_SIZES[0]);
+
+struct QualityProfile {
+  const char* name;
+  framesize_t startSize;
+  framesize_t smallest;    // startSize too to adapt quality only
+  framesize_t largest;     // within the camera's fb size
+  int startQuality;
+  int bestQuality;         // lowest set_quality value used
+  int worstQuality;        // highest before the frame size drops
+  float targetFps;
+  uint32_t budgetKbps;
+};
+
+// What a mode sets on the sensor besides frame size and quality.
+struct SensorLook {
+  int specialEffect;  // set_special_effect(): 0 none, 2 grayscale
+  int saturation;     // set_saturation(), -2..2
+};
+
+// What the consumer got over the last period; the sketch measures it.
+struct QualityLoad {
+  float seconds;       // period length
+  float wantFps;       // its target, capped by what the sensor delivered
+  float gotFps;        // 0 with nobody to deliver to: no decision
+  uint8_t backlogPct;  // fullest queue in front of it now
+  bool lost;           // frames were dropped for a full queue
+};
+
+class QualityController {
+ public:
+  bool begin() {
+    lock_ = xSemaphoreCreateMutex();
+    return lock_ != nullptr;
+  }
+
+  // Switches profile and applies its starting point and look.
+  void setProfile(const QualityProfile* profile, sensor_t* s, const SensorLook& look) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    profile_ = profile;
+    bytes_ = 0;
+    over_ = under_ = settle_ = 0;
+    quality_ = profile->startQuality;
+    size_ = sizeIndex(profile->startSize);
+    if (s) apply(s, look, QUALITY_SIZES[size_], quality_);
+    xSemaphoreGive(lock_);
+  }
+
+  // No profile: the controller leaves the sensor at size, quality and look.
+  void setFixed(framesize_t size, int quality, sensor_t* s, const SensorLook& look) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    profile_ = nullptr;
+    bytes_ = 0;
+    if (s) apply(s, look, size, quality);
+    xSemaphoreGive(lock_);
+  }
+
+  // cameraTask: a frame the profile's consumer took.
+  void frame(size_t len) { bytes_ += len; }
+
+  // cameraTask, once per period. True when it changed the sensor's settings.
+  bool update(const QualityLoad& load, sensor_t* s) {
+    if (!lock_ || !s) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool changed = false;
+    uint32_t bytes = bytes_;
+    bytes_ = 0;
+    const QualityProfile* p = profile_;
+    if (p && load.seconds > 0) {
+      kbps_ = bytes * 8 / 1000.0f / load.seconds;
+      gotFps_ = load.gotFps;
+      wantFps_ = load.wantFps < p->targetFps ? load.wantFps : p->targetFps;
+      backlog_ = load.backlogPct;
+      if (settle_) {
+        settle_--;
+      } else if (load.gotFps > 0) {
+        bool pressure = load.lost || load.backlogPct > QUALITY_BACKLOG_HIGH || kbps_ > p->budgetKbps ||
+                        load.gotFps < wantFps_ * QUALITY_FPS_SHORT;
+        bool headroom = !load.lost && load.backlogPct < QUALITY_BACKLOG_LOW &&
+                        kbps_ < p->budgetKbps * QUALITY_BUDGET_ROOM && load.gotFps >= wantFps_ * QUALITY_FPS_MET;
+        over_ = pressure ? over_ + 1 : 0;
+        under_ = headroom ? under_ + 1 : 0;
+        if (over_ >= QUALITY_DOWN_PERIODS) changed = stepDown(*p, s);
+        else if (under_ >= QUALITY_UP_PERIODS) changed = stepUp(*p, s);
+        if (changed) over_ = under_ = 0;
+      }
+    }
+    xSemaphoreGive(lock_);
+    return changed;
+  }
+
+  int quality() const { return profile_ ? quality_ : -1; }
+  uint16_t width() const { return profile_ ? resolution[QUALITY_SIZES[size_]].width : 0; }
+  float kbps() const { return kbps_; }
+  const MetricsCounter& stepsDown() const { return down_; }
+  const MetricsCounter& stepsUp() const { return up_; }
+
+  // The "quality" object of /stats.
+  void json(JsonWriter& out) const {
+    const QualityProfile* p = profile_;
+    if (!p) {
+      out.printf("null");
+      return;
+    }
+    out.printf("{\"profile\":\"%s\",\"quality\":%d,\"width\":%u,\"height\":%u,\"kbps\":%.0f,"
+               "\"budget_kbps\":%u,\"fps\":%.1f,\"want_fps\":%.1f,\"backlog_pct\":%u,"
+               "\"steps_down\":%u,\"steps_up\":%u}",
+               p->name, quality_, (unsigned)resolution[QUALITY_SIZES[size_]].width,
+               (unsigned)resolution[QUALITY_SIZES[size_]].height, kbps_, (unsigned)p->budgetKbps, gotFps_,
+               wantFps_, (unsigned)backlog_, (unsigned)down_.value(), (unsigned)up_.value());
+  }
+
+ private:
+  static size_t sizeIndex(framesize_t size) {
+    size_t i = 0;
+    while (i + 1 < QUALITY_SIZE_COUNT && QUALITY_SIZES[i] < size) i++;
+    return i;
+  }
+
+  // Lock held.
+  static void apply(sensor_t* s, const SensorLook& look, framesize_t size, int quality) {
+    s->set_special_effect(s, look.specialEffect);
+    s->set_framesize(s, size);
+    s->set_quality(s, quality);
+    s->set_saturation(s, look.saturation);
+  }
+
+  bool stepDown(const QualityProfile& p, sensor_t* s) {
+    if (quality_ < p.worstQuality) {
+      quality_ = min(quality_ + QUALITY_STEP_DOWN, p.worstQuality);
+      s->set_quality(s, quality_);
+    } else if (QUALITY_SIZES[size_] > p.smallest && size_ > 0) {
+      size_--;
+      quality_ = (p.bestQuality + p.worstQuality) / 2;
+      s->set_framesize(s, QUALITY_SIZES[size_]);
+      s->set_quality(s, quality_);
+      settle_ = QUALITY_SETTLE_PERIODS;
+    } else {
+      return false;  // as small as this profile goes
+    }
+    down_.inc();
+    return true;
+  }
+
+  bool stepUp(const QualityProfile& p, sensor_t* s) {
+    if (quality_ > p.bestQuality) {
+      quality_ = max(quality_ - QUALITY_STEP_UP, p.bestQuality);
+      s->set_quality(s, quality_);
+    } else if (QUALITY_SIZES[size_] < p.largest && size_ + 1 < QUALITY_SIZE_COUNT) {
+      size_++;
+      quality_ = (p.bestQuality + p.worstQuality) / 2;
+      s->set_framesize(s, QUALITY_SIZES[size_]);
+      s->set_quality(s, quality_);
+      settle_ = QUALITY_SETTLE_PERIODS;
+    } else {
+      return false;  // already the best this profile allows
+    }
+    up_.inc();
+    return true;
+  }
+
+  SemaphoreHandle_t lock_ = nullptr;
+  const QualityProfile* profile_ = nullptr;
+  int quality_ = 0;
+  size_t size_ = 0;        // index into QUALITY_SIZES
+  uint32_t bytes_ = 0;     // taken this period; cameraTask only
+  uint8_t over_ = 0;       // consecutive periods of pressure
+  uint8_t under_ = 0;      // consecutive periods of headroom
+  uint8_t settle_ = 0;
+  float kbps_ = 0;
+  float gotFps_ = 0;
+  float wantFps_ = 0;
+  uint8_t backlog_ = 0;
+  MetricsCounter down_;
+  MetricsCounter up_;
+};
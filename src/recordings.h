@@ -0,0 +1,606 @@
+#pragma once
+// Recorded segments over HTTP: listing, time-seek playback and downloads.
+//
+//   /recordings                        JSON list of segments
+//   /recordings/rec_NNN.avi?t=S&speed=N
+//                                      multipart MJPEG from S seconds into the
+//                                      segment, paced by the capture timestamps
+//                                      (N times faster; default 1)
+//   /recordings/rec_NNN.avi?events&min=L&gap=S
+//                                      JSON list of the stretches where the
+//                                      scene changed by at least L luma levels
+//                                      a frame, merged across quiet gaps of up
+//                                      to S seconds: where to jump with ?t=
+//   /recordings/rec_NNN.avi            the file itself (also .idx and old
+//                                      .mjpg), with single-range Range support
+//
+// Range offsets are full 32-bit file positions, so seeks and resumed
+// downloads past 2 GiB (segments run up to AVI_MAX_BYTES) get the right
+// bytes. AsyncWebServer appends "Accept-Ranges: none" to every response,
+// after any header of ours, so ranges can't be advertised; they are served
+// all the same, and players and download tools go by the 206.
+//
+// The listing comes from the segment catalog (see segment_catalog.h), without
+// touching the card, a few segments per response chunk. Seeking uses the segment's sidecar index (see
+// avi_recorder.h): a binary search over its timestamps, then a direct read at
+// the frame's offset. Events come from the activity score in the same index,
+// read a few batches per response chunk so a long segment doesn't hold up
+// async_tcp. Segments recorded before the score was stored have none.
+//
+// Playback is paced without blocking: a frame that isn't due yet parks the
+// response until its time with a TcpWaker (see tcp_wake.h).
+//
+// Repeats (empty entries, see frame_decimator.h) are skipped in playback,
+// which leaves the frame before on screen until the next real one is due. A
+// seek that lands on a repeat starts from the frame it repeats. A fill reads
+// at most PLAYBACK_FILL_INDEX_READS index batches looking for the next real
+// frame, then lets other connections run.
+//
+// The card is shared with the recorder's writer task, so reads go through a
+// PLAYBACK_READ_CHUNK buffer, sector aligned and DMA capable when possible.
+// FatFs then reads straight into it as one multi-sector transfer per refill,
+// instead of one small read per TCP segment competing with the writer for the
+// volume lock. At most PLAYBACK_MAX_SESSIONS playbacks and downloads run at
+// once; the rest get a 503.
+//
+// The segment being recorded is refused with 409: its directory entry (size)
+// is only updated when the writer closes it, so readers would see a stale or
+// empty file.
+//
+// All fillers run on the async_tcp task, so the session count needs no
+// locking.
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <FS.h>
+#include <memory>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "avi_recorder.h"
+#include "json_writer.h"
+#include "mjpeg_stream.h"
+#include "segment_catalog.h"
+#include "tcp_wake.h"
+
+const size_t PLAYBACK_READ_CHUNK = 16 * 1024;
+const size_t PLAYBACK_MAX_SESSIONS = 2;
+const size_t PLAYBACK_INDEX_BATCH = 64;    // sidecar entries read at a time
+const uint32_t PLAYBACK_FILL_INDEX_READS = 2;  // batches a playback fill may read skipping repeats
+const float PLAYBACK_MAX_SPEED = 16;
+const float PLAYBACK_EVENT_LEVELS = 0.5f;  // default ?min: mean luma change a frame
+const float PLAYBACK_EVENT_GAP_S = 2.0f;   // default ?gap
+const size_t PLAYBACK_EVENT_BATCHES = 8;   // index batches scanned per response chunk
+
+// Sequential reads through a large buffer; refills start on a sector boundary.
+struct BufferedReader {
+  File file;
+  uint8_t* buf = nullptr;
+  uint32_t bufPos = 0;  // file offset of buf[0]
+  size_t bufLen = 0;
+
+  bool begin(File f) {
+    file = f;
+    buf = (uint8_t*)heap_caps_malloc(PLAYBACK_READ_CHUNK, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (!buf) buf = (uint8_t*)heap_caps_malloc(PLAYBACK_READ_CHUNK, MALLOC_CAP_SPIRAM);
+    return buf != nullptr;
+  }
+
+  ~BufferedReader() {
+    if (buf) heap_caps_free(buf);
+  }
+
+  // Copy up to n bytes from file offset pos. 0 at end of file or on error.
+  size_t read(uint32_t pos, uint8_t* dst, size_t n) {
+    if (pos < bufPos || pos >= bufPos + bufLen) {
+      uint32_t start = pos & ~(uint32_t)511;
+      if (!file.seek(start)) return 0;
+      bufPos = start;
+      bufLen = file.read(buf, PLAYBACK_READ_CHUNK);
+      if (pos >= bufPos + bufLen) return 0;
+    }
+    size_t k = min(n, (size_t)(bufPos + bufLen - pos));
+    memcpy(dst, buf + (pos - bufPos), k);
+    return k;
+  }
+};
+
+struct PlaybackStream {
+  size_t* sessions = nullptr;
+  TcpWaker* waker = nullptr;
+  int wakeSlot = -1;
+  BufferedReader avi;
+  File idx;
+  size_t entrySize = 0;
+  uint32_t frames = 0;
+  uint32_t next = 0;              // next frame to send
+  float speed = 1;
+  int64_t baseTs = 0;             // capture time of the first frame sent
+  int64_t startUs = 0;            // when it was sent
+
+  AviIndexEntry batch[PLAYBACK_INDEX_BATCH];
+  uint32_t batchFirst = 0;
+  uint32_t batchLen = 0;
+  uint32_t batchReads = 0;
+  AviIndexEntry frame = {};       // frame being sent
+
+  char head[128];
+  size_t headLen = 0;
+  size_t partPos = 0;
+  size_t partLen = 0;
+
+  ~PlaybackStream() {
+    idx.close();
+    avi.file.close();
+    if (waker) waker->detach(wakeSlot);
+    if (sessions) (*sessions)--;
+  }
+
+  // Return the filler's RESPONSE_TRY_AGAIN, to be filled again at time at
+  // (or by the next poll without a waker).
+  size_t waitUntil(int64_t at) {
+    if (waker) waker->parkUntil(wakeSlot, at);
+    return RESPONSE_TRY_AGAIN;
+  }
+
+  bool entry(uint32_t n, AviIndexEntry& e) {
+    if (n < batchFirst || n >= batchFirst + batchLen) {
+      batchFirst = n;
+      batchLen = aviReadIndex(idx, entrySize, n, batch, PLAYBACK_INDEX_BATCH);
+      batchReads++;
+      if (n >= batchFirst + batchLen) return false;
+    }
+    e = batch[n - batchFirst];
+    return true;
+  }
+};
+
+// Where a /recordings listing has got to: the last segment written.
+struct ListCursor {
+  uint32_t id;
+  uint8_t format;
+  bool started;  // "[" written
+  bool any;      // a segment written
+  bool done;     // "]" written
+};
+
+// A ?events scan: busy stretches of one segment, found from its sidecar.
+struct EventScan {
+  size_t* sessions = nullptr;
+  File idx;
+  size_t entrySize = 0;
+  uint32_t frames = 0;
+  uint32_t next = 0;              // next entry to look at
+  uint16_t minActivity = 0;
+  int64_t gapUs = 0;
+  int64_t baseTs = 0;             // first frame's capture time
+  bool inEvent = false;
+  int64_t startTs = 0;            // of the event being followed
+  int64_t lastTs = 0;             // its last frame over minActivity
+  uint16_t peak = 0;
+  uint32_t count = 0;             // events written
+  bool finished = false;          // "]" written
+
+  AviIndexEntry batch[PLAYBACK_INDEX_BATCH];
+  char out[96];
+  size_t outLen = 0;
+  size_t outPos = 0;
+
+  ~EventScan() {
+    idx.close();
+    if (sessions) (*sessions)--;
+  }
+};
+
+struct DownloadState {
+  size_t* sessions = nullptr;
+  BufferedReader reader;
+  uint32_t start = 0;
+
+  ~DownloadState() {
+    reader.file.close();
+    if (sessions) (*sessions)--;
+  }
+};
+
+class RecordingServer {
+ public:
+  // waker paces playbacks; without one a playback waits for the lwIP poll
+  // between frames.
+  void begin(FS& fs, SegmentCatalog& catalog, TcpWaker* waker = nullptr) {
+    fs_ = &fs;
+    catalog_ = &catalog;
+    waker_ = waker;
+  }
+
+  // Handler for "/recordings" and everything under it.
+  void handle(AsyncWebServerRequest* request) {
+    if (!fs_) {
+      request->send(503, "text/plain", "No SD card");
+      return;
+    }
+    String url = request->url();
+    String name = url.length() > 12 ? url.substring(12) : String();  // after "/recordings/"
+    if (name.length() == 0) {
+      request->send(beginList(request));
+      return;
+    }
+    if (!validName(name)) {
+      request->send(404, "text/plain", "No such recording");
+      return;
+    }
+    String path = "/" + name;
+    if (catalog_->isOpen(path)) {
+      request->send(409, "text/plain", "Segment is still being recorded");
+      return;
+    }
+    if (sessions_ >= PLAYBACK_MAX_SESSIONS) {
+      request->send(503, "text/plain", "Too many playback sessions");
+      return;
+    }
+    if (request->hasParam("events")) {
+      events(request, path);
+    } else if (request->hasParam("t")) {
+      play(request, path);
+    } else {
+      download(request, path);
+    }
+  }
+
+  // Chunked JSON array of segments, oldest first. Each fill renders as many
+  // whole segments as fit; ones deleted meanwhile are left out.
+  AsyncWebServerResponse* beginList(AsyncWebServerRequest* request) {
+    ListCursor cursor = {};
+    SegmentCatalog* catalog = catalog_;
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+      "application/json",
+      [catalog, cursor](uint8_t* buffer, size_t maxLen, size_t) mutable -> size_t {
+        if (cursor.done) return 0;
+        JsonWriter out((char*)buffer, maxLen);
+        if (!cursor.started) {
+          out.printf("[");
+          cursor.started = true;
+        }
+        CatalogEntry e;
+        while (catalog->next(cursor.id, cursor.format, e)) {
+          if (e.open != CATALOG_PREPARED) {
+            size_t mark = out.length();
+            char path[32];
+            SegmentCatalog::pathFor(e, false, path, sizeof(path));
+            out.printf("%s{\"name\":\"%s\",\"bytes\":%llu,\"frames\":%u,\"seconds\":%.1f,"
+                       "\"start_time\":%u,\"recording\":%s}",
+                       cursor.any ? "," : "", path + 1, (unsigned long long)e.bytes, (unsigned)e.frames,
+                       e.durationMs / 1000.0, (unsigned)e.startTime, e.open ? "true" : "false");
+            if (out.overflowed()) {
+              out.truncate(mark);
+              return out.length() ? out.length() : RESPONSE_TRY_AGAIN;
+            }
+            cursor.any = true;
+          }
+          cursor.id = e.id;
+          cursor.format = e.format;
+        }
+        size_t mark = out.length();
+        out.printf("]");
+        if (out.overflowed()) {
+          out.truncate(mark);
+        } else {
+          cursor.done = true;
+        }
+        return out.length() ? out.length() : RESPONSE_TRY_AGAIN;
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    return response;
+  }
+
+ private:
+  // rec_<digits>.avi / .idx / .mjpg; nothing else on the card is served.
+  static bool validName(const String& name) {
+    if (!name.startsWith("rec_")) return false;
+    int dot = name.indexOf('.');
+    if (dot <= 4) return false;
+    for (int i = 4; i < dot; i++) {
+      if (name[i] < '0' || name[i] > '9') return false;
+    }
+    String ext = name.substring(dot);
+    return ext == ".avi" || ext == ".idx" || ext == ".mjpg";
+  }
+
+  // First frame captured at or after seconds into the segment: binary search
+  // over the sidecar timestamps. frames if seconds is past the end.
+  static uint32_t seek(File& idx, size_t entrySize, uint32_t frames, float seconds) {
+    AviIndexEntry e;
+    if (aviReadIndex(idx, entrySize, 0, &e, 1) != 1) return frames;
+    int64_t target = e.timestampUs + (int64_t)(seconds * 1e6);
+    uint32_t lo = 0, hi = frames;
+    while (lo < hi) {
+      uint32_t mid = lo + (hi - lo) / 2;
+      if (aviReadIndex(idx, entrySize, mid, &e, 1) != 1) return frames;
+      if (e.timestampUs < target) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    return lo;
+  }
+
+  void play(AsyncWebServerRequest* request, const String& path) {
+    if (!path.endsWith(".avi")) {
+      request->send(400, "text/plain", "Only .avi segments can be played");
+      return;
+    }
+    float seconds = request->getParam("t")->value().toFloat();
+    float speed = request->hasParam("speed") ? request->getParam("speed")->value().toFloat() : 1;
+    if (seconds < 0 || speed <= 0 || speed > PLAYBACK_MAX_SPEED) {
+      request->send(400, "text/plain", "Bad t or speed");
+      return;
+    }
+
+    std::shared_ptr<PlaybackStream> stream = std::make_shared<PlaybackStream>();
+    stream->idx = fs_->open(path.substring(0, path.length() - 4) + ".idx", FILE_READ);
+    stream->entrySize = aviIndexEntrySize(stream->idx);
+    stream->frames = aviIndexFrames(stream->idx, stream->entrySize);
+    File avi = fs_->open(path, FILE_READ);
+    if (!avi || !stream->frames) {
+      avi.close();
+      request->send(404, "text/plain", "No such recording or no index");
+      return;
+    }
+    if (!stream->avi.begin(avi)) {
+      request->send(503, "text/plain", "Out of memory");
+      return;
+    }
+    stream->next = seek(stream->idx, stream->entrySize, stream->frames, seconds);
+    if (stream->next >= stream->frames) {
+      request->send(416, "text/plain", "t is past the end of the segment");
+      return;
+    }
+    AviIndexEntry e;
+    while (stream->next > 0 && aviReadIndex(stream->idx, stream->entrySize, stream->next, &e, 1) == 1 &&
+           e.length == 0) {
+      stream->next--;  // a repeat: start from the frame it shows
+    }
+    stream->speed = speed;
+    stream->sessions = &sessions_;
+    sessions_++;
+    if (waker_) {
+      stream->waker = waker_;
+      stream->wakeSlot = waker_->attach(request->client());
+    }
+
+    AsyncWebServerResponse* response = request->beginResponse(
+      MJPEG_CONTENT_TYPE, 0,
+      [stream](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return fillPlayback(*stream, buffer, maxLen);
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+  }
+
+  // Same part layout as the live stream, plus the frame's capture time.
+  static size_t fillPlayback(PlaybackStream& s, uint8_t* buf, size_t maxLen) {
+    size_t written = 0;
+    uint32_t reads = s.batchReads;
+    while (written < maxLen) {
+      if (s.partPos == s.partLen) {
+        if (written) break;  // hand over what we have before waiting
+        if (s.batchReads - reads >= PLAYBACK_FILL_INDEX_READS) return s.waitUntil(esp_timer_get_time());
+        if (s.next >= s.frames || !s.entry(s.next, s.frame)) return 0;
+        if (s.frame.length == 0) {
+          s.next++;  // a repeat: the client keeps showing the frame before
+          continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if (s.startUs == 0) {
+          s.startUs = now;
+          s.baseTs = s.frame.timestampUs;
+        }
+        int64_t due = s.startUs + (int64_t)((s.frame.timestampUs - s.baseTs) / s.speed);
+        if (due > now) return s.waitUntil(due);
+        s.next++;
+
+        s.headLen = snprintf(s.head, sizeof(s.head),
+                             "%sContent-Type: image/jpeg\r\nContent-Length: %u\r\nX-Timestamp-Us: %lld\r\n\r\n",
+                             s.partLen == 0 ? "--" MJPEG_BOUNDARY "\r\n" : "",
+                             (unsigned)s.frame.length, (long long)s.frame.timestampUs);
+        s.partPos = 0;
+        s.partLen = s.headLen + s.frame.length + MJPEG_PART_TRAILER_LEN;
+      }
+
+      size_t pos = s.partPos;
+      size_t n;
+      if (pos < s.headLen) {
+        n = min(s.headLen - pos, maxLen - written);
+        memcpy(buf + written, s.head + pos, n);
+      } else if (pos < s.headLen + s.frame.length) {
+        n = min(s.headLen + s.frame.length - pos, maxLen - written);
+        n = s.avi.read(s.frame.offset + (pos - s.headLen), buf + written, n);
+        if (n == 0) return written;  // truncated file: end the stream
+      } else {
+        n = min(s.partLen - pos, maxLen - written);
+        memcpy(buf + written, MJPEG_PART_TRAILER + (pos - s.headLen - s.frame.length), n);
+      }
+      written += n;
+      s.partPos += n;
+    }
+    return written;
+  }
+
+  void events(AsyncWebServerRequest* request, const String& path) {
+    if (!path.endsWith(".avi")) {
+      request->send(400, "text/plain", "Only .avi segments have events");
+      return;
+    }
+    float levels = request->hasParam("min") ? request->getParam("min")->value().toFloat() : PLAYBACK_EVENT_LEVELS;
+    float gap = request->hasParam("gap") ? request->getParam("gap")->value().toFloat() : PLAYBACK_EVENT_GAP_S;
+    if (levels <= 0 || levels > 255 || gap < 0) {
+      request->send(400, "text/plain", "Bad min or gap");
+      return;
+    }
+    std::shared_ptr<EventScan> scan = std::make_shared<EventScan>();
+    scan->idx = fs_->open(path.substring(0, path.length() - 4) + ".idx", FILE_READ);
+    scan->entrySize = aviIndexEntrySize(scan->idx);
+    scan->frames = aviIndexFrames(scan->idx, scan->entrySize);
+    AviIndexEntry first;
+    if (!scan->frames || aviReadIndex(scan->idx, scan->entrySize, 0, &first, 1) != 1) {
+      request->send(404, "text/plain", "No such recording or no index");
+      return;
+    }
+    scan->baseTs = first.timestampUs;
+    scan->minActivity = (uint16_t)max(1.0f, levels * 16 + 0.5f);
+    scan->gapUs = (int64_t)(gap * 1e6);
+    scan->outLen = snprintf(scan->out, sizeof(scan->out), "[");
+    scan->sessions = &sessions_;
+    sessions_++;
+
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+      "application/json",
+      [scan](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return fillEvents(*scan, buffer, maxLen);
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    request->send(response);
+  }
+
+  // One event (or the closing bracket) per piece. A chunk that finds nothing
+  // within PLAYBACK_EVENT_BATCHES sends a space, which JSON ignores, and the
+  // scan carries on in the next one.
+  static size_t fillEvents(EventScan& s, uint8_t* buf, size_t maxLen) {
+    if (s.outPos == s.outLen) {
+      if (s.finished) return 0;
+      s.outPos = s.outLen = 0;
+      for (size_t b = 0; b < PLAYBACK_EVENT_BATCHES && !s.outLen; b++) {
+        size_t n = s.next < s.frames
+                       ? aviReadIndex(s.idx, s.entrySize, s.next, s.batch, PLAYBACK_INDEX_BATCH)
+                       : 0;
+        if (n == 0) {
+          if (s.inEvent) closeEvent(s);
+          s.outLen += snprintf(s.out + s.outLen, sizeof(s.out) - s.outLen, "]");
+          s.finished = true;
+          break;
+        }
+        size_t i = 0;
+        while (i < n && !s.outLen) {
+          const AviIndexEntry& e = s.batch[i++];
+          if (e.activity >= s.minActivity) {
+            if (!s.inEvent) {
+              s.inEvent = true;
+              s.startTs = e.timestampUs;
+              s.peak = 0;
+            }
+            s.lastTs = e.timestampUs;
+            if (e.activity > s.peak) s.peak = e.activity;
+          } else if (s.inEvent && e.timestampUs - s.lastTs > s.gapUs) {
+            closeEvent(s);
+          }
+        }
+        s.next += i;
+      }
+      if (!s.outLen) s.outLen = snprintf(s.out, sizeof(s.out), " ");
+    }
+    size_t n = min(maxLen, s.outLen - s.outPos);
+    memcpy(buf, s.out + s.outPos, n);
+    s.outPos += n;
+    return n;
+  }
+
+  static void closeEvent(EventScan& s) {
+    s.inEvent = false;
+    s.outLen = snprintf(s.out, sizeof(s.out), "%s{\"t\":%.2f,\"seconds\":%.2f,\"peak\":%.2f}",
+                        s.count++ ? "," : "", (s.startTs - s.baseTs) / 1e6, (s.lastTs - s.startTs) / 1e6,
+                        s.peak / 16.0);
+  }
+
+  // bytes=a-b, bytes=a- or bytes=-n. 1 and [start, end] if satisfiable, 0 if
+  // not or a position isn't a number, -1 if absent or not something we handle
+  // (then the whole file is sent).
+  static int parseRange(const String& header, size_t size, uint32_t& start, uint32_t& end) {
+    if (!header.startsWith("bytes=") || header.indexOf(',') >= 0) return -1;
+    int dash = header.indexOf('-');
+    if (dash < 0) return -1;
+    String from = header.substring(6, dash);
+    String to = header.substring(dash + 1);
+    from.trim();
+    to.trim();
+    uint64_t first = 0, last = 0;
+    if (from.length() == 0) {
+      if (!parseOffset(to, last) || last == 0 || size == 0) return 0;
+      start = last >= size ? 0 : size - last;
+      end = size - 1;
+      return 1;
+    }
+    if (!parseOffset(from, first) || (to.length() && !parseOffset(to, last))) return 0;
+    if (!to.length() || last >= size) last = size - 1;
+    if (first >= size || last < first) return 0;
+    start = first;
+    end = last;
+    return 1;
+  }
+
+  // A byte position in a Range header: digits only. String::toInt() is a
+  // 32-bit long on the ESP32 and saturates at 2 GiB.
+  static bool parseOffset(const String& text, uint64_t& out) {
+    if (!text.length() || !isdigit((unsigned char)text[0])) return false;
+    char* end;
+    out = strtoull(text.c_str(), &end, 10);  // ULLONG_MAX on overflow: past any file
+    return *end == '\0';
+  }
+
+  void download(AsyncWebServerRequest* request, const String& path) {
+    File file = fs_->open(path, FILE_READ);
+    if (!file || file.isDirectory()) {
+      request->send(404, "text/plain", "No such recording");
+      return;
+    }
+    size_t size = file.size();
+    uint32_t start = 0, end = size ? size - 1 : 0;
+    int range = request->hasHeader("Range") ? parseRange(request->header("Range"), size, start, end) : -1;
+    if (range == 0) {
+      file.close();
+      AsyncWebServerResponse* response = request->beginResponse(416, "text/plain", "Range not satisfiable");
+      response->addHeader("Content-Range", "bytes */" + String((unsigned long)size));
+      request->send(response);
+      return;
+    }
+    if (size == 0) {
+      file.close();
+      request->send(200, contentType(path), "");
+      return;
+    }
+
+    std::shared_ptr<DownloadState> dl = std::make_shared<DownloadState>();
+    if (!dl->reader.begin(file)) {
+      file.close();
+      request->send(503, "text/plain", "Out of memory");
+      return;
+    }
+    dl->start = start;
+    dl->sessions = &sessions_;
+    sessions_++;
+
+    size_t len = end - start + 1;
+    AsyncWebServerResponse* response = request->beginResponse(
+      contentType(path), len,
+      [dl, len](uint8_t* buffer, size_t maxLen, size_t index) -> size_t {
+        return dl->reader.read(dl->start + index, buffer, min(maxLen, len - index));
+      });
+    if (range == 1) {
+      response->setCode(206);
+      response->addHeader("Content-Range", "bytes " + String((unsigned long)start) + "-" +
+                                               String((unsigned long)end) + "/" + String((unsigned long)size));
+    }
+    request->send(response);
+  }
+
+  static const char* contentType(const String& path) {
+    if (path.endsWith(".avi")) return "video/x-msvideo";
+    if (path.endsWith(".mjpg")) return "video/x-motion-jpeg";
+    return "application/octet-stream";
+  }
+
+  FS* fs_ = nullptr;
+  SegmentCatalog* catalog_ = nullptr;
+  TcpWaker* waker_ = nullptr;
+  size_t sessions_ = 0;
+};
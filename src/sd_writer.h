@@ -0,0 +1,384 @@
+#pragma once
+// Asynchronous, batched SD card writer for the recorder.
+//
+// cameraTask used to write each JPEG to the card itself (or hand the fb to
+// loop() to do so), so every FAT cluster allocation or card-internal garbage
+// collection - easily 100+ ms - held a camera framebuffer and stalled capture.
+// Now the producer only copies the encoded frame into a PSRAM ring and lets
+// the fb go; a dedicated writer task drains the ring to the card.
+//
+// The writer gathers ring bytes into an internal, DMA-capable staging block
+// and writes whole blocks (SD_WRITER_BLOCK, multiples of SD_WRITER_ALIGN from
+// the start of the file), so FatFs passes them to the SDMMC driver as one
+// multi-sector transfer. Writing straight out of PSRAM would not help: the
+// driver can't DMA from PSRAM and falls back to one sector per command.
+// A partial block is only written before a file switch or, aligned down, when
+// no new data has arrived for SD_WRITER_IDLE_FLUSH.
+//
+// Files are switched in band: switchTo() records the ring position, and
+// everything appended before it still lands in the previous file. The caller
+// opens the file itself, so a failure is reported to it synchronously; the
+// writer task closes files once their last byte is on the card. call() queues
+// a function to run on the writer task in the same order, for work that has to
+// touch the card off cameraTask (the recorder's index checkpoints and segment
+// finishing, see avi_recorder.h). Longer work goes to background(), which the
+// writer runs one step at a time, each only once the ring holds less than a
+// block, so it never starves the frames queued behind it.
+//
+// append() is single-producer (cameraTask) and never blocks: when the ring is
+// full the frame is dropped and counted. Stats (queue depth, write latency
+// percentiles, throughput, overflow drops) are read from any task.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <algorithm>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "json_writer.h"
+#include "metrics.h"
+#include "task_topology.h"
+#include "trace.h"
+
+const size_t SD_WRITER_BLOCK = 32 * 1024;
+static_assert((SD_WRITER_BLOCK & (SD_WRITER_BLOCK - 1)) == 0, "the ring is a power of two of at least a block");
+const size_t SD_WRITER_ALIGN = 4096;
+const TickType_t SD_WRITER_IDLE_FLUSH = pdMS_TO_TICKS(500);
+const size_t SD_WRITER_MAX_PENDING = 12;  // switches and calls queued ahead of the writer
+const size_t SD_WRITER_LATENCY_WINDOW = 128;
+const size_t SD_WRITER_MAX_JOBS = 4;      // background jobs at a time
+
+class SdWriter {
+ public:
+  // Runs on the writer task with the file currently being written.
+  typedef void (*WriterFn)(File& file, void* arg);
+  // One bounded step of background work; false once it is done.
+  typedef bool (*StepFn)(void* arg);
+
+  struct Piece {
+    const void* data;
+    size_t len;
+  };
+
+  // Allocates the ring (PSRAM, or a small internal one without PSRAM) and the
+  // staging block, and starts the writer task. ringBytes is rounded down to a
+  // power of two (at least SD_WRITER_BLOCK), which the free-running ring
+  // counters need to wrap cleanly.
+  bool begin(size_t ringBytes, const TaskPlacement& placement) {
+    size_t pow2 = SD_WRITER_BLOCK;
+    while (pow2 * 2 <= ringBytes) pow2 *= 2;
+    ringBytes = pow2;
+    ring_ = (uint8_t*)heap_caps_malloc(ringBytes, MALLOC_CAP_SPIRAM);
+    if (!ring_) {
+      ringBytes = 4 * SD_WRITER_BLOCK;
+      ring_ = (uint8_t*)heap_caps_malloc(ringBytes, MALLOC_CAP_8BIT);
+    }
+    stage_ = (uint8_t*)heap_caps_malloc(SD_WRITER_BLOCK, MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    lock_ = xSemaphoreCreateMutex();
+    if (!ring_ || !stage_ || !lock_) return false;
+    size_ = ringBytes;
+    mask_ = ringBytes - 1;
+    return startTask(placement, taskEntry, this, &task_);
+  }
+
+  bool ready() const { return task_ != nullptr; }
+
+  // Copy one encoded frame into the ring. False (and counted) if it doesn't
+  // fit; the frame is then dropped whole, never split.
+  bool append(const uint8_t* data, size_t len) {
+    Piece piece = {data, len};
+    return append(&piece, 1);
+  }
+
+  // Same, for a record gathered from several pieces (e.g. chunk header, JPEG,
+  // padding). All of it or nothing goes into the ring.
+  bool append(const Piece* pieces, size_t count) {
+    if (!task_) return false;
+    size_t len = 0;
+    for (size_t i = 0; i < count; i++) len += pieces[i].len;
+    uint32_t head = head_.load(std::memory_order_relaxed);
+    uint32_t used = head - tail_.load(std::memory_order_acquire);
+    if (len > size_ - used) {
+      overflowFrames_.fetch_add(1, std::memory_order_relaxed);
+      overflowBytes_.fetch_add(len, std::memory_order_relaxed);
+      return false;
+    }
+    uint32_t pos = head;
+    for (size_t i = 0; i < count; i++) {
+      size_t off = pos & mask_;
+      size_t first = std::min(pieces[i].len, size_ - off);
+      memcpy(ring_ + off, pieces[i].data, first);
+      memcpy(ring_, (const uint8_t*)pieces[i].data + first, pieces[i].len - first);
+      pos += pieces[i].len;
+    }
+    head_.store(head + len, std::memory_order_release);
+
+    used += len;
+    if (used > peakUsed_.load(std::memory_order_relaxed)) peakUsed_.store(used, std::memory_order_relaxed);
+    // A whole block to write, or enough for an idle flush, which the writer
+    // doesn't wait for while the ring holds less
+    if (used >= SD_WRITER_BLOCK || used - len < SD_WRITER_ALIGN) xTaskNotifyGive(task_);
+    return true;
+  }
+
+  // Everything appended from now on goes to file; the previous file is closed
+  // once its data is written. Pass File() to just close. False if too many
+  // switches are already pending.
+  bool switchTo(File file) {
+    Pending p = {};
+    p.fn = nullptr;
+    p.arg = nullptr;
+    p.flush = true;
+    p.file = file;
+    return push(p);
+  }
+
+  void close() { switchTo(File()); }
+
+  // Run fn(file, arg) on the writer task after everything queued before it.
+  // With flush, every byte appended so far is in the file first (a partial
+  // block is written if need be) and file is the one it went to; otherwise fn
+  // runs as soon as the writer gets to it. False if too much is pending.
+  bool call(WriterFn fn, void* arg, bool flush) {
+    Pending p = {};
+    p.fn = fn;
+    p.arg = arg;
+    p.flush = flush;
+    return push(p);
+  }
+
+  // Writer task (from a call()): run fn(arg) step by step, between ring
+  // blocks, until it returns false. False if SD_WRITER_MAX_JOBS are running.
+  bool background(StepFn fn, void* arg) {
+    if (jobCount_ == SD_WRITER_MAX_JOBS) return false;
+    jobs_[(jobFirst_ + jobCount_++) % SD_WRITER_MAX_JOBS] = {fn, arg};
+    return true;
+  }
+
+  // Switches and calls that can still be queued.
+  size_t pendingFree() {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    size_t n = SD_WRITER_MAX_PENDING - pendingCount_;
+    xSemaphoreGive(lock_);
+    return n;
+  }
+
+  // Bytes waiting in the ring.
+  size_t queuedBytes() const {
+    return head_.load(std::memory_order_relaxed) - tail_.load(std::memory_order_relaxed);
+  }
+  size_t capacity() const { return size_; }
+  uint8_t fillPercent() const { return size_ ? queuedBytes() * 100 / size_ : 0; }
+  uint32_t overflowFrames() const { return overflowFrames_.load(std::memory_order_relaxed); }
+  uint32_t writes() const { return writes_.load(std::memory_order_relaxed); }
+  uint32_t writtenKB() const { return writtenKB_.load(std::memory_order_relaxed); }
+  // Every block write's latency, for /metrics.
+  const MetricsHistogram& writeLatency() const { return writeLatency_; }
+  // Times the writer task has woken, for /tasks.
+  const MetricsCounter& wakes() const { return wakes_; }
+
+  // JSON object for /stats. Latencies are in ms over the last
+  // SD_WRITER_LATENCY_WINDOW writes; write_mbps is bytes over time spent in
+  // write(), i.e. what the card sustains.
+  void statsJson(JsonWriter& out) const {
+    uint32_t lat[SD_WRITER_LATENCY_WINDOW];
+    uint32_t writes = writes_.load(std::memory_order_relaxed);
+    size_t n = std::min((size_t)writes, SD_WRITER_LATENCY_WINDOW);
+    memcpy(lat, latencyUs_, n * sizeof(uint32_t));
+    uint32_t busyMs = busyMs_.load(std::memory_order_relaxed);
+    uint32_t writtenKB = writtenKB_.load(std::memory_order_relaxed);
+
+    out.printf("{\"ring_kb\":%u,\"queued_kb\":%u,\"queued_pct\":%u,\"peak_pct\":%u",
+               (unsigned)(size_ / 1024), (unsigned)(queuedBytes() / 1024), (unsigned)fillPercent(),
+               (unsigned)(size_ ? peakUsed_.load(std::memory_order_relaxed) * 100 / size_ : 0));
+    out.printf(",\"writes\":%u,\"written_mb\":%.1f,\"write_mbps\":%.2f", (unsigned)writes,
+               writtenKB / 1024.0, busyMs ? writtenKB / 1.024 / busyMs : 0.0);
+    out.printf(",\"write_ms\":{\"p50\":%.1f,\"p95\":%.1f,\"p99\":%.1f,\"max\":%.1f}",
+               percentile(lat, n, 50) / 1000.0, percentile(lat, n, 95) / 1000.0,
+               percentile(lat, n, 99) / 1000.0,
+               maxLatencyUs_.load(std::memory_order_relaxed) / 1000.0);
+    out.printf(",\"overflow_frames\":%u,\"overflow_kb\":%u}", (unsigned)overflowFrames(),
+               (unsigned)(overflowBytes_.load(std::memory_order_relaxed) / 1024));
+  }
+
+ private:
+  struct Job {
+    StepFn fn;
+    void* arg;
+  };
+
+  struct Pending {
+    uint32_t pos;   // ring position the switch or flushing call takes effect at
+    WriterFn fn;    // nullptr for a file switch
+    void* arg;
+    bool flush;
+    File file;
+  };
+
+  bool push(Pending& entry) {
+    if (!task_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool ok = pendingCount_ < SD_WRITER_MAX_PENDING;
+    if (ok) {
+      Pending& p = pending_[(pendingFirst_ + pendingCount_) % SD_WRITER_MAX_PENDING];
+      p = entry;
+      p.pos = head_.load(std::memory_order_acquire);
+      pendingCount_++;
+    }
+    xSemaphoreGive(lock_);
+    xTaskNotifyGive(task_);
+    return ok;
+  }
+
+  static void taskEntry(void* self) { ((SdWriter*)self)->run(); }
+
+  void run() {
+    for (;;) {
+      // Nothing an idle flush could write: sleep until append() or a switch.
+      // With background work, don't sleep at all, and leave the idle flush
+      // until it is done
+      bool working = jobCount_ > 0;
+      TickType_t wait = working ? 0 : queuedBytes() >= SD_WRITER_ALIGN ? SD_WRITER_IDLE_FLUSH : portMAX_DELAY;
+      bool woken = ulTaskNotifyTake(pdTRUE, wait) > 0;
+      if (woken || !working) wakes_.inc();
+      drain(!woken && !working);
+      if (working && queuedBytes() < SD_WRITER_BLOCK) step();
+    }
+  }
+
+  // One step of the oldest background job.
+  void step() {
+    Job& job = jobs_[jobFirst_];
+    if (job.fn(job.arg)) return;
+    jobFirst_ = (jobFirst_ + 1) % SD_WRITER_MAX_JOBS;
+    jobCount_--;
+  }
+
+  bool nextPending(uint32_t& pos, bool& flush) {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    bool any = pendingCount_ > 0;
+    if (any) {
+      pos = pending_[pendingFirst_].pos;
+      flush = pending_[pendingFirst_].flush;
+    }
+    xSemaphoreGive(lock_);
+    return any;
+  }
+
+  void applyPending() {
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    Pending& p = pending_[pendingFirst_];
+    WriterFn fn = p.fn;
+    void* arg = p.arg;
+    File next = p.file;
+    p.file = File();
+    pendingFirst_ = (pendingFirst_ + 1) % SD_WRITER_MAX_PENDING;
+    pendingCount_--;
+    xSemaphoreGive(lock_);
+    if (fn) {
+      fn(file_, arg);
+      return;
+    }
+    if (file_) file_.close();
+    file_ = next;
+  }
+
+  void drain(bool idle) {
+    for (;;) {
+      uint32_t tail = tail_.load(std::memory_order_relaxed);
+      uint32_t limit = head_.load(std::memory_order_acquire);
+      uint32_t pendingPos;
+      bool flush = false;
+      bool pending = nextPending(pendingPos, flush);
+      if (pending && !flush) {
+        applyPending();
+        continue;
+      }
+      bool switching = pending;
+      if (switching) limit = pendingPos;
+      size_t avail = limit - tail;
+
+      if (switching && avail == 0) {
+        applyPending();
+        continue;
+      }
+      size_t n = std::min(avail, SD_WRITER_BLOCK);
+      if (!switching) {
+        // Only whole blocks while data keeps coming; keep the file offset
+        // aligned when flushing an idle tail
+        if (n < SD_WRITER_BLOCK && !idle) return;
+        n -= n % SD_WRITER_ALIGN;
+        if (n == 0) return;
+      }
+
+      size_t off = tail & mask_;
+      size_t first = std::min(n, size_ - off);
+      memcpy(stage_, ring_ + off, first);
+      memcpy(stage_ + first, ring_, n - first);
+      tail_.store(tail + n, std::memory_order_release);  // ring space is free again
+
+      if (file_) writeBlock(n);
+    }
+  }
+
+  void writeBlock(size_t n) {
+    int64_t start = esp_timer_get_time();
+    file_.write(stage_, n);
+    uint32_t us = (uint32_t)(esp_timer_get_time() - start);
+    writeLatency_.observe(us);
+    TRACE_SPAN("sd_write", 0, start);
+
+    uint32_t w = writes_.load(std::memory_order_relaxed);
+    latencyUs_[w % SD_WRITER_LATENCY_WINDOW] = us;
+    writes_.store(w + 1, std::memory_order_relaxed);
+    if (us > maxLatencyUs_.load(std::memory_order_relaxed)) maxLatencyUs_.store(us, std::memory_order_relaxed);
+    busyUs_ += us;
+    writtenBytes_ += n;
+    busyMs_.store(busyUs_ / 1000, std::memory_order_relaxed);
+    writtenKB_.store(writtenBytes_ / 1024, std::memory_order_relaxed);
+  }
+
+  static uint32_t percentile(uint32_t* v, size_t n, int pct) {
+    if (n == 0) return 0;
+    size_t idx = (n - 1) * pct / 100;
+    std::nth_element(v, v + idx, v + n);
+    return v[idx];
+  }
+
+  uint8_t* ring_ = nullptr;
+  size_t size_ = 0;
+  uint32_t mask_ = 0;  // size_ - 1; size_ is a power of two
+  uint8_t* stage_ = nullptr;
+  TaskHandle_t task_ = nullptr;
+
+  // Free-running byte counters; the ring offset is counter & mask_, which
+  // stays continuous across their wrap because size_ divides 2^32
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> tail_{0};
+  std::atomic<uint32_t> peakUsed_{0};
+
+  SemaphoreHandle_t lock_ = nullptr;  // guards pending_
+  Pending pending_[SD_WRITER_MAX_PENDING];
+  size_t pendingFirst_ = 0;
+  size_t pendingCount_ = 0;
+  File file_;                         // writer task only
+  Job jobs_[SD_WRITER_MAX_JOBS] = {};  // writer task only
+  size_t jobFirst_ = 0;
+  size_t jobCount_ = 0;
+
+  uint32_t latencyUs_[SD_WRITER_LATENCY_WINDOW] = {};
+  std::atomic<uint32_t> writes_{0};
+  std::atomic<uint32_t> maxLatencyUs_{0};
+  uint64_t busyUs_ = 0;               // writer task only; published as busyMs_/writtenKB_
+  uint64_t writtenBytes_ = 0;
+  std::atomic<uint32_t> busyMs_{0};
+  std::atomic<uint32_t> writtenKB_{0};
+  std::atomic<uint32_t> overflowFrames_{0};
+  std::atomic<uint32_t> overflowBytes_{0};
+  MetricsHistogram writeLatency_{METRICS_BUCKETS(METRICS_LATENCY_BUCKETS_US), 1e-6};
+  MetricsCounter wakes_;
+};
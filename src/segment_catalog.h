@@ -0,0 +1,473 @@
+#pragma once
+// On-card catalog of recorded segments.
+//
+// Picking the next file name used to probe SD_MMC.exists() on rec_001,
+// rec_002, ... and retention walked the whole root directory to delete one
+// file per rotation. FAT directory lookups are linear, so both got slower
+// with every segment, and the %03d names ran out at 999.
+//
+// The catalog keeps one CatalogEntry per segment (id, size, frames, start
+// time, duration) in a PSRAM ring, oldest first. Allocating the next id is
+// the last id + 1; eviction pops the oldest entry and deletes its two files.
+// Free space is the card's own figure, sampled off the loop by StorageSampler
+// and passed in with syncFreeBytes(), plus the sizes evicted since; so
+// rotation needs no directory scan and no FAT free-cluster count, and files
+// the catalog doesn't know (time-lapse stills) still count.
+//
+// A segment is created (and its files opened) ahead of the rotation that
+// starts it, see AviRecorder::prepare(); start() marks it recording. One that
+// never got a frame before a reset is deleted at boot.
+//
+// State survives resets in CATALOG_PATH, an append-only journal of fixed-size
+// CatalogRecords (add / update / delete, each a full entry plus checksum)
+// replayed at boot. When the journal gets long, or ends in a torn record, it
+// is rewritten as one add per live segment through CATALOG_TMP_PATH and a
+// rename. A card without a journal is scanned once and the journal is built
+// from what is found (including old rec_NNN.mjpg files).
+//
+// Calls come from the loop, HTTP and async_tcp tasks; a mutex guards the
+// entries and the journal. It is never held while a segment's files are
+// deleted: freeing a multi-GB file walks its whole FAT cluster chain, and
+// the /recordings handlers on async_tcp take the same lock.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <stddef.h>
+#include <time.h>
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "avi_recorder.h"
+
+const char CATALOG_PATH[] = "/catalog.log";
+const char CATALOG_TMP_PATH[] = "/catalog.tmp";
+const size_t CATALOG_MAX_SEGMENTS = 4096;   // oldest are evicted beyond this
+const size_t CATALOG_KEEP = 3;              // newest segments never evicted: standby, open, still finishing
+const size_t CATALOG_COMPACT_SLACK = 64;    // journal records allowed beyond 3 per live segment
+const size_t CATALOG_EVICT_BATCH = 8;       // segments evict() deletes at most per call
+
+enum CatalogFormat : uint8_t {
+  CATALOG_AVI = 0,    // rec_N.avi + rec_N.idx
+  CATALOG_MJPG = 1,   // rec_N.mjpg from before the AVI recorder
+};
+
+enum CatalogState : uint8_t {
+  CATALOG_CLOSED = 0,
+  CATALOG_RECORDING = 1,
+  CATALOG_PREPARED = 2,  // files created for the next rotation, no frames yet
+};
+
+struct CatalogEntry {
+  uint32_t id;
+  uint32_t startTime;   // time() at start: wall clock if set, else seconds since boot
+  uint32_t durationMs;  // first to last frame
+  uint32_t frames;
+  uint64_t bytes;       // segment plus sidecar index
+  uint8_t format;       // CatalogFormat
+  uint8_t open;         // CatalogState; an open one cut off by a reset is fixed at boot
+  uint8_t reserved[6];
+};
+
+struct CatalogRecord {
+  uint32_t type;        // CATALOG_ADD / CATALOG_UPDATE / CATALOG_DELETE
+  uint32_t check;       // FNV-1a of type and entry; a torn tail fails it
+  CatalogEntry entry;
+};
+
+const uint32_t CATALOG_ADD = 0x44444141;     // "AADD"
+const uint32_t CATALOG_UPDATE = 0x44505541;  // "AUPD"
+const uint32_t CATALOG_DELETE = 0x4C454441;  // "ADEL"
+
+class SegmentCatalog {
+ public:
+  // Load the journal (or build it from a directory scan) and start tracking
+  // free space from what the card reports now.
+  bool begin(FS& fs, uint64_t cardBytes, uint64_t usedBytes) {
+    fs_ = &fs;
+    entries_ = (CatalogEntry*)heap_caps_malloc(CATALOG_MAX_SEGMENTS * sizeof(CatalogEntry), MALLOC_CAP_SPIRAM);
+    if (!entries_) entries_ = (CatalogEntry*)heap_caps_malloc(CATALOG_MAX_SEGMENTS * sizeof(CatalogEntry), MALLOC_CAP_8BIT);
+    lock_ = xSemaphoreCreateMutex();
+    if (!entries_ || !lock_) return false;
+    freeBytes_ = cardBytes > usedBytes ? cardBytes - usedBytes : 0;
+
+    if (!fs.exists(CATALOG_PATH) && fs.exists(CATALOG_TMP_PATH)) fs.rename(CATALOG_TMP_PATH, CATALOG_PATH);
+    bool rewrite;
+    if (fs.exists(CATALOG_PATH)) {
+      rewrite = load();
+    } else {
+      scan();
+      rewrite = true;
+    }
+    for (size_t i = 0; i < count_;) {
+      if (!at(i).open) {
+        i++;
+        continue;
+      }
+      rewrite = true;
+      if (at(i).open == CATALOG_PREPARED) {
+        deleteFiles(drop(i));  // never started, nothing in it
+        continue;
+      }
+      recover(at(i++));
+    }
+    if (rewrite || records_ > 3 * count_ + CATALOG_COMPACT_SLACK) return compact();
+    journal_ = fs.open(CATALOG_PATH, FILE_APPEND);
+    return (bool)journal_;
+  }
+
+  bool ready() const { return lock_ != nullptr; }
+
+  // Register a new segment, to be started later, and return its id (0 on
+  // failure). The file names are written to aviPath / idxPath.
+  uint32_t create(char* aviPath, char* idxPath, size_t len) {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    CatalogEntry oldest = {};
+    bool full = count_ == CATALOG_MAX_SEGMENTS;
+    if (full) oldest = remove(0);
+    CatalogEntry e = {};
+    e.id = ++lastId_;
+    e.startTime = (uint32_t)time(nullptr);
+    e.format = CATALOG_AVI;
+    e.open = CATALOG_PREPARED;
+    at(count_++) = e;
+    append(CATALOG_ADD, e);
+    xSemaphoreGive(lock_);
+    if (full) deleteFiles(oldest);
+    pathFor(e, false, aviPath, len);
+    pathFor(e, true, idxPath, len);
+    return e.id;
+  }
+
+  // The segment's first frame is being recorded now, or was captured
+  // earlierS seconds ago (pre-event frames, see pre_event.h).
+  void start(uint32_t id, uint32_t earlierS = 0) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    CatalogEntry* e = find(id, CATALOG_AVI);
+    if (e) {
+      e->startTime = (uint32_t)time(nullptr) - earlierS;
+      e->open = CATALOG_RECORDING;
+      append(CATALOG_UPDATE, *e);
+    }
+    xSemaphoreGive(lock_);
+  }
+
+  // The segment is closed with these final numbers.
+  void finish(uint32_t id, const AviSegmentSummary& s) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    CatalogEntry* e = find(id, CATALOG_AVI);
+    if (e) {
+      e->bytes = s.bytes;
+      e->frames = s.frames;
+      e->durationMs = s.durationMs;
+      e->open = CATALOG_CLOSED;
+      append(CATALOG_UPDATE, *e);
+    }
+    xSemaphoreGive(lock_);
+  }
+
+  // Forget a segment that was never recorded (files failed to open, or the
+  // recording stopped before it started), and delete its files.
+  void discard(uint32_t id) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    size_t i = indexOf(id, CATALOG_AVI);
+    CatalogEntry e = {};
+    bool found = i < count_;
+    if (found) e = remove(i);
+    xSemaphoreGive(lock_);
+    if (found) deleteFiles(e);
+  }
+
+  // Delete the oldest segments until at least minFree bytes are free, keeping
+  // the newest CATALOG_KEEP, CATALOG_EVICT_BATCH at most. Returns how many
+  // were deleted.
+  size_t evict(uint64_t minFree) {
+    if (!lock_) return 0;
+    CatalogEntry gone[CATALOG_EVICT_BATCH];
+    size_t n = 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    while (freeBytes_ < minFree && count_ > CATALOG_KEEP && n < CATALOG_EVICT_BATCH) gone[n++] = remove(0);
+    xSemaphoreGive(lock_);
+    for (size_t i = 0; i < n; i++) deleteFiles(gone[i]);
+    return n;
+  }
+
+  // The card has freeBytes free as of a probe just taken. Segments written
+  // up to then are in it already.
+  void syncFreeBytes(uint64_t freeBytes) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    freeBytes_ = freeBytes;
+    xSemaphoreGive(lock_);
+  }
+
+  uint64_t freeBytes() const {
+    if (!lock_) return 0;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    uint64_t free = freeBytes_;
+    xSemaphoreGive(lock_);
+    return free;
+  }
+
+  size_t count() const { return count_; }
+
+  // fn(entry) for every segment, oldest first, under the lock: keep it short
+  // and don't call back into the catalog.
+  template <typename Fn>
+  void forEach(Fn fn) {
+    if (!lock_) return;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    for (size_t i = 0; i < count_; i++) fn(at(i));
+    xSemaphoreGive(lock_);
+  }
+
+  // The first segment after (id, format), oldest first, into out: a walk
+  // over the catalog that doesn't hold the lock between steps. Start from
+  // id 0. False past the newest.
+  bool next(uint32_t id, uint8_t format, CatalogEntry& out) {
+    if (!lock_) return false;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    size_t lo = 0, hi = count_;  // entries are in (id, format) order
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      const CatalogEntry& e = at(mid);
+      if (e.id < id || (e.id == id && e.format <= format)) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    bool found = lo < count_;
+    if (found) out = at(lo);
+    xSemaphoreGive(lock_);
+    return found;
+  }
+
+  // Segment being recorded, or prepared for the next rotation? (path is any
+  // of its files.)
+  bool isOpen(const String& path) {
+    bool open = false;
+    forEach([&](const CatalogEntry& e) {
+      char p[32];
+      pathFor(e, false, p, sizeof(p));
+      String base = p;
+      if (e.open && path.startsWith(base.substring(0, base.lastIndexOf('.') + 1))) open = true;
+    });
+    return open;
+  }
+
+  static void pathFor(const CatalogEntry& e, bool index, char* buf, size_t len) {
+    const char* ext = e.format == CATALOG_MJPG ? ".mjpg" : index ? ".idx" : ".avi";
+    snprintf(buf, len, "/rec_%03u%s", (unsigned)e.id, ext);
+  }
+
+ private:
+  CatalogEntry& at(size_t i) { return entries_[(first_ + i) % CATALOG_MAX_SEGMENTS]; }
+
+  static uint32_t checksum(const CatalogRecord& r) {
+    const uint8_t* p = (const uint8_t*)&r;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(r); i++) {
+      if (i < offsetof(CatalogRecord, check) || i >= offsetof(CatalogRecord, entry)) h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+  }
+
+  // Position of a segment, or count_. Newest entries are the ones looked up,
+  // so search from the back.
+  size_t indexOf(uint32_t id, uint8_t format) {
+    for (size_t i = count_; i-- > 0;) {
+      if (at(i).id == id && at(i).format == format) return i;
+    }
+    return count_;
+  }
+
+  CatalogEntry* find(uint32_t id, uint8_t format) {
+    size_t i = indexOf(id, format);
+    return i < count_ ? &at(i) : nullptr;
+  }
+
+  void append(uint32_t type, const CatalogEntry& e) {
+    CatalogRecord r = {};
+    r.type = type;
+    r.entry = e;
+    r.check = checksum(r);
+    if (journal_) {
+      journal_.write((const uint8_t*)&r, sizeof(r));
+      journal_.flush();
+    }
+    if (++records_ > 3 * count_ + CATALOG_COMPACT_SLACK) compact();
+  }
+
+  // Forget entry i, in the journal too, and return it for deleteFiles()
+  // once the lock is released. Lock held.
+  CatalogEntry remove(size_t i) {
+    CatalogEntry e = drop(i);
+    append(CATALOG_DELETE, e);
+    return e;
+  }
+
+  // remove() without the journal record, for boot before the journal is
+  // rewritten.
+  CatalogEntry drop(size_t i) {
+    CatalogEntry e = at(i);
+    if (i == 0) {
+      first_ = (first_ + 1) % CATALOG_MAX_SEGMENTS;
+    } else {
+      for (size_t j = i; j + 1 < count_; j++) at(j) = at(j + 1);
+    }
+    count_--;
+    freeBytes_ += e.bytes;
+    return e;
+  }
+
+  // Delete the files of an entry dropped from the catalog. Lock not held.
+  void deleteFiles(const CatalogEntry& e) {
+    char path[32];
+    if (e.format == CATALOG_AVI) {
+      pathFor(e, true, path, sizeof(path));
+      fs_->remove(path);
+    }
+    pathFor(e, false, path, sizeof(path));
+    fs_->remove(path);
+    Serial.printf("Deleted: %s\n", path);
+  }
+
+  // Replay the journal. True if it ended in a bad record and needs rewriting.
+  bool load() {
+    File f = fs_->open(CATALOG_PATH, FILE_READ);
+    CatalogRecord batch[32];
+    bool bad = false;
+    size_t n;
+    while (!bad && (n = f.read((uint8_t*)batch, sizeof(batch)) / sizeof(CatalogRecord)) > 0) {
+      for (size_t i = 0; i < n && !bad; i++) {
+        const CatalogRecord& r = batch[i];
+        if (r.check != checksum(r)) {
+          bad = true;
+          break;
+        }
+        records_++;
+        CatalogEntry* e;
+        size_t j;
+        switch (r.type) {
+          case CATALOG_ADD:
+            if (count_ == CATALOG_MAX_SEGMENTS) {
+              first_ = (first_ + 1) % CATALOG_MAX_SEGMENTS;
+              count_--;
+            }
+            at(count_++) = r.entry;
+            if (r.entry.id > lastId_) lastId_ = r.entry.id;
+            break;
+          case CATALOG_UPDATE:
+            e = find(r.entry.id, r.entry.format);
+            if (e) *e = r.entry;
+            break;
+          case CATALOG_DELETE:
+            j = indexOf(r.entry.id, r.entry.format);
+            if (j == count_) break;
+            if (j == 0) {
+              first_ = (first_ + 1) % CATALOG_MAX_SEGMENTS;
+            } else {
+              for (; j + 1 < count_; j++) at(j) = at(j + 1);
+            }
+            count_--;
+            break;
+          default:
+            bad = true;
+        }
+      }
+    }
+    bad = bad || f.size() % sizeof(CatalogRecord) != 0;
+    f.close();
+    return bad;
+  }
+
+  // One-time directory scan for a card without a journal.
+  void scan() {
+    File root = fs_->open("/");
+    File file = root.openNextFile();
+    while (file) {
+      String name = file.name();
+      int slash = name.lastIndexOf('/');
+      if (slash >= 0) name = name.substring(slash + 1);
+      int dot = name.indexOf('.');
+      String ext = dot > 0 ? name.substring(dot) : String();
+      if (name.startsWith("rec_") && dot > 4 && (ext == ".avi" || ext == ".mjpg") && count_ < CATALOG_MAX_SEGMENTS) {
+        CatalogEntry e = {};
+        e.id = name.substring(4, dot).toInt();
+        e.format = ext == ".avi" ? CATALOG_AVI : CATALOG_MJPG;
+        e.bytes = file.size();
+        e.open = e.format == CATALOG_AVI ? CATALOG_RECORDING : CATALOG_CLOSED;  // frames, duration and sidecar size filled in by recover()
+        // Directory order isn't id order; insertion sort, once
+        size_t i = count_++;
+        while (i > 0 && (at(i - 1).id > e.id || (at(i - 1).id == e.id && at(i - 1).format > e.format))) {
+          at(i) = at(i - 1);
+          i--;
+        }
+        at(i) = e;
+        if (e.id > lastId_) lastId_ = e.id;
+      }
+      file.close();
+      file = root.openNextFile();
+    }
+    root.close();
+  }
+
+  // Size, frames and duration of a segment that wasn't closed through
+  // finish(): recorded when the device reset, or found by scan().
+  void recover(CatalogEntry& e) {
+    char path[32];
+    pathFor(e, false, path, sizeof(path));
+    File avi = fs_->open(path, FILE_READ);
+    e.bytes = avi ? avi.size() : 0;
+    avi.close();
+    if (e.format == CATALOG_AVI) {
+      pathFor(e, true, path, sizeof(path));
+      File idx = fs_->open(path, FILE_READ);
+      if (idx) e.bytes += idx.size();
+      size_t entrySize = aviIndexEntrySize(idx);
+      e.frames = aviIndexFrames(idx, entrySize);
+      AviIndexEntry first, last;
+      if (e.frames && aviReadIndex(idx, entrySize, 0, &first, 1) == 1 &&
+          aviReadIndex(idx, entrySize, e.frames - 1, &last, 1) == 1) {
+        e.durationMs = (uint32_t)((last.timestampUs - first.timestampUs) / 1000);
+      }
+      idx.close();
+    }
+    e.open = CATALOG_CLOSED;
+  }
+
+  // Rewrite the journal as one add per live segment.
+  bool compact() {
+    if (journal_) journal_.close();
+    File tmp = fs_->open(CATALOG_TMP_PATH, FILE_WRITE);
+    if (!tmp) return false;
+    records_ = 0;
+    for (size_t i = 0; i < count_; i++) {
+      CatalogRecord r = {};
+      r.type = CATALOG_ADD;
+      r.entry = at(i);
+      r.check = checksum(r);
+      tmp.write((const uint8_t*)&r, sizeof(r));
+      records_++;
+    }
+    tmp.close();
+    fs_->remove(CATALOG_PATH);
+    fs_->rename(CATALOG_TMP_PATH, CATALOG_PATH);
+    journal_ = fs_->open(CATALOG_PATH, FILE_APPEND);
+    return (bool)journal_;
+  }
+
+  FS* fs_ = nullptr;
+  SemaphoreHandle_t lock_ = nullptr;
+  CatalogEntry* entries_ = nullptr;  // ring, oldest at first_
+  size_t first_ = 0;
+  size_t count_ = 0;
+  uint32_t lastId_ = 0;
+  uint64_t freeBytes_ = 0;
+  File journal_;
+  size_t records_ = 0;               // in the journal file
+};
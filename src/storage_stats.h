@@ -0,0 +1,99 @@
+#pragma once
+// Card capacity and usage, sampled off the request path.
+//
+// SD_MMC.usedBytes() asks FatFs for the free cluster count, which can mean a
+// walk of the allocation table: tens of milliseconds on a large FAT32 card.
+// /stats used to call it on every request, on the async_tcp task, so each
+// open dashboard stalled the web server that long once a second. A
+// low-priority task now runs the probe every period (or when refresh() asks
+// for it, e.g. after segments were evicted) and readers get the last sample
+// for the price of a mutex and a copy. notifyTo() has each new sample wake a
+// task too, for the loop to resync the segment catalog's free space.
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "metrics.h"
+#include "task_topology.h"
+
+// Fills in the card's size and the bytes in use. Runs on the sampler task.
+typedef bool (*StorageProbe)(uint64_t* totalBytes, uint64_t* usedBytes);
+
+struct StorageSample {
+  bool valid;           // false until the first successful probe
+  uint64_t totalBytes;
+  uint64_t usedBytes;
+  uint32_t takenAt;     // millis() when the probe finished
+  uint32_t probeMs;     // how long the probe took
+  uint32_t count;       // probes so far
+
+  uint64_t freeBytes() const { return totalBytes > usedBytes ? totalBytes - usedBytes : 0; }
+};
+
+class StorageSampler {
+ public:
+  bool begin(StorageProbe probe, uint32_t periodMs, const TaskPlacement& placement) {
+    probe_ = probe;
+    period_ = pdMS_TO_TICKS(periodMs);
+    lock_ = xSemaphoreCreateMutex();
+    if (!lock_) return false;
+    return startTask(placement, taskEntry, this, &task_);
+  }
+
+  // Wake task after every successful probe. Call before begin().
+  void notifyTo(TaskHandle_t task) { notify_ = task; }
+
+  // Probe now rather than at the end of the current period.
+  void refresh() {
+    if (task_) xTaskNotifyGive(task_);
+  }
+
+  // Times the task has woken, for /tasks.
+  const MetricsCounter& wakes() const { return wakes_; }
+
+  StorageSample sample() const {
+    StorageSample s = {};
+    if (!lock_) return s;
+    xSemaphoreTake(lock_, portMAX_DELAY);
+    s = sample_;
+    xSemaphoreGive(lock_);
+    return s;
+  }
+
+ private:
+  static void taskEntry(void* arg) { static_cast<StorageSampler*>(arg)->run(); }
+
+  void run() {
+    for (;;) {
+      uint64_t total = 0, used = 0;
+      int64_t start = esp_timer_get_time();
+      bool ok = probe_(&total, &used);
+      uint32_t probeMs = (esp_timer_get_time() - start) / 1000;
+
+      xSemaphoreTake(lock_, portMAX_DELAY);
+      if (ok) {
+        sample_.valid = true;
+        sample_.totalBytes = total;
+        sample_.usedBytes = used;
+        sample_.takenAt = millis();
+      }
+      sample_.probeMs = probeMs;
+      sample_.count++;
+      xSemaphoreGive(lock_);
+      if (ok && notify_) xTaskNotifyGive(notify_);
+
+      ulTaskNotifyTake(pdTRUE, period_);
+      wakes_.inc();
+    }
+  }
+
+  StorageProbe probe_ = nullptr;
+  TickType_t period_ = 0;
+  SemaphoreHandle_t lock_ = nullptr;
+  TaskHandle_t task_ = nullptr;
+  TaskHandle_t notify_ = nullptr;
+  StorageSample sample_ = {};
+  MetricsCounter wakes_;
+};
@@ -0,0 +1,177 @@
+#pragma once
+// Task placement and per-task CPU accounting for /tasks.
+//
+// TaskPlacement puts a task's core, priority and stack in one place, so each
+// sketch declares its task layout as a short table instead of scattering the
+// numbers through xTaskCreatePinnedToCore calls. TaskStats reads FreeRTOS's
+// run-time stats (uxTaskGetSystemState) and reports every task's share of a
+// core since the previous report, its stack headroom and, for tasks that
+// count them, how often it woke up. That is enough to see which core is
+// short of time and who is using it.
+//
+// FreeRTOS keeps no per-task context-switch count without a kernel trace
+// hook, so tasks that want one bump a MetricsCounter each time they return
+// from blocking (their voluntary switches) and hand it to track().
+//
+// Run-time shares need CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS. Without it
+// the CPU fields are null and the rest is still reported.
+
+#include <Arduino.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "json_writer.h"
+#include "metrics.h"
+
+const size_t TASK_STATS_MAX_TASKS = 32;
+const size_t TASK_STATS_MAX_TRACKED = 8;
+
+struct TaskPlacement {
+  const char* name;     // task name, which is also how /tasks finds it
+  const char* role;     // capture, writer, network, housekeeping, analysis
+  uint32_t stackBytes;
+  UBaseType_t priority;
+  BaseType_t core;      // tskNO_AFFINITY lets the scheduler pick
+};
+
+inline bool startTask(const TaskPlacement& p, TaskFunction_t fn, void* arg, TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, p.name, p.stackBytes, arg, p.priority, handle, p.core) == pdPASS;
+}
+
+class TaskStats {
+ public:
+  // Labels a task this sketch started. wakes, if given, counts its wakeups.
+  bool track(const TaskPlacement& placement, const MetricsCounter* wakes = nullptr) {
+    return add(placement.name, placement.role, &placement, wakes);
+  }
+  // Labels a task started elsewhere (AsyncTCP, the Arduino loop).
+  bool track(const char* name, const char* role, const MetricsCounter* wakes = nullptr) {
+    return add(name, role, nullptr, wakes);
+  }
+
+  // Appends the "/tasks" object. CPU shares cover the time since the previous
+  // call (since boot on the first). Call from one task only (async_tcp).
+  void json(JsonWriter& out) {
+    uint32_t total = 0;
+    UBaseType_t n = uxTaskGetSystemState(status_, TASK_STATS_MAX_TASKS, &total);
+#if configGENERATE_RUN_TIME_STATS
+    uint32_t window = total - lastTotal_;
+    lastTotal_ = total;
+    bool timed = window > 0;
+#else
+    uint32_t window = 0;
+    bool timed = false;
+#endif
+
+    // Per-core load from the tasks pinned there; idle tasks excluded
+    double pinned[2] = {0, 0};
+    double unpinned = 0;
+    double share[TASK_STATS_MAX_TASKS];
+    for (UBaseType_t i = 0; i < n; i++) {
+      uint32_t run = runTime(status_[i]);
+      share[i] = timed ? 100.0 * (uint32_t)(run - lastRun(status_[i].xHandle)) / window : 0;
+      if (isIdle(status_[i])) continue;
+      BaseType_t core = xTaskGetAffinity(status_[i].xHandle);
+      if (core == 0 || core == 1) pinned[core] += share[i];
+      else unpinned += share[i];
+    }
+
+    out.printf("{\"run_time_stats\":%s,\"window_ms\":%u", timed ? "true" : "false", (unsigned)(window / 1000));
+    if (timed) {
+      out.printf(",\"core0_pct\":%.1f,\"core1_pct\":%.1f,\"unpinned_pct\":%.1f", pinned[0], pinned[1], unpinned);
+    } else {
+      out.printf(",\"core0_pct\":null,\"core1_pct\":null,\"unpinned_pct\":null");
+    }
+    out.printf(",\"tasks\":[");
+    for (UBaseType_t i = 0; i < n; i++) {
+      const TaskStatus_t& t = status_[i];
+      const Tracked* tracked = find(t.pcTaskName);
+      BaseType_t core = xTaskGetAffinity(t.xHandle);
+      out.printf("%s{\"name\":", i ? "," : "");
+      out.string(t.pcTaskName);
+      out.printf(",\"role\":");
+      if (tracked) out.string(tracked->role);
+      else out.printf("null");
+      out.printf(",\"state\":\"%s\",\"core\":%d,\"priority\":%u,\"stack_free\":%u",
+                 stateName(t.eCurrentState), core == 0 || core == 1 ? (int)core : -1,
+                 (unsigned)t.uxCurrentPriority, (unsigned)t.usStackHighWaterMark);
+      if (tracked && tracked->placement) out.printf(",\"stack_bytes\":%u", (unsigned)tracked->placement->stackBytes);
+      if (timed) out.printf(",\"cpu_pct\":%.1f", share[i]);
+      else out.printf(",\"cpu_pct\":null");
+      if (tracked && tracked->wakes) {
+        uint32_t wakes = tracked->wakes->value();
+        out.printf(",\"wakes\":%u", (unsigned)wakes);
+        if (timed) out.printf(",\"wakes_per_s\":%.1f", (uint32_t)(wakes - tracked->lastWakes) * 1e6 / window);
+      }
+      out.printf("}");
+    }
+    out.printf("]}");
+
+    // Remember this snapshot for the next window
+    for (UBaseType_t i = 0; i < n; i++) {
+      lastHandle_[i] = status_[i].xHandle;
+      lastRun_[i] = runTime(status_[i]);
+    }
+    lastCount_ = n;
+    for (size_t i = 0; i < trackedCount_; i++) {
+      if (tracked_[i].wakes) tracked_[i].lastWakes = tracked_[i].wakes->value();
+    }
+  }
+
+ private:
+  struct Tracked {
+    const char* name;
+    const char* role;
+    const TaskPlacement* placement;
+    const MetricsCounter* wakes;
+    uint32_t lastWakes;
+  };
+
+  bool add(const char* name, const char* role, const TaskPlacement* placement, const MetricsCounter* wakes) {
+    if (trackedCount_ == TASK_STATS_MAX_TRACKED) return false;
+    tracked_[trackedCount_++] = {name, role, placement, wakes, 0};
+    return true;
+  }
+
+  const Tracked* find(const char* name) const {
+    for (size_t i = 0; i < trackedCount_; i++) {
+      if (strcmp(tracked_[i].name, name) == 0) return &tracked_[i];
+    }
+    return nullptr;
+  }
+
+  static uint32_t runTime(const TaskStatus_t& t) {
+#if configGENERATE_RUN_TIME_STATS
+    return (uint32_t)t.ulRunTimeCounter;
+#else
+    return 0;
+#endif
+  }
+
+  uint32_t lastRun(TaskHandle_t handle) const {
+    for (size_t i = 0; i < lastCount_; i++) {
+      if (lastHandle_[i] == handle) return lastRun_[i];
+    }
+    return 0;  // new since the last report
+  }
+
+  // "IDLE" on IDF 4, "IDLE0"/"IDLE1" on IDF 5
+  static bool isIdle(const TaskStatus_t& t) { return strncmp(t.pcTaskName, "IDLE", 4) == 0; }
+
+  static const char* stateName(eTaskState state) {
+    switch (state) {
+      case eRunning: return "running";
+      case eReady: return "ready";
+      case eBlocked: return "blocked";
+      case eSuspended: return "suspended";
+      default: return "deleted";
+    }
+  }
+
+  TaskStatus_t status_[TASK_STATS_MAX_TASKS];
+  Tracked tracked_[TASK_STATS_MAX_TRACKED];
+  size_t trackedCount_ = 0;
+  TaskHandle_t lastHandle_[TASK_STATS_MAX_TASKS] = {};
+  uint32_t lastRun_[TASK_STATS_MAX_TASKS] = {};
+  size_t lastCount_ = 0;
+  uint32_t lastTotal_ = 0;
+};
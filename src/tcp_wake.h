@@ -0,0 +1,170 @@
+#pragma once
+// Waking AsyncWebServer responses that wait on something other than the
+// network: the next camera frame, or the next frame's time in a playback.
+//
+// A filler with nothing to send returns RESPONSE_TRY_AGAIN, and
+// AsyncWebServer runs it again on the next ACK or lwIP poll. With nothing in
+// flight no ACK comes, and the poll only every 500 ms. Blocking in the filler
+// instead would hold up async_tcp, which every connection shares.
+//
+// So the filler parks its slot and returns. wake() (any task) or a deadline
+// given to parkUntil() raises the connection's poll early: a callback on the
+// tcpip thread, where lwIP's poll timer runs, looks the pcb up among the
+// active ones, skipping a connection closed in the meantime, and calls its
+// poll handler. AsyncTCP queues that to async_tcp like any other poll, and
+// AsyncWebServer fills again. One callback serves every slot woken before it
+// runs; a wake that finds its slot not parked is dropped.
+//
+// attach(), detach(), park() and parkUntil() run on async_tcp. A slot whose
+// response didn't get one (all TCP_WAKE_SLOTS taken) just waits for the poll.
+
+#include <Arduino.h>
+#include <AsyncTCP.h>
+#include <atomic>
+#include "esp_timer.h"
+#include "lwip/priv/tcp_priv.h"
+#include "lwip/tcpip.h"
+
+const int TCP_WAKE_SLOTS = 8;
+const int64_t TCP_WAKE_NO_DEADLINE = INT64_MAX;
+
+class TcpWaker {
+ public:
+  bool begin() {
+    timerLock_ = xSemaphoreCreateMutex();
+    esp_timer_create_args_t args = {};
+    args.callback = onTimer;
+    args.arg = this;
+    args.name = "tcp_wake";
+    return timerLock_ && esp_timer_create(&args, &timer_) == ESP_OK;
+  }
+
+  // A slot for client's response, -1 if none is free.
+  int attach(AsyncClient* client) {
+    int slot = -1;
+    portENTER_CRITICAL(&mux_);
+    for (int i = 0; i < TCP_WAKE_SLOTS; i++) {
+      if (!slots_[i].client) {
+        slots_[i].client = client;
+        slots_[i].pcb = client->pcb();
+        slots_[i].deadline = TCP_WAKE_NO_DEADLINE;
+        slot = i;
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&mux_);
+    return slot;
+  }
+
+  void detach(int slot) {
+    if (slot < 0) return;
+    parked_.fetch_and(~bit(slot));
+    portENTER_CRITICAL(&mux_);
+    slots_[slot] = {};
+    portEXIT_CRITICAL(&mux_);
+  }
+
+  // The slot's filler is about to return RESPONSE_TRY_AGAIN. Park before the
+  // last look at whatever it waits for, so a wake() after that look isn't
+  // missed.
+  void park(int slot) {
+    if (slot < 0) return;
+    parked_.fetch_or(bit(slot));
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+
+  // Park, and wake the slot once esp_timer_get_time() reaches at.
+  void parkUntil(int slot, int64_t at) {
+    if (slot < 0 || !timer_) return;
+    park(slot);
+    portENTER_CRITICAL(&mux_);
+    slots_[slot].deadline = at;
+    portEXIT_CRITICAL(&mux_);
+    schedule();
+  }
+
+  // Any task: wake the parked slots among slots (a bit mask). Publish what
+  // they wait for first.
+  void wake(uint32_t slots) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint32_t due = parked_.fetch_and(~slots) & slots;
+    if (!due) return;
+    pending_.fetch_or(due);
+    if (posted_.exchange(true)) return;
+    if (tcpip_callback(onTcpip, this) != ERR_OK) {
+      posted_.store(false);  // the poll timer still gets to them
+    }
+  }
+
+  static uint32_t bit(int slot) { return slot < 0 ? 0 : 1u << slot; }
+
+ private:
+  struct Slot {
+    AsyncClient* client;
+    tcp_pcb* pcb;
+    int64_t deadline;
+  };
+
+  // Run the timer for the earliest deadline. Serialized so a caller with a
+  // later deadline can't restart the timer over an earlier one.
+  void schedule() {
+    xSemaphoreTake(timerLock_, portMAX_DELAY);
+    int64_t next = TCP_WAKE_NO_DEADLINE;
+    portENTER_CRITICAL(&mux_);
+    for (int i = 0; i < TCP_WAKE_SLOTS; i++) {
+      if (slots_[i].deadline < next) next = slots_[i].deadline;
+    }
+    portEXIT_CRITICAL(&mux_);
+    esp_timer_stop(timer_);
+    if (next != TCP_WAKE_NO_DEADLINE) {
+      int64_t delay = next - esp_timer_get_time();
+      esp_timer_start_once(timer_, delay > 0 ? delay : 1);
+    }
+    xSemaphoreGive(timerLock_);
+  }
+
+  // esp_timer task: wake the slots whose deadline has come.
+  static void onTimer(void* arg) {
+    TcpWaker* self = (TcpWaker*)arg;
+    int64_t now = esp_timer_get_time();
+    uint32_t due = 0;
+    portENTER_CRITICAL(&self->mux_);
+    for (int i = 0; i < TCP_WAKE_SLOTS; i++) {
+      if (self->slots_[i].deadline <= now) {
+        self->slots_[i].deadline = TCP_WAKE_NO_DEADLINE;
+        due |= bit(i);
+      }
+    }
+    portEXIT_CRITICAL(&self->mux_);
+    if (due) self->wake(due);
+    self->schedule();
+  }
+
+  // tcpip thread: raise the poll of each woken slot whose pcb is still open.
+  static void onTcpip(void* arg) {
+    TcpWaker* self = (TcpWaker*)arg;
+    self->posted_.store(false);
+    uint32_t due = self->pending_.exchange(0);
+    for (int i = 0; i < TCP_WAKE_SLOTS; i++) {
+      if (!(due & bit(i))) continue;
+      portENTER_CRITICAL(&self->mux_);
+      Slot slot = self->slots_[i];
+      portEXIT_CRITICAL(&self->mux_);
+      if (!slot.pcb) continue;
+      for (tcp_pcb* pcb = tcp_active_pcbs; pcb; pcb = pcb->next) {
+        if (pcb == slot.pcb && pcb->callback_arg == slot.client && pcb->poll) {
+          pcb->poll(pcb->callback_arg, pcb);
+          break;
+        }
+      }
+    }
+  }
+
+  Slot slots_[TCP_WAKE_SLOTS] = {};
+  portMUX_TYPE mux_ = portMUX_INITIALIZER_UNLOCKED;
+  std::atomic<uint32_t> parked_{0};
+  std::atomic<uint32_t> pending_{0};  // woken, for the next tcpip callback
+  std::atomic<bool> posted_{false};
+  esp_timer_handle_t timer_ = nullptr;
+  SemaphoreHandle_t timerLock_ = nullptr;
+};
@@ -0,0 +1,162 @@
+#pragma once
+// Time-lapse stills on the SD card.
+//
+// The time-lapse consumer takes one frame every few seconds or minutes (its
+// rate is set in the FramePacer, see frame_pacer.h) and keeps each as a JPEG:
+// /timelapse/NNNN/NNNNNN.jpg, one directory per run, numbered in order so
+// `ffmpeg -i %06d.jpg` turns a run into a video. cameraTask only parks a
+// reference to the frame here; the housekeeping task (loop()) writes it, so
+// capture never waits on the card. A still not yet written when the next one
+// arrives is replaced and counted as dropped.
+//
+// Stills are not in the segment catalog. When the card runs short, the
+// housekeeping task deletes finished runs, oldest first, with removeOldest()
+// before it evicts any segment. The newest run, which may still be taking
+// stills, is kept.
+//
+// start(), writePending() and removeOldest() run on the housekeeping task, so
+// the card work of starting a run is off the web server's; stop() and
+// active() from any task, offer() from cameraTask. The counters are atomics,
+// for json() on async_tcp.
+
+#include <Arduino.h>
+#include <FS.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "frame_pool.h"
+#include "json_writer.h"
+
+const char TIMELAPSE_DIR[] = "/timelapse";
+const int TIMELAPSE_REMOVE_BATCH = 64;  // stills deleted per removeOldest() call
+
+class Timelapse {
+ public:
+  // Numbers the next run after the highest one on the card.
+  bool begin(fs::FS& fs) {
+    firstRun_ = UINT32_MAX;
+    fs_ = &fs;
+    if (!fs.exists(TIMELAPSE_DIR) && !fs.mkdir(TIMELAPSE_DIR)) return false;
+    File dir = fs.open(TIMELAPSE_DIR);
+    if (!dir) return false;
+    uint32_t last = 0;
+    for (File entry = dir.openNextFile(); entry; entry = dir.openNextFile()) {
+      const char* name = strrchr(entry.name(), '/');
+      uint32_t run = strtoul(name ? name + 1 : entry.name(), nullptr, 10);
+      if (run > last) last = run;
+      if (run && run < firstRun_) firstRun_ = run;
+    }
+    lastRun_.store(last, std::memory_order_relaxed);
+    if (firstRun_ == UINT32_MAX) firstRun_ = 1;
+    return true;
+  }
+
+  // The task that calls writePending(); woken for each still.
+  void notifyTo(TaskHandle_t task) { notify_ = task; }
+
+  // Housekeeping task: starts a new run directory. False without a card.
+  bool start() {
+    if (active()) return true;
+    if (!fs_) return false;
+    uint32_t run = lastRun_.load(std::memory_order_relaxed) + 1;
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%04u", TIMELAPSE_DIR, (unsigned)run);
+    if (!fs_->mkdir(path)) return false;
+    lastRun_.store(run, std::memory_order_relaxed);
+    stills_.store(0, std::memory_order_relaxed);
+    active_.store(true, std::memory_order_release);
+    return true;
+  }
+
+  // A still already handed over is still written.
+  void stop() { active_.store(false, std::memory_order_relaxed); }
+  bool active() const { return active_.load(std::memory_order_acquire); }
+
+  // cameraTask: keep this frame. Takes a reference of its own on slot.
+  void offer(FrameSlot* slot) {
+    slot->pool->retain(slot);
+    FrameSlot* previous = pending_.exchange(slot, std::memory_order_acq_rel);
+    if (previous) {
+      previous->pool->release(previous);
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (notify_) xTaskNotifyGive(notify_);
+  }
+
+  // Housekeeping task: write the still cameraTask handed over, if any.
+  void writePending() {
+    FrameRef still(pending_.exchange(nullptr, std::memory_order_acq_rel));
+    if (!still) return;
+    char path[40];
+    uint32_t n = stills_.load(std::memory_order_relaxed);
+    snprintf(path, sizeof(path), "%s/%04u/%06u.jpg", TIMELAPSE_DIR,
+             (unsigned)lastRun_.load(std::memory_order_relaxed), (unsigned)n);
+    File file = fs_->open(path, FILE_WRITE);
+    if (!file || file.write(still.data(), still.len()) != still.len()) {
+      file.close();
+      failed_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    file.close();
+    stills_.store(n + 1, std::memory_order_relaxed);
+    written_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  // Housekeeping task: delete up to TIMELAPSE_REMOVE_BATCH stills of the
+  // oldest run but the newest, and its directory once empty. False if there
+  // is no such run left. How much that freed shows in the next card sample.
+  bool removeOldest() {
+    if (!fs_) return false;
+    for (; firstRun_ < lastRun_.load(std::memory_order_relaxed); firstRun_++) {
+      char path[40];
+      snprintf(path, sizeof(path), "%s/%04u", TIMELAPSE_DIR, (unsigned)firstRun_);
+      File dir = fs_->open(path);
+      if (!dir) continue;  // a gap in the numbering
+      char names[TIMELAPSE_REMOVE_BATCH][16];
+      int n = 0;
+      for (File entry = dir.openNextFile(); entry && n < TIMELAPSE_REMOVE_BATCH; entry = dir.openNextFile()) {
+        const char* name = strrchr(entry.name(), '/');
+        snprintf(names[n++], sizeof(names[0]), "%s", name ? name + 1 : entry.name());
+      }
+      dir.close();
+      // Not while the directory is open: FAT lists it as it goes
+      int gone = 0;
+      for (int i = 0; i < n; i++) {
+        char still[64];
+        snprintf(still, sizeof(still), "%s/%.15s", path, names[i]);
+        if (fs_->remove(still)) gone++;
+      }
+      removed_.fetch_add(gone, std::memory_order_relaxed);
+      if (gone == TIMELAPSE_REMOVE_BATCH) return true;
+      fs_->rmdir(path);  // fails if a still couldn't be deleted; move on regardless
+      Serial.printf("Deleted: %s\n", path);
+      firstRun_++;
+      return true;
+    }
+    return false;
+  }
+
+  void json(JsonWriter& out) const {
+    out.printf("{\"active\":%s,\"run\":%u,\"stills\":%u,\"written\":%u,\"dropped\":%u,\"failed\":%u,"
+               "\"removed\":%u}",
+               active() ? "true" : "false", (unsigned)lastRun_.load(std::memory_order_relaxed),
+               (unsigned)stills_.load(std::memory_order_relaxed), (unsigned)written(),
+               (unsigned)dropped_.load(std::memory_order_relaxed), (unsigned)failed_.load(std::memory_order_relaxed),
+               (unsigned)removed_.load(std::memory_order_relaxed));
+  }
+
+  uint32_t written() const { return written_.load(std::memory_order_relaxed); }
+
+ private:
+  fs::FS* fs_ = nullptr;
+  TaskHandle_t notify_ = nullptr;
+  std::atomic<bool> active_{false};
+  std::atomic<FrameSlot*> pending_{nullptr};
+  std::atomic<uint32_t> lastRun_{0};  // current or last run's directory number
+  uint32_t firstRun_ = 1;             // oldest run that may still be on the card
+  std::atomic<uint32_t> stills_{0};   // in the current run
+  std::atomic<uint32_t> written_{0};  // since boot
+  std::atomic<uint32_t> dropped_{0};
+  std::atomic<uint32_t> failed_{0};
+  std::atomic<uint32_t> removed_{0};  // stills deleted to make room
+};
@@ -0,0 +1,237 @@
+#pragma once
+// Per-frame stage trace, exported at /trace as Chrome trace_event JSON.
+//
+// When FPS drops, the counters in /metrics say that something got slower but
+// not which stage of which frame. Each traced stage records a span (name,
+// frame number, task, start, duration) in a ring of TRACE_RING_EVENTS slots
+// in PSRAM. Writers claim a slot with one atomic increment and publish it by
+// stamping its sequence number, so any task can trace without a lock and a
+// reader can spot a slot that was overwritten while it was copying it.
+// /trace streams the ring out as JSON that Perfetto (ui.perfetto.dev) or
+// chrome://tracing open directly, one track per task.
+//
+// Tracing is compiled in by default and off until started, and a span then
+// costs one relaxed load and a branch, so production builds can keep it.
+// Building with TRACE_ENABLED 0 compiles the TRACE_* macros out altogether.
+//
+// Task names are looked up when the trace is exported, so only long-lived
+// tasks should record spans.
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "json_writer.h"
+
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+#ifndef TRACE_RING_EVENTS
+#define TRACE_RING_EVENTS 4096  // power of two; 32 bytes each, ~30 s at 20 fps
+#endif
+
+const size_t TRACE_MAX_TASKS = 16;
+
+struct TraceEvent {
+  std::atomic<uint32_t> seq;  // claim index + 1 once written, 0 while writing
+  uint32_t frame;             // 0 for spans not tied to a frame
+  const char* name;           // string literal
+  TaskHandle_t task;
+  int64_t start;              // esp_timer_get_time()
+  uint32_t dur;               // us
+};
+
+class Tracer {
+ public:
+  bool begin() {
+    if (ring_) return true;
+    size_t bytes = TRACE_RING_EVENTS * sizeof(TraceEvent);
+    ring_ = (TraceEvent*)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM);  // too big for internal RAM
+    if (!ring_) return false;
+    for (size_t i = 0; i < TRACE_RING_EVENTS; i++) ring_[i].seq.store(0, std::memory_order_relaxed);
+    return true;
+  }
+
+  // Starts a new trace; spans recorded before this are not exported. False
+  // without a ring (no PSRAM).
+  bool start() {
+    if (!ring_) return false;
+    since_.store(head_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    on_.store(true, std::memory_order_release);
+    return true;
+  }
+  void stop() { on_.store(false, std::memory_order_relaxed); }
+  bool on() const { return on_.load(std::memory_order_relaxed); }
+
+  // Records a span from start to now.
+  void record(const char* name, uint32_t frame, int64_t start) {
+    uint32_t dur = (uint32_t)(esp_timer_get_time() - start);
+    uint32_t i = head_.fetch_add(1, std::memory_order_relaxed);
+    TraceEvent& e = ring_[i & (TRACE_RING_EVENTS - 1)];
+    e.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    e.frame = frame;
+    e.name = name;
+    e.task = xTaskGetCurrentTaskHandle();
+    e.start = start;
+    e.dur = dur;
+    e.seq.store(i + 1, std::memory_order_release);
+  }
+
+  // Spans recorded since start(), up to the ring size.
+  uint32_t recorded() const {
+    uint32_t n = head_.load(std::memory_order_relaxed) - since_.load(std::memory_order_relaxed);
+    return n < TRACE_RING_EVENTS ? n : TRACE_RING_EVENTS;
+  }
+
+  // Chunked JSON of the spans in the ring when the request arrived, oldest
+  // first. Tracing carries on meanwhile; spans overwritten before they are
+  // sent are skipped.
+  AsyncWebServerResponse* beginResponse(AsyncWebServerRequest* request) {
+    Export x = {};
+    x.end = head_.load(std::memory_order_acquire);
+    x.next = x.end - recorded();
+    AsyncWebServerResponse* response = request->beginChunkedResponse(
+      "application/json",
+      [this, x](uint8_t* buffer, size_t maxLen, size_t) mutable -> size_t {
+        if (x.done) return 0;
+        JsonWriter out((char*)buffer, maxLen);
+        while (!x.done) {
+          size_t mark = out.length();
+          bool consumed = render(x, out);
+          if (out.overflowed()) {
+            out.truncate(mark);
+            break;
+          }
+          if (consumed) x.step++;
+        }
+        return out.length() ? out.length() : RESPONSE_TRY_AGAIN;
+      });
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("Content-Disposition", "attachment; filename=\"trace.json\"");
+    return response;
+  }
+
+ private:
+  struct Export {
+    uint32_t next;  // ring index of the next span
+    uint32_t end;
+    uint32_t step;  // 0 header, 1 spans, 2 footer
+    bool comma;
+    bool done;
+    size_t taskCount;
+    TaskHandle_t tasks[TRACE_MAX_TASKS];
+  };
+
+  // Writes the next piece of the document. False while more of the current
+  // step remains.
+  bool render(Export& x, JsonWriter& out) {
+    if (x.step == 0) {
+      out.printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+      return true;
+    }
+    if (x.step == 2) {
+      out.printf("]}\n");
+      x.done = true;
+      return true;
+    }
+    if (x.next == x.end) return true;
+
+    TraceEvent e;
+    if (!copy(x.next, e)) {
+      x.next++;
+      return false;
+    }
+    size_t tid = taskId(x, e.task);
+    bool newTask = tid == x.taskCount;
+    if (newTask) {
+      // First span of this task: name its track before it
+      out.printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":",
+                 x.comma ? "," : "", (unsigned)tid + 1);
+      out.string(pcTaskGetName(e.task));
+      out.printf("}},");
+    }
+    out.printf("%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%u",
+               x.comma && !newTask ? "," : "", e.name, (unsigned)tid + 1, (long long)e.start,
+               (unsigned)e.dur);
+    if (e.frame) out.printf(",\"args\":{\"frame\":%u}", (unsigned)e.frame);
+    out.printf("}");
+    if (out.overflowed()) return false;  // the caller drops the partial span; retried next fill
+    if (newTask && x.taskCount < TRACE_MAX_TASKS) x.tasks[x.taskCount++] = e.task;
+    x.comma = true;
+    x.next++;
+    return false;
+  }
+
+  // Seqlock-style read of span i; false if it was overwritten or is being
+  // written.
+  bool copy(uint32_t i, TraceEvent& dst) const {
+    const TraceEvent& e = ring_[i & (TRACE_RING_EVENTS - 1)];
+    if (e.seq.load(std::memory_order_acquire) != i + 1) return false;
+    dst.frame = e.frame;
+    dst.name = e.name;
+    dst.task = e.task;
+    dst.start = e.start;
+    dst.dur = e.dur;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return e.seq.load(std::memory_order_relaxed) == i + 1;
+  }
+
+  // Track number for task; x.taskCount if it has none yet. Tasks beyond
+  // TRACE_MAX_TASKS share the last track.
+  static size_t taskId(const Export& x, TaskHandle_t task) {
+    for (size_t i = 0; i < x.taskCount; i++) {
+      if (x.tasks[i] == task) return i;
+    }
+    return x.taskCount < TRACE_MAX_TASKS ? x.taskCount : TRACE_MAX_TASKS - 1;
+  }
+
+  TraceEvent* ring_ = nullptr;
+  std::atomic<uint32_t> head_{0};
+  std::atomic<uint32_t> since_{0};
+  std::atomic<bool> on_{false};
+};
+
+inline Tracer& tracer() {
+  static Tracer t;
+  return t;
+}
+
+// Times the enclosing scope. frame can be set once it is known.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, uint32_t frame = 0)
+      : name_(name), frame_(frame), start_(tracer().on() ? esp_timer_get_time() : 0) {}
+  ~TraceScope() {
+    if (start_) tracer().record(name_, frame_, start_);
+  }
+  void frame(uint32_t frame) { frame_ = frame; }
+
+ private:
+  const char* name_;
+  uint32_t frame_;
+  int64_t start_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#if TRACE_ENABLED
+// Spans the rest of the enclosing scope.
+#define TRACE_SCOPE(name, frame) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name, frame)
+// For spans that don't follow a scope: start is TRACE_NOW() (0 while tracing
+// is off) or any esp_timer_get_time() value, and TRACE_SPAN() ends the span.
+#define TRACE_NOW() (tracer().on() ? esp_timer_get_time() : 0)
+#define TRACE_SPAN(name, frame, start)                               \
+  do {                                                               \
+    if ((start) && tracer().on()) tracer().record(name, frame, start); \
+  } while (0)
+#else
+#define TRACE_SCOPE(name, frame) ((void)(frame))
+#define TRACE_NOW() ((int64_t)0)
+#define TRACE_SPAN(name, frame, start) ((void)(frame), (void)(start))
+#endif